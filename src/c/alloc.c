@@ -5,6 +5,7 @@
 #include "behavior.h"
 #include "ctrino.h"
 #include "derived.h"
+#include "interp.h"
 #include "process.h"
 #include "tagged.h"
 #include "try-inl.h"
@@ -44,10 +45,12 @@ value_t new_heap_uninitialized_roots(runtime_t *runtime) {
 value_t new_heap_mutable_roots(runtime_t *runtime) {
   TRY_DEF(argument_map_trie_root, new_heap_argument_map_trie(runtime,
       ROOT(runtime, empty_array)));
+  TRY_DEF(in_order_argument_maps, new_heap_array_buffer(runtime, 16));
   size_t size = kMutableRootsSize;
   TRY_DEF(result, alloc_heap_object(runtime, size,
       ROOT(runtime, mutable_mutable_roots_species)));
   RAW_MROOT(result, argument_map_trie_root) = argument_map_trie_root;
+  RAW_MROOT(result, in_order_argument_maps) = in_order_argument_maps;
   return result;
 }
 
@@ -92,6 +95,7 @@ value_t new_heap_instance_species(runtime_t *runtime, value_t primary,
   set_species_instance_family(result, ofInstance);
   set_species_family_behavior(result, &kInstanceBehavior);
   set_species_division_behavior(result, &kInstanceSpeciesBehavior);
+  set_species_heap(result, &runtime->heap);
   set_instance_species_primary_type_field(result, primary);
   set_instance_species_manager(result, manager);
   return post_create_sanity_check(result, size);
@@ -104,6 +108,7 @@ value_t new_heap_compact_species(runtime_t *runtime, family_behavior_t *behavior
   set_species_instance_family(result, behavior->family);
   set_species_family_behavior(result, behavior);
   set_species_division_behavior(result, &kCompactSpeciesBehavior);
+  set_species_heap(result, &runtime->heap);
   return post_create_sanity_check(result, bytes);
 }
 
@@ -115,6 +120,7 @@ value_t new_heap_modal_species_unchecked(runtime_t *runtime,
   set_species_instance_family(result, behavior->family);
   set_species_family_behavior(result, behavior);
   set_species_division_behavior(result, &kModalSpeciesBehavior);
+  set_species_heap(result, &runtime->heap);
   set_modal_species_mode(result, mode);
   set_modal_species_base_root(result, base_root);
   return result;
@@ -253,13 +259,24 @@ value_t new_heap_factory(runtime_t *runtime, factory_constructor_t *constr) {
 }
 
 value_t new_heap_code_block(runtime_t *runtime, value_t bytecode,
-    value_t value_pool, size_t high_water_mark) {
+    value_t value_pool, size_t high_water_mark, size_t inline_cache_count) {
+  // Most code blocks have no call sites so only allocate the caches when we
+  // need them.
+  value_t inline_caches = nothing();
+  if (inline_cache_count > 0)
+    TRY_SET(inline_caches, new_heap_array(runtime, inline_cache_count));
+  TRY_DEF(decoded_bytecode, decode_bytecode(runtime, bytecode, value_pool));
   size_t size = kCodeBlockSize;
   TRY_DEF(result, alloc_heap_object(runtime, size,
       ROOT(runtime, mutable_code_block_species)));
   set_code_block_bytecode(result, bytecode);
   set_code_block_value_pool(result, value_pool);
   set_code_block_high_water_mark(result, high_water_mark);
+  set_code_block_inline_caches(result, inline_caches);
+  set_code_block_decoded_bytecode(result, decoded_bytecode);
+  size_t serial = 0;
+  TRY(code_block_table_add(runtime->code_block_table, &serial));
+  set_code_block_serial(result, serial);
   TRY(ensure_frozen(runtime, result));
   return post_create_sanity_check(result, size);
 }
@@ -610,6 +627,9 @@ value_t new_heap_signature_map(runtime_t *runtime) {
   TRY_DEF(result, alloc_heap_object(runtime, size,
       ROOT(runtime, mutable_signature_map_species)));
   set_signature_map_entries(result, entries);
+  set_signature_map_selector_index(result, nothing());
+  set_signature_map_unindexed(result, nothing());
+  set_signature_map_subject_index(result, nothing());
   return post_create_sanity_check(result, size);
 }
 
@@ -937,8 +957,11 @@ value_t alloc_heap_object(runtime_t *runtime, size_t bytes, value_t species) {
   }
   if (!heap_try_alloc(&runtime->heap, bytes, &addr))
     return new_heap_exhausted_condition(bytes);
+  runtime->gc_stats.bytes_allocated += bytes;
   value_t result = new_heap_object(addr);
   set_heap_object_header(result, species);
+  if (runtime->alloc_profile != NULL)
+    alloc_profile_record(runtime, result, bytes);
   return result;
 }
 
@@ -987,3 +1010,254 @@ value_t set_instance_field(runtime_t *runtime, value_t instance, value_t key,
   value_t fields = get_instance_fields(instance);
   return set_id_hash_map_at(runtime, fields, key, value);
 }
+
+
+// --- P r o f i l i n g ---
+
+// The number of frames of the allocating code to record in a sample.
+#define kAllocProfileTraceDepth 8
+
+// How many sites to include in the profile report.
+#define kAllocProfileReportTopCount 20
+
+void alloc_profile_init(alloc_profile_t *profile, size_t interval) {
+  memset(profile, 0, sizeof(alloc_profile_t));
+  profile->interval = interval;
+  profile->bytes_until_sample = interval;
+}
+
+// Frees a string copied by alloc_profile_copy_string.
+static void alloc_profile_free_string(char *str) {
+  if (str != NULL)
+    allocator_default_free(new_memory_block(str, strlen(str) + 1));
+}
+
+// Returns a malloc'ed copy of the given string or NULL if allocation fails.
+static char *alloc_profile_copy_string(string_t *str) {
+  memory_block_t memory = allocator_default_malloc(str->length + 1);
+  if (memory_block_is_empty(memory))
+    return NULL;
+  memcpy(memory.memory, str->chars, str->length + 1);
+  return (char*) memory.memory;
+}
+
+void alloc_profile_dispose(alloc_profile_t *profile) {
+  for (size_t i = 0; i < profile->capacity; i++) {
+    alloc_profile_free_string(profile->entries[i].key);
+    alloc_profile_free_string(profile->entries[i].trace);
+  }
+  if (profile->entries != NULL)
+    allocator_default_free(new_memory_block(profile->entries,
+        profile->capacity * sizeof(alloc_profile_entry_t)));
+  profile->entries = NULL;
+  profile->capacity = profile->entry_count = 0;
+}
+
+// Returns the entry for the given site, which is either the one already
+// recording it or the unused one where it should go.
+static alloc_profile_entry_t *alloc_profile_find(alloc_profile_entry_t *entries,
+    size_t capacity, heap_object_family_t family, const char *key,
+    int64_t hash) {
+  size_t index = ((size_t) hash) & (capacity - 1);
+  while (true) {
+    alloc_profile_entry_t *entry = &entries[index];
+    if (entry->key == NULL)
+      return entry;
+    if (entry->hash == hash && entry->family == family
+        && strcmp(entry->key, key) == 0)
+      return entry;
+    index = (index + 1) & (capacity - 1);
+  }
+}
+
+// Makes sure there's room in the table for one more site. Returns false if
+// that's not possible.
+static bool alloc_profile_ensure_room(alloc_profile_t *profile) {
+  if (2 * (profile->entry_count + 1) <= profile->capacity)
+    return true;
+  size_t new_capacity = (profile->capacity == 0) ? 64 : (2 * profile->capacity);
+  memory_block_t memory = allocator_default_malloc(
+      new_capacity * sizeof(alloc_profile_entry_t));
+  if (memory_block_is_empty(memory))
+    return false;
+  alloc_profile_entry_t *new_entries = (alloc_profile_entry_t*) memory.memory;
+  memset(new_entries, 0, memory.size);
+  for (size_t i = 0; i < profile->capacity; i++) {
+    alloc_profile_entry_t *entry = &profile->entries[i];
+    if (entry->key != NULL)
+      *alloc_profile_find(new_entries, new_capacity, entry->family,
+          entry->key, entry->hash) = *entry;
+  }
+  if (profile->entries != NULL)
+    allocator_default_free(new_memory_block(profile->entries,
+        profile->capacity * sizeof(alloc_profile_entry_t)));
+  profile->entries = new_entries;
+  profile->capacity = new_capacity;
+  return true;
+}
+
+// Returns the selector of the invocation with the given tags the given frame
+// is suspended at, or nothing if it doesn't have one.
+static value_t alloc_profile_get_selector(runtime_t *runtime, frame_t *frame,
+    value_t tags) {
+  value_t selector_key = ROOT(runtime, selector_key);
+  size_t arg_count = get_call_tags_entry_count(tags);
+  for (size_t i = 0; i < arg_count; i++) {
+    if (is_same_value(get_call_tags_tag_at(tags, i), selector_key))
+      return frame_get_pending_argument_at(frame, tags, i);
+  }
+  return nothing();
+}
+
+// Prints the innermost invocations of the code currently allocating to the
+// given buffers, one line per invocation: the key gets the selector, the call
+// tags, the serial of the code block, and the pc of each invocation and the
+// trace gets the backtrace entry with the argument values. Either buffer can
+// be NULL. Only the key is used to tell sites apart so the same code
+// allocating with different arguments counts as one site, whereas different
+// methods that happen to make the same call at the same pc don't. This
+// walks the frames itself rather than using capture_backtrace since the stack
+// can be deep and only the top of it is kept anyway, and since the allocation
+// can happen in the middle of an instruction only invokes are captured.
+static value_t alloc_profile_print_site(runtime_t *runtime, frame_t *top,
+    string_buffer_t *key, string_buffer_t *trace) {
+  // The top frame is the one executing the allocating instruction, its pc isn't
+  // after an invocation so there's no entry to capture for it. Start from its
+  // caller.
+  frame_iter_t iter;
+  frame_iter_init_from_frame(&iter, top);
+  size_t depth = 0;
+  while (depth < kAllocProfileTraceDepth && frame_iter_advance(&iter)) {
+    frame_t *frame = frame_iter_get_current(&iter);
+    value_t tags = get_frame_invoke_tags(frame);
+    if (is_nothing(tags))
+      continue;
+    if (key != NULL) {
+      value_t selector = alloc_profile_get_selector(runtime, frame, tags);
+      value_t code_block = frame_get_code_block(frame);
+      string_buffer_printf(key, "\n%v %v@%i:%i", selector, tags,
+          (int) get_code_block_serial(code_block), (int) frame->pc);
+    }
+    if (trace != NULL) {
+      TRY_DEF(entry, capture_invoke_backtrace_entry(runtime, frame));
+      string_buffer_printf(trace, "\n  - %v", entry);
+    }
+    depth++;
+  }
+  return success();
+}
+
+// Takes a sample of the given object and adds it to the profile.
+static void alloc_profile_sample(runtime_t *runtime, alloc_profile_t *profile,
+    value_t object, size_t bytes) {
+  heap_object_family_t family = get_heap_object_family(object);
+  string_buffer_t key_buf;
+  string_buffer_init(&key_buf);
+  string_buffer_t trace_buf;
+  string_buffer_init(&trace_buf);
+  profile->is_sampling = true;
+  if (profile->frame != NULL) {
+    // The trace is only needed for the first sample at a site but the key has
+    // to be printed before we know whether this is the first one.
+    value_t printed = alloc_profile_print_site(runtime, profile->frame,
+        &key_buf, NULL);
+    if (is_condition(printed))
+      goto done;
+  }
+  string_t key;
+  string_buffer_flush(&key_buf, &key);
+  hash_stream_t stream;
+  hash_stream_init(&stream);
+  hash_stream_write_int64(&stream, family);
+  hash_stream_write_data(&stream, key.chars, key.length);
+  int64_t hash = hash_stream_flush(&stream);
+  if (!alloc_profile_ensure_room(profile))
+    goto done;
+  alloc_profile_entry_t *entry = alloc_profile_find(profile->entries,
+      profile->capacity, family, key.chars, hash);
+  if (entry->key == NULL) {
+    if (profile->frame != NULL) {
+      value_t printed = alloc_profile_print_site(runtime, profile->frame,
+          NULL, &trace_buf);
+      if (is_condition(printed))
+        goto done;
+    }
+    string_t trace;
+    string_buffer_flush(&trace_buf, &trace);
+    char *key_copy = alloc_profile_copy_string(&key);
+    char *trace_copy = alloc_profile_copy_string(&trace);
+    if (key_copy == NULL || trace_copy == NULL) {
+      alloc_profile_free_string(key_copy);
+      alloc_profile_free_string(trace_copy);
+      goto done;
+    }
+    entry->key = key_copy;
+    entry->trace = trace_copy;
+    entry->family = family;
+    entry->hash = hash;
+    profile->entry_count++;
+  }
+  entry->samples++;
+  entry->bytes += bytes;
+  profile->sample_count++;
+ done:
+  profile->is_sampling = false;
+  string_buffer_dispose(&key_buf);
+  string_buffer_dispose(&trace_buf);
+}
+
+void alloc_profile_record(runtime_t *runtime, value_t object, size_t bytes) {
+  alloc_profile_t *profile = runtime->alloc_profile;
+  if (profile->is_sampling)
+    return;
+  if (bytes < profile->bytes_until_sample) {
+    profile->bytes_until_sample -= bytes;
+    return;
+  }
+  profile->bytes_until_sample = profile->interval;
+  alloc_profile_sample(runtime, profile, object, bytes);
+}
+
+// Orders profile entries by decreasing sample count.
+static int compare_alloc_profile_entries(const void *a, const void *b) {
+  uint64_t samples_a = (*(alloc_profile_entry_t* const*) a)->samples;
+  uint64_t samples_b = (*(alloc_profile_entry_t* const*) b)->samples;
+  return (samples_a < samples_b) - (samples_a > samples_b);
+}
+
+void alloc_profile_print_report(runtime_t *runtime) {
+  alloc_profile_t *profile = runtime->alloc_profile;
+  CHECK_FALSE("no allocation profile", profile == NULL);
+  print_ln("--- Allocation profile: %lli samples, one every %lli bytes ---",
+      (long long) profile->sample_count, (long long) profile->interval);
+  if (profile->entry_count == 0)
+    return;
+  memory_block_t memory = allocator_default_malloc(
+      profile->entry_count * sizeof(alloc_profile_entry_t*));
+  if (memory_block_is_empty(memory))
+    return;
+  alloc_profile_entry_t **sorted = (alloc_profile_entry_t**) memory.memory;
+  size_t count = 0;
+  for (size_t i = 0; i < profile->capacity; i++) {
+    if (profile->entries[i].key != NULL)
+      sorted[count++] = &profile->entries[i];
+  }
+  qsort(sorted, count, sizeof(alloc_profile_entry_t*),
+      compare_alloc_profile_entries);
+  char row[256];
+  for (size_t i = 0; i < count && i < kAllocProfileReportTopCount; i++) {
+    alloc_profile_entry_t *entry = sorted[i];
+    // Each sample stands for about 'interval' bytes of allocation.
+    double percentage = (100.0 * entry->samples) / profile->sample_count;
+    snprintf(row, sizeof(row), "%5.1f%% %8llu samples, ~%llu bytes: %s",
+        percentage, (unsigned long long) entry->samples,
+        (unsigned long long) (entry->samples * profile->interval),
+        get_heap_object_family_name(entry->family));
+    if (entry->trace[0] == '\0') {
+      print_ln("%s\n  (outside the interpreter)", row);
+    } else {
+      print_ln("%s%s", row, entry->trace);
+    }
+  }
+  allocator_default_free(memory);
+}
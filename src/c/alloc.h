@@ -121,9 +121,9 @@ value_t new_heap_factory(runtime_t *runtime, factory_constructor_t *constr);
 value_t new_heap_argument_map_trie(runtime_t *runtime, value_t value);
 
 // Creates a new code block object with the given bytecode blob and value pool
-// array.
+// array, and room for the given number of inline caches.
 value_t new_heap_code_block(runtime_t *runtime, value_t bytecode,
-    value_t value_pool, size_t high_water_mark);
+    value_t value_pool, size_t high_water_mark, size_t inline_cache_count);
 
 // Creates a new type object with the given display name.
 value_t new_heap_type(runtime_t *runtime, alloc_flags_t flags,
@@ -367,4 +367,63 @@ value_t set_instance_field(runtime_t *runtime, value_t instance, value_t key,
     value_t value);
 
 
+// --- P r o f i l i n g ---
+
+// An allocation site seen by the allocation profiler: the family of the object
+// allocated along with the invocations that led to the code that allocated it.
+typedef struct {
+  // The key that identifies the site, printed, or NULL if this entry is unused.
+  // It has the selector, call tags, code block serial, and pc of each
+  // invocation but not the arguments.
+  char *key;
+  // The backtrace, including arguments, of the first sample taken at the site.
+  char *trace;
+  // The family of the objects allocated.
+  heap_object_family_t family;
+  // Hash of the family and the key.
+  int64_t hash;
+  // How many samples were taken at this site.
+  uint64_t samples;
+  // The total size of the sampled objects.
+  uint64_t bytes;
+} alloc_profile_entry_t;
+
+// Allocation statistics collected by sampling one allocation every so many
+// bytes. The samples are aggregated by site in a hash table.
+struct alloc_profile_t {
+  // The number of bytes to allocate between samples.
+  size_t interval;
+  // How many bytes are left to allocate before the next sample is taken.
+  size_t bytes_until_sample;
+  // The frame being executed by the interpreter, or NULL if it isn't running.
+  frame_t *frame;
+  // True while taking a sample so the allocations that requires aren't
+  // themselves sampled.
+  bool is_sampling;
+  // The total number of samples taken.
+  uint64_t sample_count;
+  // The table of sites, using open addressing.
+  alloc_profile_entry_t *entries;
+  size_t capacity;
+  size_t entry_count;
+};
+
+// Initializes the given profile to sample an allocation every 'interval'
+// bytes.
+void alloc_profile_init(alloc_profile_t *profile, size_t interval);
+
+// Disposes the memory held by the given profile.
+void alloc_profile_dispose(alloc_profile_t *profile);
+
+// Called after the given object of the given size has been allocated. Takes a
+// sample if it's time. Failing to take a sample, for instance because there
+// is no room in the heap for the backtrace, isn't an error; the sample is
+// simply dropped.
+void alloc_profile_record(runtime_t *runtime, value_t object, size_t bytes);
+
+// Prints a report of the allocation sites sampled by the given runtime, which
+// must have been created with allocation profiling enabled.
+void alloc_profile_print_report(runtime_t *runtime);
+
+
 #endif // _ALLOC
@@ -580,6 +580,21 @@ static value_t get_internal_object_type(value_t self, runtime_t *runtime) {
   return new_condition(ccInternalFamily);
 }
 
+bool has_primary_type(value_t self) {
+  switch (get_value_domain(self)) {
+    case vdInteger:
+      return true;
+    case vdHeapObject:
+      return get_heap_object_family_behavior(self)->get_primary_type
+          != get_internal_object_type;
+    case vdCustomTagged:
+      return get_custom_tagged_behavior(self)->get_primary_type
+          != get_internal_object_type;
+    default:
+      return false;
+  }
+}
+
 
 // ## Scoping
 
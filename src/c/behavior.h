@@ -196,6 +196,10 @@ value_t set_heap_object_contents(runtime_t *runtime, value_t object,
 // Returns the primary type of the given value.
 value_t get_primary_type(value_t value, runtime_t *runtime);
 
+// Returns true iff the given value has a primary type, that is, if calling
+// get_primary_type on it will succeed rather than report an internal family.
+bool has_primary_type(value_t value);
+
 // Performs the on-scope-exit action for the given derived object.
 void on_derived_object_exit(value_t self);
 
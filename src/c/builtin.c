@@ -41,16 +41,17 @@ value_t escape_builtin(builtin_arguments_t *args, value_array_t values) {
 
 value_t add_builtin_method_impl(runtime_t *runtime, value_t map,
     const char *name_c_str, size_t arg_count, builtin_method_t impl,
-    int leave_argc) {
+    int leave_argc, inline_builtin_method_t inline_impl) {
   CHECK_FAMILY(ofIdHashMap, map);
   E_BEGIN_TRY_FINALLY();
     assembler_t assm;
     E_TRY(assembler_init(&assm, runtime, nothing(), scope_get_bottom()));
     if (leave_argc == -1) {
       // Simple case where there can be no signals.
-      E_TRY(assembler_emit_builtin(&assm, impl));
+      E_TRY(assembler_emit_builtin(&assm, impl, inline_impl));
       E_TRY(assembler_emit_return(&assm));
     } else {
+      CHECK_PTREQ("inline builtin may escape", NULL, inline_impl);
       short_buffer_cursor_t dest;
       size_t code_start_offset = assembler_get_code_cursor(&assm);
       // Invoke the builtin. This will either keep going or, if there is a
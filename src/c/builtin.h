@@ -53,11 +53,20 @@ value_t escape_builtin(builtin_arguments_t *args, value_array_t values);
 // Signature of a function that implements a built-in method.
 typedef value_t (*builtin_method_t)(builtin_arguments_t *args);
 
+// Signature of a function that implements a built-in method with at most one
+// argument directly on the subject and argument values, without a frame of its
+// own, such that it can be executed at the call site. Returns nothing if it
+// can't handle the values it is given, for instance if they have the wrong
+// type or the result overflows, in which case the call is made to the full
+// builtin method as usual.
+typedef value_t (*inline_builtin_method_t)(value_t self, value_t that);
+
 // Add a builtin method implementation to the given map with the given name,
-// number of arguments, and implementation.
+// number of arguments, and implementation. If the inline method is non-NULL it
+// will be used in place of calling the method where possible.
 value_t add_builtin_method_impl(runtime_t *runtime, value_t map,
     const char *name_c_str, size_t arg_count, builtin_method_t method,
-    int leave_arg_count);
+    int leave_arg_count, inline_builtin_method_t inline_method);
 
 struct assembler_t;
 
@@ -188,38 +188,6 @@ bool assembler_is_symbol_bound(assembler_t *assm, value_t symbol) {
 }
 
 
-// --- S c r a t c h ---
-
-void reusable_scratch_memory_init(reusable_scratch_memory_t *memory) {
-  memory->memory = memory_block_empty();
-}
-
-void reusable_scratch_memory_dispose(reusable_scratch_memory_t *memory) {
-  allocator_default_free(memory->memory);
-  memory->memory = memory_block_empty();
-}
-
-void *reusable_scratch_memory_alloc(reusable_scratch_memory_t *memory,
-    size_t size) {
-  memory_block_t current = memory->memory;
-  if (current.size < size) {
-    // If the current memory block is too small to handle what we're asking
-    // for replace it with a new one with room enough.
-    allocator_default_free(current);
-    current = allocator_default_malloc(size * 2);
-    memory->memory = current;
-  }
-  return current.memory;
-}
-
-void reusable_scratch_memory_double_alloc(reusable_scratch_memory_t *memory,
-    size_t first_size, void **first, size_t second_size, void **second) {
-  void *block = reusable_scratch_memory_alloc(memory, first_size + second_size);
-  *first = block;
-  *second = ((byte_t*) block) + first_size;
-}
-
-
 // --- A s s e m b l e r ---
 
 value_t assembler_init(assembler_t *assm, runtime_t *runtime, value_t fragment,
@@ -239,6 +207,10 @@ value_t assembler_init_stripped_down(assembler_t *assm, runtime_t *runtime) {
   assm->fragment = null();
   short_buffer_init(&assm->code);
   assm->stack_height = assm->high_water_mark = 0;
+  assm->inline_cache_count = 0;
+  assm->last_op_offset = 0;
+  assm->last_opcode = ocReturn;
+  assm->can_rewrite_last_op = false;
   reusable_scratch_memory_init(&assm->scratch_memory);
   return success();
 }
@@ -278,7 +250,7 @@ value_t assembler_flush(assembler_t *assm) {
   }
   CHECK_EQ("wrong number of entries", entries_seen, value_pool_size);
   return new_heap_code_block(assm->runtime, bytecode, value_pool,
-      assm->high_water_mark);
+      assm->high_water_mark, assm->inline_cache_count);
 }
 
 reusable_scratch_memory_t *assembler_get_scratch_memory(assembler_t *assm) {
@@ -293,9 +265,59 @@ static void assembler_emit_short(assembler_t *assm, size_t value) {
 
 // Writes an opcode to this assembler.
 static void assembler_emit_opcode(assembler_t *assm, opcode_t opcode) {
+  assm->last_op_offset = assm->code.length;
+  assm->last_opcode = opcode;
+  assm->can_rewrite_last_op = true;
   assembler_emit_short(assm, opcode);
 }
 
+// The peephole stage works as instructions are emitted: each emit function
+// checks whether the last instruction written can be combined with the one
+// it's about to write and if so rewrites the last one in place rather than
+// emitting a new one. Which combinations are worth it is based on how often
+// each pair of instructions is executed in practice.
+
+// Returns true if the last instruction written has the given opcode and may be
+// rewritten by the peephole stage.
+static bool assembler_last_op_is(assembler_t *assm, opcode_t opcode) {
+  return assm->can_rewrite_last_op && assm->last_opcode == opcode;
+}
+
+// Replaces the opcode of the last instruction with the given one, leaving its
+// operands in place. The caller is responsible for writing any additional
+// operands the new opcode takes.
+static void assembler_rewrite_last_opcode(assembler_t *assm, opcode_t opcode) {
+  short_buffer_cursor_t cursor = {&assm->code, assm->last_op_offset};
+  short_buffer_cursor_set(&cursor, opcode);
+  assm->last_opcode = opcode;
+}
+
+// Returns the operand at the given offset within the last instruction.
+static short_t assembler_get_last_op_operand(assembler_t *assm, size_t index) {
+  short_t *code = (short_t*) assm->code.memory.memory;
+  return code[assm->last_op_offset + index];
+}
+
+// Sets the operand at the given offset within the last instruction.
+static void assembler_set_last_op_operand(assembler_t *assm, size_t index,
+    size_t value) {
+  CHECK_REL("large value", value, <=, 0xFFFF);
+  short_buffer_cursor_t cursor = {&assm->code, assm->last_op_offset + index};
+  short_buffer_cursor_set(&cursor, (short_t) value);
+}
+
+// Removes the last instruction from the code.
+static void assembler_drop_last_op(assembler_t *assm) {
+  assm->code.length = assm->last_op_offset;
+  assm->can_rewrite_last_op = false;
+}
+
+// Allocates a fresh inline cache slot and writes its index to this assembler.
+static void assembler_emit_inline_cache(assembler_t *assm) {
+  assembler_emit_short(assm, assm->inline_cache_count);
+  assm->inline_cache_count++;
+}
+
 static void assembler_emit_cursor(assembler_t *assm, short_buffer_cursor_t *out) {
   short_buffer_append_cursor(&assm->code, out);
 }
@@ -340,21 +362,39 @@ void assembler_adjust_stack_height(assembler_t *assm, int delta) {
 }
 
 size_t assembler_get_code_cursor(assembler_t *assm) {
+  // The cursor may be used as a jump target so the instructions before and
+  // after it must be kept separate.
+  assm->can_rewrite_last_op = false;
   // The length is measured in number of elements so we can just return it
   // directly, there's no need to adjust for the element size.
   return assm->code.length;
 }
 
 value_t assembler_emit_push(assembler_t *assm, value_t value) {
-  assembler_emit_opcode(assm, ocPush);
+  if (assembler_last_op_is(assm, ocPush)) {
+    assembler_rewrite_last_opcode(assm, ocPushPush);
+  } else if (assembler_last_op_is(assm, ocLoadArgument)) {
+    assembler_rewrite_last_opcode(assm, ocLoadArgumentPush);
+  } else {
+    assembler_emit_opcode(assm, ocPush);
+  }
   TRY(assembler_emit_value(assm, value));
   assembler_adjust_stack_height(assm, +1);
   return success();
 }
 
 value_t assembler_emit_pop(assembler_t *assm, size_t count) {
-  assembler_emit_opcode(assm, ocPop);
-  assembler_emit_short(assm, count);
+  if (count > 0 && assembler_last_op_is(assm, ocSlap)) {
+    // Slapping n values and then popping m values, the slapped value first,
+    // is the same as popping n+m values so turn the slap into a pop. Popping
+    // none would leave the slapped value so that can't be combined.
+    size_t slap_count = assembler_get_last_op_operand(assm, 1);
+    assembler_rewrite_last_opcode(assm, ocPop);
+    assembler_set_last_op_operand(assm, 1, slap_count + count);
+  } else {
+    assembler_emit_opcode(assm, ocPop);
+    assembler_emit_short(assm, count);
+  }
   assembler_adjust_stack_height(assm, -count);
   return success();
 }
@@ -462,6 +502,7 @@ value_t assembler_emit_invocation(assembler_t *assm, value_t fragment,
   TRY(assembler_emit_value(assm, tags));
   TRY(assembler_emit_value(assm, fragment));
   TRY(assembler_emit_value(assm, helper));
+  assembler_emit_inline_cache(assm);
   // The result will be pushed onto the stack on top of the arguments.
   assembler_adjust_stack_height(assm, 1);
   return success();
@@ -474,14 +515,20 @@ value_t assembler_emit_signal(assembler_t *assm, opcode_t opcode, value_t tags)
   // Pad the instruction to give it the same length as the other invoke ops.
   assembler_emit_short(assm, 0);
   assembler_emit_short(assm, 0);
+  assembler_emit_short(assm, 0);
   // Do Not Adjust Your Stack Height.
   return success();
 }
 
-value_t assembler_emit_builtin(assembler_t *assm, builtin_method_t builtin) {
+value_t assembler_emit_builtin(assembler_t *assm, builtin_method_t builtin,
+    inline_builtin_method_t inline_builtin) {
   TRY_DEF(wrapper, new_heap_void_p(assm->runtime, builtin));
+  value_t inline_wrapper = null();
+  if (inline_builtin != NULL)
+    TRY_SET(inline_wrapper, new_heap_void_p(assm->runtime, inline_builtin));
   assembler_emit_opcode(assm, ocBuiltin);
   TRY(assembler_emit_value(assm, wrapper));
+  TRY(assembler_emit_value(assm, inline_wrapper));
   // Pushes the result.
   assembler_adjust_stack_height(assm, +1);
   return success();
@@ -497,6 +544,7 @@ value_t assembler_emit_builtin_maybe_escape(assembler_t *assm,
   // Pad this op to be the same length as invoke ops since all ops that can
   // produce a backtrace entry should have the same length.
   assembler_emit_short(assm, 0);
+  assembler_emit_short(assm, 0);
   // The builting will either succeed and leave one value on the stack or fail
   // and leave argc signal params on the stack plus the appropriate invocation
   // record.
@@ -510,6 +558,10 @@ value_t assembler_emit_builtin_maybe_escape(assembler_t *assm,
 
 value_t assembler_emit_return(assembler_t *assm) {
   CHECK_EQ("invalid stack height", 1, assm->stack_height);
+  // Returning only uses the top of the stack and discards the rest so there's
+  // no reason to slap the values below it off first.
+  if (assembler_last_op_is(assm, ocSlap))
+    assembler_drop_last_op(assm);
   assembler_emit_opcode(assm, ocReturn);
   return success();
 }
@@ -562,7 +614,11 @@ value_t assembler_emit_load_global(assembler_t *assm, value_t name,
 }
 
 value_t assembler_emit_load_argument(assembler_t *assm, size_t param_index) {
-  assembler_emit_opcode(assm, ocLoadArgument);
+  if (assembler_last_op_is(assm, ocPush)) {
+    assembler_rewrite_last_opcode(assm, ocPushLoadArgument);
+  } else {
+    assembler_emit_opcode(assm, ocLoadArgument);
+  }
   assembler_emit_short(assm, param_index);
   assembler_adjust_stack_height(assm, +1);
   return success();
@@ -628,6 +684,7 @@ value_t assembler_emit_call_ensurer(assembler_t *assm) {
   assembler_emit_short(assm, 0);
   assembler_emit_short(assm, 0);
   assembler_emit_short(assm, 0);
+  assembler_emit_short(assm, 0);
   assembler_adjust_stack_height(assm,
       + 1);               // the return value from the shard
   return success();
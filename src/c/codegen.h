@@ -84,36 +84,6 @@ value_t scope_lookup(scope_o *self, value_t symbol, binding_info_t *info_out);
 // always return the same value.
 scope_o *scope_get_bottom();
 
-// A block of reusable scratch memory. It can be used to grab a block of memory
-// of a given size without worrying about releasing it. Just be sure not to
-// have two different users at the same time.
-typedef struct {
-  // The current memory block.
-  memory_block_t memory;
-} reusable_scratch_memory_t;
-
-// Initializes a reusable scratch memory block.
-void reusable_scratch_memory_init(reusable_scratch_memory_t *memory);
-
-// Disposes this scratch memory block, releasing any memory returned from this
-// block. Obviously this invalidates any memory blocks ever returned from this
-// block.
-void reusable_scratch_memory_dispose(reusable_scratch_memory_t *memory);
-
-// Returns a memory block of the given size backed by the given reusable memory
-// block. This invalidates any memory blocks previously returned, so only the
-// last block returned can be used. You don't have to explicitly release this
-// block, it will be disposed along with the reusable memory block whenever
-// it is disposed.
-void *reusable_scratch_memory_alloc(reusable_scratch_memory_t *memory,
-    size_t size);
-
-// Returns two blocks of memory from a reusable scratch memory block. All the
-// same rules apply as with reusable_scratch_malloc. Really this is just a
-// shorthand for allocating one block and splitting it in two.
-void reusable_scratch_memory_double_alloc(reusable_scratch_memory_t *memory,
-    size_t first_size, void **first, size_t second_size, void **second);
-
 
 // Bytecode assembler data.
 typedef struct assembler_t {
@@ -127,12 +97,21 @@ typedef struct assembler_t {
   size_t stack_height;
   // The highest the stack has been at any point.
   size_t high_water_mark;
+  // The number of inline cache slots used by the code so far.
+  size_t inline_cache_count;
   // The callback for resolving local symbols.
   scope_o *scope;
   // A reusable memory block.
   reusable_scratch_memory_t scratch_memory;
   // The module fragment we're compiling within.
   value_t fragment;
+  // The offset and opcode of the last instruction written. The peephole stage
+  // uses these to combine the last instruction with the next one.
+  size_t last_op_offset;
+  opcode_t last_opcode;
+  // Is it safe to rewrite the last instruction? It stops being safe when the
+  // code cursor has been read since, as a jump may target that position.
+  bool can_rewrite_last_op;
 } assembler_t;
 
 // Initializes an assembler. If the given scope callback is NULL it is taken to
@@ -164,7 +143,9 @@ reusable_scratch_memory_t *assembler_get_scratch_memory(assembler_t *assm);
 void assembler_adjust_stack_height(assembler_t *assm, int delta);
 
 // Returns the offset in words of the next location in the code stream which
-// will be written, that is, one past the last written instruction.
+// will be written, that is, one past the last written instruction. Reading the
+// cursor stops the peephole stage from combining the instructions on either
+// side of it.
 size_t assembler_get_code_cursor(assembler_t *assm);
 
 // Emits a push instruction.
@@ -189,8 +170,10 @@ value_t assembler_emit_invocation(assembler_t *assm, value_t space, value_t tags
 value_t assembler_emit_signal(assembler_t *assm, opcode_t opcode, value_t record);
 
 // Emits a raw call to a builtin with the given implementation which can't cause
-// signals.
-value_t assembler_emit_builtin(assembler_t *assm, builtin_method_t builtin);
+// signals. The inline implementation, which may be NULL, is recorded in the
+// instruction such that call sites can find it.
+value_t assembler_emit_builtin(assembler_t *assm, builtin_method_t builtin,
+    inline_builtin_method_t inline_builtin);
 
 // Emits a raw call to a builtin with the given implementation that may cause
 // a leave signal to be returned which requires leave_argc slots on the stack.
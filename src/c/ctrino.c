@@ -5,6 +5,8 @@
 #include "behavior.h"
 #include "builtin.h"
 #include "ctrino.h"
+#include "file.h"
+#include "interp.h"
 #include "log.h"
 #include "value-inl.h"
 
@@ -48,7 +50,7 @@ static value_t add_ctrino_method(runtime_t *runtime, value_t space,
     // Build the implementation.
     assembler_t assm;
     E_TRY(assembler_init(&assm, runtime, nothing(), scope_get_bottom()));
-    E_TRY(assembler_emit_builtin(&assm, implementation));
+    E_TRY(assembler_emit_builtin(&assm, implementation, NULL));
     E_TRY(assembler_emit_return(&assm));
     E_TRY_DEF(code_block, assembler_flush(&assm));
     // Build the signature.
@@ -189,6 +191,115 @@ static value_t ctrino_get_current_backtrace(builtin_arguments_t *args) {
   return capture_backtrace(runtime, frame);
 }
 
+// Returns a two-element array holding the number of hits and misses of the
+// runtime's method lookup cache.
+static value_t ctrino_get_lookup_cache_stats(builtin_arguments_t *args) {
+  value_t self = get_builtin_subject(args);
+  runtime_t *runtime = get_builtin_runtime(args);
+  CHECK_FAMILY(ofCtrino, self);
+  lookup_cache_t *cache = runtime->lookup_cache;
+  TRY_DEF(result, new_heap_array(runtime, 2));
+  set_array_at(result, 0, new_integer(cache->hits));
+  set_array_at(result, 1, new_integer(cache->misses));
+  return result;
+}
+
+// Returns an array holding the runtime's garbage collection statistics: the
+// number of nursery and full collections, the time spent in each in
+// microseconds, the longest pause, and the number of bytes allocated and
+// copied.
+static value_t ctrino_get_gc_stats(builtin_arguments_t *args) {
+  value_t self = get_builtin_subject(args);
+  runtime_t *runtime = get_builtin_runtime(args);
+  CHECK_FAMILY(ofCtrino, self);
+  gc_stats_t *stats = &runtime->gc_stats;
+  TRY_DEF(result, new_heap_array(runtime, 7));
+  set_array_at(result, 0, new_integer(stats->nursery_collections));
+  set_array_at(result, 1, new_integer(stats->full_collections));
+  set_array_at(result, 2, new_integer(stats->nursery_pause_usecs));
+  set_array_at(result, 3, new_integer(stats->full_pause_usecs));
+  set_array_at(result, 4, new_integer(stats->max_pause_usecs));
+  set_array_at(result, 5, new_integer(stats->bytes_allocated));
+  set_array_at(result, 6, new_integer(stats->bytes_copied));
+  return result;
+}
+
+// Writes a dump of the heap to the file with the given name. See
+// write_heap_dump_to_handle for the format.
+static value_t ctrino_write_heap_dump(builtin_arguments_t *args) {
+  value_t self = get_builtin_subject(args);
+  value_t filename = get_builtin_argument(args, 0);
+  CHECK_FAMILY(ofCtrino, self);
+  CHECK_FAMILY(ofString, filename);
+  string_t filename_str;
+  get_string_contents(filename, &filename_str);
+  TRY(write_heap_dump_to_file(get_builtin_runtime(args), &filename_str));
+  return null();
+}
+
+// Visitor that collects the methods whose code has been invoked at least a
+// given number of times. If there is no result array it just counts them.
+typedef struct {
+  value_visitor_o super;
+  code_block_table_t *code_blocks;
+  size_t min_count;
+  value_t result;
+  size_t count;
+} hot_method_collector_o;
+
+static value_t hot_method_collector_visit(hot_method_collector_o *self,
+    value_t value) {
+  if (!in_family(ofMethod, value))
+    return success();
+  value_t code = get_method_code(value);
+  if (is_nothing(code))
+    return success();
+  code_block_data_t *data = code_block_table_get(self->code_blocks, code);
+  size_t invocations = data->invocation_count;
+  if (invocations < self->min_count)
+    return success();
+  if (!is_nothing(self->result)) {
+    value_t pair = get_array_at(self->result, self->count);
+    set_array_at(pair, 0, value);
+    set_array_at(pair, 1, new_integer(invocations));
+  }
+  self->count++;
+  return success();
+}
+
+// Returns an array of [method, invocation count] pairs for all the methods in
+// the heap that have been invoked at least the given number of times. Methods
+// that have become garbage since the last collection may be included.
+static value_t ctrino_get_hot_methods(builtin_arguments_t *args) {
+  value_t self = get_builtin_subject(args);
+  value_t min_count = get_builtin_argument(args, 0);
+  runtime_t *runtime = get_builtin_runtime(args);
+  CHECK_FAMILY(ofCtrino, self);
+  CHECK_DOMAIN(vdInteger, min_count);
+  hot_method_collector_o collector;
+  collector.super.vtable.visit = (value_visitor_visit_m) hot_method_collector_visit;
+  collector.code_blocks = runtime->code_block_table;
+  collector.min_count = get_integer_value(min_count);
+  collector.result = nothing();
+  collector.count = 0;
+  // First count the methods, then allocate the result, then fill it in. The
+  // second traversal doesn't allocate so the heap stays the same while we
+  // traverse it.
+  heap_t *heap = &runtime->heap;
+  TRY(heap_for_each_space_object(heap, (value_visitor_o*) &collector));
+  size_t length = collector.count;
+  TRY_DEF(result, new_heap_array(runtime, length));
+  for (size_t i = 0; i < length; i++) {
+    TRY_DEF(pair, new_heap_array(runtime, 2));
+    set_array_at(result, i, pair);
+  }
+  collector.result = result;
+  collector.count = 0;
+  TRY(heap_for_each_space_object(heap, (value_visitor_o*) &collector));
+  CHECK_EQ("hot methods changed", length, collector.count);
+  return result;
+}
+
 static value_t ctrino_builtin(builtin_arguments_t *args) {
   value_t self = get_builtin_subject(args);
   value_t name = get_builtin_argument(args, 0);
@@ -211,5 +322,9 @@ value_t add_ctrino_builtin_methods(runtime_t *runtime, value_t space) {
   ADD_BUILTIN("to_string", 1, ctrino_to_string);
   ADD_BUILTIN("get_current_backtrace", 0, ctrino_get_current_backtrace);
   ADD_BUILTIN("builtin", 1, ctrino_builtin);
+  ADD_BUILTIN("get_lookup_cache_stats", 0, ctrino_get_lookup_cache_stats);
+  ADD_BUILTIN("get_hot_methods", 1, ctrino_get_hot_methods);
+  ADD_BUILTIN("get_gc_stats", 0, ctrino_get_gc_stats);
+  ADD_BUILTIN("write_heap_dump", 1, ctrino_write_heap_dump);
   return success();
 }
@@ -2,7 +2,10 @@
 // Licensed under the Apache License, Version 2.0 (see LICENSE).
 
 #include "alloc.h"
+#include "behavior.h"
+#include "derived.h"
 #include "file.h"
+#include "value-inl.h"
 
 value_t read_handle_to_blob(runtime_t *runtime, FILE *handle) {
   // Read the complete file into a byte buffer.
@@ -35,3 +38,139 @@ value_t read_file_to_blob(runtime_t *runtime, string_t *filename) {
     fclose(handle);
   E_END_TRY_FINALLY();
 }
+
+
+// --- H e a p   d u m p ---
+
+static const char *kHeapDumpMagic = "nheapdmp";
+static const size_t kHeapDumpVersion = 1;
+
+// Writes a number as an unsigned LEB128 varint.
+static void heap_dump_write_uint(FILE *handle, uint64_t value) {
+  while (value >= 0x80) {
+    fputc((int) ((value & 0x7F) | 0x80), handle);
+    value >>= 7;
+  }
+  fputc((int) value, handle);
+}
+
+static void heap_dump_write_string(FILE *handle, const char *str) {
+  size_t length = strlen(str);
+  heap_dump_write_uint(handle, length);
+  fwrite(str, 1, length, handle);
+}
+
+// Returns the object a value refers to as far as the dump is concerned, or
+// nothing if it doesn't refer to an object.
+static value_t heap_dump_get_target(value_t value) {
+  switch (get_value_domain(value)) {
+    case vdHeapObject:
+      return value;
+    case vdDerivedObject:
+      return get_derived_object_host(value);
+    default:
+      return nothing();
+  }
+}
+
+static void heap_dump_write_address(FILE *handle, value_t object) {
+  heap_dump_write_uint(handle, (address_arith_t) get_heap_object_address(object));
+}
+
+// Field visitor that writes a root record for each tracked object.
+typedef struct {
+  field_visitor_o super;
+  FILE *handle;
+} heap_dump_root_writer_o;
+
+static value_t heap_dump_write_root(FILE *handle, value_t value) {
+  value_t target = heap_dump_get_target(value);
+  if (!is_nothing(target)) {
+    fputc('r', handle);
+    heap_dump_write_address(handle, target);
+  }
+  return success();
+}
+
+static value_t heap_dump_root_writer_visit(heap_dump_root_writer_o *self,
+    value_t *field) {
+  return heap_dump_write_root(self->handle, *field);
+}
+
+// Value visitor that writes an object record for each object.
+typedef struct {
+  value_visitor_o super;
+  FILE *handle;
+} heap_dump_object_writer_o;
+
+static value_t heap_dump_object_writer_visit(heap_dump_object_writer_o *self,
+    value_t object) {
+  FILE *handle = self->handle;
+  heap_object_layout_t layout;
+  get_heap_object_layout(object, &layout);
+  // Count the references first since the count goes before them.
+  size_t ref_count = 1;
+  value_field_iter_t iter;
+  value_field_iter_init(&iter, object);
+  value_t *field;
+  while (value_field_iter_next(&iter, &field)) {
+    if (!is_nothing(heap_dump_get_target(*field)))
+      ref_count++;
+  }
+  fputc('o', handle);
+  heap_dump_write_address(handle, object);
+  heap_dump_write_uint(handle,
+      get_heap_object_family_ordinal(get_heap_object_family(object)));
+  heap_dump_write_uint(handle, layout.size);
+  heap_dump_write_uint(handle, ref_count);
+  heap_dump_write_address(handle, get_heap_object_species(object));
+  value_field_iter_init(&iter, object);
+  while (value_field_iter_next(&iter, &field)) {
+    value_t target = heap_dump_get_target(*field);
+    if (!is_nothing(target))
+      heap_dump_write_address(handle, target);
+  }
+  return success();
+}
+
+value_t write_heap_dump_to_handle(runtime_t *runtime, FILE *handle) {
+  fwrite(kHeapDumpMagic, 1, strlen(kHeapDumpMagic), handle);
+  heap_dump_write_uint(handle, kHeapDumpVersion);
+  // Family names.
+#define __EMIT_FAMILY_NAME__(Family, family, CM, ID, PT, SR, NL, FU, EM, MD, OW, N) \
+  fputc('f', handle);                                                          \
+  heap_dump_write_uint(handle, get_heap_object_family_ordinal(of##Family));    \
+  heap_dump_write_string(handle, #Family);
+  ENUM_HEAP_OBJECT_FAMILIES(__EMIT_FAMILY_NAME__)
+#undef __EMIT_FAMILY_NAME__
+  // Roots.
+  heap_dump_write_root(handle, runtime->roots);
+  heap_dump_write_root(handle, runtime->mutable_roots);
+  heap_dump_root_writer_o root_writer;
+  root_writer.super.vtable.visit =
+      (field_visitor_visit_m) heap_dump_root_writer_visit;
+  root_writer.handle = handle;
+  TRY(heap_for_each_tracker_field(&runtime->heap,
+      (field_visitor_o*) &root_writer));
+  // Objects.
+  heap_dump_object_writer_o object_writer;
+  object_writer.super.vtable.visit =
+      (value_visitor_visit_m) heap_dump_object_writer_visit;
+  object_writer.handle = handle;
+  TRY(heap_for_each_space_object(&runtime->heap,
+      (value_visitor_o*) &object_writer));
+  fputc('e', handle);
+  return ferror(handle)
+      ? new_system_error_condition(seFileWriteFailed)
+      : success();
+}
+
+value_t write_heap_dump_to_file(runtime_t *runtime, string_t *filename) {
+  FILE *handle = fopen(filename->chars, "wb");
+  if (handle == NULL)
+    return new_system_error_condition(seFileWriteFailed);
+  value_t result = write_heap_dump_to_handle(runtime, handle);
+  if (fclose(handle) != 0 && !is_condition(result))
+    result = new_system_error_condition(seFileWriteFailed);
+  return result;
+}
@@ -17,4 +17,25 @@ value_t read_handle_to_blob(runtime_t *runtime, FILE *handle);
 // Reads the full contents of a named file.
 value_t read_file_to_blob(runtime_t *runtime, string_t *filename);
 
+// Writes a snapshot of every object in the runtime's heap to the given handle.
+// The dump is a stream of records, each starting with a tag byte, where all
+// numbers are unsigned LEB128 varints and strings are a length followed by
+// that many bytes:
+//
+//   header: "nheapdmp" version
+//   'f' ordinal name: the name of the family with the given ordinal.
+//   'r' address: a root, an object that is always reachable.
+//   'o' address family size count ref*: an object with the given address,
+//       family ordinal and size in bytes, and the addresses of the count
+//       objects it references, including its species. References to derived
+//       objects are given as their host.
+//   'e': the end of the dump.
+//
+// The dump includes objects that are no longer reachable. See
+// src/sh/heap-dump.py for a tool that computes retained sizes from a dump.
+value_t write_heap_dump_to_handle(runtime_t *runtime, FILE *handle);
+
+// Writes a heap dump to the named file.
+value_t write_heap_dump_to_file(runtime_t *runtime, string_t *filename);
+
 #endif // _FILE
@@ -0,0 +1,8 @@
+// Copyright 2014 the Neutrino authors (see AUTHORS).
+// Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+// Fallback that keeps all pages.
+
+static void discard_memory_pages(address_t start, size_t size) {
+  // nothing to do
+}
@@ -0,0 +1,19 @@
+// Copyright 2014 the Neutrino authors (see AUTHORS).
+// Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+// Page management using madvise.
+
+#define __USE_MISC
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Tells the os that the contents of the given range of memory are no longer
+// needed. Only the pages entirely within the range are released; they'll be
+// faulted back in, zeroed, if they are touched again.
+static void discard_memory_pages(address_t start, size_t size) {
+  address_arith_t page_size = (address_arith_t) sysconf(_SC_PAGESIZE);
+  address_t first = align_address(page_size, start);
+  address_t limit = (address_t) (((address_arith_t) (start + size)) & ~(page_size - 1));
+  if (first < limit)
+    madvise(first, limit - first, MADV_DONTNEED);
+}
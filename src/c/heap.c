@@ -7,6 +7,12 @@
 #include "try-inl.h"
 #include "value-inl.h"
 
+#ifdef IS_GCC
+#include "heap-posix-opt.c"
+#else
+#include "heap-fallback-opt.c"
+#endif
+
 
 // --- M i s c ---
 
@@ -34,9 +40,18 @@ static size_t is_size_aligned(uint32_t alignment, size_t size) {
 // The default space config.
 static const runtime_config_t kDefaultConfig = {
   1 * kMB,      // semispace_size_bytes
+  1 * kMB,      // nursery_size_bytes
   100 * kMB,    // system_memory_limit
   0,            // allocation_failure_fuzzer_frequency
-  0             // allocation_failure_fuzzer_seed
+  0,            // allocation_failure_fuzzer_seed
+  false,        // profile_opcodes
+  false,        // enable_jit
+  100,          // jit_threshold
+  0,            // alloc_profile_interval
+  200,          // heap_growth_percent
+  50,           // heap_shrink_percent
+  1,            // gc_thread_count
+  gvFull        // gc_validation_level
 };
 
 void runtime_config_init_defaults(runtime_config_t *config) {
@@ -47,17 +62,19 @@ const runtime_config_t *runtime_config_get_default() {
   return &kDefaultConfig;
 }
 
-value_t space_init(space_t *space, const runtime_config_t *config) {
+value_t space_init(space_t *space, size_t size_bytes) {
   // Start out by clearing it, just for good measure.
   space_clear(space);
   // Allocate one word more than strictly necessary to account for possible
   // alignment.
-  size_t bytes = config->semispace_size_bytes + kValueSize;
+  size_t bytes = size_bytes + kValueSize;
   memory_block_t memory = allocator_default_malloc(bytes);
   if (memory_block_is_empty(memory))
     return new_system_error_condition(seAllocationFailed);
+#ifdef ENABLE_CHECKS
   // Clear the newly allocated memory to a recognizable value.
   memset(memory.memory, kBlankHeapMarker, bytes);
+#endif
   address_t aligned = align_address(kValueSize, (address_t) memory.memory);
   space->memory = memory;
   space->next_free = space->start = aligned;
@@ -65,14 +82,16 @@ value_t space_init(space_t *space, const runtime_config_t *config) {
   // wastes the extra word we allocated to make room for alignment. However,
   // making the space size slightly different depending on whether malloc
   // aligns its data or not is a recipe for subtle bugs.
-  space->limit = space->next_free + config->semispace_size_bytes;
+  space->limit = space->next_free + size_bytes;
   return success();
 }
 
 void space_dispose(space_t *space) {
   if (memory_block_is_empty(space->memory))
     return;
+#ifdef ENABLE_CHECKS
   memset(space->memory.memory, kFreedHeapMarker, space->memory.size);
+#endif
   allocator_default_free(space->memory);
   space_clear(space);
 }
@@ -87,15 +106,64 @@ bool space_is_empty(space_t *space) {
   return space->next_free == NULL;
 }
 
+void space_reset(space_t *space) {
+  CHECK_FALSE("resetting empty space", space_is_empty(space));
+#ifdef ENABLE_CHECKS
+  memset(space->start, kBlankHeapMarker, space->next_free - space->start);
+#endif
+  space->next_free = space->start;
+}
+
+void space_discard(space_t *space) {
+  CHECK_FALSE("discarding empty space", space_is_empty(space));
+  space->next_free = space->start;
+  discard_memory_pages(space->start, space_get_reserved_bytes(space));
+}
+
+void space_reuse(space_t *space, size_t capacity) {
+  CHECK_FALSE("reusing empty space", space_is_empty(space));
+  CHECK_EQ("reusing non-discarded space", 0, space_get_used_bytes(space));
+  space_set_capacity_bytes(space, capacity);
+#ifdef ENABLE_CHECKS
+  memset(space->start, kBlankHeapMarker, capacity);
+#endif
+}
+
+size_t space_get_used_bytes(space_t *space) {
+  return space->next_free - space->start;
+}
+
+size_t space_get_free_bytes(space_t *space) {
+  return space->limit - space->next_free;
+}
+
+size_t space_get_capacity_bytes(space_t *space) {
+  return space->limit - space->start;
+}
+
+size_t space_get_reserved_bytes(space_t *space) {
+  // This is the inverse of the calculation in space_init.
+  return space->memory.size - kValueSize;
+}
+
+void space_set_capacity_bytes(space_t *space, size_t capacity) {
+  CHECK_REL("capacity below used", capacity, >=, space_get_used_bytes(space));
+  CHECK_REL("capacity above reserved", capacity, <=,
+      space_get_reserved_bytes(space));
+  space->limit = space->start + capacity;
+}
+
 bool space_try_alloc(space_t *space, size_t size, address_t *memory_out) {
   CHECK_FALSE("allocating in empty space", space_is_empty(space));
   size_t aligned = align_size(kValueSize, size);
   address_t addr = space->next_free;
   address_t next = addr + aligned;
   if (next <= space->limit) {
+#ifdef ENABLE_CHECKS
     // Clear the newly allocated memory to a different value, again to make the
     // contents recognizable.
     memset(addr, kAllocedHeapMarker, aligned);
+#endif
     *memory_out = addr;
     space->next_free = next;
     return true;
@@ -188,35 +256,258 @@ void heap_dispose_object_tracker(heap_t *heap, object_tracker_t *tracker) {
   heap->object_tracker_count--;
 }
 
-value_t heap_validate(heap_t *heap) {
-  object_tracker_iter_t iter;
-  object_tracker_iter_init(&iter, heap);
-  object_tracker_t *prev = &heap->root_object_tracker;
-  size_t trackers_seen = 0;
-  while (object_tracker_iter_has_current(&iter)) {
-    object_tracker_t *current = object_tracker_iter_get_current(&iter);
-    trackers_seen++;
-    COND_CHECK_EQ("tracker validate", ccValidationFailed, prev->next, current);
-    COND_CHECK_EQ("tracker validate", ccValidationFailed, current->prev, prev);
-    prev = current;
-    object_tracker_iter_advance(&iter);
+// --- R e m e m b e r e d   s e t ---
+
+void remembered_set_init(remembered_set_t *set) {
+  set->slots = NULL;
+  set->capacity = 0;
+  set->size = 0;
+  set->memory = memory_block_empty();
+}
+
+// Is the given slot value the marker for an empty slot?
+static bool is_remembered_set_slot_empty(value_t slot) {
+  return slot.encoded == 0;
+}
+
+// Returns the slot in the given slot array where the given object either is or
+// should go.
+static value_t *find_remembered_set_slot(value_t *slots, size_t capacity,
+    value_t object) {
+  // The low bits of object addresses are always the same so shift them away
+  // before picking the starting slot.
+  size_t index = (size_t) ((object.encoded >> kDomainTagSize) % capacity);
+  while (true) {
+    value_t *slot = &slots[index];
+    if (is_remembered_set_slot_empty(*slot) || is_same_value(*slot, object))
+      return slot;
+    index = (index + 1) % capacity;
+  }
+}
+
+// Grows the set such that it has room for more elements. Returns false if the
+// new storage couldn't be allocated, in which case the set is unchanged.
+static bool remembered_set_grow(remembered_set_t *set) {
+  size_t new_capacity = (set->capacity == 0) ? 64 : (2 * set->capacity);
+  memory_block_t new_memory = allocator_default_malloc(
+      new_capacity * sizeof(value_t));
+  if (memory_block_is_empty(new_memory))
+    return false;
+  value_t *new_slots = (value_t*) new_memory.memory;
+  memset(new_slots, 0, new_capacity * sizeof(value_t));
+  for (size_t i = 0; i < set->capacity; i++) {
+    value_t object = set->slots[i];
+    if (!is_remembered_set_slot_empty(object))
+      *find_remembered_set_slot(new_slots, new_capacity, object) = object;
+  }
+  size_t size = set->size;
+  remembered_set_dispose(set);
+  set->slots = new_slots;
+  set->capacity = new_capacity;
+  set->size = size;
+  set->memory = new_memory;
+  return true;
+}
+
+bool remembered_set_add(remembered_set_t *set, value_t object) {
+  CHECK_DOMAIN(vdHeapObject, object);
+  // Keep the load factor below one half so probe sequences stay short.
+  if (2 * (set->size + 1) > set->capacity) {
+    if (!remembered_set_grow(set))
+      return false;
+  }
+  value_t *slot = find_remembered_set_slot(set->slots, set->capacity, object);
+  if (is_remembered_set_slot_empty(*slot)) {
+    *slot = object;
+    set->size++;
+  }
+  return true;
+}
+
+bool remembered_set_contains(remembered_set_t *set, value_t object) {
+  if (set->size == 0)
+    return false;
+  value_t *slot = find_remembered_set_slot(set->slots, set->capacity, object);
+  return !is_remembered_set_slot_empty(*slot);
+}
+
+value_t remembered_set_for_each_object(remembered_set_t *set,
+    value_visitor_o *visitor) {
+  for (size_t i = 0; i < set->capacity; i++) {
+    value_t object = set->slots[i];
+    if (!is_remembered_set_slot_empty(object))
+      TRY(value_visitor_visit(visitor, object));
   }
-  COND_CHECK_EQ("tracker validate", ccValidationFailed, trackers_seen,
-      heap->object_tracker_count);
   return success();
 }
 
+void remembered_set_dispose(remembered_set_t *set) {
+  if (!memory_block_is_empty(set->memory)) {
+    allocator_default_free(set->memory);
+    set->memory = memory_block_empty();
+  }
+  set->slots = NULL;
+  set->capacity = 0;
+  set->size = 0;
+}
+
+
+// The size of the header before each large object, rounded up such that the
+// object stays aligned.
+static size_t get_large_object_header_size() {
+  return align_size(kValueSize, sizeof(large_object_t));
+}
+
+// Returns the object stored after the given large object header.
+static value_t get_large_object_value(large_object_t *header) {
+  return new_heap_object(((address_t) header) + get_large_object_header_size());
+}
+
+// Returns the header stored before the given large object.
+static large_object_t *get_large_object_header(value_t object) {
+  return (large_object_t*) (get_heap_object_address(object)
+      - get_large_object_header_size());
+}
+
+// Returns the size of the given large object.
+static size_t get_large_object_size(large_object_t *header) {
+  return header->memory.size - get_large_object_header_size() - kValueSize;
+}
+
+void large_object_space_init(large_object_space_t *space, size_t limit_bytes) {
+  space->first = NULL;
+  space->grey = NULL;
+  space->used_bytes = 0;
+  space->limit_bytes = limit_bytes;
+}
+
+// Releases the memory held by the given large object.
+static void large_object_free(large_object_t *header) {
+  memory_block_t memory = header->memory;
+#ifdef ENABLE_CHECKS
+  memset(memory.memory, kFreedHeapMarker, memory.size);
+#endif
+  allocator_default_free(memory);
+}
+
+void large_object_space_dispose(large_object_space_t *space) {
+  large_object_t *current = space->first;
+  while (current != NULL) {
+    large_object_t *next = current->next;
+    large_object_free(current);
+    current = next;
+  }
+  large_object_space_init(space, space->limit_bytes);
+}
+
+bool large_object_space_try_alloc(large_object_space_t *space, size_t size,
+    address_t *memory_out) {
+  size_t aligned = align_size(kValueSize, size);
+  if (space->used_bytes + aligned > space->limit_bytes)
+    return false;
+  // Allocate one word more than necessary to account for alignment, like
+  // space_init.
+  memory_block_t memory = allocator_default_malloc(
+      get_large_object_header_size() + aligned + kValueSize);
+  if (memory_block_is_empty(memory))
+    return false;
+  large_object_t *header = (large_object_t*) align_address(kValueSize,
+      (address_t) memory.memory);
+  header->memory = memory;
+  header->is_marked = false;
+  header->next_grey = NULL;
+  header->next = space->first;
+  space->first = header;
+  space->used_bytes += aligned;
+  address_t addr = get_heap_object_address(get_large_object_value(header));
+#ifdef ENABLE_CHECKS
+  memset(addr, kAllocedHeapMarker, aligned);
+#endif
+  *memory_out = addr;
+  return true;
+}
+
+bool large_object_space_contains(large_object_space_t *space, address_t addr) {
+  for (large_object_t *current = space->first; current != NULL; current = current->next) {
+    address_t start = get_heap_object_address(get_large_object_value(current));
+    if (start <= addr && addr < start + get_large_object_size(current))
+      return true;
+  }
+  return false;
+}
+
+value_t large_object_space_for_each_object(large_object_space_t *space,
+    value_visitor_o *visitor) {
+  for (large_object_t *current = space->first; current != NULL; current = current->next)
+    TRY(value_visitor_visit(visitor, get_large_object_value(current)));
+  return success();
+}
+
+bool large_object_space_mark(large_object_space_t *space, value_t object) {
+  if (!large_object_space_mark_ungrey(space, object))
+    return false;
+  large_object_t *header = get_large_object_header(object);
+  header->next_grey = space->grey;
+  space->grey = header;
+  return true;
+}
+
+bool large_object_space_mark_ungrey(large_object_space_t *space, value_t object) {
+  large_object_t *header = get_large_object_header(object);
+  if (header->is_marked)
+    return false;
+  header->is_marked = true;
+  return true;
+}
+
+void large_object_space_sweep(large_object_space_t *space) {
+  CHECK_PTREQ("sweeping with grey objects", NULL, space->grey);
+  large_object_t **link = &space->first;
+  while (*link != NULL) {
+    large_object_t *current = *link;
+    if (current->is_marked) {
+      current->is_marked = false;
+      link = &current->next;
+    } else {
+      *link = current->next;
+      space->used_bytes -= get_large_object_size(current);
+      large_object_free(current);
+    }
+  }
+}
+
 
 // --- H e a p ---
 
+// Objects larger than this fraction of the nursery are allocated directly in
+// old space.
+static const size_t kNurseryLargeObjectFraction = 4;
+
+// Objects at least this large are allocated in the large object space. This
+// is chosen such that default-sized stack pieces end up there.
+static const size_t kLargeObjectSizeBytes = 8 * kKB;
+
 value_t heap_init(heap_t *heap, const runtime_config_t *config) {
-  // Initialize new space, leave old space clear; we won't use that until
-  // later.
+  // Initialize the nursery and old space, leave from-space clear; we won't use
+  // that until later.
   if (config == NULL)
     config = runtime_config_get_default();
   heap->config = *config;
-  TRY(space_init(&heap->to_space, config));
+  TRY(space_init(&heap->nursery, config->nursery_size_bytes));
+  TRY(space_init(&heap->old_space, config->semispace_size_bytes));
   space_clear(&heap->from_space);
+  space_clear(&heap->spare_space);
+  large_object_space_init(&heap->large_object_space,
+      config->semispace_size_bytes);
+  // The immortal space starts out empty but initialized such that we don't
+  // have to check whether it's there before looking inside it.
+  TRY(space_init(&heap->immortal_space, 0));
+  heap->immortal_space_is_closed = true;
+  remembered_set_init(&heap->remembered_set);
+  heap->needs_full_collection = false;
+  heap->allow_nursery_overflow = false;
+  heap->failed_old_allocation_bytes = 0;
+  heap->failed_large_allocation_bytes = 0;
   // Initialize the object tracker loop using the dummy node.
   heap->root_object_tracker.next = heap->root_object_tracker.prev = &heap->root_object_tracker;
   heap->object_tracker_count = 0;
@@ -224,17 +515,56 @@ value_t heap_init(heap_t *heap, const runtime_config_t *config) {
 }
 
 bool heap_try_alloc(heap_t *heap, size_t size, address_t *memory_out) {
-  return space_try_alloc(&heap->to_space, size, memory_out);
+  if (size >= kLargeObjectSizeBytes) {
+    if (!large_object_space_try_alloc(&heap->large_object_space, size, memory_out)) {
+      heap->needs_full_collection = true;
+      if (size > heap->failed_large_allocation_bytes)
+        heap->failed_large_allocation_bytes = size;
+      return false;
+    }
+    // Large objects are old from the start so, like objects allocated
+    // directly in old space, they're remembered up front.
+    heap_remember_object(heap, new_heap_object(*memory_out));
+    return true;
+  }
+  if (size <= (heap->config.nursery_size_bytes / kNurseryLargeObjectFraction)) {
+    if (space_try_alloc(&heap->nursery, size, memory_out))
+      return true;
+    if (!heap->allow_nursery_overflow)
+      return false;
+  }
+  if (!space_try_alloc(&heap->old_space, size, memory_out)) {
+    heap->needs_full_collection = true;
+    if (size > heap->failed_old_allocation_bytes)
+      heap->failed_old_allocation_bytes = size;
+    return false;
+  }
+  // Objects allocated directly in old space get their fields initialized
+  // without going through the write barrier so they're remembered up front.
+  heap_remember_object(heap, new_heap_object(*memory_out));
+  return true;
 }
 
 void heap_dispose(heap_t *heap) {
   CHECK_EQ("Leaking undisposed trackers", 0, heap->object_tracker_count);
-  space_dispose(&heap->to_space);
+  space_dispose(&heap->nursery);
+  space_dispose(&heap->old_space);
   space_dispose(&heap->from_space);
+  space_dispose(&heap->spare_space);
+  large_object_space_dispose(&heap->large_object_space);
+  space_dispose(&heap->immortal_space);
+  remembered_set_dispose(&heap->remembered_set);
+}
+
+value_t heap_for_each_space_object(heap_t *heap, value_visitor_o *visitor) {
+  TRY(space_for_each_object(&heap->immortal_space, visitor));
+  TRY(space_for_each_object(&heap->old_space, visitor));
+  TRY(large_object_space_for_each_object(&heap->large_object_space, visitor));
+  return space_for_each_object(&heap->nursery, visitor);
 }
 
 value_t heap_for_each_object(heap_t *heap, value_visitor_o *visitor) {
-  CHECK_FALSE("traversing empty space", space_is_empty(&heap->to_space));
+  CHECK_FALSE("traversing empty space", space_is_empty(&heap->nursery));
   object_tracker_iter_t iter;
   object_tracker_iter_init(&iter, heap);
   while (object_tracker_iter_has_current(&iter)) {
@@ -242,7 +572,7 @@ value_t heap_for_each_object(heap_t *heap, value_visitor_o *visitor) {
     TRY(value_visitor_visit(visitor, current->value));
     object_tracker_iter_advance(&iter);
   }
-  return space_for_each_object(&heap->to_space, visitor);
+  return heap_for_each_space_object(heap, visitor);
 }
 
 typedef struct {
@@ -269,38 +599,415 @@ static value_t field_delegator_visit(field_delegator_o *self, value_t object) {
   return success();
 }
 
-value_t heap_for_each_field(heap_t *heap, field_visitor_o *visitor) {
+// Initializes a field delegator that passes fields on to the given visitor.
+static void field_delegator_init(field_delegator_o *delegator,
+    field_visitor_o *visitor) {
+  delegator->super.vtable.visit = (value_visitor_visit_m) field_delegator_visit;
+  delegator->field_visitor = visitor;
+}
+
+value_t remembered_set_for_each_field(remembered_set_t *set,
+    field_visitor_o *visitor) {
+  field_delegator_o delegator;
+  field_delegator_init(&delegator, visitor);
+  return remembered_set_for_each_object(set, (value_visitor_o*) &delegator);
+}
+
+value_t heap_for_each_tracker_field(heap_t *heap, field_visitor_o *visitor) {
   object_tracker_iter_t iter;
   object_tracker_iter_init(&iter, heap);
   while (object_tracker_iter_has_current(&iter)) {
     object_tracker_t *current = object_tracker_iter_get_current(&iter);
-    field_visitor_visit(visitor, &current->value);
+    TRY(field_visitor_visit(visitor, &current->value));
     object_tracker_iter_advance(&iter);
   }
+  return success();
+}
+
+// Invokes the given callback for each object field in the given space, starting
+// from the object at the given address.
+static value_t space_for_each_field_from(space_t *space, address_t start,
+    field_visitor_o *visitor) {
+  field_delegator_o delegator;
+  field_delegator_init(&delegator, visitor);
+  // This is space_for_each_object except that it starts from the given address
+  // rather than the start of the space.
+  address_t current = start;
+  while (current < space->next_free) {
+    value_t value = new_heap_object(current);
+    TRY(field_delegator_visit(&delegator, value));
+    heap_object_layout_t layout;
+    heap_object_layout_init(&layout);
+    get_heap_object_layout(value, &layout);
+    size_t size = layout.size;
+    CHECK_TRUE("object heap size alignment", is_size_aligned(kValueSize, size));
+    current += size;
+  }
+  return success();
+}
+
+value_t heap_for_each_old_field(heap_t *heap, address_t start,
+    field_visitor_o *visitor) {
+  return space_for_each_field_from(&heap->old_space, start, visitor);
+}
+
+value_t heap_for_each_immortal_field(heap_t *heap, address_t start,
+    field_visitor_o *visitor) {
+  return space_for_each_field_from(&heap->immortal_space, start, visitor);
+}
+
+value_t heap_for_each_grey_large_field(heap_t *heap, field_visitor_o *visitor) {
+  field_delegator_o delegator;
+  field_delegator_init(&delegator, visitor);
+  large_object_space_t *space = &heap->large_object_space;
+  while (space->grey != NULL) {
+    large_object_t *next = space->grey;
+    space->grey = next->next_grey;
+    next->next_grey = NULL;
+    TRY(field_delegator_visit(&delegator, get_large_object_value(next)));
+  }
+  return success();
+}
+
+value_t heap_object_for_each_field(value_t object, field_visitor_o *visitor) {
   field_delegator_o delegator;
-  delegator.super.vtable.visit = (value_visitor_visit_m) field_delegator_visit;
-  delegator.field_visitor = visitor;
-  return space_for_each_object(&heap->to_space, (value_visitor_o*) &delegator);
+  field_delegator_init(&delegator, visitor);
+  return field_delegator_visit(&delegator, object);
+}
+
+bool heap_in_nursery(heap_t *heap, value_t object) {
+  return space_contains(&heap->nursery, get_heap_object_address(object));
+}
+
+bool heap_in_immortal_space(heap_t *heap, value_t object) {
+  return space_contains(&heap->immortal_space, get_heap_object_address(object));
+}
+
+bool heap_in_large_object_space(heap_t *heap, value_t object) {
+  return large_object_space_contains(&heap->large_object_space,
+      get_heap_object_address(object));
+}
+
+void heap_remember_object(heap_t *heap, value_t object) {
+  if (!remembered_set_add(&heap->remembered_set, object))
+    heap->needs_full_collection = true;
+}
+
+bool heap_needs_full_collection(heap_t *heap) {
+  // Promoting everything in the nursery must be guaranteed to succeed so if
+  // old space doesn't have room for that we need the full collection to make
+  // room.
+  return heap->needs_full_collection
+      || (space_get_free_bytes(&heap->old_space) < space_get_used_bytes(&heap->nursery));
+}
+
+void record_heap_object_write_slow(value_t object, value_t value) {
+  address_t target = in_domain(vdHeapObject, value)
+      ? get_heap_object_address(value)
+      : get_derived_object_address(value);
+  address_t holder = get_heap_object_address(object);
+  // The barrier only has the object being written so the heap comes from its
+  // species.
+  heap_t *heap = get_species_heap(get_heap_object_header(object));
+  // Immortal objects are deep frozen so they shouldn't be written at all but
+  // if one is made to point out of the immortal space full collections can't
+  // skip it anymore.
+  if (space_contains(&heap->immortal_space, holder)
+      && !space_contains(&heap->immortal_space, target))
+    heap->immortal_space_is_closed = false;
+  if (space_contains(&heap->nursery, target) && !space_contains(&heap->nursery, holder))
+    heap_remember_object(heap, object);
+}
+
+// Returns the given size scaled by the given percentage.
+static size_t scale_by_percent(size_t size, size_t percent) {
+  return (size / 100) * percent + ((size % 100) * percent) / 100;
+}
+
+// Returns the largest capacity old space is allowed to have. During a full
+// collection there are two old spaces as well as the nursery so together they
+// must stay within the system memory limit.
+static size_t get_max_old_space_capacity(heap_t *heap) {
+  size_t limit = heap->config.system_memory_limit;
+  size_t nursery = heap->config.nursery_size_bytes;
+  return (limit > nursery) ? ((limit - nursery) / 2) : 0;
+}
+
+// Returns the capacity old space should have when it holds the given number of
+// live bytes.
+static size_t get_target_old_space_capacity(heap_t *heap, size_t live_bytes) {
+  size_t target = scale_by_percent(live_bytes, heap->config.heap_growth_percent);
+  // Make sure the next collection of the nursery can promote everything and
+  // that the allocation that triggered this collection will succeed, otherwise
+  // the next collection would have to be a full one again.
+  size_t needed = live_bytes + heap->config.nursery_size_bytes
+      + heap->failed_old_allocation_bytes;
+  if (target < needed)
+    target = needed;
+  size_t max = get_max_old_space_capacity(heap);
+  if (target > max)
+    target = max;
+  if (target < heap->config.semispace_size_bytes)
+    target = heap->config.semispace_size_bytes;
+  // Whatever the limits say it has to be able to hold the live data.
+  if (target < live_bytes)
+    target = live_bytes;
+  return target;
 }
 
 value_t heap_prepare_garbage_collection(heap_t *heap) {
   CHECK_TRUE("from space not empty", space_is_empty(&heap->from_space));
-  CHECK_FALSE("to space empty", space_is_empty(&heap->to_space));
-  // Move to-space to from-space so we have a handle on it for later.
-  heap->from_space = heap->to_space;
-  // Reset to-space so we can use the fields again.
-  space_clear(&heap->to_space);
-  // Then create a new empty to-space.
-  return space_init(&heap->to_space, &heap->config);
+  CHECK_FALSE("old space empty", space_is_empty(&heap->old_space));
+  // Move old space to from-space so we have a handle on it for later.
+  heap->from_space = heap->old_space;
+  // Reset old space so we can use the fields again.
+  space_clear(&heap->old_space);
+  // We don't know how much will survive until after the collection but it's
+  // at most everything in from-space and the nursery, so we reserve room for
+  // that much to survive and to then grow by the usual amount. Once we know how
+  // much actually survived the capacity is set to what it should be.
+  size_t live_bound = space_get_used_bytes(&heap->from_space)
+      + space_get_used_bytes(&heap->nursery);
+  size_t reserve = get_target_old_space_capacity(heap, live_bound);
+  if (reserve < live_bound)
+    reserve = live_bound;
+  size_t current = space_get_capacity_bytes(&heap->from_space);
+  if (reserve < current)
+    reserve = current;
+  if (heap->config.gc_thread_count > 1) {
+    // A parallel collection leaves the unused ends of the threads' copy buffers
+    // behind as garbage. Objects that take up more than an eighth of a buffer
+    // are allocated directly so at most that much of each buffer is wasted,
+    // except for the last one of each thread.
+    size_t parallel_bound = live_bound + live_bound / 4
+        + heap->config.gc_thread_count * kGcCopyBufferSize;
+    if (reserve < parallel_bound)
+      reserve = parallel_bound;
+  }
+  // Everything gets traversed so there's no need to remember anything. Objects
+  // that need to be remembered are added back as they're migrated.
+  remembered_set_dispose(&heap->remembered_set);
+  heap->needs_full_collection = false;
+  // Then set up the new empty old space. If the spare left over from the last
+  // collection is large enough, but not so large that we'd be holding on to
+  // lots of memory we don't need, we use that rather than allocate a new one.
+  space_t *spare = &heap->spare_space;
+  if (!space_is_empty(spare)) {
+    size_t spare_reserved = space_get_reserved_bytes(spare);
+    if (reserve <= spare_reserved && spare_reserved <= 2 * reserve) {
+      heap->old_space = *spare;
+      space_clear(spare);
+      space_reuse(&heap->old_space, reserve);
+      return success();
+    }
+    space_dispose(spare);
+  }
+  return space_init(&heap->old_space, reserve);
 }
 
 value_t heap_complete_garbage_collection(heap_t *heap) {
   CHECK_FALSE("from space empty", space_is_empty(&heap->from_space));
-  CHECK_FALSE("to space empty", space_is_empty(&heap->to_space));
-  space_dispose(&heap->from_space);
+  CHECK_FALSE("old space empty", space_is_empty(&heap->old_space));
+  space_t *old_space = &heap->old_space;
+  size_t current = space_get_capacity_bytes(&heap->from_space);
+  size_t target = get_target_old_space_capacity(heap,
+      space_get_used_bytes(old_space));
+  // Only shrink if it makes a significant difference.
+  if (target < current && target >= scale_by_percent(current, heap->config.heap_shrink_percent))
+    target = current;
+  if (target > space_get_reserved_bytes(old_space))
+    target = space_get_reserved_bytes(old_space);
+  space_set_capacity_bytes(old_space, target);
+  heap->failed_old_allocation_bytes = 0;
+  // Large objects that weren't reached are freed and the limit on the large
+  // object space is adjusted to what survived in the same way as old space.
+  large_object_space_t *large_space = &heap->large_object_space;
+  large_object_space_sweep(large_space);
+  size_t large_live = large_space->used_bytes;
+  size_t large_limit = scale_by_percent(large_live, heap->config.heap_growth_percent);
+  if (large_limit < large_live + heap->failed_large_allocation_bytes)
+    large_limit = large_live + heap->failed_large_allocation_bytes;
+  if (large_limit < heap->config.semispace_size_bytes)
+    large_limit = heap->config.semispace_size_bytes;
+  large_space->limit_bytes = large_limit;
+  heap->failed_large_allocation_bytes = 0;
+  // Keep the old from-space around to be the next old space but let the os
+  // have its pages back in the meantime.
+  CHECK_TRUE("spare space not empty", space_is_empty(&heap->spare_space));
+  space_discard(&heap->from_space);
+  heap->spare_space = heap->from_space;
+  space_clear(&heap->from_space);
+  space_reset(&heap->nursery);
   return success();
 }
 
+value_t heap_prepare_promotion(heap_t *heap, space_t *immortal_from_out) {
+  CHECK_FALSE("promoting outside gc", space_is_empty(&heap->from_space));
+  // Everything in the collected spaces could turn out to be deep frozen so
+  // that's how much room we need.
+  size_t reserve = space_get_used_bytes(&heap->from_space)
+      + space_get_used_bytes(&heap->nursery)
+      + space_get_used_bytes(&heap->immortal_space);
+  *immortal_from_out = heap->immortal_space;
+  space_clear(&heap->immortal_space);
+  return space_init(&heap->immortal_space, reserve);
+}
+
+// Returns true if no object in the immortal space points outside it.
+static bool is_immortal_space_closed(heap_t *heap) {
+  space_t *space = &heap->immortal_space;
+  address_t current = space->start;
+  while (current < space->next_free) {
+    value_t object = new_heap_object(current);
+    value_t *field = access_heap_object_field(object, kHeapObjectHeaderOffset);
+    value_field_iter_t iter;
+    value_field_iter_init(&iter, object);
+    do {
+      value_domain_t domain = get_value_domain(*field);
+      address_t target = NULL;
+      if (domain == vdHeapObject)
+        target = get_heap_object_address(*field);
+      else if (domain == vdDerivedObject)
+        target = get_derived_object_address(*field);
+      if (target != NULL && !space_contains(space, target))
+        return false;
+    } while (value_field_iter_next(&iter, &field));
+    current = iter.limit;
+  }
+  return true;
+}
+
+void heap_complete_promotion(heap_t *heap, space_t *immortal_from) {
+  space_dispose(immortal_from);
+  // Nothing more is allocated in the immortal space until the next promotion
+  // so the memory we reserved but didn't use can go back to the os.
+  space_t *space = &heap->immortal_space;
+  size_t used = space_get_used_bytes(space);
+  space_set_capacity_bytes(space, used);
+  discard_memory_pages(space->next_free, space_get_reserved_bytes(space) - used);
+  heap->immortal_space_is_closed = is_immortal_space_closed(heap);
+}
+
+void heap_prepare_nursery_collection(heap_t *heap, remembered_set_t *remembered_out) {
+  *remembered_out = heap->remembered_set;
+  remembered_set_init(&heap->remembered_set);
+}
+
+void heap_complete_nursery_collection(heap_t *heap) {
+  space_reset(&heap->nursery);
+}
+
+// Visitor that checks that old objects that point into the nursery are in the
+// remembered set.
+typedef struct {
+  value_visitor_o super;
+  heap_t *heap;
+} remembered_set_validator_o;
+
+// Returns true if the given value points into the nursery of the given heap.
+static bool points_into_nursery(heap_t *heap, value_t value) {
+  switch (get_value_domain(value)) {
+    case vdHeapObject:
+      return heap_in_nursery(heap, value);
+    case vdDerivedObject:
+      return space_contains(&heap->nursery, get_derived_object_address(value));
+    default:
+      return false;
+  }
+}
+
+// Checks that the given old object is remembered if it points into the nursery.
+static value_t remembered_set_validator_visit(remembered_set_validator_o *self,
+    value_t object) {
+  heap_t *heap = self->heap;
+  bool points_young = points_into_nursery(heap, get_heap_object_header(object));
+  value_field_iter_t iter;
+  value_field_iter_init(&iter, object);
+  value_t *field;
+  while (!points_young && value_field_iter_next(&iter, &field))
+    points_young = points_into_nursery(heap, *field);
+  COND_CHECK_TRUE("remembered set validate", ccValidationFailed,
+      !points_young || remembered_set_contains(&heap->remembered_set, object));
+  return success();
+}
+
+value_t heap_validate(heap_t *heap) {
+  object_tracker_iter_t iter;
+  object_tracker_iter_init(&iter, heap);
+  object_tracker_t *prev = &heap->root_object_tracker;
+  size_t trackers_seen = 0;
+  while (object_tracker_iter_has_current(&iter)) {
+    object_tracker_t *current = object_tracker_iter_get_current(&iter);
+    trackers_seen++;
+    COND_CHECK_EQ("tracker validate", ccValidationFailed, prev->next, current);
+    COND_CHECK_EQ("tracker validate", ccValidationFailed, current->prev, prev);
+    prev = current;
+    object_tracker_iter_advance(&iter);
+  }
+  COND_CHECK_EQ("tracker validate", ccValidationFailed, trackers_seen,
+      heap->object_tracker_count);
+  return success();
+}
+
+value_t heap_validate_remembered_set(heap_t *heap) {
+  // If the remembered set may be incomplete the next collection is a full one
+  // so it doesn't matter.
+  if (heap->needs_full_collection)
+    return success();
+  remembered_set_validator_o validator;
+  validator.super.vtable.visit = (value_visitor_visit_m) remembered_set_validator_visit;
+  validator.heap = heap;
+  TRY(space_for_each_object(&heap->immortal_space, (value_visitor_o*) &validator));
+  TRY(space_for_each_object(&heap->old_space, (value_visitor_o*) &validator));
+  return large_object_space_for_each_object(&heap->large_object_space,
+      (value_visitor_o*) &validator);
+}
+
+// Visitor that checks that fields point to objects within the heap.
+typedef struct {
+  field_visitor_o super;
+  heap_t *heap;
+} reference_validator_o;
+
+// Checks that the given field, if it holds a reference, points into the heap.
+static value_t reference_validator_visit(reference_validator_o *self,
+    value_t *field) {
+  address_t target = NULL;
+  switch (get_value_domain(*field)) {
+    case vdHeapObject:
+      target = get_heap_object_address(*field);
+      break;
+    case vdDerivedObject:
+      target = get_derived_object_address(*field);
+      break;
+    default:
+      return success();
+  }
+  heap_t *heap = self->heap;
+  COND_CHECK_TRUE("reference validate", ccValidationFailed,
+      space_contains(&heap->old_space, target)
+          || space_contains(&heap->nursery, target)
+          || space_contains(&heap->immortal_space, target)
+          || large_object_space_contains(&heap->large_object_space, target));
+  return success();
+}
+
+value_t heap_validate_references(heap_t *heap) {
+  reference_validator_o validator;
+  validator.super.vtable.visit = (field_visitor_visit_m) reference_validator_visit;
+  validator.heap = heap;
+  field_visitor_o *visitor = (field_visitor_o*) &validator;
+  TRY(heap_for_each_tracker_field(heap, visitor));
+  TRY(heap_for_each_old_field(heap, heap->old_space.start, visitor));
+  TRY(heap_for_each_immortal_field(heap, heap->immortal_space.start, visitor));
+  field_delegator_o delegator;
+  field_delegator_init(&delegator, visitor);
+  TRY(large_object_space_for_each_object(&heap->large_object_space,
+      (value_visitor_o*) &delegator));
+  return space_for_each_object(&heap->nursery, (value_visitor_o*) &delegator);
+}
+
+
 void value_field_iter_init(value_field_iter_t *iter, value_t value) {
   if (!is_heap_object(value)) {
     iter->limit = iter->next = NULL;
@@ -58,11 +58,28 @@ struct field_visitor_o {
 value_t field_visitor_visit(field_visitor_o *self, value_t *field);
 
 
+// How thoroughly to validate the runtime before and after garbage collection.
+typedef enum {
+  // Don't validate anything.
+  gvNone,
+  // Validate the heap's own data structures and the roots.
+  gvRoots,
+  // Validate every object in the heap as well as the remembered set.
+  gvFull,
+  // In addition to full validation check that every reference in the heap
+  // points to an object within the heap.
+  gvExpensive
+} gc_validation_level_t;
+
 // Settings to apply when creating a runtime. This struct gets passed by value
 // under some circumstances so be sure it doesn't break anything to do that.
 typedef struct {
-  // The size in bytes of the space to create.
+  // The initial and minimum size in bytes of the old space where objects that
+  // survive a collection of the nursery end up. Old space grows and shrinks
+  // from there depending on how much data survives full collections.
   size_t semispace_size_bytes;
+  // The size in bytes of the nursery where new objects are allocated.
+  size_t nursery_size_bytes;
   // The max amount of memory we'll allocate from the system. This is mainly a
   // failsafe in case a bug causes the runtime to allocate out of control, which
   // has happened, because the OS doesn't necessarily handle that very well.
@@ -72,6 +89,32 @@ typedef struct {
   // Random seed used to initialize the pseudo random generator used to
   // determine when to simulate a failure when fuzzing.
   size_t gc_fuzz_seed;
+  // Should the interpreter collect opcode execution statistics?
+  bool profile_opcodes;
+  // Should code be compiled to native code before being executed? Only has an
+  // effect on platforms where native code is supported and is ignored when
+  // profiling opcodes since native code isn't profiled.
+  bool enable_jit;
+  // When native code is enabled, how many times a method must have been
+  // invoked before it's compiled. Code that is never invoked as a method, like
+  // a program's top level, is only compiled if this is 0.
+  size_t jit_threshold;
+  // If nonzero, sample an allocation every this many bytes and record where it
+  // happened.
+  size_t alloc_profile_interval;
+  // After a full collection old space is resized to this percentage of the
+  // size of the data that survived, so 200 means that half of it will be free.
+  size_t heap_growth_percent;
+  // Old space is only shrunk if the new size is less than this percentage of
+  // the current size. This keeps it from being resized after every collection
+  // when the amount of live data fluctuates a little.
+  size_t heap_shrink_percent;
+  // The number of threads that copy objects during a full collection. With
+  // more than one the collection runs in parallel, otherwise, or if threads
+  // aren't supported, it runs on the calling thread alone.
+  size_t gc_thread_count;
+  // How much validation to do around garbage collections.
+  gc_validation_level_t gc_validation_level;
 } runtime_config_t;
 
 // Initializes the fields of this runtime config to the defaults. These defaults
@@ -99,9 +142,9 @@ typedef struct {
   memory_block_t memory;
 } space_t;
 
-// Initialize the given space, assumed to be uninitialized. If this fails for
-// whatever reason a condition is returned.
-value_t space_init(space_t *space, const runtime_config_t *config);
+// Initialize the given space, assumed to be uninitialized, to hold the given
+// number of bytes. If this fails for whatever reason a condition is returned.
+value_t space_init(space_t *space, size_t size_bytes);
 
 // If necessary, dispose the memory held by this space.
 void space_dispose(space_t *space);
@@ -113,6 +156,37 @@ void space_clear(space_t *space);
 // Is this an empty space?
 bool space_is_empty(space_t *space);
 
+// Discards all the objects in this space such that allocation starts over from
+// the beginning.
+void space_reset(space_t *space);
+
+// Discards all the objects in this space and releases the underlying memory to
+// the os, though the space keeps it reserved. Before allocating in the space
+// again it must be made ready using space_reuse.
+void space_discard(space_t *space);
+
+// Makes a space that has been discarded ready to be allocated in again, with
+// the given capacity.
+void space_reuse(space_t *space, size_t capacity);
+
+// Returns the number of bytes that have been allocated in this space.
+size_t space_get_used_bytes(space_t *space);
+
+// Returns the number of bytes that can still be allocated in this space.
+size_t space_get_free_bytes(space_t *space);
+
+// Returns the number of bytes this space can hold in total.
+size_t space_get_capacity_bytes(space_t *space);
+
+// Returns the most bytes this space could hold if its capacity was changed,
+// that is, the size of the memory that was allocated for it.
+size_t space_get_reserved_bytes(space_t *space);
+
+// Sets the number of bytes this space can hold. The new capacity must be at
+// least the number of bytes already allocated and no more than the number of
+// bytes reserved.
+void space_set_capacity_bytes(space_t *space, size_t capacity);
+
 // Allocate the given number of byte in the given space. The size is not
 // required to be value pointer aligned, this function will take care of
 // that if necessary. If allocation is successful the result will be stored
@@ -132,21 +206,158 @@ address_t align_address(address_arith_t alignment, address_t ptr);
 bool space_contains(space_t *space, address_t addr);
 
 
-// A full garbage-collectable heap.
+// A set of old objects that may hold pointers into the nursery. It is an open
+// addressing hash set of object values where a zero value marks an empty slot.
 typedef struct {
+  // The slots of the set.
+  value_t *slots;
+  // The number of slots.
+  size_t capacity;
+  // The number of objects in the set.
+  size_t size;
+  // The memory the slots are stored in.
+  memory_block_t memory;
+} remembered_set_t;
+
+// Initializes an empty remembered set. This doesn't allocate any storage, that
+// only happens when objects are added.
+void remembered_set_init(remembered_set_t *set);
+
+// Adds the given object to this set if it's not already there. Returns false
+// if the set needed to grow and the memory for that couldn't be allocated.
+bool remembered_set_add(remembered_set_t *set, value_t object);
+
+// Returns true iff the given object is in this set.
+bool remembered_set_contains(remembered_set_t *set, value_t object);
+
+// Invokes the given callback for each object in this set.
+value_t remembered_set_for_each_object(remembered_set_t *set,
+    value_visitor_o *visitor);
+
+// Invokes the given callback for the header and each field of each object in
+// this set.
+value_t remembered_set_for_each_field(remembered_set_t *set,
+    field_visitor_o *visitor);
+
+// Releases the memory held by this set.
+void remembered_set_dispose(remembered_set_t *set);
+
+
+// Bookkeeping stored immediately before each object in the large object space.
+typedef struct large_object_t {
+  // The next object in the space.
+  struct large_object_t *next;
+  // The next marked object whose fields haven't been migrated yet.
+  struct large_object_t *next_grey;
+  // The memory that holds this header and the object.
+  memory_block_t memory;
+  // Has the object been found to be live by the current full collection?
+  bool is_marked;
+} large_object_t;
+
+// A space of objects that are too large to be worth copying. Each object is
+// allocated separately and never moves; instead a full collection marks the
+// ones that are reachable and frees the rest.
+typedef struct {
+  // The objects in this space.
+  large_object_t *first;
+  // The objects that have been marked but whose fields haven't been migrated.
+  large_object_t *grey;
+  // The total size of the objects in this space.
+  size_t used_bytes;
+  // How large the total size of the objects can grow before allocation fails.
+  size_t limit_bytes;
+} large_object_space_t;
+
+// Initializes an empty large object space that allows the given number of
+// bytes to be allocated.
+void large_object_space_init(large_object_space_t *space, size_t limit_bytes);
+
+// Frees all the objects in this space.
+void large_object_space_dispose(large_object_space_t *space);
+
+// Allocate an object of the given size in this space. Returns false if there
+// isn't room under the space's limit or the memory couldn't be allocated.
+bool large_object_space_try_alloc(large_object_space_t *space, size_t size,
+    address_t *memory_out);
+
+// Returns true if the given address is within an object in this space. This
+// traverses the whole space so it's only meant for validation.
+bool large_object_space_contains(large_object_space_t *space, address_t addr);
+
+// Invokes the given callback for each object in this space.
+value_t large_object_space_for_each_object(large_object_space_t *space,
+    value_visitor_o *visitor);
+
+// Marks the given object, which must be in this space, as live. Returns true
+// if it wasn't already marked in which case it is also added to the grey
+// objects.
+bool large_object_space_mark(large_object_space_t *space, value_t object);
+
+// Marks the given object like large_object_space_mark but without adding it
+// to the grey objects, the caller is responsible for migrating its fields.
+// Returns true if it wasn't already marked.
+bool large_object_space_mark_ungrey(large_object_space_t *space, value_t object);
+
+// Frees the objects that haven't been marked and clears the marks of those
+// that have.
+void large_object_space_sweep(large_object_space_t *space);
+
+
+// A full garbage-collectable heap. New objects are allocated in the nursery
+// and the ones that survive a collection of the nursery are promoted to old
+// space. Old objects are only moved by a full collection. Any old object that
+// may point into the nursery is in the remembered set, that's what allows the
+// nursery to be collected without looking at the rest of old space.
+struct heap_t {
   // The space configuration this heap gets it settings from.
   runtime_config_t config;
   // The space where we allocate new objects.
-  space_t to_space;
-  // The space that, during gc, holds existing object and from which values are
-  // copied into to-space.
+  space_t nursery;
+  // The space that holds objects that have survived a collection, as well as
+  // objects that are too large to be allocated in the nursery.
+  space_t old_space;
+  // The space that, during a full gc, holds the previous old space from which
+  // objects are copied into the new one.
   space_t from_space;
+  // The memory of the from-space of the last full gc, kept around such that it
+  // can be reused for the old space of the next one rather than allocating a
+  // new space every time.
+  space_t spare_space;
+  // The space that holds objects too large to be worth copying.
+  large_object_space_t large_object_space;
+  // The space that holds deep frozen objects that have been promoted out of
+  // the collected heap. Objects here are only moved if there is another
+  // promotion, otherwise they're never collected.
+  space_t immortal_space;
+  // True unless an object in the immortal space may point to an object outside
+  // it, in which case full collections have to treat the immortal objects as
+  // roots.
+  bool immortal_space_is_closed;
+  // The old objects that may hold pointers into the nursery.
+  remembered_set_t remembered_set;
+  // Set when the remembered set may be incomplete or old space has run out so
+  // the next collection has to be a full one.
+  bool needs_full_collection;
+  // When set, allocations that don't fit in the nursery go to old space
+  // instead of failing.
+  bool allow_nursery_overflow;
+  // The size of the largest allocation that failed because old space was full
+  // since the last full collection. The next full collection makes sure there
+  // is room for it.
+  size_t failed_old_allocation_bytes;
+  // The same as failed_old_allocation_bytes but for the large object space.
+  size_t failed_large_allocation_bytes;
   // A the object trackers are kept in a linked list cycle where this node is
   // always linked in.
   object_tracker_t root_object_tracker;
   // The number of object trackers allocated.
   size_t object_tracker_count;
-} heap_t;
+};
+
+// The size of the buffers the threads of a parallel collection claim from old
+// space and copy objects into.
+#define kGcCopyBufferSize (32 * kKB)
 
 // Initialize the given heap, returning a condition to indicate success or
 // failure. If the config is NULL the default is used.
@@ -161,10 +372,52 @@ bool heap_try_alloc(heap_t *heap, size_t size, address_t *memory_out);
 // Invokes the given callback for each object in the heap.
 value_t heap_for_each_object(heap_t *heap, value_visitor_o *visitor);
 
-// Invokes the given callback for each object field in the space. It is safe to
-// allocate new object while traversing the space, new objects will have their
-// fields visited in order of allocation.
-value_t heap_for_each_field(heap_t *heap, field_visitor_o *visitor);
+// Invokes the given callback for each object allocated in the heap's spaces,
+// that is, every object except those held by object trackers.
+value_t heap_for_each_space_object(heap_t *heap, value_visitor_o *visitor);
+
+// Invokes the given callback for the value field of each object tracker.
+value_t heap_for_each_tracker_field(heap_t *heap, field_visitor_o *visitor);
+
+// Invokes the given callback for each object field in old space, starting from
+// the object at the given address. It is safe to allocate new object while
+// traversing the space, new objects will have their fields visited in order of
+// allocation.
+value_t heap_for_each_old_field(heap_t *heap, address_t start,
+    field_visitor_o *visitor);
+
+// Invokes the given callback for each object field of the large objects that
+// have been marked since their fields were last visited. Objects marked while
+// traversing will also be visited.
+value_t heap_for_each_grey_large_field(heap_t *heap, field_visitor_o *visitor);
+
+// Invokes the given callback for each object field in the immortal space,
+// starting from the object at the given address. Like heap_for_each_old_field
+// objects allocated while traversing will also be visited.
+value_t heap_for_each_immortal_field(heap_t *heap, address_t start,
+    field_visitor_o *visitor);
+
+// Invokes the given callback for the header and each field of the given
+// object.
+value_t heap_object_for_each_field(value_t object, field_visitor_o *visitor);
+
+// Returns true iff the given heap object is in the nursery.
+bool heap_in_nursery(heap_t *heap, value_t object);
+
+// Returns true iff the given heap object is in the large object space. This
+// traverses the whole space so it's only meant for validation.
+bool heap_in_large_object_space(heap_t *heap, value_t object);
+
+// Returns true iff the given heap object is in the immortal space.
+bool heap_in_immortal_space(heap_t *heap, value_t object);
+
+// Adds the given old object to the remembered set. If that fails the next
+// collection will be a full one.
+void heap_remember_object(heap_t *heap, value_t object);
+
+// Returns true if the next collection has to be a full one rather than just a
+// collection of the nursery.
+bool heap_needs_full_collection(heap_t *heap);
 
 // Dispose of the given heap.
 void heap_dispose(heap_t *heap);
@@ -172,13 +425,42 @@ void heap_dispose(heap_t *heap);
 // Checks that the heap's data structures are consistent.
 value_t heap_validate(heap_t *heap);
 
-// Prepares this heap to be garbage collected by creating a new arena and swapping
-// it in as the new allocation space.
+// Checks that every old object that points into the nursery is in the
+// remembered set. This traverses all of old space.
+value_t heap_validate_remembered_set(heap_t *heap);
+
+// Checks that every reference stored in the heap points to an object in one of
+// the heap's spaces. This traverses the whole heap.
+value_t heap_validate_references(heap_t *heap);
+
+// Prepares this heap to be fully garbage collected by creating a new old space
+// and making the current one from-space. The new old space is made large
+// enough to hold everything that could possibly survive as well as room to
+// grow.
 value_t heap_prepare_garbage_collection(heap_t *heap);
 
-// Wraps up an in-progress garbage collection by discarding from-space.
+// Wraps up an in-progress full garbage collection by discarding from-space and
+// the nursery, and resizes old space based on how much data survived.
 value_t heap_complete_garbage_collection(heap_t *heap);
 
+// Prepares a full garbage collection, which must already have been prepared
+// with heap_prepare_garbage_collection, to also promote deep frozen objects.
+// The current immortal space is stored in the given out parameter and a new
+// one large enough to hold everything that could be promoted takes its place.
+value_t heap_prepare_promotion(heap_t *heap, space_t *immortal_from_out);
+
+// Wraps up a promotion, before the full collection is completed, by disposing
+// the previous immortal space and trimming the new one to what was promoted.
+void heap_complete_promotion(heap_t *heap, space_t *immortal_from);
+
+// Prepares this heap for collecting the nursery by moving the current
+// remembered set into the given one and starting a new empty one.
+void heap_prepare_nursery_collection(heap_t *heap, remembered_set_t *remembered_out);
+
+// Wraps up an in-progress collection of the nursery by discarding its
+// contents.
+void heap_complete_nursery_collection(heap_t *heap);
+
 // Creates a new object tracker that holds the specified value.
 object_tracker_t *heap_new_heap_object_tracker(heap_t *heap, value_t value);
 
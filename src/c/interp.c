@@ -10,22 +10,55 @@
 #include "try-inl.h"
 #include "value-inl.h"
 
+#include <time.h>
 
 // Cache of various data associated with the code currently being executed.
 typedef struct {
-  // The raw bytecode.
-  blob_t bytecode;
-  // The pool of constant values used by the bytecode.
-  value_t value_pool;
+  // The elements of the decoded bytecode. This points directly into the heap
+  // so it is only valid until the next garbage collection, which can't happen
+  // while the interpreter is running.
+  value_t *code;
+  // The inline caches for the call sites in the bytecode.
+  value_t inline_caches;
+  // The runtime's code block table, or NULL if native code is disabled.
+  code_block_table_t *code_blocks;
+  // The native code for the bytecode or NULL if there is none.
+  jit_code_t *native_code;
 } code_cache_t;
 
+// Initializes the code cache for executing code in the given runtime. The
+// cache must be refreshed before it's used.
+static void code_cache_init(code_cache_t *cache, runtime_t *runtime) {
+  cache->code = NULL;
+  cache->inline_caches = nothing();
+  code_block_table_t *table = runtime->code_block_table;
+  cache->code_blocks = table->use_native_code ? table : NULL;
+  cache->native_code = NULL;
+}
+
+// Returns the native code for the given code block, compiling it if it has
+// become hot enough. A code block running interpreted may be compiled while
+// it is still executing, in which case it continues in native code at the next
+// entry point.
+static jit_code_t *ensure_native_code(code_block_table_t *table,
+    value_t code_block) {
+  code_block_data_t *data = code_block_table_get(table, code_block);
+  if (!data->is_compiled
+      && data->invocation_count >= table->native_code_threshold) {
+    data->native_code = new_jit_code(get_code_block_decoded_bytecode(code_block));
+    data->is_compiled = true;
+  }
+  return data->native_code;
+}
+
 // Updates the code cache according to the given frame. This must be called each
 // time control moves from one frame to another.
 static void code_cache_refresh(code_cache_t *cache, frame_t *frame) {
   value_t code_block = frame_get_code_block(frame);
-  value_t bytecode = get_code_block_bytecode(code_block);
-  get_blob_data(bytecode, &cache->bytecode);
-  cache->value_pool = get_code_block_value_pool(code_block);
+  cache->code = get_array_elements(get_code_block_decoded_bytecode(code_block));
+  cache->inline_caches = get_code_block_inline_caches(code_block);
+  if (cache->code_blocks != NULL)
+    cache->native_code = ensure_native_code(cache->code_blocks, code_block);
 }
 
 // Records the current state of the given frame in the given escape state object
@@ -65,13 +98,14 @@ static void restore_escape_state(frame_t *frame, value_t stack,
 
 // Returns the short value at the given offset from the current pc.
 static short_t read_short(code_cache_t *cache, frame_t *frame, size_t offset) {
-  return blob_short_at(&cache->bytecode, frame->pc + offset);
+  value_t value = cache->code[frame->pc + offset];
+  CHECK_DOMAIN(vdInteger, value);
+  return (short_t) get_integer_value(value);
 }
 
 // Returns the value at the given offset from the current pc.
 static value_t read_value(code_cache_t *cache, frame_t *frame, size_t offset) {
-  size_t index = read_short(cache, frame, offset);
-  return get_array_at(cache->value_pool, index);
+  return cache->code[frame->pc + offset];
 }
 
 // Returns the code that implements the given method object.
@@ -98,6 +132,38 @@ static value_t ensure_method_code(runtime_t *runtime, value_t method) {
   return code;
 }
 
+// Records that the given code block is being invoked as a method. The count
+// is kept in the code block table rather than the code block itself since the
+// code block is frozen.
+static void count_code_block_invocation(runtime_t *runtime, value_t code_block) {
+  code_block_data_t *data = code_block_table_get(runtime->code_block_table,
+      code_block);
+  data->invocation_count++;
+}
+
+// If the given code block is a builtin with an inline implementation, tries
+// executing that directly on the pending arguments in the given frame. Returns
+// the result if that succeeded, otherwise nothing and then the code block must
+// be called the usual way.
+static value_t try_inline_builtin(value_t code_block, value_t arg_map,
+    frame_t *frame) {
+  value_t *code = get_array_elements(get_code_block_decoded_bytecode(code_block));
+  if (!is_same_value(code[0], new_integer(ocBuiltin)))
+    return nothing();
+  value_t wrapper = code[2];
+  if (!in_family(ofVoidP, wrapper))
+    return nothing();
+  inline_builtin_method_t impl = (inline_builtin_method_t) get_void_p_value(wrapper);
+  // The arguments are still on the stack so where a builtin would read its
+  // parameter i from its own frame we peek at the corresponding argument.
+  value_t self = frame_peek_value(frame,
+      get_integer_value(get_array_at(arg_map, 0)));
+  value_t that = nothing();
+  if (get_array_length(arg_map) > 2)
+    that = frame_peek_value(frame, get_integer_value(get_array_at(arg_map, 2)));
+  return impl(self, that);
+}
+
 static void log_lookup_error(value_t condition, value_t tags, frame_t *frame) {
   size_t arg_count = get_call_tags_entry_count(tags);
   string_buffer_t buf;
@@ -161,6 +227,69 @@ static bool maybe_fire_next_barrier(code_cache_t *cache, frame_t *frame,
   return false;
 }
 
+// Returns the current value of the clock used to time instructions for the
+// opcode profile.
+static uint64_t read_profile_clock() {
+#if defined(IS_GCC) && (defined(__x86_64__) || defined(__i386__))
+  return __builtin_ia32_rdtsc();
+#else
+  return (uint64_t) clock();
+#endif
+}
+
+// The state of opcode profiling within one run of the interpreter loop: which
+// instruction is executing, in which code block, and since when.
+typedef struct {
+  // The profile to record into or NULL if profiling is disabled.
+  opcode_profile_t *profile;
+  // The table that holds the per-code-block numbers.
+  code_block_table_t *code_blocks;
+  // The opcode of the current instruction or -1 if there is none yet.
+  int32_t opcode;
+  // The code block of the current instruction.
+  value_t code_block;
+  // When the current instruction started executing.
+  uint64_t start;
+} opcode_profiler_t;
+
+static void opcode_profiler_init(opcode_profiler_t *profiler,
+    runtime_t *runtime) {
+  profiler->profile = runtime->opcode_profile;
+  profiler->code_blocks = runtime->code_block_table;
+  profiler->opcode = -1;
+  profiler->code_block = nothing();
+  profiler->start = 0;
+}
+
+// Attributes the time from when the current instruction started until now to
+// the instruction and its code block.
+static void opcode_profiler_finish_current(opcode_profiler_t *profiler) {
+  if (profiler->opcode < 0)
+    return;
+  uint64_t elapsed = read_profile_clock() - profiler->start;
+  profiler->profile->cycles[profiler->opcode] += elapsed;
+  code_block_data_t *data = code_block_table_get(profiler->code_blocks,
+      profiler->code_block);
+  data->opcode_cycles += elapsed;
+}
+
+// Records that the given opcode is about to be executed within the given code
+// block.
+static void opcode_profiler_enter(opcode_profiler_t *profiler, opcode_t opcode,
+    value_t code_block) {
+  opcode_profiler_finish_current(profiler);
+  opcode_profile_t *profile = profiler->profile;
+  profile->counts[opcode]++;
+  if (profiler->opcode >= 0)
+    profile->pair_counts[profiler->opcode][opcode]++;
+  code_block_table_get(profiler->code_blocks, code_block)->opcode_count++;
+  profiler->opcode = opcode;
+  profiler->code_block = code_block;
+  // Start the clock last so the bookkeeping isn't counted against the
+  // instruction.
+  profiler->start = read_profile_clock();
+}
+
 // Counter that increments for each opcode executed when interpreter topic
 // logging is enabled. Can be helpful for debugging but is kind of a lame hack.
 static uint64_t opcode_counter = 0;
@@ -180,6 +309,53 @@ static uint64_t interrupt_counter = 0;
   }                                                                            \
 } while (false)
 
+// Reads the opcode at the current pc and does the bookkeeping that happens
+// before executing each instruction. If there is native code for the current
+// instruction that gets run first and then the opcode is read where it left
+// off, which is always an instruction the native code couldn't handle.
+#define FETCH_OPCODE() do {                                                    \
+  if (cache.native_code != NULL                                                \
+      && jit_code_has_entry(cache.native_code, frame.pc))                      \
+    jit_code_run(cache.native_code, &frame, cache.code);                       \
+  opcode = (opcode_t) read_short(&cache, &frame, 0);                           \
+  TOPIC_INFO(Interpreter, "Opcode: %s (%i)", get_opcode_name(opcode),          \
+      opcode_counter++);                                                       \
+  IF_EXPENSIVE_CHECKS_ENABLED(MAYBE_INTERRUPT());                              \
+  if (profiler.profile != NULL)                                                \
+    opcode_profiler_enter(&profiler, opcode, frame_get_code_block(&frame));    \
+} while (false)
+
+// The interpreter loop either dispatches through a switch or, where the
+// compiler supports labels as values, by jumping straight from the end of one
+// instruction to the implementation of the next (direct threading). Threading
+// gives each instruction its own indirect jump which the branch predictor can
+// track separately instead of having every instruction share the one jump at
+// the top of the switch. Define DISABLE_THREADED_DISPATCH to force the switch.
+#if defined(IS_GCC) && !defined(DISABLE_THREADED_DISPATCH)
+#define USE_THREADED_DISPATCH 1
+#endif
+
+#ifdef USE_THREADED_DISPATCH
+
+// Marks the start of the implementation of the given opcode.
+#define OPCODE(Name) op_##Name: case oc##Name
+
+// Ends the current instruction and continues with the next one.
+#define DISPATCH() do {                                                        \
+  FETCH_OPCODE();                                                              \
+  CHECK_REL("invalid opcode", (size_t) opcode, <,                              \
+      sizeof(kDispatchTable) / sizeof(*kDispatchTable));                       \
+  goto *kDispatchTable[opcode];                                                \
+} while (false)
+
+#else // !USE_THREADED_DISPATCH
+
+#define OPCODE(Name) case oc##Name
+
+#define DISPATCH() break
+
+#endif // USE_THREADED_DISPATCH
+
 
 // Runs the given stack within the given ambience until a condition is
 // encountered or evaluation completes. This function also bails on and leaves
@@ -190,35 +366,64 @@ static value_t run_stack_pushing_signals(value_t ambience, value_t stack) {
   runtime_t *runtime = get_ambience_runtime(ambience);
   frame_t frame = open_stack(stack);
   code_cache_t cache;
+  code_cache_init(&cache, runtime);
   code_cache_refresh(&cache, &frame);
+  opcode_profiler_t profiler;
+  opcode_profiler_init(&profiler, runtime);
+  // Let the allocation profiler see which code is allocating. This may be a
+  // nested run so the outer frame is restored on the way out.
+  alloc_profile_t *alloc_profile = runtime->alloc_profile;
+  frame_t *outer_alloc_profile_frame = NULL;
+  if (alloc_profile != NULL) {
+    outer_alloc_profile_frame = alloc_profile->frame;
+    alloc_profile->frame = &frame;
+  }
+#ifdef USE_THREADED_DISPATCH
+  static void *const kDispatchTable[] = {
+#define __EMIT_DISPATCH_TARGET__(Name, ARGC, VALUES) __extension__ &&op_##Name,
+    ENUM_OPCODES(__EMIT_DISPATCH_TARGET__)
+#undef __EMIT_DISPATCH_TARGET__
+  };
+#endif
   E_BEGIN_TRY_FINALLY();
+    opcode_t opcode;
     while (true) {
-      opcode_t opcode = (opcode_t) read_short(&cache, &frame, 0);
-      TOPIC_INFO(Interpreter, "Opcode: %s (%i)", get_opcode_name(opcode),
-          opcode_counter++);
-      IF_EXPENSIVE_CHECKS_ENABLED(MAYBE_INTERRUPT());
+      FETCH_OPCODE();
       switch (opcode) {
-        case ocPush: {
+        OPCODE(Push): {
           value_t value = read_value(&cache, &frame, 1);
           frame_push_value(&frame, value);
           frame.pc += kPushOperationSize;
-          break;
+          DISPATCH();
         }
-        case ocPop: {
+        OPCODE(PushPush): {
+          frame_push_value(&frame, read_value(&cache, &frame, 1));
+          frame_push_value(&frame, read_value(&cache, &frame, 2));
+          frame.pc += kPushPushOperationSize;
+          DISPATCH();
+        }
+        OPCODE(PushLoadArgument): {
+          frame_push_value(&frame, read_value(&cache, &frame, 1));
+          size_t param_index = read_short(&cache, &frame, 2);
+          frame_push_value(&frame, frame_get_argument(&frame, param_index));
+          frame.pc += kPushLoadArgumentOperationSize;
+          DISPATCH();
+        }
+        OPCODE(Pop): {
           size_t count = read_short(&cache, &frame, 1);
           for (size_t i = 0; i < count; i++)
             frame_pop_value(&frame);
           frame.pc += kPopOperationSize;
-          break;
+          DISPATCH();
         }
-        case ocCheckStackHeight: {
+        OPCODE(CheckStackHeight): {
           size_t expected = read_short(&cache, &frame, 1);
           size_t height = frame.stack_pointer - frame.frame_pointer;
           CHECK_EQ("stack height", expected, height);
           frame.pc += kCheckStackHeightOperationSize;
-          break;
+          DISPATCH();
         }
-        case ocNewArray: {
+        OPCODE(NewArray): {
           size_t length = read_short(&cache, &frame, 1);
           E_TRY_DEF(array, new_heap_array(runtime, length));
           for (size_t i = 0; i < length; i++) {
@@ -227,39 +432,64 @@ static value_t run_stack_pushing_signals(value_t ambience, value_t stack) {
           }
           frame_push_value(&frame, array);
           frame.pc += kNewArrayOperationSize;
-          break;
+          DISPATCH();
         }
-        case ocInvoke: {
-          // Look up the method in the method space.
+        OPCODE(Invoke): {
           value_t tags = read_value(&cache, &frame, 1);
           CHECK_FAMILY(ofCallTags, tags);
-          value_t fragment = read_value(&cache, &frame, 2);
-          CHECK_FAMILY(ofModuleFragment, fragment);
-          value_t helper = read_value(&cache, &frame, 3);
-          CHECK_FAMILY(ofSignatureMap, helper);
-          value_t arg_map;
-          value_t method = lookup_method_full(ambience, fragment, tags, &frame,
-              helper, &arg_map);
-          if (in_condition_cause(ccLookupError, method)) {
-            log_lookup_error(method, tags, &frame);
-            E_RETURN(method);
+          size_t site = read_short(&cache, &frame, 4);
+          // First check whether this site has seen a similar invocation before.
+          value_t arg_map = whatever();
+          value_t code_block = whatever();
+          value_t method = probe_inline_cache(ambience, cache.inline_caches,
+              site, tags, &frame, &code_block, &arg_map);
+          if (in_condition_cause(ccNotFound, method)) {
+            // It hasn't so look up the method in the method space.
+            value_t fragment = read_value(&cache, &frame, 2);
+            CHECK_FAMILY(ofModuleFragment, fragment);
+            value_t helper = read_value(&cache, &frame, 3);
+            CHECK_FAMILY(ofSignatureMap, helper);
+            lookup_footprint_t footprint;
+            method = lookup_method_full(ambience, fragment, tags, &frame,
+                helper, &arg_map, &footprint);
+            if (in_condition_cause(ccLookupError, method)) {
+              log_lookup_error(method, tags, &frame);
+              E_RETURN(method);
+            }
+            // The lookup may have failed with a different condition. Check for
+            // that.
+            E_TRY(method);
+            E_TRY_SET(code_block, ensure_method_code(runtime, method));
+            E_TRY(update_inline_cache(ambience, cache.inline_caches, site, tags,
+                &frame, &footprint, method, code_block, arg_map));
+          }
+          // Simple builtins get executed right here so there's no need to
+          // push a frame at all. The result ends up where the callee would
+          // have returned it.
+          value_t inline_result = try_inline_builtin(code_block, arg_map,
+              &frame);
+          if (!is_nothing(inline_result)) {
+            count_code_block_invocation(runtime, code_block);
+            frame_push_value(&frame, inline_result);
+            frame.pc += kInvokeOperationSize;
+            DISPATCH();
           }
-          // The lookup may have failed with a different condition. Check for that.
-          E_TRY(method);
-          E_TRY_DEF(code_block, ensure_method_code(runtime, method));
-          // We should now have done everything that can fail so we advance the
-          // pc over this instruction. In reality we haven't, the frame push op
-          // below can fail so we should really push the next frame before
-          // storing the pc for this one. Laters.
+          // The frame push stores the pc so we have to advance it over this
+          // instruction first. If the push fails nothing else has been changed
+          // so we step back to make the instruction restartable.
           frame.pc += kInvokeOperationSize;
-          // Push a new activation.
-          E_TRY(push_stack_frame(runtime, stack, &frame,
-              get_code_block_high_water_mark(code_block), arg_map));
+          value_t pushed = push_stack_frame(runtime, stack, &frame,
+              get_code_block_high_water_mark(code_block), arg_map);
+          if (in_domain(vdCondition, pushed)) {
+            frame.pc -= kInvokeOperationSize;
+            E_RETURN(pushed);
+          }
+          count_code_block_invocation(runtime, code_block);
           frame_set_code_block(&frame, code_block);
           code_cache_refresh(&cache, &frame);
-          break;
+          DISPATCH();
         }
-        case ocSignalContinue: case ocSignalEscape: {
+        OPCODE(SignalContinue): OPCODE(SignalEscape): {
           // Look up the method in the method space.
           value_t tags = read_value(&cache, &frame, 1);
           CHECK_FAMILY(ofCallTags, tags);
@@ -292,20 +522,21 @@ static value_t run_stack_pushing_signals(value_t ambience, value_t stack) {
             E_TRY_DEF(code_block, ensure_method_code(runtime, method));
             E_TRY(push_stack_frame(runtime, stack, &frame,
                 get_code_block_high_water_mark(code_block), arg_map));
+            count_code_block_invocation(runtime, code_block);
             frame_set_code_block(&frame, code_block);
             CHECK_TRUE("subject not null", is_null(frame_get_argument(&frame, 0)));
             frame_set_argument(&frame, 0, handler);
             code_cache_refresh(&cache, &frame);
           }
-          break;
+          DISPATCH();
         }
-        case ocGoto: {
+        OPCODE(Goto): {
           size_t delta = read_short(&cache, &frame, 1);
           frame.pc += delta;
-          break;
+          DISPATCH();
         }
-        case ocDelegateToLambda:
-        case ocDelegateToBlock: {
+        OPCODE(DelegateToLambda):
+        OPCODE(DelegateToBlock): {
           // This op only appears in the lambda and block delegator methods.
           // They should never be executed because the delegation happens during
           // method lookup. If we hit here something's likely wrong with the
@@ -313,7 +544,7 @@ static value_t run_stack_pushing_signals(value_t ambience, value_t stack) {
           UNREACHABLE("delegate to lambda");
           return new_condition(ccWat);
         }
-        case ocBuiltin: {
+        OPCODE(Builtin): {
           value_t wrapper = read_value(&cache, &frame, 1);
           builtin_method_t impl = (builtin_method_t) get_void_p_value(wrapper);
           builtin_arguments_t args;
@@ -321,9 +552,9 @@ static value_t run_stack_pushing_signals(value_t ambience, value_t stack) {
           E_TRY_DEF(result, impl(&args));
           frame_push_value(&frame, result);
           frame.pc += kBuiltinOperationSize;
-          break;
+          DISPATCH();
         }
-        case ocBuiltinMaybeEscape: {
+        OPCODE(BuiltinMaybeEscape): {
           value_t wrapper = read_value(&cache, &frame, 1);
           builtin_method_t impl = (builtin_method_t) get_void_p_value(wrapper);
           builtin_arguments_t args;
@@ -362,6 +593,7 @@ static value_t run_stack_pushing_signals(value_t ambience, value_t stack) {
             E_TRY_DEF(code_block, ensure_method_code(runtime, method));
             E_TRY(push_stack_frame(runtime, stack, &frame,
                 get_code_block_high_water_mark(code_block), arg_map));
+            count_code_block_invocation(runtime, code_block);
             frame_set_code_block(&frame, code_block);
             CHECK_TRUE("subject not null", is_null(frame_get_argument(&frame, 0)));
             frame_set_argument(&frame, 0, handler);
@@ -372,21 +604,21 @@ static value_t run_stack_pushing_signals(value_t ambience, value_t stack) {
             frame_push_value(&frame, result);
             frame.pc += kBuiltinMaybeEscapeOperationSize;
           }
-          break;
+          DISPATCH();
         }
-        case ocReturn: {
+        OPCODE(Return): {
           value_t result = frame_pop_value(&frame);
           frame_pop_within_stack_piece(&frame);
           code_cache_refresh(&cache, &frame);
           frame_push_value(&frame, result);
-          break;
+          DISPATCH();
         }
-        case ocStackBottom: {
+        OPCODE(StackBottom): {
           value_t result = frame_pop_value(&frame);
           validate_stack_on_normal_exit(&frame);
           E_RETURN(result);
         }
-        case ocStackPieceBottom: {
+        OPCODE(StackPieceBottom): {
           value_t top_piece = frame.stack_piece;
           value_t result = frame_pop_value(&frame);
           value_t next_piece = get_stack_piece_previous(top_piece);
@@ -394,18 +626,18 @@ static value_t run_stack_pushing_signals(value_t ambience, value_t stack) {
           frame = open_stack(stack);
           code_cache_refresh(&cache, &frame);
           frame_push_value(&frame, result);
-          break;
+          DISPATCH();
         }
-        case ocSlap: {
+        OPCODE(Slap): {
           value_t value = frame_pop_value(&frame);
           size_t argc = read_short(&cache, &frame, 1);
           for (size_t i = 0; i < argc; i++)
             frame_pop_value(&frame);
           frame_push_value(&frame, value);
           frame.pc += kSlapOperationSize;
-          break;
+          DISPATCH();
         }
-        case ocNewReference: {
+        OPCODE(NewReference): {
           // Create the reference first so that if it fails we haven't clobbered
           // the stack yet.
           E_TRY_DEF(ref, new_heap_reference(runtime, nothing()));
@@ -413,32 +645,32 @@ static value_t run_stack_pushing_signals(value_t ambience, value_t stack) {
           set_reference_value(ref, value);
           frame_push_value(&frame, ref);
           frame.pc += kNewReferenceOperationSize;
-          break;
+          DISPATCH();
         }
-        case ocSetReference: {
+        OPCODE(SetReference): {
           value_t ref = frame_pop_value(&frame);
           CHECK_FAMILY(ofReference, ref);
           value_t value = frame_peek_value(&frame, 0);
           set_reference_value(ref, value);
           frame.pc += kSetReferenceOperationSize;
-          break;
+          DISPATCH();
         }
-        case ocGetReference: {
+        OPCODE(GetReference): {
           value_t ref = frame_pop_value(&frame);
           CHECK_FAMILY(ofReference, ref);
           value_t value = get_reference_value(ref);
           frame_push_value(&frame, value);
           frame.pc += kGetReferenceOperationSize;
-          break;
+          DISPATCH();
         }
-        case ocLoadLocal: {
+        OPCODE(LoadLocal): {
           size_t index = read_short(&cache, &frame, 1);
           value_t value = frame_get_local(&frame, index);
           frame_push_value(&frame, value);
           frame.pc += kLoadLocalOperationSize;
-          break;
+          DISPATCH();
         }
-        case ocLoadGlobal: {
+        OPCODE(LoadGlobal): {
           value_t ident = read_value(&cache, &frame, 1);
           CHECK_FAMILY(ofIdentifier, ident);
           value_t fragment = read_value(&cache, &frame, 2);
@@ -446,18 +678,40 @@ static value_t run_stack_pushing_signals(value_t ambience, value_t stack) {
           value_t module = get_module_fragment_module(fragment);
           E_TRY_DEF(value, module_lookup_identifier(runtime, module,
               get_identifier_stage(ident), get_identifier_path(ident)));
+          if (is_module_fragment_bound(fragment)) {
+            // Once the fragment is bound, and so all the ones it can see, its
+            // bindings can't change so we can replace this instruction with
+            // one that loads the value directly.
+            value_t decoded = get_code_block_decoded_bytecode(
+                frame_get_code_block(&frame));
+            set_array_at(decoded, frame.pc, new_integer(ocLoadCachedGlobal));
+            set_array_at(decoded, frame.pc + 1, value);
+          }
           frame_push_value(&frame, value);
           frame.pc += kLoadGlobalOperationSize;
-          break;
+          DISPATCH();
         }
-        case ocLoadArgument: {
+        OPCODE(LoadCachedGlobal): {
+          value_t value = read_value(&cache, &frame, 1);
+          frame_push_value(&frame, value);
+          frame.pc += kLoadCachedGlobalOperationSize;
+          DISPATCH();
+        }
+        OPCODE(LoadArgument): {
           size_t param_index = read_short(&cache, &frame, 1);
           value_t value = frame_get_argument(&frame, param_index);
           frame_push_value(&frame, value);
           frame.pc += kLoadArgumentOperationSize;
-          break;
+          DISPATCH();
+        }
+        OPCODE(LoadArgumentPush): {
+          size_t param_index = read_short(&cache, &frame, 1);
+          frame_push_value(&frame, frame_get_argument(&frame, param_index));
+          frame_push_value(&frame, read_value(&cache, &frame, 2));
+          frame.pc += kLoadArgumentPushOperationSize;
+          DISPATCH();
         }
-        case ocLoadRefractedArgument: {
+        OPCODE(LoadRefractedArgument): {
           size_t param_index = read_short(&cache, &frame, 1);
           size_t block_depth = read_short(&cache, &frame, 2);
           value_t subject = frame_get_argument(&frame, 0);
@@ -466,9 +720,9 @@ static value_t run_stack_pushing_signals(value_t ambience, value_t stack) {
           value_t value = frame_get_argument(&home, param_index);
           frame_push_value(&frame, value);
           frame.pc += kLoadRefractedArgumentOperationSize;
-          break;
+          DISPATCH();
         }
-        case ocLoadRefractedLocal: {
+        OPCODE(LoadRefractedLocal): {
           size_t index = read_short(&cache, &frame, 1);
           size_t block_depth = read_short(&cache, &frame, 2);
           value_t subject = frame_get_argument(&frame, 0);
@@ -477,18 +731,18 @@ static value_t run_stack_pushing_signals(value_t ambience, value_t stack) {
           value_t value = frame_get_local(&home, index);
           frame_push_value(&frame, value);
           frame.pc += kLoadRefractedLocalOperationSize;
-          break;
+          DISPATCH();
         }
-        case ocLoadLambdaCapture: {
+        OPCODE(LoadLambdaCapture): {
           size_t index = read_short(&cache, &frame, 1);
           value_t subject = frame_get_argument(&frame, 0);
           CHECK_FAMILY(ofLambda, subject);
           value_t value = get_lambda_capture(subject, index);
           frame_push_value(&frame, value);
           frame.pc += kLoadLambdaCaptureOperationSize;
-          break;
+          DISPATCH();
         }
-        case ocLoadRefractedCapture: {
+        OPCODE(LoadRefractedCapture): {
           size_t index = read_short(&cache, &frame, 1);
           size_t block_depth = read_short(&cache, &frame, 2);
           value_t subject = frame_get_argument(&frame, 0);
@@ -499,9 +753,9 @@ static value_t run_stack_pushing_signals(value_t ambience, value_t stack) {
           value_t value = get_lambda_capture(lambda, index);
           frame_push_value(&frame, value);
           frame.pc += kLoadRefractedLocalOperationSize;
-          break;
+          DISPATCH();
         }
-        case ocLambda: {
+        OPCODE(Lambda): {
           value_t space = read_value(&cache, &frame, 1);
           CHECK_FAMILY(ofMethodspace, space);
           size_t capture_count = read_short(&cache, &frame, 2);
@@ -522,9 +776,9 @@ static value_t run_stack_pushing_signals(value_t ambience, value_t stack) {
           }
           set_lambda_captures(lambda, captures);
           frame_push_value(&frame, lambda);
-          break;
+          DISPATCH();
         }
-        case ocCreateBlock: {
+        OPCODE(CreateBlock): {
           value_t space = read_value(&cache, &frame, 1);
           CHECK_FAMILY(ofMethodspace, space);
           // Create the block object.
@@ -540,9 +794,9 @@ static value_t run_stack_pushing_signals(value_t ambience, value_t stack) {
           // Push the block object.
           frame_push_value(&frame, block);
           frame.pc += kCreateBlockOperationSize;
-          break;
+          DISPATCH();
         }
-        case ocCreateEnsurer: {
+        OPCODE(CreateEnsurer): {
           value_t code_block = read_value(&cache, &frame, 1);
           value_t section = frame_alloc_derived_object(&frame,
               get_genus_descriptor(dgEnsureSection));
@@ -551,9 +805,9 @@ static value_t run_stack_pushing_signals(value_t ambience, value_t stack) {
           value_validate(section);
           frame_push_value(&frame, section);
           frame.pc += kCreateEnsurerOperationSize;
-          break;
+          DISPATCH();
         }
-        case ocCallEnsurer: {
+        OPCODE(CallEnsurer): {
           value_t value = frame_pop_value(&frame);
           value_t shard = frame_pop_value(&frame);
           frame_push_value(&frame, value);
@@ -570,9 +824,9 @@ static value_t run_stack_pushing_signals(value_t ambience, value_t stack) {
               get_code_block_high_water_mark(code_block), argmap);
           frame_set_code_block(&frame, code_block);
           code_cache_refresh(&cache, &frame);
-          break;
+          DISPATCH();
         }
-        case ocDisposeEnsurer: {
+        OPCODE(DisposeEnsurer): {
           // Discard the result of the ensure block. If an ensure blocks needs
           // to return a useful value it can do it via an escape.
           frame_pop_value(&frame);
@@ -582,9 +836,9 @@ static value_t run_stack_pushing_signals(value_t ambience, value_t stack) {
           frame_destroy_derived_object(&frame, get_genus_descriptor(dgEnsureSection));
           frame_push_value(&frame, value);
           frame.pc += kDisposeEnsurerOperationSize;
-          break;
+          DISPATCH();
         }
-        case ocInstallSignalHandler: {
+        OPCODE(InstallSignalHandler): {
           value_t space = read_value(&cache, &frame, 1);
           CHECK_FAMILY(ofMethodspace, space);
           size_t dest_offset = read_short(&cache, &frame, 2);
@@ -602,9 +856,9 @@ static value_t run_stack_pushing_signals(value_t ambience, value_t stack) {
           // Finally capture the escape state.
           capture_escape_state(section, &frame, dest_offset);
           value_validate(section);
-          break;
+          DISPATCH();
         }
-        case ocUninstallSignalHandler: {
+        OPCODE(UninstallSignalHandler): {
           // The result has been left at the top of the stack.
           value_t value = frame_pop_value(&frame);
           value_t section = frame_pop_value(&frame);
@@ -613,9 +867,9 @@ static value_t run_stack_pushing_signals(value_t ambience, value_t stack) {
           frame_destroy_derived_object(&frame, get_genus_descriptor(dgSignalHandlerSection));
           frame_push_value(&frame, value);
           frame.pc += kUninstallSignalHandlerOperationSize;
-          break;
+          DISPATCH();
         }
-        case ocCreateEscape: {
+        OPCODE(CreateEscape): {
           size_t dest_offset = read_short(&cache, &frame, 1);
           // Create an initially empty escape object.
           E_TRY_DEF(escape, new_heap_escape(runtime, nothing()));
@@ -632,9 +886,9 @@ static value_t run_stack_pushing_signals(value_t ambience, value_t stack) {
           // destination offset) so this is what we want to capture.
           capture_escape_state(section, &frame,
               dest_offset);
-          break;
+          DISPATCH();
         }
-        case ocLeaveOrFireBarrier: {
+        OPCODE(LeaveOrFireBarrier): {
           size_t argc = read_short(&cache, &frame, 1);
           // At this point the handler has been set as the subject of the call
           // to the handler method. Above the arguments are also two scratch
@@ -656,9 +910,9 @@ static value_t run_stack_pushing_signals(value_t ambience, value_t stack) {
             // If a barrier was fired we'll want to let the interpreter loop
             // around again so just break without touching .pc.
           }
-          break;
+          DISPATCH();
         }
-        case ocFireEscapeOrBarrier: {
+        OPCODE(FireEscapeOrBarrier): {
           value_t escape = frame_get_argument(&frame, 0);
           CHECK_FAMILY(ofEscape, escape);
           value_t section = get_escape_section(escape);
@@ -673,9 +927,9 @@ static value_t run_stack_pushing_signals(value_t ambience, value_t stack) {
             // If a barrier was fired we'll want to let the interpreter loop
             // around again so just break without touching .pc.
           }
-          break;
+          DISPATCH();
         }
-        case ocDisposeEscape: {
+        OPCODE(DisposeEscape): {
           value_t value = frame_pop_value(&frame);
           value_t escape = frame_pop_value(&frame);
           CHECK_FAMILY(ofEscape, escape);
@@ -686,9 +940,9 @@ static value_t run_stack_pushing_signals(value_t ambience, value_t stack) {
           frame_destroy_derived_object(&frame, get_genus_descriptor(dgEscapeSection));
           frame_push_value(&frame, value);
           frame.pc += kDisposeEscapeOperationSize;
-          break;
+          DISPATCH();
         }
-        case ocDisposeBlock: {
+        OPCODE(DisposeBlock): {
           value_t value = frame_pop_value(&frame);
           value_t block = frame_pop_value(&frame);
           CHECK_FAMILY(ofBlock, block);
@@ -698,7 +952,7 @@ static value_t run_stack_pushing_signals(value_t ambience, value_t stack) {
           frame_destroy_derived_object(&frame, get_genus_descriptor(dgBlockSection));
           frame_push_value(&frame, value);
           frame.pc += kDisposeBlockOperationSize;
-          break;
+          DISPATCH();
         }
         default:
           ERROR("Unexpected opcode %i", opcode);
@@ -707,6 +961,10 @@ static value_t run_stack_pushing_signals(value_t ambience, value_t stack) {
       }
     }
   E_FINALLY();
+    if (profiler.profile != NULL)
+      opcode_profiler_finish_current(&profiler);
+    if (alloc_profile != NULL)
+      alloc_profile->frame = outer_alloc_profile_frame;
     close_frame(&frame);
   E_END_TRY_FINALLY();
 }
@@ -733,7 +991,7 @@ static value_t run_stack_until_signal(safe_value_t s_ambience, safe_value_t s_st
     value_t result = run_stack_until_condition(ambience, stack);
     if (in_condition_cause(ccHeapExhausted, result)) {
       runtime_t *runtime = get_ambience_runtime(ambience);
-      runtime_garbage_collect(runtime);
+      runtime_garbage_collect_nursery(runtime);
       goto loop;
     } else if (in_condition_cause(ccForceValidate, result)) {
       runtime_t *runtime = get_ambience_runtime(ambience);
@@ -744,9 +1002,61 @@ static value_t run_stack_until_signal(safe_value_t s_ambience, safe_value_t s_st
   } while (false);
 }
 
+// The size of each operation, indexed by opcode.
+static const size_t kOperationSizes[] = {
+#define __EMIT_OPERATION_SIZE__(Name, ARGC, VALUES) ARGC,
+  ENUM_OPCODES(__EMIT_OPERATION_SIZE__)
+#undef __EMIT_OPERATION_SIZE__
+};
+
+// The value operand mask of each operation, indexed by opcode.
+static const uint32_t kOperationValueMasks[] = {
+#define __EMIT_VALUE_MASK__(Name, ARGC, VALUES) VALUES,
+  ENUM_OPCODES(__EMIT_VALUE_MASK__)
+#undef __EMIT_VALUE_MASK__
+};
+
+value_t decode_bytecode(runtime_t *runtime, value_t bytecode,
+    value_t value_pool) {
+  CHECK_FAMILY(ofBlob, bytecode);
+  CHECK_FAMILY(ofArray, value_pool);
+  blob_t data;
+  get_blob_data(bytecode, &data);
+  size_t length = blob_short_length(&data);
+  if (length == 0)
+    return ROOT(runtime, empty_array);
+  TRY_DEF(result, new_heap_array(runtime, length));
+  bool has_load_global = false;
+  size_t pc = 0;
+  while (pc < length) {
+    opcode_t opcode = (opcode_t) blob_short_at(&data, pc);
+    if (opcode == ocLoadGlobal)
+      has_load_global = true;
+    CHECK_REL("invalid opcode", (size_t) opcode, <,
+        sizeof(kOperationSizes) / sizeof(*kOperationSizes));
+    size_t size = kOperationSizes[opcode];
+    uint32_t value_mask = kOperationValueMasks[opcode];
+    set_array_at(result, pc, new_integer(opcode));
+    for (size_t i = 1; i < size; i++) {
+      short_t operand = blob_short_at(&data, pc + i);
+      value_t decoded = ((value_mask >> i) & 1)
+          ? get_array_at(value_pool, operand)
+          : new_integer(operand);
+      set_array_at(result, pc + i, decoded);
+    }
+    pc += size;
+  }
+  CHECK_EQ("bytecode ends mid-instruction", length, pc);
+  if (!has_load_global)
+    // There's nothing the interpreter will want to rewrite so the result can
+    // be frozen.
+    TRY(ensure_frozen(runtime, result));
+  return result;
+}
+
 const char *get_opcode_name(opcode_t opcode) {
   switch (opcode) {
-#define __EMIT_CASE__(Name, ARGC)                                              \
+#define __EMIT_CASE__(Name, ARGC, VALUES)                                      \
     case oc##Name:                                                             \
       return #Name;
   ENUM_OPCODES(__EMIT_CASE__)
@@ -756,6 +1066,220 @@ const char *get_opcode_name(opcode_t opcode) {
   }
 }
 
+// The number of entries a code block table starts out with room for.
+static const size_t kInitialCodeBlockTableCapacity = 256;
+
+value_t code_block_table_init(code_block_table_t *table, bool use_native_code,
+    size_t native_code_threshold) {
+  table->entries = NULL;
+  table->length = 0;
+  table->capacity = 0;
+  table->use_native_code = use_native_code;
+  table->native_code_threshold = native_code_threshold;
+  memory_block_t memory = allocator_default_malloc(
+      kInitialCodeBlockTableCapacity * sizeof(code_block_data_t));
+  if (memory_block_is_empty(memory))
+    return new_system_error_condition(seAllocationFailed);
+  table->entries = (code_block_data_t*) memory.memory;
+  table->capacity = kInitialCodeBlockTableCapacity;
+  return success();
+}
+
+void code_block_table_dispose(code_block_table_t *table) {
+  if (table->entries == NULL)
+    return;
+  for (size_t i = 0; i < table->length; i++)
+    delete_jit_code(table->entries[i].native_code);
+  allocator_default_free(new_memory_block(table->entries,
+      table->capacity * sizeof(code_block_data_t)));
+  table->entries = NULL;
+}
+
+value_t code_block_table_add(code_block_table_t *table, size_t *serial_out) {
+  if (table->length == table->capacity) {
+    size_t new_capacity = table->capacity * 2;
+    memory_block_t memory = allocator_default_malloc(
+        new_capacity * sizeof(code_block_data_t));
+    if (memory_block_is_empty(memory))
+      return new_system_error_condition(seAllocationFailed);
+    memcpy(memory.memory, table->entries,
+        table->length * sizeof(code_block_data_t));
+    allocator_default_free(new_memory_block(table->entries,
+        table->capacity * sizeof(code_block_data_t)));
+    table->entries = (code_block_data_t*) memory.memory;
+    table->capacity = new_capacity;
+  }
+  code_block_data_t *data = &table->entries[table->length];
+  data->invocation_count = 0;
+  data->opcode_count = 0;
+  data->opcode_cycles = 0;
+  data->native_code = NULL;
+  data->is_compiled = false;
+  *serial_out = table->length++;
+  return success();
+}
+
+code_block_data_t *code_block_table_get(code_block_table_t *table,
+    value_t code_block) {
+  size_t serial = get_code_block_serial(code_block);
+  CHECK_REL("code block not in table", serial, <, table->length);
+  return &table->entries[serial];
+}
+
+void opcode_profile_init(opcode_profile_t *profile) {
+  memset(profile, 0, sizeof(opcode_profile_t));
+}
+
+// How many opcode pairs and methods to include in the profile report.
+#define kProfileReportTopCount 20
+
+// An entry in one of the tables of the profile report.
+typedef struct {
+  // What the entry is about, an opcode or a pair of opcodes.
+  size_t index;
+  // How many times it happened.
+  uint64_t count;
+  // The time it took.
+  uint64_t cycles;
+} profile_entry_t;
+
+// Orders profile entries by decreasing time, then decreasing count.
+static int compare_profile_entries(const void *a, const void *b) {
+  const profile_entry_t *entry_a = (const profile_entry_t*) a;
+  const profile_entry_t *entry_b = (const profile_entry_t*) b;
+  if (entry_a->cycles != entry_b->cycles)
+    return (entry_a->cycles < entry_b->cycles) ? 1 : -1;
+  if (entry_a->count != entry_b->count)
+    return (entry_a->count < entry_b->count) ? 1 : -1;
+  return 0;
+}
+
+// Returns how large a percentage the part is of the total.
+static double get_percentage(uint64_t part, uint64_t total) {
+  return (total == 0) ? 0.0 : (100.0 * part) / total;
+}
+
+// Visitor that keeps track of the methods that have spent the most time in the
+// interpreter, sorted by decreasing time.
+typedef struct {
+  value_visitor_o super;
+  code_block_table_t *code_blocks;
+  value_t methods[kProfileReportTopCount];
+  profile_entry_t entries[kProfileReportTopCount];
+  size_t count;
+} hot_code_collector_o;
+
+static value_t hot_code_collector_visit(hot_code_collector_o *self,
+    value_t value) {
+  if (!in_family(ofMethod, value))
+    return success();
+  value_t code_block = get_method_code(value);
+  if (is_nothing(code_block))
+    return success();
+  code_block_data_t *data = code_block_table_get(self->code_blocks, code_block);
+  if (data->opcode_count == 0)
+    return success();
+  profile_entry_t entry = {0, data->opcode_count, data->opcode_cycles};
+  // Insert the method into the sorted table, dropping the last entry if the
+  // table is full.
+  size_t i = self->count;
+  while (i > 0 && compare_profile_entries(&entry, &self->entries[i - 1]) < 0) {
+    if (i < kProfileReportTopCount) {
+      self->entries[i] = self->entries[i - 1];
+      self->methods[i] = self->methods[i - 1];
+    }
+    i--;
+  }
+  if (i < kProfileReportTopCount) {
+    self->entries[i] = entry;
+    self->methods[i] = value;
+    if (self->count < kProfileReportTopCount)
+      self->count++;
+  }
+  return success();
+}
+
+value_t opcode_profile_print_report(runtime_t *runtime) {
+  opcode_profile_t *profile = runtime->opcode_profile;
+  CHECK_FALSE("no opcode profile", profile == NULL);
+  char row[256];
+  // Opcodes.
+  profile_entry_t opcodes[kOpcodeCount];
+  uint64_t total_count = 0;
+  uint64_t total_cycles = 0;
+  for (size_t i = 0; i < kOpcodeCount; i++) {
+    profile_entry_t entry = {i, profile->counts[i], profile->cycles[i]};
+    opcodes[i] = entry;
+    total_count += entry.count;
+    total_cycles += entry.cycles;
+  }
+  qsort(opcodes, kOpcodeCount, sizeof(profile_entry_t), compare_profile_entries);
+  print_ln("--- Opcode profile: %lli instructions, %lli cycles ---",
+      (long long) total_count, (long long) total_cycles);
+  snprintf(row, sizeof(row), "%-24s %14s %7s %16s %7s %10s", "opcode",
+      "count", "%", "cycles", "%", "cycles/op");
+  print_ln("%s", row);
+  for (size_t i = 0; i < kOpcodeCount && opcodes[i].count > 0; i++) {
+    profile_entry_t *entry = &opcodes[i];
+    snprintf(row, sizeof(row), "%-24s %14llu %6.2f%% %16llu %6.2f%% %10.1f",
+        get_opcode_name((opcode_t) entry->index),
+        (unsigned long long) entry->count,
+        get_percentage(entry->count, total_count),
+        (unsigned long long) entry->cycles,
+        get_percentage(entry->cycles, total_cycles),
+        ((double) entry->cycles) / entry->count);
+    print_ln("%s", row);
+  }
+  // Opcode pairs, which don't have a time so they're sorted by count only.
+  profile_entry_t pairs[kProfileReportTopCount];
+  size_t pair_count = 0;
+  for (size_t i = 0; i < kOpcodeCount * kOpcodeCount; i++) {
+    uint64_t count = profile->pair_counts[i / kOpcodeCount][i % kOpcodeCount];
+    profile_entry_t entry = {i, count, 0};
+    if (count == 0)
+      continue;
+    size_t j = pair_count;
+    while (j > 0 && compare_profile_entries(&entry, &pairs[j - 1]) < 0) {
+      if (j < kProfileReportTopCount)
+        pairs[j] = pairs[j - 1];
+      j--;
+    }
+    if (j < kProfileReportTopCount) {
+      pairs[j] = entry;
+      if (pair_count < kProfileReportTopCount)
+        pair_count++;
+    }
+  }
+  print_ln("--- Most frequent opcode pairs ---");
+  for (size_t i = 0; i < pair_count; i++) {
+    profile_entry_t *entry = &pairs[i];
+    snprintf(row, sizeof(row), "%-24s %-24s %14llu %6.2f%%",
+        get_opcode_name((opcode_t) (entry->index / kOpcodeCount)),
+        get_opcode_name((opcode_t) (entry->index % kOpcodeCount)),
+        (unsigned long long) entry->count,
+        get_percentage(entry->count, total_count));
+    print_ln("%s", row);
+  }
+  // Methods. Only methods that are still in the heap are included and top
+  // level code that doesn't belong to a method isn't included at all.
+  hot_code_collector_o collector;
+  collector.super.vtable.visit = (value_visitor_visit_m) hot_code_collector_visit;
+  collector.code_blocks = runtime->code_block_table;
+  collector.count = 0;
+  TRY(heap_for_each_space_object(&runtime->heap,
+      (value_visitor_o*) &collector));
+  print_ln("--- Methods with the most time spent ---");
+  for (size_t i = 0; i < collector.count; i++) {
+    profile_entry_t *entry = &collector.entries[i];
+    snprintf(row, sizeof(row), "%14llu %16llu %6.2f%%",
+        (unsigned long long) entry->count,
+        (unsigned long long) entry->cycles,
+        get_percentage(entry->cycles, total_cycles));
+    print_ln("%s %4v", row, get_method_signature(collector.methods[i]));
+  }
+  return success();
+}
+
 value_t run_code_block_until_condition(value_t ambience, value_t code) {
   // Create the stack to run the code on.
   runtime_t *runtime = get_ambience_runtime(ambience);
@@ -6,68 +6,168 @@
 #define _INTERP
 
 #include "builtin.h"
+#include "jit.h"
 #include "runtime.h"
 #include "utils.h"
 #include "value.h"
 
-// Invokes the given macro for each opcode name and argument count.
+// Invokes the given macro for each opcode name, argument count, and value
+// operand mask. Bit i of the mask is set if the operand at offset i within
+// the instruction is an index into the code block's value pool rather than a
+// plain number. The ops whose names are two other ops run together, like
+// PushPush, are superinstructions that do the same as the two ops in sequence;
+// they're only ever generated by the assembler's peephole stage.
+// LoadCachedGlobal never appears in bytecode, the interpreter rewrites
+// LoadGlobal instructions into it in the decoded form.
 #define ENUM_OPCODES(F)                                                        \
-  F(Builtin,                    2)                                             \
-  F(BuiltinMaybeEscape,         4)                                             \
-  F(CallEnsurer,                4)                                             \
-  F(CheckStackHeight,           2)                                             \
-  F(CreateBlock,                2)                                             \
-  F(CreateEnsurer,              2)                                             \
-  F(CreateEscape,               2)                                             \
-  F(DelegateToLambda,           1)                                             \
-  F(DelegateToBlock,            1)                                             \
-  F(DisposeBlock,               1)                                             \
-  F(DisposeEnsurer,             1)                                             \
-  F(DisposeEscape,              1)                                             \
-  F(FireEscapeOrBarrier,        1)                                             \
-  F(GetReference,               1)                                             \
-  F(Goto,                       2)                                             \
-  F(InstallSignalHandler,       3)                                             \
-  F(UninstallSignalHandler,     1)                                             \
-  F(Invoke,                     4)                                             \
-  F(Lambda,                     3)                                             \
-  F(LeaveOrFireBarrier,         2)                                             \
-  F(LoadArgument,               2)                                             \
-  F(LoadGlobal,                 3)                                             \
-  F(LoadLocal,                  2)                                             \
-  F(LoadLambdaCapture,          2)                                             \
-  F(LoadRefractedArgument,      3)                                             \
-  F(LoadRefractedCapture,       3)                                             \
-  F(LoadRefractedLocal,         3)                                             \
-  F(NewArray,                   2)                                             \
-  F(NewReference,               1)                                             \
-  F(Pop,                        2)                                             \
-  F(Push,                       2)                                             \
-  F(Return,                     1)                                             \
-  F(SetReference,               1)                                             \
-  F(SignalEscape,               4)                                             \
-  F(SignalContinue,             4)                                             \
-  F(Slap,                       2)                                             \
-  F(StackBottom,                1)                                             \
-  F(StackPieceBottom,           1)
+  F(Builtin,                    3, 0x6)                                        \
+  F(BuiltinMaybeEscape,         5, 0x2)                                        \
+  F(CallEnsurer,                5, 0)                                          \
+  F(CheckStackHeight,           2, 0)                                          \
+  F(CreateBlock,                2, 0x2)                                        \
+  F(CreateEnsurer,              2, 0x2)                                        \
+  F(CreateEscape,               2, 0)                                          \
+  F(DelegateToLambda,           1, 0)                                          \
+  F(DelegateToBlock,            1, 0)                                          \
+  F(DisposeBlock,               1, 0)                                          \
+  F(DisposeEnsurer,             1, 0)                                          \
+  F(DisposeEscape,              1, 0)                                          \
+  F(FireEscapeOrBarrier,        1, 0)                                          \
+  F(GetReference,               1, 0)                                          \
+  F(Goto,                       2, 0)                                          \
+  F(InstallSignalHandler,       3, 0x2)                                        \
+  F(UninstallSignalHandler,     1, 0)                                          \
+  F(Invoke,                     5, 0xE)                                        \
+  F(Lambda,                     3, 0x2)                                        \
+  F(LeaveOrFireBarrier,         2, 0)                                          \
+  F(LoadCachedGlobal,           3, 0x6)                                        \
+  F(LoadArgument,               2, 0)                                          \
+  F(LoadArgumentPush,           3, 0x4)                                        \
+  F(LoadGlobal,                 3, 0x6)                                        \
+  F(LoadLocal,                  2, 0)                                          \
+  F(LoadLambdaCapture,          2, 0)                                          \
+  F(LoadRefractedArgument,      3, 0)                                          \
+  F(LoadRefractedCapture,       3, 0)                                          \
+  F(LoadRefractedLocal,         3, 0)                                          \
+  F(NewArray,                   2, 0)                                          \
+  F(NewReference,               1, 0)                                          \
+  F(Pop,                        2, 0)                                          \
+  F(Push,                       2, 0x2)                                        \
+  F(PushLoadArgument,           3, 0x2)                                        \
+  F(PushPush,                   3, 0x6)                                        \
+  F(Return,                     1, 0)                                          \
+  F(SetReference,               1, 0)                                          \
+  F(SignalEscape,               5, 0x2)                                        \
+  F(SignalContinue,             5, 0x2)                                        \
+  F(Slap,                       2, 0)                                          \
+  F(StackBottom,                1, 0)                                          \
+  F(StackPieceBottom,           1, 0)
 
 // The enum of all opcodes.
 typedef enum {
   __ocFirst__ = -1
-#define __DECLARE_OPCODE__(Name, ARGC) , oc##Name
+#define __DECLARE_OPCODE__(Name, ARGC, VALUES) , oc##Name
   ENUM_OPCODES(__DECLARE_OPCODE__)
 #undef __DECLARE_OPCODE__
 } opcode_t;
 
+// The number of different opcodes.
+enum {
+#define __COUNT_OPCODE__(Name, ARGC, VALUES) + 1
+  kOpcodeCount = 0 ENUM_OPCODES(__COUNT_OPCODE__)
+#undef __COUNT_OPCODE__
+};
+
 // Declare the opcode size constants.
-#define __DECLARE_OPCODE_SIZE__(Name, ARGC)                                    \
+#define __DECLARE_OPCODE_SIZE__(Name, ARGC, VALUES)                            \
   static const size_t k##Name##OperationSize = (ARGC);
   ENUM_OPCODES(__DECLARE_OPCODE_SIZE__)
 #undef __DECLARE_OPCODE_SIZE__
 
+// Returns an array holding the given bytecode in decoded form. The array has
+// an element for each short of the bytecode such that pcs are the same in both
+// forms; opcodes and numeric operands become integers and value pool
+// references become the values themselves. The result is mutable only if it
+// contains LoadGlobal instructions, which the interpreter rewrites.
+value_t decode_bytecode(runtime_t *runtime, value_t bytecode,
+    value_t value_pool);
+
 // Returns the string name of the opcode with the given index.
 const char *get_opcode_name(opcode_t opcode);
 
+// Execution statistics collected by the interpreter when opcode profiling is
+// enabled. Time is measured in cycles where the platform has a cycle counter
+// and in clock ticks otherwise. The per-method numbers are stored in the
+// runtime's code block table.
+struct opcode_profile_t {
+  // How many times each opcode has been executed.
+  uint64_t counts[kOpcodeCount];
+  // The total time spent executing each opcode.
+  uint64_t cycles[kOpcodeCount];
+  // How many times each opcode has been followed by each other opcode, indexed
+  // first by the earlier of the two.
+  uint64_t pair_counts[kOpcodeCount][kOpcodeCount];
+};
+
+// Clears all the counts in the given profile.
+void opcode_profile_init(opcode_profile_t *profile);
+
+// Prints a report of the opcode profile collected by the given runtime, which
+// must have been created with opcode profiling enabled.
+value_t opcode_profile_print_report(runtime_t *runtime);
+
+// The data about a code block that is kept outside the heap, either because it
+// keeps changing after the code block has been frozen or because it isn't a
+// heap value.
+typedef struct {
+  // The number of times the code block has been invoked as a method.
+  uint64_t invocation_count;
+  // The number of instructions executed in the code block. Only updated when
+  // opcode profiling is enabled.
+  uint64_t opcode_count;
+  // The time spent executing instructions in the code block, in the same unit
+  // as the opcode profile. Only updated when opcode profiling is enabled.
+  uint64_t opcode_cycles;
+  // The native code for the code block or NULL if there is none.
+  jit_code_t *native_code;
+  // Has the code block been compiled to native code? If compilation found
+  // nothing to compile there's no native code but we don't want to try again.
+  bool is_compiled;
+} code_block_data_t;
+
+// Table of data about each code block created by a runtime, indexed by the
+// code blocks' serial numbers. Entries are never removed, not even when the
+// code block they belong to is collected, so this grows with the number of
+// code blocks ever created rather than the number alive.
+struct code_block_table_t {
+  // The entries, one for each serial number handed out.
+  code_block_data_t *entries;
+  // The number of entries in use.
+  size_t length;
+  // The number of entries there is room for.
+  size_t capacity;
+  // Should code blocks be compiled to native code?
+  bool use_native_code;
+  // How many times a code block must have been invoked before it's compiled.
+  size_t native_code_threshold;
+};
+
+// Initializes an empty code block table. If native code is enabled code blocks
+// are compiled once they've been invoked the given number of times.
+value_t code_block_table_init(code_block_table_t *table, bool use_native_code,
+    size_t native_code_threshold);
+
+// Disposes the given table along with any native code it holds.
+void code_block_table_dispose(code_block_table_t *table);
+
+// Adds an entry to the given table, storing its serial number in the out
+// parameter.
+value_t code_block_table_add(code_block_table_t *table, size_t *serial_out);
+
+// Returns the entry in the given table that belongs to the given code block.
+code_block_data_t *code_block_table_get(code_block_table_t *table,
+    value_t code_block);
+
 // Executes the given code block object, returning the result. If any conditions
 // occur evaluation is interrupted.
 value_t run_code_block_until_condition(value_t ambience, value_t code);
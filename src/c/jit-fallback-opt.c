@@ -0,0 +1,22 @@
+// Copyright 2014 the Neutrino authors (see AUTHORS).
+// Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+// Fallback for platforms without a native code generator. Everything gets
+// interpreted.
+
+bool jit_is_supported() {
+  return false;
+}
+
+static bool compile_native_code(jit_code_t *code, value_t *decoded,
+    size_t length) {
+  return false;
+}
+
+static void free_native_code(jit_code_t *code) {
+  // nothing to do
+}
+
+void jit_code_run(jit_code_t *code, frame_t *frame, value_t *decoded) {
+  UNREACHABLE("running native code");
+}
@@ -0,0 +1,414 @@
+// Copyright 2014 the Neutrino authors (see AUTHORS).
+// Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+// Native code generation for x86-64 using the System V calling convention.
+//
+// While native code runs rbx holds the frame, r12 the elements of the decoded
+// bytecode, and r13 the frame's stack pointer which is only written back to
+// the frame around calls to C and on exit. Value operands are loaded from the
+// decoded bytecode each time rather than being embedded in the code since the
+// garbage collector may move them.
+
+#define __USE_MISC
+#include <stddef.h>
+#include <sys/mman.h>
+
+bool jit_is_supported() {
+  return true;
+}
+
+// Signature of the stub at the start of the native code. It sets up the
+// registers and jumps to the target which must be an entry point.
+typedef void (*native_entry_t)(frame_t *frame, value_t *decoded,
+    byte_t *target);
+
+// Signature of the C functions that implement the instructions that are too
+// involved to be worth generating code for. They're passed the frame and a
+// pointer to the instruction within the decoded bytecode.
+typedef void (*native_helper_t)(frame_t *frame, value_t *instr);
+
+// Returns the numeric operand at the given offset within an instruction.
+static size_t get_operand(value_t *instr, size_t offset) {
+  value_t value = instr[offset];
+  CHECK_DOMAIN(vdInteger, value);
+  return (size_t) get_integer_value(value);
+}
+
+static void native_check_stack_height(frame_t *frame, value_t *instr) {
+  size_t expected = get_operand(instr, 1);
+  size_t height = frame->stack_pointer - frame->frame_pointer;
+  CHECK_EQ("stack height", expected, height);
+}
+
+static void native_load_argument(frame_t *frame, value_t *instr) {
+  size_t param_index = get_operand(instr, 1);
+  frame_push_value(frame, frame_get_argument(frame, param_index));
+}
+
+static void native_push_load_argument(frame_t *frame, value_t *instr) {
+  frame_push_value(frame, instr[1]);
+  size_t param_index = get_operand(instr, 2);
+  frame_push_value(frame, frame_get_argument(frame, param_index));
+}
+
+static void native_load_argument_push(frame_t *frame, value_t *instr) {
+  size_t param_index = get_operand(instr, 1);
+  frame_push_value(frame, frame_get_argument(frame, param_index));
+  frame_push_value(frame, instr[2]);
+}
+
+static void native_load_refracted_argument(frame_t *frame, value_t *instr) {
+  size_t param_index = get_operand(instr, 1);
+  size_t block_depth = get_operand(instr, 2);
+  frame_t home = frame_empty();
+  get_refractor_refracted_frame(frame_get_argument(frame, 0), block_depth,
+      &home);
+  frame_push_value(frame, frame_get_argument(&home, param_index));
+}
+
+static void native_load_refracted_local(frame_t *frame, value_t *instr) {
+  size_t index = get_operand(instr, 1);
+  size_t block_depth = get_operand(instr, 2);
+  frame_t home = frame_empty();
+  get_refractor_refracted_frame(frame_get_argument(frame, 0), block_depth,
+      &home);
+  frame_push_value(frame, frame_get_local(&home, index));
+}
+
+static void native_load_lambda_capture(frame_t *frame, value_t *instr) {
+  size_t index = get_operand(instr, 1);
+  value_t subject = frame_get_argument(frame, 0);
+  CHECK_FAMILY(ofLambda, subject);
+  frame_push_value(frame, get_lambda_capture(subject, index));
+}
+
+static void native_load_refracted_capture(frame_t *frame, value_t *instr) {
+  size_t index = get_operand(instr, 1);
+  size_t block_depth = get_operand(instr, 2);
+  frame_t home = frame_empty();
+  get_refractor_refracted_frame(frame_get_argument(frame, 0), block_depth,
+      &home);
+  value_t lambda = frame_get_argument(&home, 0);
+  CHECK_FAMILY(ofLambda, lambda);
+  frame_push_value(frame, get_lambda_capture(lambda, index));
+}
+
+static void native_get_reference(frame_t *frame, value_t *instr) {
+  value_t ref = frame_pop_value(frame);
+  CHECK_FAMILY(ofReference, ref);
+  frame_push_value(frame, get_reference_value(ref));
+}
+
+static void native_set_reference(frame_t *frame, value_t *instr) {
+  value_t ref = frame_pop_value(frame);
+  CHECK_FAMILY(ofReference, ref);
+  set_reference_value(ref, frame_peek_value(frame, 0));
+}
+
+// Returns the helper that implements the given opcode, or NULL if it doesn't
+// have one.
+static native_helper_t get_native_helper(opcode_t opcode) {
+  switch (opcode) {
+    case ocCheckStackHeight: return native_check_stack_height;
+    case ocLoadArgument: return native_load_argument;
+    case ocPushLoadArgument: return native_push_load_argument;
+    case ocLoadArgumentPush: return native_load_argument_push;
+    case ocLoadRefractedArgument: return native_load_refracted_argument;
+    case ocLoadRefractedLocal: return native_load_refracted_local;
+    case ocLoadLambdaCapture: return native_load_lambda_capture;
+    case ocLoadRefractedCapture: return native_load_refracted_capture;
+    case ocGetReference: return native_get_reference;
+    case ocSetReference: return native_set_reference;
+    default: return NULL;
+  }
+}
+
+// Returns true if there is a template for the given opcode. Everything that
+// may allocate, invoke, return, or otherwise change which frame or code block
+// is executing is left to the interpreter.
+static bool has_native_template(opcode_t opcode) {
+  switch (opcode) {
+    case ocPush:
+    case ocPushPush:
+    case ocPop:
+    case ocSlap:
+    case ocLoadLocal:
+    case ocLoadCachedGlobal:
+    case ocGoto:
+      return true;
+    default:
+      return get_native_helper(opcode) != NULL;
+  }
+}
+
+// The size of each operation, indexed by opcode.
+static const size_t kNativeOperationSizes[] = {
+#define __EMIT_OPERATION_SIZE__(Name, ARGC, VALUES) ARGC,
+  ENUM_OPCODES(__EMIT_OPERATION_SIZE__)
+#undef __EMIT_OPERATION_SIZE__
+};
+
+// The offsets of the frame fields accessed from native code. They're used as
+// 8-bit displacements.
+#define kStackPointerDisp ((byte_t) offsetof(frame_t, stack_pointer))
+#define kFramePointerDisp ((byte_t) offsetof(frame_t, frame_pointer))
+#define kPcDisp ((byte_t) offsetof(frame_t, pc))
+
+// State maintained while generating the native code for a code block.
+typedef struct {
+  // The code generated so far.
+  byte_buffer_t buf;
+  // Offset of the code that writes back the state and returns.
+  size_t exit_offset;
+  // For each jump whose target hasn't been generated yet, the offset of the
+  // 32-bit displacement to patch and the pc of the target.
+  size_t *jump_offsets;
+  size_t *jump_targets;
+  size_t jump_count;
+} native_assembler_t;
+
+static void emit_bytes(native_assembler_t *assm, const byte_t *bytes,
+    size_t count) {
+  for (size_t i = 0; i < count; i++)
+    byte_buffer_append(&assm->buf, bytes[i]);
+}
+
+// Emits the given list of bytes.
+#define EMIT(ASSM, ...) do {                                                   \
+  const byte_t __bytes__[] = {__VA_ARGS__};                                    \
+  emit_bytes((ASSM), __bytes__, sizeof(__bytes__));                            \
+} while (false)
+
+static void emit_int32(native_assembler_t *assm, int32_t value) {
+  uint32_t bits = (uint32_t) value;
+  for (size_t i = 0; i < 4; i++)
+    byte_buffer_append(&assm->buf, (byte_t) (bits >> (8 * i)));
+}
+
+static void emit_int64(native_assembler_t *assm, uint64_t value) {
+  for (size_t i = 0; i < 8; i++)
+    byte_buffer_append(&assm->buf, (byte_t) (value >> (8 * i)));
+}
+
+// Returns the offset of the next byte to be emitted.
+static size_t get_native_offset(native_assembler_t *assm) {
+  return assm->buf.length;
+}
+
+// Sets the 32-bit displacement at the given offset such that it points to
+// the given target, assuming the displacement is the last part of the
+// instruction.
+static void patch_displacement(native_assembler_t *assm, size_t offset,
+    size_t target) {
+  byte_t *bytes = (byte_t*) assm->buf.memory.memory;
+  uint32_t bits = (uint32_t) (int32_t) (target - (offset + 4));
+  for (size_t i = 0; i < 4; i++)
+    bytes[offset + i] = (byte_t) (bits >> (8 * i));
+}
+
+// jmp rel32 to the given offset which has already been generated.
+static void emit_jump_back(native_assembler_t *assm, size_t target) {
+  EMIT(assm, 0xE9);
+  size_t offset = get_native_offset(assm);
+  emit_int32(assm, 0);
+  patch_displacement(assm, offset, target);
+}
+
+// rax := decoded[index]
+static void emit_load_operand(native_assembler_t *assm, size_t index) {
+  EMIT(assm, 0x49, 0x8B, 0x84, 0x24);
+  emit_int32(assm, (int32_t) (index * sizeof(value_t)));
+}
+
+// Pushes rax onto the stack.
+static void emit_push_rax(native_assembler_t *assm) {
+  // mov [r13], rax
+  EMIT(assm, 0x49, 0x89, 0x45, 0x00);
+  // add r13, 8
+  EMIT(assm, 0x49, 0x83, 0xC5, (byte_t) sizeof(value_t));
+}
+
+// Sets the frame's pc to the given value and leaves the native code.
+static void emit_exit(native_assembler_t *assm, size_t pc) {
+  // mov qword [rbx + pc], imm32
+  EMIT(assm, 0x48, 0xC7, 0x43, kPcDisp);
+  emit_int32(assm, (int32_t) pc);
+  emit_jump_back(assm, assm->exit_offset);
+}
+
+// Calls the given helper with the frame and the instruction at the given pc.
+static void emit_call_helper(native_assembler_t *assm, native_helper_t helper,
+    size_t pc) {
+  // mov [rbx + sp], r13
+  EMIT(assm, 0x4C, 0x89, 0x6B, kStackPointerDisp);
+  // mov rdi, rbx
+  EMIT(assm, 0x48, 0x89, 0xDF);
+  // lea rsi, [r12 + 8 * pc]
+  EMIT(assm, 0x49, 0x8D, 0xB4, 0x24);
+  emit_int32(assm, (int32_t) (pc * sizeof(value_t)));
+  // mov rax, imm64
+  EMIT(assm, 0x48, 0xB8);
+  emit_int64(assm, (uint64_t) (address_arith_t) helper);
+  // call rax
+  EMIT(assm, 0xFF, 0xD0);
+  // mov r13, [rbx + sp]
+  EMIT(assm, 0x4C, 0x8B, 0x6B, kStackPointerDisp);
+}
+
+// Emits the entry stub and the exit sequence.
+static void emit_entry_and_exit(native_assembler_t *assm) {
+  // The three pushes, together with the return address, keep the stack 16-byte
+  // aligned for the helper calls.
+  EMIT(assm, 0x53);                   // push rbx
+  EMIT(assm, 0x41, 0x54);             // push r12
+  EMIT(assm, 0x41, 0x55);             // push r13
+  EMIT(assm, 0x48, 0x89, 0xFB);       // mov rbx, rdi
+  EMIT(assm, 0x49, 0x89, 0xF4);       // mov r12, rsi
+  EMIT(assm, 0x4C, 0x8B, 0x6B, kStackPointerDisp); // mov r13, [rbx + sp]
+  EMIT(assm, 0xFF, 0xE2);             // jmp rdx
+  assm->exit_offset = get_native_offset(assm);
+  EMIT(assm, 0x4C, 0x89, 0x6B, kStackPointerDisp); // mov [rbx + sp], r13
+  EMIT(assm, 0x41, 0x5D);             // pop r13
+  EMIT(assm, 0x41, 0x5C);             // pop r12
+  EMIT(assm, 0x5B);                   // pop rbx
+  EMIT(assm, 0xC3);                   // ret
+}
+
+// Emits the template for the instruction at the given pc.
+static void emit_instruction(native_assembler_t *assm, value_t *decoded,
+    size_t pc, opcode_t opcode) {
+  value_t *instr = decoded + pc;
+  switch (opcode) {
+    case ocPush:
+    case ocLoadCachedGlobal:
+      emit_load_operand(assm, pc + 1);
+      emit_push_rax(assm);
+      break;
+    case ocPushPush:
+      emit_load_operand(assm, pc + 1);
+      emit_push_rax(assm);
+      emit_load_operand(assm, pc + 2);
+      emit_push_rax(assm);
+      break;
+    case ocPop: {
+      // sub r13, 8 * count
+      EMIT(assm, 0x49, 0x81, 0xED);
+      emit_int32(assm, (int32_t) (get_operand(instr, 1) * sizeof(value_t)));
+      break;
+    }
+    case ocSlap: {
+      // mov rax, [r13 - 8]
+      EMIT(assm, 0x49, 0x8B, 0x45, 0xF8);
+      // sub r13, 8 * argc
+      EMIT(assm, 0x49, 0x81, 0xED);
+      emit_int32(assm, (int32_t) (get_operand(instr, 1) * sizeof(value_t)));
+      // mov [r13 - 8], rax
+      EMIT(assm, 0x49, 0x89, 0x45, 0xF8);
+      break;
+    }
+    case ocLoadLocal: {
+      // mov rax, [rbx + fp]
+      EMIT(assm, 0x48, 0x8B, 0x43, kFramePointerDisp);
+      // mov rax, [rax + 8 * index]
+      EMIT(assm, 0x48, 0x8B, 0x80);
+      emit_int32(assm, (int32_t) (get_operand(instr, 1) * sizeof(value_t)));
+      emit_push_rax(assm);
+      break;
+    }
+    case ocGoto: {
+      // jmp rel32, patched once all the code has been generated.
+      EMIT(assm, 0xE9);
+      assm->jump_offsets[assm->jump_count] = get_native_offset(assm);
+      assm->jump_targets[assm->jump_count] = pc + get_operand(instr, 1);
+      assm->jump_count++;
+      emit_int32(assm, 0);
+      break;
+    }
+    default:
+      emit_call_helper(assm, get_native_helper(opcode), pc);
+      break;
+  }
+}
+
+static bool compile_native_code(jit_code_t *code, value_t *decoded,
+    size_t length) {
+  native_assembler_t assm;
+  byte_buffer_init(&assm.buf);
+  memory_block_t offsets_memory = allocator_default_malloc(
+      length * sizeof(size_t));
+  memory_block_t targets_memory = allocator_default_malloc(
+      length * sizeof(size_t));
+  assm.jump_offsets = (size_t*) offsets_memory.memory;
+  assm.jump_targets = (size_t*) targets_memory.memory;
+  assm.jump_count = 0;
+  bool result = false;
+  if (assm.jump_offsets == NULL || assm.jump_targets == NULL)
+    goto done;
+  emit_entry_and_exit(&assm);
+  memset(code->entries, 0, length * sizeof(uint32_t));
+  bool has_native_code = false;
+  // Does the code generated for the previous instruction continue into the
+  // code for the next?
+  bool falls_through = false;
+  size_t pc = 0;
+  while (pc < length) {
+    opcode_t opcode = (opcode_t) get_integer_value(decoded[pc]);
+    CHECK_REL("invalid opcode", (size_t) opcode, <, (size_t) kOpcodeCount);
+    if (has_native_template(opcode)) {
+      code->entries[pc] = (uint32_t) get_native_offset(&assm);
+      emit_instruction(&assm, decoded, pc, opcode);
+      falls_through = (opcode != ocGoto);
+      has_native_code = true;
+    } else if (falls_through) {
+      emit_exit(&assm, pc);
+      falls_through = false;
+    }
+    pc += kNativeOperationSizes[opcode];
+  }
+  if (falls_through)
+    emit_exit(&assm, pc);
+  if (!has_native_code)
+    goto done;
+  // Jumps go straight to the target's native code if there is any and
+  // otherwise exit to the interpreter at the target.
+  for (size_t i = 0; i < assm.jump_count; i++) {
+    size_t target = assm.jump_targets[i];
+    if (target < length && code->entries[target] != 0) {
+      patch_displacement(&assm, assm.jump_offsets[i], code->entries[target]);
+    } else {
+      patch_displacement(&assm, assm.jump_offsets[i], get_native_offset(&assm));
+      emit_exit(&assm, target);
+    }
+  }
+  // Copy the code into executable memory.
+  size_t size = assm.buf.length;
+  void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED)
+    goto done;
+  memcpy(memory, assm.buf.memory.memory, size);
+  if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(memory, size);
+    goto done;
+  }
+  code->start = (byte_t*) memory;
+  code->size = size;
+  result = true;
+done:
+  byte_buffer_dispose(&assm.buf);
+  if (assm.jump_offsets != NULL)
+    allocator_default_free(offsets_memory);
+  if (assm.jump_targets != NULL)
+    allocator_default_free(targets_memory);
+  return result;
+}
+
+static void free_native_code(jit_code_t *code) {
+  munmap(code->start, code->size);
+}
+
+void jit_code_run(jit_code_t *code, frame_t *frame, value_t *decoded) {
+  CHECK_TRUE("no native code", jit_code_has_entry(code, frame->pc));
+  native_entry_t entry = (native_entry_t) code->start;
+  entry(frame, decoded, code->start + code->entries[frame->pc]);
+}
@@ -0,0 +1,48 @@
+// Copyright 2014 the Neutrino authors (see AUTHORS).
+// Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include "interp.h"
+#include "jit.h"
+#include "value-inl.h"
+
+#if defined(IS_GCC) && defined(__x86_64__)
+#include "jit-x64-opt.c"
+#else
+#include "jit-fallback-opt.c"
+#endif
+
+jit_code_t *new_jit_code(value_t decoded) {
+  CHECK_FAMILY(ofArray, decoded);
+  if (!jit_is_supported())
+    return NULL;
+  size_t length = get_array_length(decoded);
+  if (length == 0)
+    return NULL;
+  memory_block_t code_memory = allocator_default_malloc(sizeof(jit_code_t));
+  if (memory_block_is_empty(code_memory))
+    return NULL;
+  jit_code_t *code = (jit_code_t*) code_memory.memory;
+  code->start = NULL;
+  code->size = 0;
+  code->entry_count = length;
+  memory_block_t entries_memory = allocator_default_malloc(
+      length * sizeof(uint32_t));
+  code->entries = (uint32_t*) entries_memory.memory;
+  if (code->entries == NULL
+      || !compile_native_code(code, get_array_elements(decoded), length)) {
+    delete_jit_code(code);
+    return NULL;
+  }
+  return code;
+}
+
+void delete_jit_code(jit_code_t *code) {
+  if (code == NULL)
+    return;
+  if (code->start != NULL)
+    free_native_code(code);
+  if (code->entries != NULL)
+    allocator_default_free(new_memory_block(code->entries,
+        code->entry_count * sizeof(uint32_t)));
+  allocator_default_free(new_memory_block(code, sizeof(jit_code_t)));
+}
@@ -0,0 +1,60 @@
+// Copyright 2014 the Neutrino authors (see AUTHORS).
+// Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+// Baseline compiler that translates runs of simple instructions from a code
+// block's decoded bytecode into native code by stitching together a fixed
+// template for each instruction. See interp.md for how it fits together with
+// the interpreter.
+
+
+#ifndef _JIT
+#define _JIT
+
+#include "process.h"
+#include "utils.h"
+#include "value.h"
+
+FORWARD(jit_code_t);
+
+// The native code generated for a single code block.
+struct jit_code_t {
+  // The executable memory holding the code. It starts with a stub that is
+  // shared by all the entry points.
+  byte_t *start;
+  // The size in bytes of the executable memory.
+  size_t size;
+  // The offset of the native code for each pc within the decoded bytecode, or
+  // 0 where execution has to happen in the interpreter.
+  uint32_t *entries;
+  // The number of elements in the entries array, the length of the decoded
+  // bytecode.
+  size_t entry_count;
+};
+
+// Returns true if native code can be generated on this platform.
+bool jit_is_supported();
+
+// Compiles the given decoded bytecode into native code. Returns NULL if native
+// code isn't supported, if there was nothing in the bytecode worth compiling,
+// or if compilation failed; in any case it's safe to just keep interpreting.
+// The native code doesn't refer to the bytecode directly so it stays valid
+// when the bytecode is moved by the garbage collector.
+jit_code_t *new_jit_code(value_t decoded);
+
+// Frees the given native code. The code may be NULL.
+void delete_jit_code(jit_code_t *code);
+
+// Returns true if the given native code has an entry point at the given pc.
+static bool jit_code_has_entry(jit_code_t *code, size_t pc) {
+  return code->entries[pc] != 0;
+}
+
+// Runs the given native code in the given frame starting from the frame's
+// current pc, which must be an entry point. The code array is the elements of
+// the decoded bytecode the code was compiled from. When this returns the frame
+// has been updated to reflect the instructions executed and the pc is at an
+// instruction that must be executed by the interpreter.
+void jit_code_run(jit_code_t *code, frame_t *frame, value_t *decoded);
+
+
+#endif // _JIT
@@ -109,6 +109,10 @@ static void main_allocator_data_dispose(main_allocator_data_t *data) {
 typedef struct {
   // Whether or not to print the output values.
   bool print_value;
+  // Whether to print garbage collection statistics on exit.
+  bool print_gc_stats;
+  // File to write a heap dump to on exit, or NULL.
+  const char *heap_dump;
   // Extra arguments to main.
   const char *main_options;
   // The config to store config-related flags directly into.
@@ -124,6 +128,8 @@ typedef struct {
 // Initializes a options struct.
 static void main_options_init(main_options_t *flags, runtime_config_t *config) {
   flags->print_value = false;
+  flags->print_gc_stats = false;
+  flags->heap_dump = NULL;
   flags->main_options = NULL;
   flags->config = config;
   flags->argc = 0;
@@ -160,6 +166,24 @@ static size_t c_str_as_long_or_die(const char *str) {
   return value;
 }
 
+// Parses the given string as a gc validation level. If parsing fails issues an
+// error and aborts execution.
+static gc_validation_level_t c_str_as_gc_validation_level_or_die(const char *str) {
+  if (c_str_equals(str, "none")) {
+    return gvNone;
+  } else if (c_str_equals(str, "roots")) {
+    return gvRoots;
+  } else if (c_str_equals(str, "full")) {
+    return gvFull;
+  } else if (c_str_equals(str, "expensive")) {
+    return gvExpensive;
+  } else {
+    ERROR("Couldn't parse '%s' as a validation level", str);
+    UNREACHABLE("gc validation level parse error");
+    return gvNone;
+  }
+}
+
 // Parse a set of command-line arguments.
 static void parse_options(size_t argc, char **argv, main_options_t *flags_out) {
   // Allocate an argv array that is definitely large enough to store all the
@@ -175,9 +199,35 @@ static void parse_options(size_t argc, char **argv, main_options_t *flags_out) {
       } else if (c_str_equals(arg, "--garbage-collect-fuzz-frequency")) {
         CHECK_REL("missing flag argument", i, <, argc);
         flags_out->config->gc_fuzz_freq = c_str_as_long_or_die(argv[i++]);
+        // Fuzzing is for finding gc bugs so we want to catch them early.
+        if (flags_out->config->gc_validation_level < gvFull)
+          flags_out->config->gc_validation_level = gvFull;
       } else if (c_str_equals(arg, "--garbage-collect-fuzz-seed")) {
         CHECK_REL("missing flag argument", i, <, argc);
         flags_out->config->gc_fuzz_seed = c_str_as_long_or_die(argv[i++]);
+      } else if (c_str_equals(arg, "--gc-validation")) {
+        CHECK_REL("missing flag argument", i, <, argc);
+        flags_out->config->gc_validation_level =
+            c_str_as_gc_validation_level_or_die(argv[i++]);
+      } else if (c_str_equals(arg, "--gc-threads")) {
+        CHECK_REL("missing flag argument", i, <, argc);
+        flags_out->config->gc_thread_count = c_str_as_long_or_die(argv[i++]);
+      } else if (c_str_equals(arg, "--profile-opcodes")) {
+        flags_out->config->profile_opcodes = true;
+      } else if (c_str_equals(arg, "--jit")) {
+        flags_out->config->enable_jit = true;
+      } else if (c_str_equals(arg, "--jit-threshold")) {
+        CHECK_REL("missing flag argument", i, <, argc);
+        flags_out->config->jit_threshold = c_str_as_long_or_die(argv[i++]);
+      } else if (c_str_equals(arg, "--profile-allocations")) {
+        CHECK_REL("missing flag argument", i, <, argc);
+        flags_out->config->alloc_profile_interval =
+            c_str_as_long_or_die(argv[i++]);
+      } else if (c_str_equals(arg, "--gc-stats")) {
+        flags_out->print_gc_stats = true;
+      } else if (c_str_equals(arg, "--heap-dump")) {
+        CHECK_REL("missing flag argument", i, <, argc);
+        flags_out->heap_dump = argv[i++];
       } else if (c_str_equals(arg, "--main-options")) {
         CHECK_REL("missing flag argument", i, <, argc);
         flags_out->main_options = argv[i++];
@@ -212,8 +262,13 @@ static value_t build_module_loader(runtime_t *runtime, value_t options) {
 // running scripts.
 static void runtime_config_init_main_defaults(runtime_config_t *config) {
   // Currently the runtime doesn't handle allocation failures super well
-  // (particularly plankton parsing) so keep the semispace size big.
+  // (particularly plankton parsing and module loading) so keep both the
+  // semispace and the nursery big.
   config->semispace_size_bytes = 10 * kMB;
+  config->nursery_size_bytes = 10 * kMB;
+  // Full validation traverses the whole heap around every collection which is
+  // too slow to do by default outside tests.
+  config->gc_validation_level = gvRoots;
 }
 
 // Create a vm and run the program.
@@ -236,8 +291,16 @@ static value_t neutrino_main(int argc, char **argv) {
   CREATE_SAFE_VALUE_POOL(runtime, 4, pool);
   E_BEGIN_TRY_FINALLY();
     value_t result = whatever();
+    safe_value_t s_ambience = protect(pool, ambience);
     E_TRY_DEF(main_options, parse_main_options(runtime, options.main_options));
     E_TRY(build_module_loader(runtime, main_options));
+    // Move the deep frozen roots and library data, about half of what's live
+    // at this point, out of the way of the collector. It costs one full
+    // collection of what has been loaded so far but that data is then never
+    // copied by a full collection again. Runtimes don't promote on their own
+    // since most, like the ones the tests create, never collect enough for it
+    // to pay off.
+    E_TRY(runtime_promote_deep_frozen(runtime));
     for (size_t i = 0; i < options.argc; i++) {
       const char *filename = options.argv[i];
       value_t input;
@@ -249,11 +312,21 @@ static value_t neutrino_main(int argc, char **argv) {
         E_TRY_SET(input, read_file_to_blob(runtime, &filename_str));
       }
       E_TRY_DEF(program, safe_runtime_plankton_deserialize(runtime, protect(pool, input)));
-      result = safe_execute_syntax(runtime, protect(pool, ambience),
-          protect(pool, program));
+      result = safe_execute_syntax(runtime, s_ambience, protect(pool, program));
       if (options.print_value)
         print_ln("%v", result);
     }
+    if (config.profile_opcodes)
+      E_TRY(opcode_profile_print_report(runtime));
+    if (config.alloc_profile_interval > 0)
+      alloc_profile_print_report(runtime);
+    if (options.print_gc_stats)
+      gc_stats_print_report(runtime);
+    if (options.heap_dump != NULL) {
+      string_t heap_dump_str;
+      string_init(&heap_dump_str, options.heap_dump);
+      E_TRY(write_heap_dump_to_file(runtime, &heap_dump_str));
+    }
     E_RETURN(result);
   E_FINALLY();
     DISPOSE_SAFE_VALUE_POOL(pool);
@@ -20,6 +20,7 @@ void sigmap_input_init(sigmap_input_t *input, value_t ambience, value_t tags,
   input->frame = frame;
   input->data = data;
   input->argc = argc;
+  input->identity_mask = 0;
 }
 
 size_t sigmap_input_get_argument_count(sigmap_input_t *input) {
@@ -190,8 +191,12 @@ value_t match_signature(value_t self, sigmap_input_t *input,
       return success();
     }
     value_t value = sigmap_input_get_value_at(input, i);
+    value_t guard = get_parameter_guard(param);
     value_t score;
-    TRY(guard_match(get_parameter_guard(param), value, input, space, &score));
+    TRY(guard_match(guard, value, input, space, &score));
+    if (get_guard_type(guard) == gtEq && i < 64)
+      // Record that the result now depends on the identity of this argument.
+      input->identity_mask |= (1ULL << i);
     if (!is_score_match(score)) {
       // The guard says the argument doesn't match. Bail out.
       bit_vector_dispose(&params_seen);
@@ -201,7 +206,10 @@ value_t match_signature(value_t self, sigmap_input_t *input,
     // We got a match! Record the result and move on to the next.
     bit_vector_set_at(&params_seen, index, true);
     match_info->scores[i] = score;
-    match_info->offsets[index] = sigmap_input_get_offset_at(input, i);
+    // The argument map only uses the offsets of the first argc parameters,
+    // which always fit, so any others can be dropped.
+    if (index < match_info->capacity)
+      match_info->offsets[index] = sigmap_input_get_offset_at(input, i);
     if (!get_parameter_is_optional(param))
       mandatory_seen_count++;
   }
@@ -373,6 +381,37 @@ static value_t find_best_match(runtime_t *runtime, value_t current,
   }
 }
 
+// Returns the score of matching the given type against an is-guard for the
+// given target, using the lookup cache's type match table to avoid walking the
+// inheritance hierarchy more than once for the same type and target.
+static value_t get_is_match_score(runtime_t *runtime, value_t type,
+    value_t target, value_t space, value_t *score_out) {
+  if (value_identity_compare(type, target)) {
+    // Exact matches are the most common case and cheap to check directly.
+    *score_out = new_perfect_is_match_score();
+    return success();
+  }
+  uint64_t hash = (space.encoded ^ type.encoded) * 0x9E3779B97F4A7C15ULL;
+  hash = (hash ^ target.encoded) * 0x9E3779B97F4A7C15ULL;
+  size_t index = (hash ^ (hash >> 32)) & (kTypeMatchCacheSize - 1);
+  type_match_cache_entry_t *entry = &runtime->lookup_cache->type_matches[index];
+  if (is_same_value(entry->space, space)
+      && is_same_value(entry->type, type)
+      && is_same_value(entry->target, target)
+      && entry->epoch == runtime->methodspace_epoch) {
+    *score_out = entry->score;
+    return success();
+  }
+  TRY(find_best_match(runtime, type, target, new_perfect_is_match_score(),
+      space, score_out));
+  entry->space = space;
+  entry->type = type;
+  entry->target = target;
+  entry->epoch = runtime->methodspace_epoch;
+  entry->score = *score_out;
+  return success();
+}
+
 value_t guard_match(value_t guard, value_t value, sigmap_input_t *lookup_input,
     value_t space, value_t *score_out) {
   CHECK_FAMILY(ofGuard, guard);
@@ -386,8 +425,8 @@ value_t guard_match(value_t guard, value_t value, sigmap_input_t *lookup_input,
     case gtIs: {
       TRY_DEF(primary, get_primary_type(value, lookup_input->runtime));
       value_t target = get_guard_value(guard);
-      return find_best_match(lookup_input->runtime, primary, target,
-          new_perfect_is_match_score(), space, score_out);
+      return get_is_match_score(lookup_input->runtime, primary, target, space,
+          score_out);
     }
     case gtAny:
       *score_out = new_any_match_score();
@@ -468,10 +507,19 @@ TRIVIAL_PRINT_ON_IMPL(SignatureMap, signature_map);
 
 ACCESSORS_IMPL(SignatureMap, signature_map, acInFamily, ofArrayBuffer, Entries,
     entries);
+ACCESSORS_IMPL(SignatureMap, signature_map, acInFamilyOpt, ofIdHashMap,
+    SelectorIndex, selector_index);
+ACCESSORS_IMPL(SignatureMap, signature_map, acInFamilyOpt, ofArrayBuffer,
+    Unindexed, unindexed);
+ACCESSORS_IMPL(SignatureMap, signature_map, acInFamilyOpt, ofIdHashMap,
+    SubjectIndex, subject_index);
 
 value_t signature_map_validate(value_t value) {
   VALIDATE_FAMILY(ofSignatureMap, value);
   VALIDATE_FAMILY(ofArrayBuffer, get_signature_map_entries(value));
+  VALIDATE_FAMILY_OPT(ofIdHashMap, get_signature_map_selector_index(value));
+  VALIDATE_FAMILY_OPT(ofArrayBuffer, get_signature_map_unindexed(value));
+  VALIDATE_FAMILY_OPT(ofIdHashMap, get_signature_map_subject_index(value));
   return success();
 }
 
@@ -481,11 +529,176 @@ value_t add_to_signature_map(runtime_t *runtime, value_t map, value_t signature,
   CHECK_FAMILY(ofSignature, signature);
   value_t entries = get_signature_map_entries(map);
   TRY(add_to_pair_array_buffer(runtime, entries, signature, value));
+  // The index doesn't know about the new entry so it has to be rebuilt.
+  set_signature_map_selector_index(map, nothing());
+  set_signature_map_unindexed(map, nothing());
+  set_signature_map_subject_index(map, nothing());
+  return success();
+}
+
+// Returns the value of the guard of the given type an invocation must satisfy
+// for the argument with the given tag to match the given signature, or nothing
+// if it doesn't have to satisfy any particular one. Only parameters that can be
+// given by that tag alone count, otherwise an invocation might pass the
+// argument under another tag.
+static value_t get_signature_required_guard_value(value_t signature,
+    value_t tag, guard_type_t type) {
+  value_t tags = get_signature_tags(signature);
+  if (is_nothing(tags))
+    return nothing();
+  value_t param = binary_search_pair_array(tags, tag);
+  if (in_condition_cause(ccNotFound, param) || get_parameter_is_optional(param))
+    return nothing();
+  for (size_t i = 0; i < get_pair_array_length(tags); i++) {
+    if (is_same_value(get_pair_array_second_at(tags, i), param)
+        && !is_same_value(get_pair_array_first_at(tags, i), tag))
+      return nothing();
+  }
+  value_t guard = get_parameter_guard(param);
+  return (get_guard_type(guard) == type) ? get_guard_value(guard) : nothing();
+}
+
+// Returns the selector an invocation must have to match the given signature,
+// or nothing if it doesn't require any particular one.
+static value_t get_signature_required_selector(runtime_t *runtime,
+    value_t signature) {
+  return get_signature_required_guard_value(signature,
+      ROOT(runtime, selector_key), gtEq);
+}
+
+// Returns a subject index for the given signature map entries built from the
+// given selector index.
+static value_t build_subject_index(runtime_t *runtime, value_t entries,
+    value_t selector_index) {
+  TRY_DEF(subject_index, new_heap_id_hash_map(runtime, 16));
+  id_hash_map_iter_t iter;
+  id_hash_map_iter_init(&iter, selector_index);
+  while (id_hash_map_iter_advance(&iter)) {
+    value_t selector;
+    value_t bucket;
+    id_hash_map_iter_get_current(&iter, &selector, &bucket);
+    size_t bucket_length = get_array_buffer_length(bucket);
+    if (bucket_length < kSignatureMapSubjectIndexMinSize)
+      continue;
+    TRY_DEF(by_type, new_heap_id_hash_map(runtime, 16));
+    TRY_DEF(generic, new_heap_array_buffer(runtime, 4));
+    for (size_t i = 0; i < bucket_length; i++) {
+      value_t entry = get_array_buffer_at(bucket, i);
+      value_t signature = get_pair_array_buffer_first_at(entries,
+          get_integer_value(entry));
+      value_t type = get_signature_required_guard_value(signature,
+          ROOT(runtime, subject_key), gtIs);
+      value_t list = is_nothing(type)
+          ? new_not_found_condition()
+          : get_id_hash_map_at(by_type, type);
+      if (in_condition_cause(ccNotFound, list) && !is_nothing(type)) {
+        TRY_SET(list, new_heap_array_buffer(runtime, 4));
+        value_t added = set_id_hash_map_at(runtime, by_type, type, list);
+        if (in_condition_cause(ccHeapExhausted, added))
+          return added;
+        if (is_condition(added))
+          list = added;
+      }
+      // A type that can't be hashed is treated like no type at all.
+      TRY(add_to_array_buffer(runtime, is_condition(list) ? generic : list,
+          entry));
+    }
+    TRY_DEF(node, new_heap_array(runtime, 2));
+    set_array_at(node, 0, by_type);
+    set_array_at(node, 1, generic);
+    TRY(set_id_hash_map_at(runtime, subject_index, selector, node));
+  }
+  return subject_index;
+}
+
+// Builds the selector and subject indices of the given signature map.
+static value_t build_signature_map_index(runtime_t *runtime, value_t self) {
+  value_t entries = get_signature_map_entries(self);
+  size_t entry_count = get_pair_array_buffer_length(entries);
+  TRY_DEF(index, new_heap_id_hash_map(runtime, 16));
+  TRY_DEF(unindexed, new_heap_array_buffer(runtime, 16));
+  // First create a bucket for each required selector so the entries that don't
+  // require one can be added to all of them as we go. A selector that can't be
+  // hashed is treated as not required.
+  for (size_t i = 0; i < entry_count; i++) {
+    value_t signature = get_pair_array_buffer_first_at(entries, i);
+    value_t selector = get_signature_required_selector(runtime, signature);
+    if (is_nothing(selector))
+      continue;
+    value_t bucket = get_id_hash_map_at(index, selector);
+    if (!in_condition_cause(ccNotFound, bucket))
+      continue;
+    TRY_SET(bucket, new_heap_array_buffer(runtime, 4));
+    value_t added = set_id_hash_map_at(runtime, index, selector, bucket);
+    if (in_condition_cause(ccHeapExhausted, added))
+      return added;
+  }
+  for (size_t i = 0; i < entry_count; i++) {
+    value_t signature = get_pair_array_buffer_first_at(entries, i);
+    value_t selector = get_signature_required_selector(runtime, signature);
+    value_t entry = new_integer(i);
+    value_t bucket = is_nothing(selector)
+        ? new_not_found_condition()
+        : get_id_hash_map_at(index, selector);
+    if (is_condition(bucket)) {
+      TRY(add_to_array_buffer(runtime, unindexed, entry));
+      id_hash_map_iter_t iter;
+      id_hash_map_iter_init(&iter, index);
+      while (id_hash_map_iter_advance(&iter)) {
+        value_t key;
+        value_t all_bucket;
+        id_hash_map_iter_get_current(&iter, &key, &all_bucket);
+        TRY(add_to_array_buffer(runtime, all_bucket, entry));
+      }
+    } else {
+      TRY(add_to_array_buffer(runtime, bucket, entry));
+    }
+  }
+  TRY_DEF(subject_index, build_subject_index(runtime, entries, index));
+  set_signature_map_selector_index(self, index);
+  set_signature_map_unindexed(self, unindexed);
+  set_signature_map_subject_index(self, subject_index);
   return success();
 }
 
+// Freezes the given id hash map along with the values it maps to.
+static value_t ensure_id_hash_map_and_values_frozen(runtime_t *runtime,
+    value_t map) {
+  id_hash_map_iter_t iter;
+  id_hash_map_iter_init(&iter, map);
+  while (id_hash_map_iter_advance(&iter)) {
+    value_t key;
+    value_t value;
+    id_hash_map_iter_get_current(&iter, &key, &value);
+    TRY(ensure_frozen(runtime, value));
+  }
+  return ensure_frozen(runtime, map);
+}
+
 value_t ensure_signature_map_owned_values_frozen(runtime_t *runtime, value_t self) {
-  TRY(ensure_frozen(runtime, get_signature_map_entries(self)));
+  value_t entries = get_signature_map_entries(self);
+  TRY(ensure_frozen(runtime, entries));
+  // The entries can't change any more so this is a good time to index them.
+  size_t entry_count = get_pair_array_buffer_length(entries);
+  if (entry_count >= kSignatureMapIndexMinSize
+      && is_nothing(get_signature_map_selector_index(self)))
+    TRY(build_signature_map_index(runtime, self));
+  value_t index = get_signature_map_selector_index(self);
+  if (is_nothing(index))
+    return success();
+  value_t subject_index = get_signature_map_subject_index(self);
+  id_hash_map_iter_t iter;
+  id_hash_map_iter_init(&iter, subject_index);
+  while (id_hash_map_iter_advance(&iter)) {
+    value_t selector;
+    value_t node;
+    id_hash_map_iter_get_current(&iter, &selector, &node);
+    TRY(ensure_id_hash_map_and_values_frozen(runtime, get_array_at(node, 0)));
+    TRY(ensure_frozen(runtime, get_array_at(node, 1)));
+  }
+  TRY(ensure_id_hash_map_and_values_frozen(runtime, subject_index));
+  TRY(ensure_id_hash_map_and_values_frozen(runtime, index));
+  TRY(ensure_frozen(runtime, get_signature_map_unindexed(self)));
   return success();
 }
 
@@ -502,6 +715,10 @@ struct sigmap_state_t {
   // found.
   size_t *result_offsets;
   size_t *scratch_offsets;
+  // Scores of the entry currently being matched.
+  value_t *scratch_score;
+  // The capacity of the score and offset vectors.
+  size_t capacity;
   // Is the current max score vector synthetic, that is, is it taken over
   // several ambiguous entries that are each individually smaller than their
   // max?
@@ -518,48 +735,201 @@ static void sigmap_state_swap_offsets(sigmap_state_t *state) {
 }
 
 // The max amount of arguments for which we'll allocate the lookup state on the
-// stack.
+// stack. Larger lookups allocate it from scratch memory.
 #define kSmallLookupLimit 8
 
+// Returns the subject of the invocation, using the fact that the subject sorts
+// lowest so it must be at parameter index 0 if it is there at all. Note that
+// _parameter_ index 0 is not the same as _argument_ index 0, it doesn't have
+// to be the 0'th argument (that is, the first in evaluation order) for this
+// to work. Rather, the argument index must be given by the 0'th entry of the
+// invocation record. Potentially confusingly, the argument index will actually
+// almost always be 0 as well but that's not what we're using here (since we're
+// hardcoding the index we need _always_ always, not _almost_ always).
+static value_t get_invocation_subject_with_shortcut(sigmap_input_t *input) {
+  value_t tag_zero = sigmap_input_get_tag_at(input, 0);
+  if (is_same_value(tag_zero, ROOT(input->runtime, subject_key)))
+    return sigmap_input_get_value_at(input, 0);
+  else
+    return new_not_found_condition();
+}
+
+// Returns the selector of the lookup's input or a NotFound condition if there
+// is none. The tags are sorted and the selector comes after at most the
+// subject.
+static value_t get_invocation_selector(sigmap_input_t *input) {
+  value_t selector_key = ROOT(input->runtime, selector_key);
+  size_t argc = sigmap_input_get_argument_count(input);
+  for (size_t i = 0; i < argc && i < 2; i++) {
+    if (is_same_value(sigmap_input_get_tag_at(input, i), selector_key))
+      return sigmap_input_get_value_at(input, i);
+  }
+  return new_not_found_condition();
+}
+
+// Returns the array buffer of the indices of the entries of the given signature
+// map that may match an invocation with the given selector, or nothing if any
+// of them may.
+static value_t get_sigmap_candidates(sigmap_state_t *state, value_t sigmap,
+    value_t selector) {
+  value_t entries = get_signature_map_entries(sigmap);
+  if (get_pair_array_buffer_length(entries) < kSignatureMapIndexMinSize)
+    return nothing();
+  if (is_nothing(get_signature_map_selector_index(sigmap)))
+    TRY(build_signature_map_index(state->input.runtime, sigmap));
+  if (in_condition_cause(ccNotFound, selector))
+    return get_signature_map_unindexed(sigmap);
+  value_t bucket = get_id_hash_map_at(get_signature_map_selector_index(sigmap),
+      selector);
+  if (in_condition_cause(ccNotFound, bucket))
+    return get_signature_map_unindexed(sigmap);
+  // If the selector can't be hashed we fall back to trying everything.
+  return is_condition(bucket) ? nothing() : bucket;
+}
+
+// The max number of candidates we'll collect from a subject dispatch node. If
+// there are more the lookup uses the node's whole bucket instead.
+#define kMaxSubjectCandidates 32
+
+// Adds the indices of the candidates in the given dispatch table whose subject
+// guard is the given type or one of its supertypes. Sets *fits_out to false if
+// there are too many.
+static value_t collect_subject_candidates(runtime_t *runtime, value_t by_type,
+    value_t type, value_t space, size_t *indices, size_t *count,
+    bool *fits_out) {
+  value_t list = get_id_hash_map_at(by_type, type);
+  if (!is_condition(list)) {
+    size_t length = get_array_buffer_length(list);
+    if (*count + length > kMaxSubjectCandidates) {
+      *fits_out = false;
+      return success();
+    }
+    for (size_t i = 0; i < length; i++)
+      indices[(*count)++] = get_integer_value(get_array_buffer_at(list, i));
+  }
+  TRY_DEF(parents, get_type_parents(runtime, space, type));
+  for (size_t i = 0; i < get_array_buffer_length(parents) && *fits_out; i++) {
+    value_t parent = get_array_buffer_at(parents, i);
+    TRY(collect_subject_candidates(runtime, by_type, parent, space, indices,
+        count, fits_out));
+  }
+  return success();
+}
+
+// If the given signature map has a subject dispatch node for the given selector
+// stores the indices of the entries that may match the lookup's subject in
+// increasing order in the given array and sets *found_out to true. Otherwise
+// sets *found_out to false.
+static value_t get_subject_candidates(sigmap_state_t *state, value_t sigmap,
+    value_t selector, value_t space, size_t *indices, size_t *count_out,
+    bool *found_out) {
+  *found_out = false;
+  value_t subject_index = get_signature_map_subject_index(sigmap);
+  if (is_nothing(subject_index) || is_condition(selector))
+    return success();
+  value_t node = get_id_hash_map_at(subject_index, selector);
+  if (is_condition(node))
+    return success();
+  value_t by_type = get_array_at(node, 0);
+  value_t generic = get_array_at(node, 1);
+  size_t count = get_array_buffer_length(generic);
+  if (count > kMaxSubjectCandidates)
+    return success();
+  for (size_t i = 0; i < count; i++)
+    indices[i] = get_integer_value(get_array_buffer_at(generic, i));
+  value_t subject = get_invocation_subject_with_shortcut(&state->input);
+  if (!in_condition_cause(ccNotFound, subject)) {
+    runtime_t *runtime = state->input.runtime;
+    TRY_DEF(type, get_primary_type(subject, runtime));
+    bool fits = true;
+    TRY(collect_subject_candidates(runtime, by_type, type, space, indices,
+        &count, &fits));
+    if (!fits)
+      return success();
+  }
+  // The candidates have to be tried in the same order as without the index so
+  // sort them, dropping duplicates from types reachable along several paths.
+  for (size_t i = 1; i < count; i++) {
+    size_t index = indices[i];
+    size_t j = i;
+    for (; j > 0 && indices[j - 1] > index; j--)
+      indices[j] = indices[j - 1];
+    indices[j] = index;
+  }
+  size_t unique_count = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (unique_count == 0 || indices[unique_count - 1] != indices[i])
+      indices[unique_count++] = indices[i];
+  }
+  *count_out = unique_count;
+  *found_out = true;
+  return success();
+}
+
+// Matches the entry with the given index against the lookup's input and
+// includes it in the result if it matches.
+static value_t sigmap_state_match_entry(sigmap_state_t *state, value_t entries,
+    size_t index, value_t space, match_info_t *match_info) {
+  value_t signature = get_pair_array_buffer_first_at(entries, index);
+  value_t value = get_pair_array_buffer_second_at(entries, index);
+  match_result_t match = __mrNone__;
+  TRY(match_signature(signature, &state->input, space, match_info, &match));
+  if (!match_result_is_match(match))
+    return success();
+  size_t argc = sigmap_input_get_argument_count(&state->input);
+  join_status_t status = join_score_vectors(state->max_score,
+      state->scratch_score, argc);
+  if (status == jsBetter || (state->max_is_synthetic && status == jsEqual)) {
+    // This score is either better than the previous best, or it is equal to
+    // the max which is itself synthetic and hence better than any of the
+    // entries we've seen so far.
+    TRY((state->collector->vtable->add_better)(state->collector, value));
+    // Now the max definitely isn't synthetic.
+    state->max_is_synthetic = false;
+    // The offsets for the result is now stored in scratch_offsets and we have
+    // no more use for the previous result_offsets so we swap them around.
+    sigmap_state_swap_offsets(state);
+    // And then we have to update the match info with the new scratch offsets.
+    match_info_init(match_info, state->scratch_score, state->scratch_offsets,
+        state->capacity);
+  } else if (status != jsWorse) {
+    // The next score was not strictly worse than the best we've seen so we
+    // don't have a unique best.
+    TRY((state->collector->vtable->add_ambiguous)(state->collector, value));
+    // If the result is ambiguous that means the max is now synthetic.
+    state->max_is_synthetic = (status == jsAmbiguous);
+  }
+  return success();
+}
+
 value_t continue_sigmap_lookup(sigmap_state_t *state, value_t sigmap, value_t space) {
   CHECK_FAMILY(ofSignatureMap, sigmap);
   CHECK_FAMILY(ofMethodspace, space);
   TOPIC_INFO(Lookup, "Looking up in signature map %v", sigmap);
   value_t entries = get_signature_map_entries(sigmap);
-  size_t entry_count = get_pair_array_buffer_length(entries);
-  value_t scratch_score[kSmallLookupLimit];
   match_info_t match_info;
-  match_info_init(&match_info, scratch_score, state->scratch_offsets,
-      kSmallLookupLimit);
-  size_t argc = sigmap_input_get_argument_count(&state->input);
-  for (size_t current = 0; current < entry_count; current++) {
-    value_t signature = get_pair_array_buffer_first_at(entries, current);
-    value_t value = get_pair_array_buffer_second_at(entries, current);
-    match_result_t match = __mrNone__;
-    TRY(match_signature(signature, &state->input, space, &match_info, &match));
-    if (!match_result_is_match(match))
-      continue;
-    join_status_t status = join_score_vectors(state->max_score, scratch_score,
-        argc);
-    if (status == jsBetter || (state->max_is_synthetic && status == jsEqual)) {
-      // This score is either better than the previous best, or it is equal to
-      // the max which is itself synthetic and hence better than any of the
-      // entries we've seen so far.
-      TRY((state->collector->vtable->add_better)(state->collector, value));
-      // Now the max definitely isn't synthetic.
-      state->max_is_synthetic = false;
-      // The offsets for the result is now stored in scratch_offsets and we have
-      // no more use for the previous result_offsets so we swap them around.
-      sigmap_state_swap_offsets(state);
-      // And then we have to update the match info with the new scratch offsets.
-      match_info_init(&match_info, scratch_score, state->scratch_offsets,
-          kSmallLookupLimit);
-    } else if (status != jsWorse) {
-      // The next score was not strictly worse than the best we've seen so we
-      // don't have a unique best.
-      TRY((state->collector->vtable->add_ambiguous)(state->collector, value));
-      // If the result is ambiguous that means the max is now synthetic.
-      state->max_is_synthetic = (status == jsAmbiguous);
+  match_info_init(&match_info, state->scratch_score, state->scratch_offsets,
+      state->capacity);
+  value_t selector = get_invocation_selector(&state->input);
+  size_t subject_candidates[kMaxSubjectCandidates];
+  size_t subject_candidate_count = 0;
+  bool has_subject_candidates = false;
+  TRY(get_subject_candidates(state, sigmap, selector, space,
+      subject_candidates, &subject_candidate_count, &has_subject_candidates));
+  if (has_subject_candidates) {
+    for (size_t i = 0; i < subject_candidate_count; i++)
+      TRY(sigmap_state_match_entry(state, entries, subject_candidates[i], space,
+          &match_info));
+    return success();
+  }
+  TRY_DEF(candidates, get_sigmap_candidates(state, sigmap, selector));
+  if (is_nothing(candidates)) {
+    for (size_t i = 0; i < get_pair_array_buffer_length(entries); i++)
+      TRY(sigmap_state_match_entry(state, entries, i, space, &match_info));
+  } else {
+    for (size_t i = 0; i < get_array_buffer_length(candidates); i++) {
+      size_t index = get_integer_value(get_array_buffer_at(candidates, i));
+      TRY(sigmap_state_match_entry(state, entries, index, space, &match_info));
     }
   }
   return success();
@@ -574,38 +944,91 @@ static void sigmap_state_reset(sigmap_state_t *state) {
     state->max_score[i] = new_no_match_score();
 }
 
+// Performs a lookup using the given state whose vectors have been set up by
+// do_sigmap_lookup.
+static value_t run_sigmap_lookup(sigmap_state_t *state,
+    sigmap_state_callback_t callback) {
+  sigmap_state_reset(state);
+  TRY(callback(state));
+  return (state->collector->vtable->get_result)(state->collector);
+}
+
 value_t do_sigmap_lookup(value_t ambience, value_t tags, frame_t *frame,
     sigmap_state_callback_t callback, sigmap_collector_o *collector,
     void *data) {
-  // For now we only handle lookups of a certain size. Hopefully by the time
-  // this is too small this implementation will be gone anyway.
   size_t arg_count = get_call_tags_entry_count(tags);
-  CHECK_REL("too many arguments", arg_count, <=, kSmallLookupLimit);
-  // Initialize the lookup state using stack-allocated space.
-  value_t max_score[kSmallLookupLimit];
-  size_t offsets_one[kSmallLookupLimit];
-  size_t offsets_two[kSmallLookupLimit];
   sigmap_state_t state;
   sigmap_input_init(&state.input, ambience, tags, frame, data, arg_count);
   state.collector = collector;
-  state.max_score = max_score;
-  state.result_offsets = offsets_one;
-  state.scratch_offsets = offsets_two;
-  sigmap_state_reset(&state);
-  TRY(callback(&state));
-  return (state.collector->vtable->get_result)(state.collector);
+  if (arg_count <= kSmallLookupLimit) {
+    // Initialize the lookup state using stack-allocated space.
+    value_t max_score[kSmallLookupLimit];
+    value_t scratch_score[kSmallLookupLimit];
+    size_t offsets_one[kSmallLookupLimit];
+    size_t offsets_two[kSmallLookupLimit];
+    state.max_score = max_score;
+    state.scratch_score = scratch_score;
+    state.result_offsets = offsets_one;
+    state.scratch_offsets = offsets_two;
+    state.capacity = kSmallLookupLimit;
+    return run_sigmap_lookup(&state, callback);
+  }
+  // There are too many arguments for the stack so the vectors go in the
+  // runtime's lookup scratch memory. Lookups don't nest so there's only ever
+  // one user of it.
+  runtime_t *runtime = get_ambience_runtime(ambience);
+  value_t *scores = NULL;
+  size_t *offsets = NULL;
+  reusable_scratch_memory_double_alloc(&runtime->lookup_cache->scratch_memory,
+      2 * arg_count * sizeof(value_t), (void**) &scores,
+      2 * arg_count * sizeof(size_t), (void**) &offsets);
+  if (scores == NULL)
+    return new_system_error_condition(seAllocationFailed);
+  state.max_score = scores;
+  state.scratch_score = scores + arg_count;
+  state.result_offsets = offsets;
+  state.scratch_offsets = offsets + arg_count;
+  state.capacity = arg_count;
+  return run_sigmap_lookup(&state, callback);
+}
+
+// Returns true if the given offsets map each parameter to the argument that was
+// evaluated in the same position, which is what most invocations do.
+static bool is_in_order_argument_offsets(size_t offsetc, size_t *offsets) {
+  for (size_t i = 0; i < offsetc; i++) {
+    if (offsets[i] != offsetc - i - 1)
+      return false;
+  }
+  return true;
 }
 
 // Given an array of offsets, builds and returns an argument map that performs
-// that offset mapping.
+// that offset mapping. The in-order maps are kept in a separate buffer indexed
+// by argument count so the common case doesn't have to walk the trie.
 static value_t build_argument_map(runtime_t *runtime, size_t offsetc, size_t *offsets) {
+  bool is_in_order = is_in_order_argument_offsets(offsetc, offsets);
+  value_t in_order_maps = MROOT(runtime, in_order_argument_maps);
+  size_t in_order_count = get_array_buffer_length(in_order_maps);
+  if (is_in_order && offsetc < in_order_count) {
+    value_t cached = get_array_buffer_at(in_order_maps, offsetc);
+    if (!is_null(cached))
+      return cached;
+  }
   value_t current_node = MROOT(runtime, argument_map_trie_root);
   for (size_t i = 0; i < offsetc; i++) {
     size_t offset = offsets[i];
     value_t value = (offset == kNoOffset) ? null() : new_integer(offset);
     TRY_SET(current_node, get_argument_map_trie_child(runtime, current_node, value));
   }
-  return get_argument_map_trie_value(current_node);
+  value_t result = get_argument_map_trie_value(current_node);
+  if (is_in_order) {
+    // The map is still the one from the trie so both ways of getting it yield
+    // the same object.
+    for (size_t i = in_order_count; i <= offsetc; i++)
+      TRY(add_to_array_buffer(runtime, in_order_maps, null()));
+    set_array_buffer_at(in_order_maps, offsetc, result);
+  }
+  return result;
 }
 
 value_t get_sigmap_lookup_argument_map(sigmap_state_t *state) {
@@ -619,6 +1042,203 @@ value_t get_sigmap_lookup_argument_map(sigmap_state_t *state) {
 }
 
 
+// Returns the methodspace a lookup with the given subject will be delegated to
+// if the delegate method is found in the normal lookup. Only lambdas and blocks
+// have delegate methodspaces, for everything else the result is nothing.
+static value_t get_delegate_methodspace(value_t subject) {
+  if (in_family(ofLambda, subject)) {
+    return get_lambda_methods(subject);
+  } else if (in_family(ofBlock, subject)) {
+    value_t section = get_block_section(subject);
+    return get_block_section_methodspace(section);
+  } else {
+    return nothing();
+  }
+}
+
+
+// --- L o o k u p   c a c h e ---
+
+void lookup_cache_clear(lookup_cache_t *cache) {
+  for (size_t i = 0; i < kLookupCacheSetCount * kLookupCacheSetSize; i++)
+    cache->entries[i].tags = nothing();
+  for (size_t i = 0; i < kTypeMatchCacheSize; i++)
+    cache->type_matches[i].space = nothing();
+}
+
+void lookup_cache_init(lookup_cache_t *cache) {
+  lookup_cache_clear(cache);
+  cache->hits = 0;
+  cache->misses = 0;
+  reusable_scratch_memory_init(&cache->scratch_memory);
+}
+
+void lookup_cache_dispose(lookup_cache_t *cache) {
+  reusable_scratch_memory_dispose(&cache->scratch_memory);
+}
+
+// The parts of a lookup that determine which cache entries apply to it,
+// gathered once such that they don't have to be recalculated for each entry.
+typedef struct {
+  runtime_t *runtime;
+  value_t ambience;
+  value_t tags;
+  value_t fragment;
+  value_t helper;
+  size_t argc;
+  // The arguments and their primary types in sorted tag order.
+  value_t values[kLookupCacheMaxArgumentCount];
+  value_t types[kLookupCacheMaxArgumentCount];
+  // The signal handlers on the stack and their methodspaces, innermost first.
+  value_t handlers[kLookupCacheMaxHandlerCount];
+  value_t handler_spaces[kLookupCacheMaxHandlerCount];
+  size_t handler_count;
+  // Hash of everything above except the argument values, which can't be
+  // hashed since whether they matter depends on the entry.
+  uint64_t hash;
+} lookup_cache_query_t;
+
+// Returns the primary type of the given value for use as a cache key, or
+// nothing if it has none. Lookups can only observe values without a primary
+// type through their identity so they can all share the same key.
+static value_t get_cache_key_type(value_t value, runtime_t *runtime) {
+  return has_primary_type(value) ? get_primary_type(value, runtime) : nothing();
+}
+
+// Mixes the given value into a lookup cache hash.
+static uint64_t lookup_cache_hash_mix(uint64_t hash, value_t value) {
+  return (hash ^ value.encoded) * 0x9E3779B97F4A7C15ULL;
+}
+
+// Gathers the lookup cache query for an invocation. Returns false if the
+// lookup can't be cached.
+static bool lookup_cache_query_init(lookup_cache_query_t *query,
+    value_t ambience, value_t tags, frame_t *frame, value_t fragment,
+    value_t helper) {
+  query->runtime = get_ambience_runtime(ambience);
+  query->ambience = ambience;
+  query->tags = tags;
+  query->fragment = fragment;
+  query->helper = helper;
+  query->handler_count = 0;
+  size_t argc = query->argc = get_call_tags_entry_count(tags);
+  if (argc > kLookupCacheMaxArgumentCount)
+    return false;
+  uint64_t hash = lookup_cache_hash_mix(0, tags);
+  hash = lookup_cache_hash_mix(hash, fragment);
+  hash = lookup_cache_hash_mix(hash, helper);
+  for (size_t i = 0; i < argc; i++) {
+    value_t value = query->values[i] = frame_get_pending_argument_at(frame,
+        tags, i);
+    value_t type = query->types[i] = get_cache_key_type(value, query->runtime);
+    hash = lookup_cache_hash_mix(hash, type);
+  }
+  query->hash = hash;
+  return true;
+}
+
+// Adds the signal handlers on the stack to the given query. Returns false if
+// there are too many for the lookup to be cached.
+static bool lookup_cache_query_add_handlers(lookup_cache_query_t *query,
+    frame_t *frame) {
+  barrier_iter_t barrier_iter;
+  value_t barrier = barrier_iter_init(&barrier_iter, frame);
+  while (!is_nothing(barrier)) {
+    if (in_genus(dgSignalHandlerSection, barrier)) {
+      if (query->handler_count == kLookupCacheMaxHandlerCount)
+        return false;
+      value_t space = get_barrier_state_payload(barrier);
+      query->handlers[query->handler_count] = barrier;
+      query->handler_spaces[query->handler_count] = space;
+      query->handler_count++;
+      query->hash = lookup_cache_hash_mix(query->hash, space);
+    }
+    barrier = barrier_iter_advance(&barrier_iter);
+  }
+  return true;
+}
+
+// Returns the first entry of the set the given query belongs to.
+static lookup_cache_entry_t *lookup_cache_get_set(lookup_cache_t *cache,
+    lookup_cache_query_t *query) {
+  uint64_t hash = query->hash ^ (query->hash >> 32);
+  size_t set = hash & (kLookupCacheSetCount - 1);
+  return &cache->entries[set * kLookupCacheSetSize];
+}
+
+// Returns true iff the given entry holds the result for the given query.
+static bool lookup_cache_entry_matches(lookup_cache_entry_t *entry,
+    lookup_cache_query_t *query) {
+  if (!is_same_value(entry->tags, query->tags)
+      || !is_same_value(entry->fragment, query->fragment)
+      || !is_same_value(entry->helper, query->helper)
+      || !is_same_value(entry->ambience, query->ambience)
+      || entry->epoch != query->runtime->methodspace_epoch
+      || entry->handler_count != query->handler_count)
+    return false;
+  for (size_t i = 0; i < query->argc; i++) {
+    bool is_identity = (entry->footprint.identity_mask & (1ULL << i)) != 0;
+    value_t key = is_identity ? query->values[i] : query->types[i];
+    if (!is_same_value(entry->keys[i], key))
+      return false;
+  }
+  for (size_t i = 0; i < query->handler_count; i++) {
+    if (!is_same_value(entry->handler_spaces[i], query->handler_spaces[i]))
+      return false;
+  }
+  value_t delegate_space = entry->footprint.delegate_space;
+  return is_nothing(delegate_space)
+      || is_same_value(delegate_space, get_delegate_methodspace(query->values[0]));
+}
+
+// Returns the entry holding the result for the given query or NULL if there
+// is none.
+static lookup_cache_entry_t *lookup_cache_probe(lookup_cache_t *cache,
+    lookup_cache_query_t *query) {
+  lookup_cache_entry_t *set = lookup_cache_get_set(cache, query);
+  for (size_t i = 0; i < kLookupCacheSetSize; i++) {
+    lookup_cache_entry_t *entry = &set[i];
+    if (is_nothing(entry->tags))
+      // Entries are added at the front so once we see an empty one the rest
+      // will be empty too.
+      break;
+    if (lookup_cache_entry_matches(entry, query)) {
+      cache->hits++;
+      return entry;
+    }
+  }
+  cache->misses++;
+  return NULL;
+}
+
+// Records the result of a lookup in the cache. The entry goes at the front of
+// its set, evicting the oldest entry if the set is full.
+static void lookup_cache_insert(lookup_cache_t *cache,
+    lookup_cache_query_t *query, lookup_footprint_t *footprint, value_t method,
+    value_t arg_map, size_t handler_index) {
+  lookup_cache_entry_t *set = lookup_cache_get_set(cache, query);
+  memmove(&set[1], &set[0],
+      (kLookupCacheSetSize - 1) * sizeof(lookup_cache_entry_t));
+  lookup_cache_entry_t *entry = &set[0];
+  entry->tags = query->tags;
+  entry->fragment = query->fragment;
+  entry->helper = query->helper;
+  entry->ambience = query->ambience;
+  entry->epoch = query->runtime->methodspace_epoch;
+  entry->footprint = *footprint;
+  for (size_t i = 0; i < query->argc; i++) {
+    bool is_identity = (footprint->identity_mask & (1ULL << i)) != 0;
+    entry->keys[i] = is_identity ? query->values[i] : query->types[i];
+  }
+  entry->handler_count = query->handler_count;
+  for (size_t i = 0; i < query->handler_count; i++)
+    entry->handler_spaces[i] = query->handler_spaces[i];
+  entry->method = method;
+  entry->arg_map = arg_map;
+  entry->handler_index = handler_index;
+}
+
+
 // --- M e t h o d   s p a c e ---
 
 ACCESSORS_IMPL(Methodspace, methodspace, acInFamily, ofIdHashMap, Inheritance,
@@ -648,6 +1268,7 @@ value_t add_methodspace_inheritance(runtime_t *runtime, value_t self,
   CHECK_MUTABLE(self);
   CHECK_FAMILY(ofType, subtype);
   CHECK_FAMILY(ofType, supertype);
+  runtime->methodspace_epoch++;
   value_t inheritance = get_methodspace_inheritance(self);
   value_t parents = get_id_hash_map_at(inheritance, subtype);
   if (in_condition_cause(ccNotFound, parents)) {
@@ -667,6 +1288,7 @@ value_t add_methodspace_import(runtime_t *runtime, value_t self, value_t importe
   CHECK_FAMILY(ofMethodspace, self);
   CHECK_FAMILY(ofMethodspace, imported);
   CHECK_MUTABLE(self);
+  runtime->methodspace_epoch++;
   value_t imports = get_methodspace_imports(self);
   return add_to_array_buffer(runtime, imports, imported);
 }
@@ -676,6 +1298,7 @@ value_t add_methodspace_method(runtime_t *runtime, value_t self,
   CHECK_FAMILY(ofMethodspace, self);
   CHECK_MUTABLE(self);
   CHECK_FAMILY(ofMethod, method);
+  runtime->methodspace_epoch++;
   value_t signature = get_method_signature(method);
   return add_to_signature_map(runtime, get_methodspace_methods(self), signature,
       method);
@@ -703,22 +1326,6 @@ static value_t get_invocation_subject_no_shortcut(sigmap_input_t *input) {
   return new_not_found_condition();
 }
 
-// Returns the subject of the invocation, using the fact that the subject sorts
-// lowest so it must be at parameter index 0 if it is there at all. Note that
-// _parameter_ index 0 is not the same as _argument_ index 0, it doesn't have
-// to be the 0'th argument (that is, the first in evaluation order) for this
-// to work. Rather, the argument index must be given by the 0'th entry of the
-// invocation record. Potentially confusingly, the argument index will actually
-// almost always be 0 as well but that's not what we're using here (since we're
-// hardcoding the index we need _always_ always, not _almost_ always).
-static value_t get_invocation_subject_with_shortcut(sigmap_input_t *input) {
-  value_t tag_zero = sigmap_input_get_tag_at(input, 0);
-  if (is_same_value(tag_zero, ROOT(input->runtime, subject_key)))
-    return sigmap_input_get_value_at(input, 0);
-  else
-    return new_not_found_condition();
-}
-
 // Ensures that the given methodspace as well as all transitive dependencies
 // are present in the given cache array.
 static value_t ensure_methodspace_transitive_dependencies(runtime_t *runtime,
@@ -826,6 +1433,7 @@ typedef struct {
   value_t value;
   value_t helper;
   value_t *arg_map_out;
+  lookup_footprint_t *footprint_out;
 } value_and_argument_map_t;
 
 // Lookup match collector that keeps the best result seen so far and returns
@@ -901,15 +1509,18 @@ value_t lookup_methodspace_method(value_t ambience, value_t methodspace,
   value_and_argument_map_t data;
   data.value = methodspace;
   data.arg_map_out = arg_map_out;
+  data.footprint_out = NULL;
   best_match_collector_o collector = best_match_collector_new();
   return do_sigmap_lookup(ambience, tags, frame, do_methodspace_method_lookup,
       (sigmap_collector_o*) &collector, &data);
 }
 
-// A pair of an argument map and a handler output parameter.
+// A pair of an argument map and a handler output parameter, plus the lookup
+// footprint.
 typedef struct {
   value_t *handler_out;
   value_t *arg_map_out;
+  lookup_footprint_t *footprint_out;
 } handler_and_arg_map_t;
 
 // Lookup match collector that keeps the most specific signal handler as well as
@@ -981,42 +1592,57 @@ static value_t do_signal_handler_method_lookup(sigmap_state_t *state) {
   }
   TRY_SET(*data->arg_map_out, get_sigmap_lookup_argument_map(state));
   *data->handler_out = collector->result_handler;
+  data->footprint_out->identity_mask = state->input.identity_mask;
   return success();
 }
 
 value_t lookup_signal_handler_method(value_t ambience, value_t tags,
     frame_t *frame, value_t *handler_out, value_t *arg_map_out) {
+  lookup_cache_t *cache = get_ambience_runtime(ambience)->lookup_cache;
+  lookup_cache_query_t query;
+  bool is_cacheable = lookup_cache_query_init(&query, ambience, tags, frame,
+      nothing(), nothing()) && lookup_cache_query_add_handlers(&query, frame);
+  if (is_cacheable) {
+    lookup_cache_entry_t *entry = lookup_cache_probe(cache, &query);
+    if (entry != NULL) {
+      *handler_out = query.handlers[entry->handler_index];
+      *arg_map_out = entry->arg_map;
+      return entry->method;
+    }
+  }
+  lookup_footprint_t footprint;
+  footprint.identity_mask = 0;
+  footprint.delegate_space = nothing();
   handler_and_arg_map_t data;
   data.handler_out = handler_out;
   data.arg_map_out = arg_map_out;
+  data.footprint_out = &footprint;
   signal_handler_collector_o collector = signal_handler_collector_new();
-  return do_sigmap_lookup(ambience, tags, frame,
+  TRY_DEF(result, do_sigmap_lookup(ambience, tags, frame,
       do_signal_handler_method_lookup, (sigmap_collector_o*) &collector,
-      &data);
-}
-
-// Performs the extra lookup for lambda methods that happens when the lambda
-// delegate method is found in the normal lookup.
-static value_t complete_special_lambda_lookup(sigmap_state_t *state,
-    value_t subject) {
-  CHECK_FAMILY(ofLambda, subject);
-  value_t lambda_space = get_lambda_methods(subject);
-  sigmap_state_reset(state);
-  value_and_argument_map_t *data = (value_and_argument_map_t*) state->input.data;
-  data->value = lambda_space;
-  return do_methodspace_method_lookup(state);
+      &data));
+  if (is_cacheable && in_family(ofMethod, result)) {
+    for (size_t i = 0; i < query.handler_count; i++) {
+      if (is_same_value(query.handlers[i], *handler_out)) {
+        lookup_cache_insert(cache, &query, &footprint, result, *arg_map_out, i);
+        break;
+      }
+    }
+  }
+  return result;
 }
 
-// Performs the extra lookup for block methods that happens when the block
-// delegate method is found in the normal lookup.
-static value_t complete_special_block_lookup(sigmap_state_t *state,
+// Performs the extra lookup for lambda and block methods that happens when the
+// lambda or block delegate method is found in the normal lookup.
+static value_t complete_special_delegate_lookup(sigmap_state_t *state,
     value_t subject) {
-  CHECK_FAMILY(ofBlock, subject);
-  value_t section = get_block_section(subject);
-  value_t block_space = get_block_section_methodspace(section);
+  value_t delegate_space = get_delegate_methodspace(subject);
+  CHECK_FAMILY(ofMethodspace, delegate_space);
   sigmap_state_reset(state);
   value_and_argument_map_t *data = (value_and_argument_map_t*) state->input.data;
-  data->value = block_space;
+  data->value = delegate_space;
+  if (data->footprint_out != NULL)
+    data->footprint_out->delegate_space = delegate_space;
   return do_methodspace_method_lookup(state);
 }
 
@@ -1032,31 +1658,64 @@ static value_t do_full_method_lookup(sigmap_state_t *state) {
   TRY(lookup_subject_methods(state, &subject));
   value_t result = (state->collector->vtable->get_result)(state->collector);
   TOPIC_INFO(Lookup, "Lookup result: %v", result);
+  bool is_delegate = false;
   if (in_family(ofMethod, result)) {
     value_t result_flags = get_method_flags(result);
     if (!is_flag_set_empty(result_flags)) {
       // The result has at least one special flag set so we have to give this
       // lookup special treatment.
       if (get_flag_set_at(result_flags, mfLambdaDelegate)) {
-        return complete_special_lambda_lookup(state, subject);
+        CHECK_FAMILY(ofLambda, subject);
+        is_delegate = true;
       } else if (get_flag_set_at(result_flags, mfBlockDelegate)) {
-        return complete_special_block_lookup(state, subject);
+        CHECK_FAMILY(ofBlock, subject);
+        is_delegate = true;
       }
     }
   }
-  TRY_SET(*data->arg_map_out, get_sigmap_lookup_argument_map(state));
+  if (is_delegate) {
+    TRY(complete_special_delegate_lookup(state, subject));
+  } else {
+    TRY_SET(*data->arg_map_out, get_sigmap_lookup_argument_map(state));
+  }
+  if (data->footprint_out != NULL)
+    data->footprint_out->identity_mask = state->input.identity_mask;
   return success();
 }
 
 value_t lookup_method_full(value_t ambience, value_t fragment,
-    value_t tags, frame_t *frame, value_t helper, value_t *arg_map_out) {
+    value_t tags, frame_t *frame, value_t helper, value_t *arg_map_out,
+    lookup_footprint_t *footprint_out) {
+  lookup_cache_t *cache = get_ambience_runtime(ambience)->lookup_cache;
+  lookup_cache_query_t query;
+  bool is_cacheable = lookup_cache_query_init(&query, ambience, tags, frame,
+      fragment, helper);
+  if (is_cacheable) {
+    lookup_cache_entry_t *entry = lookup_cache_probe(cache, &query);
+    if (entry != NULL) {
+      *arg_map_out = entry->arg_map;
+      if (footprint_out != NULL)
+        *footprint_out = entry->footprint;
+      return entry->method;
+    }
+  }
+  // The cache needs the footprint even if the caller doesn't.
+  lookup_footprint_t footprint;
+  if (footprint_out == NULL)
+    footprint_out = &footprint;
+  footprint_out->identity_mask = 0;
+  footprint_out->delegate_space = nothing();
   value_and_argument_map_t data;
   data.value = fragment;
   data.helper = helper;
   data.arg_map_out = arg_map_out;
+  data.footprint_out = footprint_out;
   best_match_collector_o collector = best_match_collector_new();
-  return do_sigmap_lookup(ambience, tags, frame, do_full_method_lookup,
-      (sigmap_collector_o*) &collector, &data);
+  TRY_DEF(result, do_sigmap_lookup(ambience, tags, frame, do_full_method_lookup,
+      (sigmap_collector_o*) &collector, &data));
+  if (is_cacheable && in_family(ofMethod, result))
+    lookup_cache_insert(cache, &query, footprint_out, result, *arg_map_out, 0);
+  return result;
 }
 
 value_t plankton_new_methodspace(runtime_t *runtime) {
@@ -1066,6 +1725,7 @@ value_t plankton_new_methodspace(runtime_t *runtime) {
 value_t plankton_set_methodspace_contents(value_t object, runtime_t *runtime,
     value_t contents) {
   UNPACK_PLANKTON_MAP(contents, methods, inheritance, imports);
+  runtime->methodspace_epoch++;
   set_methodspace_methods(object, methods_value);
   set_methodspace_inheritance(object, inheritance_value);
   set_methodspace_imports(object, imports_value);
@@ -1083,6 +1743,140 @@ void methodspace_print_on(value_t self, print_on_context_t *context) {
 }
 
 
+// --- I n l i n e   c a c h e ---
+
+// Returns true iff the given inline cache was populated within the given
+// ambience and the current methodspace epoch.
+static bool is_inline_cache_current(value_t cache, value_t ambience,
+    runtime_t *runtime) {
+  value_t epoch = get_array_at(cache, kInlineCacheEpochOffset);
+  value_t cache_ambience = get_array_at(cache, kInlineCacheAmbienceOffset);
+  return is_same_value(epoch, new_integer(runtime->methodspace_epoch))
+      && is_same_value(cache_ambience, ambience);
+}
+
+// Clears any entries in the given inline cache and associates it with the
+// given ambience and the current methodspace epoch.
+static void reset_inline_cache(value_t cache, value_t ambience,
+    runtime_t *runtime) {
+  set_array_at(cache, kInlineCacheEpochOffset,
+      new_integer(runtime->methodspace_epoch));
+  set_array_at(cache, kInlineCacheAmbienceOffset, ambience);
+  set_array_at(cache, kInlineCacheEntryCountOffset, new_integer(0));
+}
+
+// Returns the size of each entry in an inline cache for calls with the given
+// number of arguments.
+static size_t get_inline_cache_entry_size(size_t argc) {
+  return kInlineCacheEntryHeaderSize + argc;
+}
+
+// Returns the key to use for the given argument in an inline cache.
+static value_t get_inline_cache_key(value_t value, bool is_identity,
+    runtime_t *runtime) {
+  return is_identity ? value : get_cache_key_type(value, runtime);
+}
+
+value_t probe_inline_cache(value_t ambience, value_t inline_caches,
+    size_t index, value_t tags, frame_t *frame, value_t *code_block_out,
+    value_t *arg_map_out) {
+  CHECK_FAMILY(ofArray, inline_caches);
+  value_t cache = get_array_at(inline_caches, index);
+  if (!in_family(ofArray, cache))
+    // The site has never been resolved.
+    return new_not_found_condition();
+  runtime_t *runtime = get_ambience_runtime(ambience);
+  if (!is_inline_cache_current(cache, ambience, runtime))
+    return new_not_found_condition();
+  size_t argc = get_call_tags_entry_count(tags);
+  size_t entry_count = get_integer_value(get_array_at(cache,
+      kInlineCacheEntryCountOffset));
+  if (entry_count == 0)
+    return new_not_found_condition();
+  // Fetch the arguments and their primary types once up front rather than for
+  // each entry.
+  value_t values[kInlineCacheMaxArgumentCount];
+  value_t types[kInlineCacheMaxArgumentCount];
+  CHECK_REL("too many cached arguments", argc, <=, kInlineCacheMaxArgumentCount);
+  for (size_t i = 0; i < argc; i++) {
+    values[i] = frame_get_pending_argument_at(frame, tags, i);
+    types[i] = get_cache_key_type(values[i], runtime);
+  }
+  size_t entry_size = get_inline_cache_entry_size(argc);
+  for (size_t ie = 0; ie < entry_count; ie++) {
+    size_t entry = kInlineCacheHeaderSize + ie * entry_size;
+    uint64_t identity_mask = get_integer_value(get_array_at(cache,
+        entry + kInlineCacheEntryIdentityMaskOffset));
+    bool is_match = true;
+    for (size_t i = 0; i < argc && is_match; i++) {
+      value_t key = get_array_at(cache, entry + kInlineCacheEntryHeaderSize + i);
+      bool is_identity = (identity_mask & (1ULL << i)) != 0;
+      is_match = is_same_value(key, is_identity ? values[i] : types[i]);
+    }
+    if (!is_match)
+      continue;
+    value_t delegate_space = get_array_at(cache,
+        entry + kInlineCacheEntryDelegateSpaceOffset);
+    if (!is_nothing(delegate_space)) {
+      // The lookup was delegated so it also depends on the subject's delegate
+      // methodspace, not just its type.
+      if (!is_same_value(delegate_space, get_delegate_methodspace(values[0])))
+        continue;
+    }
+    *code_block_out = get_array_at(cache, entry + kInlineCacheEntryCodeBlockOffset);
+    *arg_map_out = get_array_at(cache, entry + kInlineCacheEntryArgumentMapOffset);
+    return get_array_at(cache, entry + kInlineCacheEntryMethodOffset);
+  }
+  return new_not_found_condition();
+}
+
+value_t update_inline_cache(value_t ambience, value_t inline_caches,
+    size_t index, value_t tags, frame_t *frame, lookup_footprint_t *footprint,
+    value_t method, value_t code_block, value_t arg_map) {
+  CHECK_FAMILY(ofArray, inline_caches);
+  CHECK_FAMILY(ofMethod, method);
+  CHECK_FAMILY(ofCodeBlock, code_block);
+  runtime_t *runtime = get_ambience_runtime(ambience);
+  size_t argc = get_call_tags_entry_count(tags);
+  if (argc > kInlineCacheMaxArgumentCount)
+    return success();
+  value_t keys[kInlineCacheMaxArgumentCount];
+  for (size_t i = 0; i < argc; i++) {
+    value_t value = frame_get_pending_argument_at(frame, tags, i);
+    bool is_identity = (footprint->identity_mask & (1ULL << i)) != 0;
+    keys[i] = get_inline_cache_key(value, is_identity, runtime);
+  }
+  size_t entry_size = get_inline_cache_entry_size(argc);
+  value_t cache = get_array_at(inline_caches, index);
+  if (!in_family(ofArray, cache)) {
+    TRY_SET(cache, new_heap_array(runtime,
+        kInlineCacheHeaderSize + kInlineCacheMaxEntryCount * entry_size));
+    reset_inline_cache(cache, ambience, runtime);
+    set_array_at(inline_caches, index, cache);
+  } else if (!is_inline_cache_current(cache, ambience, runtime)) {
+    reset_inline_cache(cache, ambience, runtime);
+  }
+  size_t entry_count = get_integer_value(get_array_at(cache,
+      kInlineCacheEntryCountOffset));
+  if (entry_count == kInlineCacheMaxEntryCount)
+    // The site is megamorphic; leave the existing entries as they are.
+    return success();
+  size_t entry = kInlineCacheHeaderSize + entry_count * entry_size;
+  set_array_at(cache, entry + kInlineCacheEntryIdentityMaskOffset,
+      new_integer(footprint->identity_mask));
+  set_array_at(cache, entry + kInlineCacheEntryDelegateSpaceOffset,
+      footprint->delegate_space);
+  set_array_at(cache, entry + kInlineCacheEntryMethodOffset, method);
+  set_array_at(cache, entry + kInlineCacheEntryCodeBlockOffset, code_block);
+  set_array_at(cache, entry + kInlineCacheEntryArgumentMapOffset, arg_map);
+  for (size_t i = 0; i < argc; i++)
+    set_array_at(cache, entry + kInlineCacheEntryHeaderSize + i, keys[i]);
+  set_array_at(cache, kInlineCacheEntryCountOffset,
+      new_integer(entry_count + 1));
+  return success();
+}
+
+
 // --- I n v o c a t i o n   r e c o r d ---
 
 ACCESSORS_IMPL(CallTags, call_tags, acInFamily, ofArray, Entries, entries);
@@ -8,6 +8,7 @@
 #define _METHOD
 
 #include "process.h"
+#include "runtime.h"
 #include "value-inl.h"
 
 // Input to a signature map lookup. This is the stuff that's fixed across the
@@ -27,6 +28,9 @@ typedef struct {
   void *data;
   // Cache of the number of arguments.
   size_t argc;
+  // Bit vector of the arguments whose identity, not just their primary type,
+  // has been observed by the lookup.
+  uint64_t identity_mask;
 } sigmap_input_t;
 
 // Initializes an input struct appropriately.
@@ -259,16 +263,58 @@ value_t compile_method_ast_to_method(runtime_t *runtime, value_t method_ast,
 /// Typically a signature map lookup happens across multiple maps, for instance
 /// all the sets of methods imported into a particular scope.
 
-static const size_t kSignatureMapSize = HEAP_OBJECT_SIZE(1);
+///
+/// Matching every signature against every invocation gets expensive for large
+/// maps so maps with enough entries are indexed by selector: most signatures
+/// require the selector to be one particular operation and those can only match
+/// invocations of that operation. The index maps each such operation to the
+/// entries that may match it, which includes the ones that don't require any
+/// particular selector, and lookup only matches against those. A mutable map is
+/// indexed the first time it's looked up in and adding to it drops the index;
+/// a frozen map is indexed when it's frozen.
+///
+/// Large enough buckets are additionally split by the type the subject is
+/// required to have so lookup only has to match the entries whose subject guard
+/// is the subject's type or one of its supertypes, along with those that don't
+/// require a particular type.
+
+static const size_t kSignatureMapSize = HEAP_OBJECT_SIZE(4);
 static const size_t kSignatureMapEntriesOffset = HEAP_OBJECT_FIELD_OFFSET(0);
+static const size_t kSignatureMapSelectorIndexOffset = HEAP_OBJECT_FIELD_OFFSET(1);
+static const size_t kSignatureMapUnindexedOffset = HEAP_OBJECT_FIELD_OFFSET(2);
+static const size_t kSignatureMapSubjectIndexOffset = HEAP_OBJECT_FIELD_OFFSET(3);
 
 // The size of the method array buffer in an empty signature map.
 static const size_t kMethodArrayInitialSize = 16;
 
+// Signature maps with fewer entries than this are not indexed, it's cheaper to
+// just match against all of them.
+static const size_t kSignatureMapIndexMinSize = 8;
+
+// Buckets with fewer entries than this are not split by subject type.
+static const size_t kSignatureMapSubjectIndexMinSize = 4;
+
 // The signature+value entries in this signature map. The entries are stored as
 // alternating signatures and values.
 ACCESSORS_DECL(signature_map, entries);
 
+// Id hash map from selectors to array buffers of the indices of the entries
+// that may match an invocation with that selector, in increasing order. Nothing
+// if the map hasn't been indexed.
+ACCESSORS_DECL(signature_map, selector_index);
+
+// Array buffer of the indices of the entries that don't require any particular
+// selector, which are the only ones that may match invocations whose selector
+// isn't in the selector index. Nothing if the map hasn't been indexed.
+ACCESSORS_DECL(signature_map, unindexed);
+
+// Id hash map from selectors to the bucket for that selector split by subject
+// type. Each value is a two-element array of an id hash map from types to
+// array buffers of the indices of the entries whose subject must be of that
+// type, and an array buffer of the indices of the rest of the bucket's entries.
+// Nothing if the map hasn't been indexed.
+ACCESSORS_DECL(signature_map, subject_index);
+
 // Adds a mapping to the given signature map, expanding it if necessary. Returns
 // a condition on failure.
 value_t add_to_signature_map(runtime_t *runtime, value_t map, value_t signature,
@@ -341,15 +387,29 @@ value_t get_type_parents(runtime_t *runtime, value_t space, value_t type);
 value_t add_methodspace_method(runtime_t *runtime, value_t self,
     value_t method);
 
+// Describes which parts of the input a method lookup depended on. Any other
+// invocation at the same site that agrees with the original one on these will
+// produce the same result.
+typedef struct {
+  // Bit vector of the arguments whose identity was observed. For the remaining
+  // arguments only the primary type matters.
+  uint64_t identity_mask;
+  // If the lookup was delegated to a lambda or block this is the methodspace
+  // it was delegated to, otherwise nothing.
+  value_t delegate_space;
+} lookup_footprint_t;
+
 // Looks up a method in this method space given an invocation record and a stack
 // frame, as well as the origin of the subject type. If the match is successful,
 // as a side-effect stores an argument map that maps between the result's
-// parameters and argument offsets on the stack.
+// parameters and argument offsets on the stack. If the footprint argument is
+// non-NULL a description of what the result depended on is stored there.
 //
 // TODO: this is an approximation of the intended lookup mechanism and should be
 //   revised later on, for instance to not hard-code the subject origin lookup.
 value_t lookup_method_full(value_t ambience, value_t fragment,
-    value_t tags, frame_t *frame, value_t helper, value_t *arg_map_out);
+    value_t tags, frame_t *frame, value_t helper, value_t *arg_map_out,
+    lookup_footprint_t *footprint_out);
 
 value_t lookup_methodspace_method(value_t ambience, value_t methodspace,
     value_t tags, frame_t *frame, value_t *arg_map_out);
@@ -367,6 +427,149 @@ value_t get_or_create_module_fragment_methodspaces_cache(runtime_t *runtime,
     value_t fragment);
 
 
+// --- I n l i n e   c a c h e ---
+
+// An inline cache remembers the results of the lookups performed at a single
+// call site. It is a plain array stored in the code block's inline cache slot
+// for the site, starting with a header followed by the entries. The cache is
+// only valid for the ambience and methodspace epoch recorded in the header;
+// if either has changed the entries are discarded.
+static const size_t kInlineCacheEpochOffset = 0;
+static const size_t kInlineCacheAmbienceOffset = 1;
+static const size_t kInlineCacheEntryCountOffset = 2;
+static const size_t kInlineCacheHeaderSize = 3;
+
+// Each entry holds the lookup result and footprint followed by one key for each
+// argument: the argument itself if its identity was observed, otherwise its
+// primary type.
+static const size_t kInlineCacheEntryIdentityMaskOffset = 0;
+static const size_t kInlineCacheEntryDelegateSpaceOffset = 1;
+static const size_t kInlineCacheEntryMethodOffset = 2;
+static const size_t kInlineCacheEntryCodeBlockOffset = 3;
+static const size_t kInlineCacheEntryArgumentMapOffset = 4;
+static const size_t kInlineCacheEntryHeaderSize = 5;
+
+// The number of entries a cache will hold before the site is considered
+// megamorphic and no more entries are added.
+static const size_t kInlineCacheMaxEntryCount = 4;
+
+// Calls with more arguments than this are not cached.
+#define kInlineCacheMaxArgumentCount 8
+
+// Looks for a cached lookup result for the invocation with the given tags at
+// the index'th inline cache of a code block. If there is one the method is
+// returned and its code block and argument map are stored in the out params,
+// otherwise a NotFound condition is returned.
+value_t probe_inline_cache(value_t ambience, value_t inline_caches,
+    size_t index, value_t tags, frame_t *frame, value_t *code_block_out,
+    value_t *arg_map_out);
+
+// Records the result of a lookup in the index'th inline cache of a code block
+// such that subsequent invocations that agree with this one on the footprint
+// can be resolved by probe_inline_cache.
+value_t update_inline_cache(value_t ambience, value_t inline_caches,
+    size_t index, value_t tags, frame_t *frame, lookup_footprint_t *footprint,
+    value_t method, value_t code_block, value_t arg_map);
+
+
+// --- L o o k u p   c a c h e ---
+
+// The lookup cache is a runtime-wide fixed-size table of lookup results
+// consulted by lookup_method_full and lookup_signal_handler_method before
+// they do a full lookup. Where inline caches give up on megamorphic sites the
+// lookup cache keeps going, just less quickly. It is organized as a number of
+// sets each holding a few entries; a lookup hashes into a set and then scans
+// the entries of that set. Because the entries hold raw values the cache is
+// cleared on every garbage collection.
+//
+// The lookup cache also holds a table of the scores of matching types against
+// is-guards, which is used by guard_match during full lookups such that the
+// inheritance hierarchy only has to be walked the first time a type is matched
+// against a particular target.
+
+// The number of sets in the cache. Must be a power of two.
+#define kLookupCacheSetCount 256
+
+// The number of entries in each set.
+#define kLookupCacheSetSize 4
+
+// Lookups with more arguments than this are not cached.
+#define kLookupCacheMaxArgumentCount 8
+
+// Signal handler lookups with more signal handlers on the stack than this are
+// not cached.
+#define kLookupCacheMaxHandlerCount 4
+
+// The number of entries in the type match table. Must be a power of two.
+#define kTypeMatchCacheSize 1024
+
+// A single cached lookup result.
+typedef struct {
+  // The tags of the invocation. If nothing the entry is empty.
+  value_t tags;
+  // For method lookups the fragment and helper of the invocation, for signal
+  // handler lookups nothing.
+  value_t fragment;
+  value_t helper;
+  // The ambience the lookup was performed within.
+  value_t ambience;
+  // The methodspace epoch when the lookup was performed.
+  uint64_t epoch;
+  // What the result depended on.
+  lookup_footprint_t footprint;
+  // One key per argument: the argument itself if its identity was observed,
+  // otherwise its primary type.
+  value_t keys[kLookupCacheMaxArgumentCount];
+  // The methodspaces of the signal handlers on the stack at the time of the
+  // lookup, innermost first.
+  value_t handler_spaces[kLookupCacheMaxHandlerCount];
+  size_t handler_count;
+  // The result of the lookup.
+  value_t method;
+  value_t arg_map;
+  // For signal handler lookups the index of the handler the method came from.
+  size_t handler_index;
+} lookup_cache_entry_t;
+
+// The cached score of matching a type against an is-guard.
+typedef struct {
+  // The methodspace whose inheritance hierarchy was used. If nothing the entry
+  // is empty.
+  value_t space;
+  // The type being matched and the guard's type.
+  value_t type;
+  value_t target;
+  // The methodspace epoch when the score was calculated.
+  uint64_t epoch;
+  value_t score;
+} type_match_cache_entry_t;
+
+// The runtime-wide lookup cache.
+struct lookup_cache_t {
+  lookup_cache_entry_t entries[kLookupCacheSetCount * kLookupCacheSetSize];
+  // Is-guard scores, hashed directly on the space, type, and target.
+  type_match_cache_entry_t type_matches[kTypeMatchCacheSize];
+  // The number of lookups that were resolved by the cache.
+  uint64_t hits;
+  // The number of cacheable lookups that weren't resolved by the cache.
+  uint64_t misses;
+  // Memory for the state of lookups with too many arguments to keep it on
+  // the stack. It's kept across lookups so it only has to be allocated when a
+  // lookup needs more than any before it.
+  reusable_scratch_memory_t scratch_memory;
+};
+
+// Resets all the entries of the given cache. The counters are left as they
+// are.
+void lookup_cache_clear(lookup_cache_t *cache);
+
+// Initializes the given cache, including the counters.
+void lookup_cache_init(lookup_cache_t *cache);
+
+// Releases any memory held by the given cache other than the cache itself.
+void lookup_cache_dispose(lookup_cache_t *cache);
+
+
 /// ## Call tags
 ///
 /// A call tags object is a mapping from parameter tag names to the offset
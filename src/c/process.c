@@ -757,7 +757,11 @@ static bool is_invocation_opcode(opcode_t op) {
   }
 }
 
-value_t capture_backtrace_entry(runtime_t *runtime, frame_t *frame) {
+// Creates a backtrace entry from the given stack frame, or returns nothing if
+// that's not possible or the frame isn't suspended at an ordinary invoke and
+// invokes_only is true.
+static value_t capture_some_backtrace_entry(runtime_t *runtime, frame_t *frame,
+    bool invokes_only) {
   // Check whether the program counter stored for this frame points immediately
   // after an invoke instruction. If it does we'll use that instruction to
   // construct the entry.
@@ -769,7 +773,7 @@ value_t capture_backtrace_entry(runtime_t *runtime, frame_t *frame) {
   blob_t data;
   get_blob_data(bytecode, &data);
   opcode_t op = (opcode_t) blob_short_at(&data, pc - kInvokeOperationSize);
-  if (!is_invocation_opcode(op))
+  if (!is_invocation_opcode(op) || (invokes_only && op != ocInvoke))
     return nothing();
   value_t tags = whatever();
   if (op == ocCallEnsurer) {
@@ -796,3 +800,25 @@ value_t capture_backtrace_entry(runtime_t *runtime, frame_t *frame) {
   // Wrap the result in a backtrace entry.
   return new_heap_backtrace_entry(runtime, invocation, new_integer(op));
 }
+
+value_t capture_backtrace_entry(runtime_t *runtime, frame_t *frame) {
+  return capture_some_backtrace_entry(runtime, frame, false);
+}
+
+value_t capture_invoke_backtrace_entry(runtime_t *runtime, frame_t *frame) {
+  return capture_some_backtrace_entry(runtime, frame, true);
+}
+
+value_t get_frame_invoke_tags(frame_t *frame) {
+  value_t code_block = frame_get_code_block(frame);
+  size_t pc = frame->pc;
+  if (pc < kInvokeOperationSize)
+    return nothing();
+  blob_t data;
+  get_blob_data(get_code_block_bytecode(code_block), &data);
+  opcode_t op = (opcode_t) blob_short_at(&data, pc - kInvokeOperationSize);
+  if (op != ocInvoke)
+    return nothing();
+  size_t record_index = blob_short_at(&data, pc - kInvokeOperationSize + 1);
+  return get_array_at(get_code_block_value_pool(code_block), record_index);
+}
@@ -549,5 +549,15 @@ void backtrace_entry_invocation_print_on(value_t invocation, int32_t opcode,
 // created nothing is returned.
 value_t capture_backtrace_entry(runtime_t *runtime, frame_t *frame);
 
+// Like capture_backtrace_entry but only creates entries for frames suspended at
+// an ordinary invoke and returns nothing for any other frame. Unlike the rest
+// those can be captured at any point during execution, not just while a signal
+// is being delivered, since their arguments stay where the invoke left them.
+value_t capture_invoke_backtrace_entry(runtime_t *runtime, frame_t *frame);
+
+// Returns the call tags of the ordinary invoke the given frame is suspended at,
+// or nothing if it isn't suspended at one.
+value_t get_frame_invoke_tags(frame_t *frame);
+
 
 #endif // _PROCESS
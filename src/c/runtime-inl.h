@@ -13,9 +13,11 @@
 #define RETRY_ONCE_IMPL(RUNTIME, DELEGATE) do {                                \
   value_t __result__ = (DELEGATE);                                             \
   if (in_condition_cause(ccHeapExhausted, __result__)) {                       \
-    runtime_garbage_collect(RUNTIME);                                          \
+    runtime_garbage_collect_nursery(RUNTIME);                                  \
     runtime_toggle_fuzzing(RUNTIME, false);                                    \
+    runtime_toggle_nursery_overflow(RUNTIME, true);                            \
     __result__ = (DELEGATE);                                                   \
+    runtime_toggle_nursery_overflow(RUNTIME, false);                           \
     runtime_toggle_fuzzing(RUNTIME, true);                                     \
     if (in_condition_cause(ccHeapExhausted, __result__))                       \
       return new_out_of_memory_condition();                                    \
@@ -6,13 +6,15 @@
 #include "check.h"
 #include "ctrino.h"
 #include "derived.h"
+#include "interp.h"
 #include "log.h"
+#include "method.h"
 #include "runtime-inl.h"
 #include "safe-inl.h"
+#include "thread.h"
 #include "try-inl.h"
 #include "value-inl.h"
 
-
 // --- R o o t s ---
 
 TRIVIAL_PRINT_ON_IMPL(Roots, roots);
@@ -30,7 +32,7 @@ static value_t create_stack_bottom_code_block(runtime_t *runtime) {
   assembler_dispose(&assm);
   size_t high_water_mark = 1 + kStackBarrierSize;
   return new_heap_code_block(runtime, bytecode, ROOT(runtime, empty_array),
-      high_water_mark);
+      high_water_mark, 0);
 }
 
 // Creates the code block object that gets executed when returning across stack
@@ -44,7 +46,7 @@ static value_t create_stack_piece_bottom_code_block(runtime_t *runtime) {
   TRY_DEF(bytecode, new_heap_blob_with_data(runtime, &blob));
   assembler_dispose(&assm);
   return new_heap_code_block(runtime, bytecode, ROOT(runtime, empty_array),
-      1);
+      1, 0);
 }
 
 // Creates an array of invocation records of the form
@@ -167,7 +169,7 @@ value_t roots_init(value_t roots, runtime_t *runtime) {
   RAW_ROOT(roots, array_of_zero) = array_of_zero;
   TRY_DEF(empty_blob, new_heap_blob(runtime, 0));
   TRY_SET(RAW_ROOT(roots, empty_code_block), new_heap_code_block(runtime,
-      empty_blob, empty_array, 0));
+      empty_blob, empty_array, 0, 0));
   TRY_SET(RAW_ROOT(roots, empty_array_buffer), new_heap_array_buffer(runtime, 0));
   TRY_SET(RAW_ROOT(roots, empty_path), new_heap_path(runtime, afFreeze, nothing(),
       nothing()));
@@ -346,6 +348,7 @@ TRIVIAL_PRINT_ON_IMPL(MutableRoots, mutable_roots);
 value_t mutable_roots_validate(value_t self) {
   VALIDATE_FAMILY(ofMutableRoots, self);
   VALIDATE_HEAP_OBJECT(ofArgumentMapTrie, RAW_MROOT(self, argument_map_trie_root));
+  VALIDATE_HEAP_OBJECT(ofArrayBuffer, RAW_MROOT(self, in_order_argument_maps));
   return success();
 }
 
@@ -410,9 +413,43 @@ static value_t runtime_hard_init(runtime_t *runtime, const runtime_config_t *con
   // Initialize the heap and roots. After this the runtime is sort-of ready to
   // be used.
   TRY(heap_init(&runtime->heap, config));
+  memory_block_t cache_memory = allocator_default_malloc(sizeof(lookup_cache_t));
+  if (memory_block_is_empty(cache_memory))
+    return new_system_error_condition(seAllocationFailed);
+  runtime->lookup_cache = (lookup_cache_t*) cache_memory.memory;
+  lookup_cache_init(runtime->lookup_cache);
+  // The table must be in place before the roots since some of them are code
+  // blocks.
+  memory_block_t table_memory = allocator_default_malloc(
+      sizeof(code_block_table_t));
+  if (memory_block_is_empty(table_memory))
+    return new_system_error_condition(seAllocationFailed);
+  runtime->code_block_table = (code_block_table_t*) table_memory.memory;
+  bool use_native_code = config->enable_jit && !config->profile_opcodes
+      && jit_is_supported();
+  TRY(code_block_table_init(runtime->code_block_table, use_native_code,
+      config->jit_threshold));
+  if (config->profile_opcodes) {
+    memory_block_t profile_memory = allocator_default_malloc(
+        sizeof(opcode_profile_t));
+    if (memory_block_is_empty(profile_memory))
+      return new_system_error_condition(seAllocationFailed);
+    runtime->opcode_profile = (opcode_profile_t*) profile_memory.memory;
+    opcode_profile_init(runtime->opcode_profile);
+  }
   TRY_SET(runtime->roots, new_heap_uninitialized_roots(runtime));
   TRY(roots_init(runtime->roots, runtime));
   TRY_SET(runtime->mutable_roots, new_heap_mutable_roots(runtime));
+  // Allocation profiling starts once the roots are in place since sampling
+  // needs the species of the objects allocated to be valid.
+  if (config->alloc_profile_interval > 0) {
+    memory_block_t profile_memory = allocator_default_malloc(
+        sizeof(alloc_profile_t));
+    if (memory_block_is_empty(profile_memory))
+      return new_system_error_condition(seAllocationFailed);
+    runtime->alloc_profile = (alloc_profile_t*) profile_memory.memory;
+    alloc_profile_init(runtime->alloc_profile, config->alloc_profile_interval);
+  }
   // Check that everything looks sane.
   return runtime_validate(runtime, nothing());
 }
@@ -486,13 +523,35 @@ static value_t value_validator_visit(value_visitor_o *self, value_t value) {
 }
 
 value_t runtime_validate(runtime_t *runtime, value_t cause) {
-  TRY(heap_validate(&runtime->heap));
+  return runtime_validate_at_level(runtime, gvFull, cause);
+}
+
+value_t runtime_validate_at_level(runtime_t *runtime,
+    gc_validation_level_t level, value_t cause) {
+  if (level == gvNone)
+    return success();
+  heap_t *heap = &runtime->heap;
+  TRY(heap_validate(heap));
+  if (level == gvRoots) {
+    TRY(value_validate(runtime->roots));
+    return value_validate(runtime->mutable_roots);
+  }
   value_visitor_o visitor;
   visitor.vtable.visit = value_validator_visit;
-  TRY(heap_for_each_object(&runtime->heap, &visitor));
+  TRY(heap_for_each_object(heap, &visitor));
+  TRY(heap_validate_remembered_set(heap));
+  if (level == gvExpensive)
+    TRY(heap_validate_references(heap));
   return success();
 }
 
+// Validates the runtime to the level given in its config, which is what is
+// done before and after garbage collection and when disposing the runtime.
+static value_t runtime_validate_for_gc(runtime_t *runtime) {
+  return runtime_validate_at_level(runtime,
+      runtime->heap.config.gc_validation_level, nothing());
+}
+
 // A record of an object that needs to be fixed up post-migration.
 typedef struct {
   // The new object that we're migrating to. All fields have already been
@@ -560,14 +619,26 @@ static void pending_fixup_worklist_dispose(pending_fixup_worklist_t *worklist) {
   }
 }
 
+FORWARD(gc_worker_t);
+
 // State maintained during garbage collection. Also functions as a field visitor
 // such that it's easy to traverse objects.
 typedef struct {
   field_visitor_o super;
   // The runtime we're collecting.
   runtime_t *runtime;
+  // Is this a collection of just the nursery?
+  bool is_nursery_collection;
+  // If this collection promotes deep frozen objects, the previous immortal
+  // space from which they are being moved. Otherwise NULL.
+  space_t *immortal_from_space;
   // List of objects to post-process after migration.
   pending_fixup_worklist_t pending_fixups;
+  // Where to record statistics about the objects migrated.
+  gc_stats_t *stats;
+  // During a parallel collection, the worker this state belongs to. Otherwise
+  // NULL.
+  gc_worker_t *worker;
 } garbage_collection_state_o;
 
 // Allocates memory in to-space for the given object and copies it raw into that
@@ -576,9 +647,14 @@ static value_t migrate_field_shallow(garbage_collection_state_o *self,
     value_t *field);
 
 // Initializes a garbage collection state object.
-static garbage_collection_state_o garbage_collection_state_new(runtime_t *runtime) {
+static garbage_collection_state_o garbage_collection_state_new(runtime_t *runtime,
+    bool is_nursery_collection) {
   garbage_collection_state_o result;
   result.runtime = runtime;
+  result.is_nursery_collection = is_nursery_collection;
+  result.immortal_from_space = NULL;
+  result.stats = &runtime->gc_stats;
+  result.worker = NULL;
   result.super.vtable.visit = (field_visitor_visit_m) migrate_field_shallow;
   pending_fixup_worklist_init(&result.pending_fixups);
   return result;
@@ -589,17 +665,299 @@ static void garbage_collection_state_dispose(garbage_collection_state_o *self) {
   pending_fixup_worklist_dispose(&self->pending_fixups);
 }
 
-static value_t migrate_object_shallow(value_t object, space_t *space) {
+/// ## Statistics
+
+// Adds the time since the given reading of the monotonic clock to the given
+// pause total.
+static void gc_stats_record_pause(gc_stats_t *stats, uint64_t *total,
+    uint64_t start) {
+  uint64_t usecs = get_monotonic_time_usecs() - start;
+  *total += usecs;
+  if (usecs > stats->max_pause_usecs)
+    stats->max_pause_usecs = usecs;
+}
+
+// Records that the given object, which is about to be migrated or marked, has
+// survived a collection.
+static void gc_stats_record_survivor(gc_stats_t *stats, value_t object) {
+  heap_object_family_t family =
+      get_heap_object_family_behavior_unchecked(object)->family;
+  stats->survivor_counts[get_heap_object_family_ordinal(family)]++;
+}
+
+// A family ordinal and how many objects of that family have survived.
+typedef struct {
+  size_t ordinal;
+  uint64_t count;
+} survivor_entry_t;
+
+// Compares two survivor entries such that the largest count comes first.
+static int compare_survivor_entries(const void *a, const void *b) {
+  uint64_t count_a = ((const survivor_entry_t*) a)->count;
+  uint64_t count_b = ((const survivor_entry_t*) b)->count;
+  return (count_a < count_b) - (count_a > count_b);
+}
+
+void gc_stats_print_report(runtime_t *runtime) {
+  gc_stats_t *stats = &runtime->gc_stats;
+  uint64_t collections = stats->nursery_collections + stats->full_collections;
+  uint64_t total_usecs = stats->nursery_pause_usecs + stats->full_pause_usecs;
+  print_ln("--- GC stats: %lli collections, %lli us ---",
+      (long long) collections, (long long) total_usecs);
+  print_ln("nursery collections: %lli (%lli us)",
+      (long long) stats->nursery_collections,
+      (long long) stats->nursery_pause_usecs);
+  print_ln("full collections:    %lli (%lli us)",
+      (long long) stats->full_collections,
+      (long long) stats->full_pause_usecs);
+  print_ln("longest pause:       %lli us", (long long) stats->max_pause_usecs);
+  print_ln("bytes allocated:     %lli", (long long) stats->bytes_allocated);
+  print_ln("bytes copied:        %lli", (long long) stats->bytes_copied);
+  print_ln("space sizes:         old %lli, large %lli, immortal %lli",
+      (long long) space_get_capacity_bytes(&runtime->heap.old_space),
+      (long long) runtime->heap.large_object_space.used_bytes,
+      (long long) space_get_used_bytes(&runtime->heap.immortal_space));
+  // Survivors by family, most frequent first.
+  survivor_entry_t entries[kNextFamilyOrdinal];
+  for (size_t i = 0; i < kNextFamilyOrdinal; i++) {
+    survivor_entry_t entry = {i, stats->survivor_counts[i]};
+    entries[i] = entry;
+  }
+  qsort(entries, kNextFamilyOrdinal, sizeof(survivor_entry_t),
+      compare_survivor_entries);
+  print_ln("survivors by family:");
+  char row[256];
+  for (size_t i = 0; i < kNextFamilyOrdinal && entries[i].count > 0; i++) {
+    heap_object_family_t family =
+        (heap_object_family_t) NEW_STATIC_INTEGER(entries[i].ordinal);
+    snprintf(row, sizeof(row), "  %-24s %14llu",
+        get_heap_object_family_name(family),
+        (unsigned long long) entries[i].count);
+    print_ln("%s", row);
+  }
+}
+
+/// ## Parallel collection state
+
+// The number of locks used to keep threads from copying the same object at the
+// same time during a parallel collection.
+#define kGcForwardLockCount 64
+
+// Objects larger than this are allocated directly in old space rather than in
+// the threads' copy buffers.
+#define kGcMaxBufferedSize (kGcCopyBufferSize / 8)
+
+// Threads don't hand out grey regions smaller than this to idle threads.
+#define kGcMinShareSize (1 * kKB)
+
+// A range of objects in old space whose fields haven't been migrated yet.
+typedef struct {
+  address_t start;
+  address_t limit;
+} gc_region_t;
+
+// A worker's stack of grey regions. The worker pushes and pops regions and the
+// other workers steal them when they run out of work.
+typedef struct {
+  // Guards the regions.
+  native_mutex_t *lock;
+  // The regions on the stack.
+  gc_region_t *regions;
+  // The number of regions on the stack. Workers looking for something to steal
+  // read this without holding the lock.
+  uint64_t length;
+  // The number of regions there is room for.
+  size_t capacity;
+} gc_region_stack_t;
+
+// The state shared between the workers of a parallel collection.
+typedef struct {
+  // The runtime being collected.
+  runtime_t *runtime;
+  // The workers, the first of which runs on the thread that started the
+  // collection.
+  gc_worker_t *workers;
+  // The number of workers.
+  size_t worker_count;
+  // Guards the state shared between workers other than the grey stacks and the
+  // object headers: allocation in old space, the marks on large objects, the
+  // remembered set, and the allocator which isn't thread safe.
+  native_mutex_t *lock;
+  // Held while an object is being copied such that only one thread copies it.
+  // Which lock guards an object is determined by its address.
+  native_mutex_t *forward_locks[kGcForwardLockCount];
+  // The number of workers that are looking for work or have work to do. When
+  // it drops to zero the collection is done.
+  uint64_t active_count;
+  // The species of the arrays used to fill the unused ends of copy buffers.
+  value_t filler_species;
+} parallel_gc_t;
+
+// One of the threads that perform a parallel collection.
+struct gc_worker_t {
+  // The state used to migrate fields on this worker.
+  garbage_collection_state_o state;
+  // The state shared with the other workers.
+  parallel_gc_t *shared;
+  // This worker's index among all the workers.
+  size_t index;
+  // The first object in the copy buffer whose fields haven't been migrated.
+  address_t scan;
+  // The next free address in the copy buffer.
+  address_t next_free;
+  // The end of the copy buffer.
+  address_t limit;
+  // Regions of old space whose fields haven't been migrated.
+  gc_region_stack_t grey;
+  // Statistics for the objects migrated by this worker, added to the runtime's
+  // when the collection is done.
+  gc_stats_t stats;
+  // The thread running this worker, NULL for the first one.
+  native_thread_t *thread;
+  // The result of running this worker.
+  value_t result;
+};
+
+// Adds the given region to the given stack.
+static value_t gc_region_stack_push(parallel_gc_t *shared,
+    gc_region_stack_t *stack, gc_region_t region) {
+  native_mutex_lock(stack->lock);
+  if (stack->length == stack->capacity) {
+    size_t new_capacity = (stack->capacity == 0) ? 16 : 2 * stack->capacity;
+    native_mutex_lock(shared->lock);
+    memory_block_t memory = allocator_default_malloc(
+        new_capacity * sizeof(gc_region_t));
+    if (!memory_block_is_empty(memory) && stack->capacity > 0) {
+      memcpy(memory.memory, stack->regions, stack->length * sizeof(gc_region_t));
+      allocator_default_free(new_memory_block(stack->regions,
+          stack->capacity * sizeof(gc_region_t)));
+    }
+    native_mutex_unlock(shared->lock);
+    if (memory_block_is_empty(memory)) {
+      native_mutex_unlock(stack->lock);
+      return new_system_error_condition(seAllocationFailed);
+    }
+    stack->regions = (gc_region_t*) memory.memory;
+    stack->capacity = new_capacity;
+  }
+  stack->regions[stack->length] = region;
+  atomic_add_uint64(&stack->length, 1);
+  native_mutex_unlock(stack->lock);
+  return success();
+}
+
+// If the given stack is nonempty removes the top region, stores it in the out
+// parameter, and returns true. Otherwise returns false.
+static bool gc_region_stack_pop(gc_region_stack_t *stack,
+    gc_region_t *region_out) {
+  native_mutex_lock(stack->lock);
+  bool result = (stack->length > 0);
+  if (result)
+    *region_out = stack->regions[atomic_subtract_uint64(&stack->length, 1)];
+  native_mutex_unlock(stack->lock);
+  return result;
+}
+
+// Returns true if the given worker should hand the given number of bytes of
+// grey objects over to the other workers rather than migrate them itself,
+// which is the case when some of them are idle and it has nothing on its
+// stack they could steal.
+static bool gc_worker_should_share(gc_worker_t *self, size_t size) {
+  parallel_gc_t *shared = self->shared;
+  return size >= kGcMinShareSize
+      && atomic_load_uint64(&self->grey.length) == 0
+      && atomic_load_uint64(&shared->active_count) < shared->worker_count;
+}
+
+// Fills the given unused range of old space with an array that nothing refers
+// to such that the space can still be traversed one object at a time.
+static void gc_fill_gap(parallel_gc_t *shared, address_t start,
+    address_t limit) {
+  if (start == limit)
+    return;
+  size_t header_size = calc_array_size(0);
+  CHECK_REL("gap too small", (size_t) (limit - start), >=, header_size);
+  size_t length = (limit - start - header_size) / kValueSize;
+  value_t filler = new_heap_object(start);
+  *access_heap_object_field(filler, kHeapObjectHeaderOffset) =
+      shared->filler_species;
+  *access_heap_object_field(filler, kArrayLengthOffset) = new_integer(length);
+  for (size_t i = 0; i < length; i++)
+    *access_heap_object_field(filler, kArrayElementsOffset + i * kValueSize) =
+        null();
+}
+
+// Allocates the given number of bytes directly in old space.
+static address_t parallel_gc_alloc(parallel_gc_t *self, size_t size) {
+  native_mutex_lock(self->lock);
+  address_t result = NULL;
+  bool alloc_succeeded = space_try_alloc(&self->runtime->heap.old_space, size,
+      &result);
+  native_mutex_unlock(self->lock);
+  CHECK_TRUE("clone alloc failed", alloc_succeeded);
+  return result;
+}
+
+// Gives up the given worker's copy buffer. The objects in it that haven't been
+// scanned are pushed on the worker's stack and the rest is filled.
+static value_t gc_worker_retire_buffer(gc_worker_t *self) {
+  if (self->scan < self->next_free) {
+    gc_region_t region = {self->scan, self->next_free};
+    TRY(gc_region_stack_push(self->shared, &self->grey, region));
+  }
+  gc_fill_gap(self->shared, self->next_free, self->limit);
+  self->scan = self->next_free = self->limit = NULL;
+  return success();
+}
+
+// Allocates room for a copy of an object of the given size, in the worker's
+// copy buffer unless it's large.
+static value_t gc_worker_alloc(gc_worker_t *self, size_t size,
+    address_t *memory_out) {
+  if (size > kGcMaxBufferedSize) {
+    *memory_out = parallel_gc_alloc(self->shared, size);
+    return success();
+  }
+  size_t free = self->limit - self->next_free;
+  // A gap of a single word can't be filled so the buffer is retired before
+  // that can happen.
+  if (size > free || free - size == kValueSize) {
+    TRY(gc_worker_retire_buffer(self));
+    address_t buffer = parallel_gc_alloc(self->shared, kGcCopyBufferSize);
+    self->scan = self->next_free = buffer;
+    self->limit = buffer + kGcCopyBufferSize;
+  }
+  *memory_out = self->next_free;
+  self->next_free += size;
+  return success();
+}
+
+/// ## Object migration
+
+static value_t migrate_object_shallow(garbage_collection_state_o *self,
+    value_t object, space_t *space) {
   // Ask the object to describe its layout.
   heap_object_layout_t layout;
   get_heap_object_layout(object, &layout);
   // Allocate new room for the object.
   address_t source = get_heap_object_address(object);
   address_t target = NULL;
-  bool alloc_succeeded = space_try_alloc(space, layout.size, &target);
-  CHECK_TRUE("clone alloc failed", alloc_succeeded);
+  gc_worker_t *worker = self->worker;
+  if (worker == NULL) {
+    bool alloc_succeeded = space_try_alloc(space, layout.size, &target);
+    CHECK_TRUE("clone alloc failed", alloc_succeeded);
+  } else {
+    TRY(gc_worker_alloc(worker, layout.size, &target));
+  }
   // Do a raw copy of the object to the target.
   memcpy(target, source, layout.size);
+  self->stats->bytes_copied += layout.size;
+  if (worker != NULL && layout.size > kGcMaxBufferedSize) {
+    // Large objects aren't in a copy buffer so they have to be scanned
+    // separately.
+    gc_region_t region = {target, target + layout.size};
+    TRY(gc_region_stack_push(worker->shared, &worker->grey, region));
+  }
   // Tag the new location as an object and return it.
   return new_heap_object(target);
 }
@@ -609,12 +967,186 @@ static bool needs_post_migrate_fixup(value_t old_object) {
   return get_heap_object_family_behavior_unchecked(old_object)->post_migrate_fixup != NULL;
 }
 
+// Returns true if the given object is written without going through the write
+// barrier so it must always be remembered when it's in old space. That's the
+// case for stack pieces which are written directly by the interpreter.
+static bool is_always_remembered(value_t object) {
+  return get_heap_object_family_behavior_unchecked(object)->family == ofStackPiece;
+}
+
+// Returns true if the given object is being collected, that is, it's in the
+// nursery or, during a full collection, in from-space or the immortal space
+// being promoted from.
+static bool is_being_collected(garbage_collection_state_o *self, value_t object) {
+  heap_t *heap = &self->runtime->heap;
+  if (heap_in_nursery(heap, object))
+    return true;
+  if (self->is_nursery_collection)
+    return false;
+  address_t addr = get_heap_object_address(object);
+  return space_contains(&heap->from_space, addr)
+      || (self->immortal_from_space != NULL
+          && space_contains(self->immortal_from_space, addr));
+}
+
+// Returns true if the given object, which hasn't been migrated yet, is deep
+// frozen. This avoids get_value_mode since that checks the species which may
+// already have been migrated.
+static bool is_deep_frozen_during_migration(value_t object) {
+  family_behavior_t *behavior = get_heap_object_family_behavior_unchecked(object);
+  if (behavior->get_mode == get_modal_heap_object_mode)
+    return get_modal_species_mode(get_heap_object_species(object)) == vmDeepFrozen;
+  return (behavior->get_mode)(object) == vmDeepFrozen;
+}
+
+// Adds the given object to the remembered set.
+static void gc_state_remember_object(garbage_collection_state_o *self,
+    value_t object) {
+  heap_t *heap = &self->runtime->heap;
+  if (self->worker == NULL) {
+    heap_remember_object(heap, object);
+  } else {
+    native_mutex_lock(self->worker->shared->lock);
+    heap_remember_object(heap, object);
+    native_mutex_unlock(self->worker->shared->lock);
+  }
+}
+
+// Adds the given fixup to the ones to perform after migration.
+static value_t gc_state_schedule_fixup(garbage_collection_state_o *self,
+    pending_fixup_t *fixup) {
+  if (self->worker == NULL)
+    return pending_fixup_worklist_add(&self->pending_fixups, fixup);
+  // The worklist belongs to this worker but growing it allocates memory which
+  // is only safe with the lock held.
+  native_mutex_lock(self->worker->shared->lock);
+  value_t result = pending_fixup_worklist_add(&self->pending_fixups, fixup);
+  native_mutex_unlock(self->worker->shared->lock);
+  return result;
+}
+
 /// ## Field migration
 
+// Marks the given object, which isn't being collected, as live if this is a
+// full collection. The only objects that aren't being collected during a full
+// collection are immortal ones and those in the large object space; the large
+// ones don't move so they're marked and have their fields migrated later
+// instead.
+static value_t mark_if_large_object(garbage_collection_state_o *self,
+    value_t object) {
+  if (self->is_nursery_collection)
+    return success();
+  heap_t *heap = &self->runtime->heap;
+  if (heap_in_immortal_space(heap, object))
+    return success();
+  IF_EXPENSIVE_CHECKS_ENABLED(CHECK_TRUE("marking non-large object",
+      heap_in_large_object_space(heap, object)));
+  gc_worker_t *worker = self->worker;
+  if (worker == NULL) {
+    if (large_object_space_mark(&heap->large_object_space, object)) {
+      gc_stats_record_survivor(self->stats, object);
+      if (is_always_remembered(object))
+        heap_remember_object(heap, object);
+    }
+    return success();
+  }
+  // During a parallel collection the object goes on this worker's stack
+  // rather than the space's grey objects such that it can be stolen.
+  native_mutex_lock(worker->shared->lock);
+  bool was_marked = large_object_space_mark_ungrey(&heap->large_object_space,
+      object);
+  if (was_marked && is_always_remembered(object))
+    heap_remember_object(heap, object);
+  native_mutex_unlock(worker->shared->lock);
+  if (!was_marked)
+    return success();
+  gc_stats_record_survivor(self->stats, object);
+  heap_object_layout_t layout;
+  get_heap_object_layout(object, &layout);
+  address_t start = get_heap_object_address(object);
+  gc_region_t region = {start, start + layout.size};
+  return gc_region_stack_push(worker->shared, &worker->grey, region);
+}
+
+// Makes a raw clone in to-space of the given object, which hasn't been moved
+// yet, and schedules what else needs to happen to it. The caller is
+// responsible for pointing the old object to the clone.
+static value_t clone_heap_object(garbage_collection_state_o *self,
+    value_t old_object) {
+  // Check with the object whether it needs post processing. This is the last
+  // time the object is intact so it's the last point we can call methods on
+  // it to find out.
+  CHECK_TRUE("migrating clone", is_being_collected(self, old_object));
+  bool needs_fixup = needs_post_migrate_fixup(old_object);
+  bool always_remembered = is_always_remembered(old_object);
+  gc_stats_record_survivor(self->stats, old_object);
+  heap_t *heap = &self->runtime->heap;
+  space_t *target = (self->immortal_from_space != NULL
+      && is_deep_frozen_during_migration(old_object))
+      ? &heap->immortal_space
+      : &heap->old_space;
+  TRY_DEF(new_object, migrate_object_shallow(self, old_object, target));
+  CHECK_DOMAIN(vdHeapObject, new_object);
+  if (always_remembered)
+    gc_state_remember_object(self, new_object);
+  // Now that we know where the new object is going to be we can schedule the
+  // fixup if necessary.
+  if (needs_fixup) {
+    pending_fixup_t fixup = {new_object, old_object};
+    TRY(gc_state_schedule_fixup(self, &fixup));
+  }
+  // At this point the cloned object still needs some work to update the
+  // fields but we rely on traversing the heap to do that eventually.
+  return new_object;
+}
+
+// Returns the lock that must be held while copying the given object during a
+// parallel collection.
+static native_mutex_t *get_forward_lock(parallel_gc_t *shared, value_t object) {
+  size_t word = ((size_t) get_heap_object_address(object)) / kValueSize;
+  return shared->forward_locks[word % kGcForwardLockCount];
+}
+
+// Does the same as ensure_heap_object_migrated during a parallel collection.
+// Objects that have been moved are recognized by their header as usual. For
+// those that haven't, only one thread at a time gets to look at a given object
+// since the object must be intact while it's being copied, and that thread
+// then sets the forward pointer with an atomic compare-and-swap such that the
+// other threads never see a half-written header.
+static value_t gc_worker_ensure_migrated(gc_worker_t *self,
+    value_t old_object) {
+  value_t *header = access_heap_object_field(old_object,
+      kHeapObjectHeaderOffset);
+  value_t old_header;
+  old_header.encoded = atomic_load_uint64(&header->encoded);
+  if (get_value_domain(old_header) == vdMovedObject)
+    return get_moved_object_target(old_header);
+  native_mutex_t *lock = get_forward_lock(self->shared, old_object);
+  native_mutex_lock(lock);
+  // Another thread may have moved the object while we were waiting.
+  old_header.encoded = atomic_load_uint64(&header->encoded);
+  value_t result;
+  if (get_value_domain(old_header) == vdMovedObject) {
+    result = get_moved_object_target(old_header);
+  } else {
+    CHECK_DOMAIN(vdHeapObject, old_header);
+    result = clone_heap_object(&self->state, old_object);
+    if (!is_condition(result)) {
+      bool forwarded = atomic_compare_and_swap_uint64(&header->encoded,
+          old_header.encoded, new_moved_object(result).encoded);
+      CHECK_TRUE("object moved concurrently", forwarded);
+    }
+  }
+  native_mutex_unlock(lock);
+  return result;
+}
+
 // Ensures that the given object has a clone in to-space, returning a pointer to
 // it. If there is no pre-existing clone a shallow one will be created.
 static value_t ensure_heap_object_migrated(garbage_collection_state_o *self,
     value_t old_object) {
+  if (self->worker != NULL)
+    return gc_worker_ensure_migrated(self->worker, old_object);
   // Check if this object has already been moved.
   value_t old_header = get_heap_object_header(old_object);
   if (get_value_domain(old_header) == vdMovedObject) {
@@ -622,32 +1154,16 @@ static value_t ensure_heap_object_migrated(garbage_collection_state_o *self,
     // location so we just get out the location of the migrated object and update
     // the field.
     return get_moved_object_target(old_header);
-  } else {
-    // The header indicates that this object hasn't been moved yet. First make
-    // a raw clone of the object in to-space.
-    CHECK_DOMAIN(vdHeapObject, old_header);
-    // Check with the object whether it needs post processing. This is the last
-    // time the object is intact so it's the last point we can call methods on
-    // it to find out.
-    CHECK_TRUE("migrating clone", space_contains(&self->runtime->heap.from_space,
-        get_heap_object_address(old_object)));
-    bool needs_fixup = needs_post_migrate_fixup(old_object);
-    value_t new_object = migrate_object_shallow(old_object, &self->runtime->heap.to_space);
-    CHECK_DOMAIN(vdHeapObject, new_object);
-    // Now that we know where the new object is going to be we can schedule the
-    // fixup if necessary.
-    if (needs_fixup) {
-      pending_fixup_t fixup = {new_object, old_object};
-      TRY(pending_fixup_worklist_add(&self->pending_fixups, &fixup));
-    }
-    // Point the old object to the new one so we know to use the new clone
-    // instead of ever cloning it again.
-    value_t forward_pointer = new_moved_object(new_object);
-    set_heap_object_header(old_object, forward_pointer);
-    // At this point the cloned object still needs some work to update the
-    // fields but we rely on traversing the heap to do that eventually.
-    return new_object;
   }
+  // The header indicates that this object hasn't been moved yet. First make
+  // a raw clone of the object in to-space.
+  CHECK_DOMAIN(vdHeapObject, old_header);
+  TRY_DEF(new_object, clone_heap_object(self, old_object));
+  // Point the old object to the new one so we know to use the new clone
+  // instead of ever cloning it again.
+  value_t forward_pointer = new_moved_object(new_object);
+  set_heap_object_header(old_object, forward_pointer);
+  return new_object;
 }
 
 // Returns a new derived object pointer identical to the given one except that
@@ -656,6 +1172,11 @@ static value_t migrate_derived_object(garbage_collection_state_o *self,
     value_t old_derived) {
   // Ensure that the host has been migrated.
   value_t old_host = get_derived_object_host(old_derived);
+  if (!is_being_collected(self, old_host)) {
+    // The host stays where it is so the derived object does too.
+    TRY(mark_if_large_object(self, old_host));
+    return old_derived;
+  }
   value_t new_host = ensure_heap_object_migrated(self, old_host);
   // Calculate the new address derived from the new host.
   value_t anchor = get_derived_object_anchor(old_derived);
@@ -673,6 +1194,11 @@ static value_t migrate_field_shallow(garbage_collection_state_o *self,
   // If this is not a heap object there's nothing to do.
   value_domain_t domain = get_value_domain(old_value);
   if (domain == vdHeapObject) {
+    if (!is_being_collected(self, old_value)) {
+      // Old objects don't move when collecting the nursery and large objects
+      // never move.
+      return mark_if_large_object(self, old_value);
+    }
     TRY_SET(*field, ensure_heap_object_migrated(self, old_value));
   } else if (domain == vdDerivedObject) {
     TRY_SET(*field, migrate_derived_object(self, old_value));
@@ -695,34 +1221,390 @@ static void runtime_apply_fixups(garbage_collection_state_o *self) {
   }
 }
 
-value_t runtime_garbage_collect(runtime_t *runtime) {
+// Visitor that schedules fixups for the objects in the immortal space when
+// they may point to objects that are being moved.
+typedef struct {
+  value_visitor_o super;
+  garbage_collection_state_o *state;
+} immortal_fixup_scheduler_o;
+
+static value_t immortal_fixup_scheduler_visit(immortal_fixup_scheduler_o *self,
+    value_t object) {
+  if (needs_post_migrate_fixup(object)) {
+    pending_fixup_t fixup = {object, object};
+    TRY(gc_state_schedule_fixup(self->state, &fixup));
+  }
+  return success();
+}
+
+/// ## Parallel collection
+
+// Returns the size of the object at the given address.
+static size_t get_heap_object_size_at(address_t addr) {
+  heap_object_layout_t layout;
+  get_heap_object_layout(new_heap_object(addr), &layout);
+  return layout.size;
+}
+
+// Migrates the fields of the object at the given address.
+static value_t gc_worker_scan_object(gc_worker_t *self, address_t addr) {
+  return heap_object_for_each_field(new_heap_object(addr),
+      (field_visitor_o*) &self->state);
+}
+
+// Migrates the fields of the objects in the given worker's copy buffer that
+// haven't been scanned, including the ones copied into it along the way, or
+// hands them over to idle workers.
+static value_t gc_worker_scan_buffer(gc_worker_t *self) {
+  while (self->scan < self->next_free) {
+    // Move the scan pointer past the object before migrating its fields in
+    // case that causes the buffer to be retired.
+    address_t current = self->scan;
+    self->scan += get_heap_object_size_at(current);
+    TRY(gc_worker_scan_object(self, current));
+    size_t grey_size = self->next_free - self->scan;
+    if (grey_size > 0 && gc_worker_should_share(self, grey_size)) {
+      gc_region_t region = {self->scan, self->next_free};
+      TRY(gc_region_stack_push(self->shared, &self->grey, region));
+      self->scan = self->next_free;
+    }
+  }
+  return success();
+}
+
+// Migrates the fields of the objects in the given region. If the region is
+// large and other workers are idle the rest of it is handed over to them after
+// each object.
+static value_t gc_worker_scan_region(gc_worker_t *self, gc_region_t region) {
+  address_t current = region.start;
+  while (current < region.limit) {
+    size_t size = get_heap_object_size_at(current);
+    TRY(gc_worker_scan_object(self, current));
+    current += size;
+    if (current < region.limit
+        && gc_worker_should_share(self, region.limit - current)) {
+      gc_region_t rest = {current, region.limit};
+      return gc_region_stack_push(self->shared, &self->grey, rest);
+    }
+  }
+  return success();
+}
+
+// Called when the given worker has run out of work. Tries to steal a region
+// from one of the other workers, in which case it's stored in the out
+// parameter and true is returned, until all workers have run out of work in
+// which case false is returned. A worker only becomes idle once its stack is
+// empty and only the owner pushes onto a stack so once they're all idle there
+// can be no work left.
+static bool gc_worker_steal(gc_worker_t *self, gc_region_t *region_out) {
+  parallel_gc_t *shared = self->shared;
+  atomic_subtract_uint64(&shared->active_count, 1);
+  while (true) {
+    for (size_t i = 1; i < shared->worker_count; i++) {
+      gc_worker_t *victim = &shared->workers[(self->index + i) % shared->worker_count];
+      if (atomic_load_uint64(&victim->grey.length) == 0)
+        continue;
+      // Become active before taking the region so the others don't conclude
+      // that there's nothing left while we're holding it.
+      atomic_add_uint64(&shared->active_count, 1);
+      if (gc_region_stack_pop(&victim->grey, region_out))
+        return true;
+      atomic_subtract_uint64(&shared->active_count, 1);
+    }
+    if (atomic_load_uint64(&shared->active_count) == 0)
+      return false;
+    native_thread_yield();
+  }
+}
+
+// Migrates objects until there are none left on any worker.
+static value_t gc_worker_run(gc_worker_t *self) {
+  while (true) {
+    gc_region_t region;
+    if (self->scan < self->next_free) {
+      TRY(gc_worker_scan_buffer(self));
+    } else if (gc_region_stack_pop(&self->grey, &region)
+        || gc_worker_steal(self, &region)) {
+      TRY(gc_worker_scan_region(self, region));
+    } else {
+      return success();
+    }
+  }
+}
+
+// The main function of the threads that run workers.
+static void gc_worker_main(void *data) {
+  gc_worker_t *self = (gc_worker_t*) data;
+  self->result = gc_worker_run(self);
+  // A worker that fails stops being active such that the others still
+  // terminate. The collection fails in any case.
+  if (is_condition(self->result))
+    atomic_subtract_uint64(&self->shared->active_count, 1);
+}
+
+// Disposes the given parallel collection state, which may have been only
+// partially initialized.
+static void parallel_gc_dispose(parallel_gc_t *self) {
+  if (self->workers != NULL) {
+    for (size_t i = 0; i < self->worker_count; i++) {
+      gc_worker_t *worker = &self->workers[i];
+      garbage_collection_state_dispose(&worker->state);
+      gc_region_stack_t *grey = &worker->grey;
+      if (grey->regions != NULL)
+        allocator_default_free(new_memory_block(grey->regions,
+            grey->capacity * sizeof(gc_region_t)));
+      if (grey->lock != NULL)
+        delete_native_mutex(grey->lock);
+    }
+    allocator_default_free(new_memory_block(self->workers,
+        self->worker_count * sizeof(gc_worker_t)));
+    self->workers = NULL;
+  }
+  for (size_t i = 0; i < kGcForwardLockCount; i++) {
+    if (self->forward_locks[i] != NULL)
+      delete_native_mutex(self->forward_locks[i]);
+    self->forward_locks[i] = NULL;
+  }
+  if (self->lock != NULL)
+    delete_native_mutex(self->lock);
+  self->lock = NULL;
+}
+
+// Sets up the state for a parallel collection of the given runtime with the
+// given number of workers. Returns false if that isn't possible, in which case
+// the collection should be done on this thread alone.
+static bool parallel_gc_init(parallel_gc_t *self, runtime_t *runtime,
+    size_t worker_count) {
+  self->runtime = runtime;
+  self->worker_count = worker_count;
+  self->active_count = worker_count;
+  self->filler_species = ROOT(runtime, mutable_array_species);
+  self->lock = new_native_mutex();
+  for (size_t i = 0; i < kGcForwardLockCount; i++)
+    self->forward_locks[i] = new_native_mutex();
+  memory_block_t memory = allocator_default_malloc(
+      worker_count * sizeof(gc_worker_t));
+  self->workers = (gc_worker_t*) memory.memory;
+  bool succeeded = (self->lock != NULL) && (self->workers != NULL);
+  for (size_t i = 0; i < kGcForwardLockCount; i++)
+    succeeded = succeeded && (self->forward_locks[i] != NULL);
+  for (size_t i = 0; self->workers != NULL && i < worker_count; i++) {
+    gc_worker_t *worker = &self->workers[i];
+    worker->state = garbage_collection_state_new(runtime, false);
+    worker->state.stats = &worker->stats;
+    worker->state.worker = worker;
+    worker->shared = self;
+    worker->index = i;
+    worker->scan = worker->next_free = worker->limit = NULL;
+    worker->grey.lock = new_native_mutex();
+    worker->grey.regions = NULL;
+    worker->grey.length = 0;
+    worker->grey.capacity = 0;
+    memset(&worker->stats, 0, sizeof(gc_stats_t));
+    worker->thread = NULL;
+    worker->result = success();
+    succeeded = succeeded && (worker->grey.lock != NULL);
+  }
+  if (!succeeded)
+    parallel_gc_dispose(self);
+  return succeeded;
+}
+
+// Runs the workers, the first one on this thread, until everything reachable
+// from what the first worker has migrated so far has been migrated. Then
+// applies the fixups they've scheduled.
+static value_t parallel_gc_run(parallel_gc_t *self) {
+  for (size_t i = 1; i < self->worker_count; i++) {
+    gc_worker_t *worker = &self->workers[i];
+    worker->thread = native_thread_start(gc_worker_main, worker);
+    // A worker that couldn't be started counts as idle from the beginning.
+    if (worker->thread == NULL)
+      atomic_subtract_uint64(&self->active_count, 1);
+  }
+  gc_worker_main(&self->workers[0]);
+  gc_stats_t *stats = &self->runtime->gc_stats;
+  value_t result = success();
+  for (size_t i = 0; i < self->worker_count; i++) {
+    gc_worker_t *worker = &self->workers[i];
+    if (worker->thread != NULL)
+      native_thread_join(worker->thread);
+    if (is_condition(worker->result) && !is_condition(result))
+      result = worker->result;
+    // All buffers have been scanned by now so this only fills the rest.
+    TRY(gc_worker_retire_buffer(worker));
+    stats->bytes_copied += worker->stats.bytes_copied;
+    for (size_t j = 0; j < kNextFamilyOrdinal; j++)
+      stats->survivor_counts[j] += worker->stats.survivor_counts[j];
+  }
+  TRY(result);
+  for (size_t i = 0; i < self->worker_count; i++)
+    runtime_apply_fixups(&self->workers[i].state);
+  return success();
+}
+
+// Performs a full garbage collection, optionally promoting the deep frozen
+// objects to the immortal space.
+static value_t runtime_garbage_collect_full(runtime_t *runtime,
+    bool promote_deep_frozen) {
   // Validate that everything's healthy before we start.
-  TRY(runtime_validate(runtime, nothing()));
-  // Create to-space and swap it in, making the current to-space into from-space.
-  TRY(heap_prepare_garbage_collection(&runtime->heap));
-  // Initialize the state we'll maintain during collection.
-  garbage_collection_state_o state = garbage_collection_state_new(runtime);
-  field_visitor_o *visitor = (field_visitor_o*) &state;
+  TRY(runtime_validate_for_gc(runtime));
+  uint64_t start = get_monotonic_time_usecs();
+  // Create a new old space and swap it in, making the current old space into
+  // from-space.
+  heap_t *heap = &runtime->heap;
+  TRY(heap_prepare_garbage_collection(heap));
+  // Initialize the state we'll maintain during collection. Promotion is rare
+  // enough that it's always done on this thread alone.
+  garbage_collection_state_o state = garbage_collection_state_new(runtime, false);
+  space_t immortal_from_space;
+  if (promote_deep_frozen) {
+    TRY(heap_prepare_promotion(heap, &immortal_from_space));
+    state.immortal_from_space = &immortal_from_space;
+  }
+  size_t thread_count = heap->config.gc_thread_count;
+  parallel_gc_t parallel;
+  bool is_parallel = !promote_deep_frozen
+      && thread_count > 1
+      && native_threads_are_supported()
+      && parallel_gc_init(&parallel, runtime, thread_count);
+  // During a parallel collection the roots are migrated by the first worker
+  // before the others are started.
+  garbage_collection_state_o *root_state = is_parallel
+      ? &parallel.workers[0].state
+      : &state;
+  field_visitor_o *visitor = (field_visitor_o*) root_state;
   // Shallow migration of all the roots.
+  // The lookup cache holds raw object pointers so it has to be discarded.
+  lookup_cache_clear(runtime->lookup_cache);
   TRY(field_visitor_visit(visitor, &runtime->roots));
   TRY(field_visitor_visit(visitor, &runtime->mutable_roots));
-  // Shallow migration of everything currently stored in to-space which, since
-  // we keep going until all objects have been migrated, effectively makes a deep
-  // migration.
-  TRY(heap_for_each_field(&runtime->heap, visitor));
-  // At this point everything has been migrated so we can run the fixups and
-  // then we're done with the state.
-  runtime_apply_fixups(&state);
+  TRY(heap_for_each_tracker_field(heap, visitor));
+  if (!promote_deep_frozen && !heap->immortal_space_is_closed) {
+    // Immortal objects that may point out of the immortal space have to be
+    // treated as roots.
+    TRY(heap_for_each_immortal_field(heap, heap->immortal_space.start, visitor));
+    immortal_fixup_scheduler_o scheduler;
+    scheduler.super.vtable.visit = (value_visitor_visit_m) immortal_fixup_scheduler_visit;
+    scheduler.state = root_state;
+    TRY(space_for_each_object(&heap->immortal_space, (value_visitor_o*) &scheduler));
+  }
+  if (is_parallel) {
+    // The workers take it from here, including running the fixups. The filler
+    // arrays they create must have the migrated species.
+    TRY(field_visitor_visit(visitor, &parallel.filler_species));
+    value_t result = parallel_gc_run(&parallel);
+    parallel_gc_dispose(&parallel);
+    TRY(result);
+  } else {
+    // Shallow migration of everything currently stored in old space, the
+    // objects being promoted, and the marked large objects which, since we keep
+    // going until all objects have been migrated, effectively makes a deep
+    // migration.
+    address_t old_scan = heap->old_space.start;
+    address_t immortal_scan = heap->immortal_space.start;
+    bool has_more = true;
+    while (has_more) {
+      TRY(heap_for_each_old_field(heap, old_scan, visitor));
+      old_scan = heap->old_space.next_free;
+      if (promote_deep_frozen) {
+        TRY(heap_for_each_immortal_field(heap, immortal_scan, visitor));
+        immortal_scan = heap->immortal_space.next_free;
+      }
+      TRY(heap_for_each_grey_large_field(heap, visitor));
+      has_more = (old_scan < heap->old_space.next_free)
+          || (promote_deep_frozen && immortal_scan < heap->immortal_space.next_free);
+    }
+    // At this point everything has been migrated so we can run the fixups.
+    runtime_apply_fixups(&state);
+  }
   garbage_collection_state_dispose(&state);
-  // Now everything has been migrated so we can throw away from-space.
-  TRY(heap_complete_garbage_collection(&runtime->heap));
+  if (promote_deep_frozen)
+    heap_complete_promotion(heap, &immortal_from_space);
+  // Now everything has been migrated so we can throw away from-space and the
+  // nursery.
+  TRY(heap_complete_garbage_collection(heap));
+  gc_stats_t *stats = &runtime->gc_stats;
+  stats->full_collections++;
+  gc_stats_record_pause(stats, &stats->full_pause_usecs, start);
   // Validate that everything's still healthy.
-  return runtime_validate(runtime, nothing());
+  return runtime_validate_for_gc(runtime);
+}
+
+value_t runtime_garbage_collect(runtime_t *runtime) {
+  return runtime_garbage_collect_full(runtime, false);
+}
+
+value_t runtime_promote_deep_frozen(runtime_t *runtime) {
+  return runtime_garbage_collect_full(runtime, true);
+}
+
+// Visitor that brings the objects that were in the remembered set up to date
+// after the nursery has been collected.
+typedef struct {
+  value_visitor_o super;
+  runtime_t *runtime;
+} remembered_object_updater_o;
+
+// Updates a single object from the old remembered set.
+static value_t remembered_object_updater_visit(remembered_object_updater_o *self,
+    value_t object) {
+  if (is_always_remembered(object)) {
+    heap_remember_object(&self->runtime->heap, object);
+  } else if (in_family(ofIdHashMap, object)) {
+    // The map may have keys that were just promoted and hence got new
+    // identity hashes.
+    fixup_id_hash_map_post_migrate(self->runtime, object, object);
+  }
+  return success();
+}
+
+value_t runtime_garbage_collect_nursery(runtime_t *runtime) {
+  heap_t *heap = &runtime->heap;
+  if (heap_needs_full_collection(heap))
+    return runtime_garbage_collect(runtime);
+  TRY(runtime_validate_for_gc(runtime));
+  uint64_t start = get_monotonic_time_usecs();
+  // Objects get promoted to the end of old space so that's where we start
+  // scanning for fields to migrate.
+  address_t promoted_start = heap->old_space.next_free;
+  remembered_set_t remembered;
+  heap_prepare_nursery_collection(heap, &remembered);
+  garbage_collection_state_o state = garbage_collection_state_new(runtime, true);
+  field_visitor_o *visitor = (field_visitor_o*) &state;
+  lookup_cache_clear(runtime->lookup_cache);
+  TRY(field_visitor_visit(visitor, &runtime->roots));
+  TRY(field_visitor_visit(visitor, &runtime->mutable_roots));
+  TRY(heap_for_each_tracker_field(heap, visitor));
+  // The remembered objects are the only old objects that can point into the
+  // nursery so they're the only old objects we need to look at, other than
+  // those being promoted.
+  TRY(remembered_set_for_each_field(&remembered, visitor));
+  TRY(heap_for_each_old_field(heap, promoted_start, visitor));
+  runtime_apply_fixups(&state);
+  garbage_collection_state_dispose(&state);
+  // Nothing points into the nursery anymore so the only objects that need to
+  // stay remembered are those that are always remembered.
+  remembered_object_updater_o updater;
+  updater.super.vtable.visit = (value_visitor_visit_m) remembered_object_updater_visit;
+  updater.runtime = runtime;
+  TRY(remembered_set_for_each_object(&remembered, (value_visitor_o*) &updater));
+  remembered_set_dispose(&remembered);
+  heap_complete_nursery_collection(heap);
+  gc_stats_t *stats = &runtime->gc_stats;
+  stats->nursery_collections++;
+  gc_stats_record_pause(stats, &stats->nursery_pause_usecs, start);
+  return runtime_validate_for_gc(runtime);
 }
 
 void runtime_clear(runtime_t *runtime) {
   runtime->next_key_index = 0;
+  runtime->methodspace_epoch = 0;
   runtime->gc_fuzzer = NULL;
+  runtime->lookup_cache = NULL;
+  runtime->opcode_profile = NULL;
+  runtime->alloc_profile = NULL;
+  runtime->code_block_table = NULL;
+  memset(&runtime->gc_stats, 0, sizeof(gc_stats_t));
   runtime->roots = whatever();
   runtime->mutable_roots = whatever();
   runtime->plankton_mapping.data = NULL;
@@ -731,13 +1613,36 @@ void runtime_clear(runtime_t *runtime) {
 }
 
 value_t runtime_dispose(runtime_t *runtime) {
-  TRY(runtime_validate(runtime, nothing()));
+  TRY(runtime_validate_for_gc(runtime));
   dispose_safe_value(runtime, runtime->module_loader);
   heap_dispose(&runtime->heap);
   if (runtime->gc_fuzzer != NULL) {
     allocator_default_free(new_memory_block(runtime->gc_fuzzer, sizeof(gc_fuzzer_t)));
     runtime->gc_fuzzer = NULL;
   }
+  if (runtime->lookup_cache != NULL) {
+    lookup_cache_dispose(runtime->lookup_cache);
+    allocator_default_free(new_memory_block(runtime->lookup_cache,
+        sizeof(lookup_cache_t)));
+    runtime->lookup_cache = NULL;
+  }
+  if (runtime->opcode_profile != NULL) {
+    allocator_default_free(new_memory_block(runtime->opcode_profile,
+        sizeof(opcode_profile_t)));
+    runtime->opcode_profile = NULL;
+  }
+  if (runtime->alloc_profile != NULL) {
+    alloc_profile_dispose(runtime->alloc_profile);
+    allocator_default_free(new_memory_block(runtime->alloc_profile,
+        sizeof(alloc_profile_t)));
+    runtime->alloc_profile = NULL;
+  }
+  if (runtime->code_block_table != NULL) {
+    code_block_table_dispose(runtime->code_block_table);
+    allocator_default_free(new_memory_block(runtime->code_block_table,
+        sizeof(code_block_table_t)));
+    runtime->code_block_table = NULL;
+  }
   return success();
 }
 
@@ -783,6 +1688,12 @@ void runtime_toggle_fuzzing(runtime_t *runtime, bool enable) {
   fuzzer->is_enabled = enable;
 }
 
+void runtime_toggle_nursery_overflow(runtime_t *runtime, bool enable) {
+  CHECK_EQ("invalid overflow toggle", !enable,
+      runtime->heap.allow_nursery_overflow);
+  runtime->heap.allow_nursery_overflow = enable;
+}
+
 value_t get_modal_species_sibling_with_mode(runtime_t *runtime, value_t species,
     value_mode_t mode) {
   CHECK_DIVISION(sdModal, species);
@@ -167,7 +167,8 @@ static inline value_t get_roots_entry_at(value_t roots, root_key_t key) {
 
 // Invokes the argument for each mutable root.
 #define ENUM_MUTABLE_ROOTS(F)                                                  \
-  F(argument_map_trie_root)
+  F(argument_map_trie_root)                                                    \
+  F(in_order_argument_maps)
 
 typedef enum {
   __mk_first__ = -1
@@ -214,6 +215,35 @@ void gc_fuzzer_init(gc_fuzzer_t *fuzzer, size_t min_freq, size_t mean_freq,
 // of the fuzzer.
 bool gc_fuzzer_tick(gc_fuzzer_t *fuzzer);
 
+// Statistics about the garbage collections done by a runtime.
+typedef struct {
+  // The number of collections of just the nursery.
+  uint64_t nursery_collections;
+  // The number of full collections, including promotions.
+  uint64_t full_collections;
+  // The total time spent in each kind of collection, in microseconds.
+  uint64_t nursery_pause_usecs;
+  uint64_t full_pause_usecs;
+  // The longest time spent in a single collection, in microseconds.
+  uint64_t max_pause_usecs;
+  // The total size of the objects allocated.
+  uint64_t bytes_allocated;
+  // The total size of the objects copied by collections.
+  uint64_t bytes_copied;
+  // The number of times an object of each family has survived a collection,
+  // indexed by family ordinal.
+  uint64_t survivor_counts[kNextFamilyOrdinal];
+} gc_stats_t;
+
+// Prints a summary of the runtime's garbage collection statistics.
+void gc_stats_print_report(runtime_t *runtime);
+
+// The runtime-wide method lookup cache. See method.h.
+FORWARD(lookup_cache_t);
+FORWARD(opcode_profile_t);
+FORWARD(alloc_profile_t);
+FORWARD(code_block_table_t);
+
 
 // All the data associated with a single VM instance.
 struct runtime_t {
@@ -225,8 +255,21 @@ struct runtime_t {
   value_t mutable_roots;
   // The next key index.
   uint64_t next_key_index;
+  // Counter that is incremented whenever a methodspace changes. Cached lookup
+  // results are only valid as long as this stays the same.
+  uint64_t methodspace_epoch;
   // Optional allocation failure fuzzer.
   gc_fuzzer_t *gc_fuzzer;
+  // Cache of method lookup results.
+  lookup_cache_t *lookup_cache;
+  // Opcode execution statistics, or NULL if opcode profiling is disabled.
+  opcode_profile_t *opcode_profile;
+  // Allocation samples, or NULL if allocation profiling is disabled.
+  alloc_profile_t *alloc_profile;
+  // Data about the code blocks created by this runtime. See interp.h.
+  code_block_table_t *code_block_table;
+  // Garbage collection statistics.
+  gc_stats_t gc_stats;
   // Environment mapping to use when deserializing plankton.
   value_mapping_t plankton_mapping;
   // The module loader used by this runtime.
@@ -254,6 +297,16 @@ value_t runtime_dispose(runtime_t *runtime);
 // running out a memory, a condition will be returned.
 value_t runtime_garbage_collect(runtime_t *runtime);
 
+// Collect garbage in the nursery of the given runtime, promoting the objects
+// that survive to old space. If old space doesn't have room for that, or the
+// heap otherwise requires it, this does a full collection instead.
+value_t runtime_garbage_collect_nursery(runtime_t *runtime);
+
+// Does a full collection that also moves every deep frozen object that
+// survives into the immortal space, where it won't be moved or traversed by
+// later collections.
+value_t runtime_promote_deep_frozen(runtime_t *runtime);
+
 // Run a series of sanity checks on the runtime to check that it is consistent.
 // Returns a condition iff something is wrong. A runtime will only validate if it
 // has been initialized successfully. The cause is an optional value that
@@ -261,6 +314,11 @@ value_t runtime_garbage_collect(runtime_t *runtime);
 // debugging.
 value_t runtime_validate(runtime_t *runtime, value_t cause);
 
+// Validates the runtime to the given level, where runtime_validate always does
+// full validation.
+value_t runtime_validate_at_level(runtime_t *runtime,
+    gc_validation_level_t level, value_t cause);
+
 // Creates a gc-safe reference to the given value.
 safe_value_t runtime_protect_value(runtime_t *runtime, value_t value);
 
@@ -276,6 +334,11 @@ void dispose_safe_value(runtime_t *runtime, safe_value_t value_s);
 // Set whether fuzzing is on or off. If there is no fuzzer this has no effect.
 void runtime_toggle_fuzzing(runtime_t *runtime, bool enable);
 
+// Sets whether allocations that don't fit in the nursery are allowed to go
+// directly to old space. This is used when retrying an operation that failed
+// because it needed more memory than the nursery could hold.
+void runtime_toggle_nursery_overflow(runtime_t *runtime, bool enable);
+
 // Returns a modal species with the specified mode which is a sibling of the
 // given value, that is, identical except having the specified mode.
 // This will allow you to go from a more restrictive mode to a less restrictive
@@ -170,10 +170,33 @@ static value_t float_32_equals_float_32(builtin_arguments_t *args) {
   return new_boolean(test_relation(value_ordering_compare(self, that), reEqual));
 }
 
+// The inline versions of the float builtins. Float arithmetic can't overflow so
+// they only need to check the types.
+
+static value_t float_32_negate_inline(value_t self, value_t that) {
+  if (!in_phylum(tpFloat32, self))
+    return nothing();
+  return new_float_32(-get_float_32_value(self));
+}
+
+static value_t float_32_minus_float_32_inline(value_t self, value_t that) {
+  if (!in_phylum(tpFloat32, self) || !in_phylum(tpFloat32, that))
+    return nothing();
+  return new_float_32(get_float_32_value(self) - get_float_32_value(that));
+}
+
+static value_t float_32_plus_float_32_inline(value_t self, value_t that) {
+  if (!in_phylum(tpFloat32, self) || !in_phylum(tpFloat32, that))
+    return nothing();
+  return new_float_32(get_float_32_value(self) + get_float_32_value(that));
+}
+
 value_t add_float_32_builtin_implementations(runtime_t *runtime, safe_value_t s_map) {
-  ADD_BUILTIN_IMPL("-f32", 0, float_32_negate);
-  ADD_BUILTIN_IMPL("f32+f32", 1, float_32_plus_float_32);
-  ADD_BUILTIN_IMPL("f32-f32", 1, float_32_minus_float_32);
+  ADD_INLINE_BUILTIN_IMPL("-f32", 0, float_32_negate, float_32_negate_inline);
+  ADD_INLINE_BUILTIN_IMPL("f32+f32", 1, float_32_plus_float_32,
+      float_32_plus_float_32_inline);
+  ADD_INLINE_BUILTIN_IMPL("f32-f32", 1, float_32_minus_float_32,
+      float_32_minus_float_32_inline);
   ADD_BUILTIN_IMPL("f32==f32", 1, float_32_equals_float_32);
   return success();
 }
@@ -0,0 +1,70 @@
+// Copyright 2014 the Neutrino authors (see AUTHORS).
+// Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+// Fallback for platforms without thread support. Threads can't be started so
+// there's only ever one and the locks and atomic operations don't need to do
+// anything special.
+
+struct native_mutex_t {
+  // Whether the mutex is currently held.
+  bool is_locked;
+};
+
+bool native_threads_are_supported() {
+  return false;
+}
+
+native_thread_t *native_thread_start(native_thread_main_m main, void *data) {
+  return NULL;
+}
+
+void native_thread_join(native_thread_t *thread) {
+  UNREACHABLE("joining thread");
+}
+
+void native_thread_yield() {
+  // nothing to do
+}
+
+native_mutex_t *new_native_mutex() {
+  memory_block_t memory = allocator_default_malloc(sizeof(native_mutex_t));
+  if (memory_block_is_empty(memory))
+    return NULL;
+  native_mutex_t *mutex = (native_mutex_t*) memory.memory;
+  mutex->is_locked = false;
+  return mutex;
+}
+
+void delete_native_mutex(native_mutex_t *mutex) {
+  allocator_default_free(new_memory_block(mutex, sizeof(native_mutex_t)));
+}
+
+void native_mutex_lock(native_mutex_t *mutex) {
+  CHECK_FALSE("mutex already locked", mutex->is_locked);
+  mutex->is_locked = true;
+}
+
+void native_mutex_unlock(native_mutex_t *mutex) {
+  CHECK_TRUE("mutex not locked", mutex->is_locked);
+  mutex->is_locked = false;
+}
+
+uint64_t atomic_load_uint64(uint64_t *word) {
+  return *word;
+}
+
+bool atomic_compare_and_swap_uint64(uint64_t *word, uint64_t expected,
+    uint64_t value) {
+  if (*word != expected)
+    return false;
+  *word = value;
+  return true;
+}
+
+uint64_t atomic_add_uint64(uint64_t *word, uint64_t delta) {
+  return *word += delta;
+}
+
+uint64_t atomic_subtract_uint64(uint64_t *word, uint64_t delta) {
+  return *word -= delta;
+}
@@ -0,0 +1,96 @@
+// Copyright 2014 the Neutrino authors (see AUTHORS).
+// Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+// Threads and locks using pthreads, atomic operations using the gcc builtins.
+
+#include <pthread.h>
+#include <sched.h>
+
+struct native_thread_t {
+  // The underlying pthread.
+  pthread_t thread;
+  // The function to call on the new thread and its data.
+  native_thread_main_m main;
+  void *data;
+};
+
+struct native_mutex_t {
+  pthread_mutex_t mutex;
+};
+
+bool native_threads_are_supported() {
+  return true;
+}
+
+// The pthread entry point which calls the thread's main function.
+static void *native_thread_entry_point(void *raw_thread) {
+  native_thread_t *thread = (native_thread_t*) raw_thread;
+  (thread->main)(thread->data);
+  return NULL;
+}
+
+native_thread_t *native_thread_start(native_thread_main_m main, void *data) {
+  memory_block_t memory = allocator_default_malloc(sizeof(native_thread_t));
+  if (memory_block_is_empty(memory))
+    return NULL;
+  native_thread_t *thread = (native_thread_t*) memory.memory;
+  thread->main = main;
+  thread->data = data;
+  if (pthread_create(&thread->thread, NULL, native_thread_entry_point, thread) != 0) {
+    allocator_default_free(memory);
+    return NULL;
+  }
+  return thread;
+}
+
+void native_thread_join(native_thread_t *thread) {
+  pthread_join(thread->thread, NULL);
+  allocator_default_free(new_memory_block(thread, sizeof(native_thread_t)));
+}
+
+void native_thread_yield() {
+  sched_yield();
+}
+
+native_mutex_t *new_native_mutex() {
+  memory_block_t memory = allocator_default_malloc(sizeof(native_mutex_t));
+  if (memory_block_is_empty(memory))
+    return NULL;
+  native_mutex_t *mutex = (native_mutex_t*) memory.memory;
+  if (pthread_mutex_init(&mutex->mutex, NULL) != 0) {
+    allocator_default_free(memory);
+    return NULL;
+  }
+  return mutex;
+}
+
+void delete_native_mutex(native_mutex_t *mutex) {
+  pthread_mutex_destroy(&mutex->mutex);
+  allocator_default_free(new_memory_block(mutex, sizeof(native_mutex_t)));
+}
+
+void native_mutex_lock(native_mutex_t *mutex) {
+  pthread_mutex_lock(&mutex->mutex);
+}
+
+void native_mutex_unlock(native_mutex_t *mutex) {
+  pthread_mutex_unlock(&mutex->mutex);
+}
+
+uint64_t atomic_load_uint64(uint64_t *word) {
+  return __atomic_load_n(word, __ATOMIC_ACQUIRE);
+}
+
+bool atomic_compare_and_swap_uint64(uint64_t *word, uint64_t expected,
+    uint64_t value) {
+  return __atomic_compare_exchange_n(word, &expected, value, false,
+      __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+uint64_t atomic_add_uint64(uint64_t *word, uint64_t delta) {
+  return __atomic_add_fetch(word, delta, __ATOMIC_SEQ_CST);
+}
+
+uint64_t atomic_subtract_uint64(uint64_t *word, uint64_t delta) {
+  return __atomic_sub_fetch(word, delta, __ATOMIC_SEQ_CST);
+}
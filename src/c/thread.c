@@ -0,0 +1,11 @@
+// Copyright 2014 the Neutrino authors (see AUTHORS).
+// Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include "check.h"
+#include "thread.h"
+
+#ifdef IS_GCC
+#include "thread-posix-opt.c"
+#else
+#include "thread-fallback-opt.c"
+#endif
@@ -0,0 +1,66 @@
+// Copyright 2014 the Neutrino authors (see AUTHORS).
+// Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+// Native threads, locks, and atomic operations. The runtime itself is
+// single-threaded, these are only used to let the garbage collector spread a
+// collection across several threads. On platforms without thread support
+// threads can't be started and the atomic operations are plain memory
+// operations.
+
+
+#ifndef _THREAD
+#define _THREAD
+
+#include "globals.h"
+#include "utils.h"
+
+FORWARD(native_thread_t);
+FORWARD(native_mutex_t);
+
+// The function run by a native thread.
+typedef void (*native_thread_main_m)(void *data);
+
+// Returns true if native threads can be started on this platform.
+bool native_threads_are_supported();
+
+// Starts a new thread that calls the given function with the given data.
+// Returns NULL if the thread couldn't be started.
+native_thread_t *native_thread_start(native_thread_main_m main, void *data);
+
+// Waits for the given thread to finish and then disposes it.
+void native_thread_join(native_thread_t *thread);
+
+// Lets other threads run before continuing this one.
+void native_thread_yield();
+
+// Creates a new unlocked mutex. Returns NULL if it couldn't be created.
+native_mutex_t *new_native_mutex();
+
+// Disposes the given mutex, which must be unlocked.
+void delete_native_mutex(native_mutex_t *mutex);
+
+// Locks the given mutex, waiting until it's been released if another thread
+// holds it.
+void native_mutex_lock(native_mutex_t *mutex);
+
+// Unlocks the given mutex which must be held by this thread.
+void native_mutex_unlock(native_mutex_t *mutex);
+
+// Returns the value of the given word. A thread that loads a value stored by
+// another thread using one of the operations below also sees everything that
+// thread had written before storing it.
+uint64_t atomic_load_uint64(uint64_t *word);
+
+// Sets the given word to the new value if it currently holds the expected one,
+// returning true if it did and false if it held something else.
+bool atomic_compare_and_swap_uint64(uint64_t *word, uint64_t expected,
+    uint64_t value);
+
+// Adds the given delta to the given word, returning the new value.
+uint64_t atomic_add_uint64(uint64_t *word, uint64_t delta);
+
+// Subtracts the given delta from the given word, returning the new value.
+uint64_t atomic_subtract_uint64(uint64_t *word, uint64_t delta);
+
+
+#endif // _THREAD
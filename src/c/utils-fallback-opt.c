@@ -0,0 +1,11 @@
+// Copyright 2014 the Neutrino authors (see AUTHORS).
+// Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+// Fallback that measures time using the standard processor clock. It only
+// counts time spent running this process so it may underestimate.
+
+#include <time.h>
+
+uint64_t get_monotonic_time_usecs() {
+  return ((uint64_t) clock()) * 1000000 / CLOCKS_PER_SEC;
+}
@@ -0,0 +1,13 @@
+// Copyright 2014 the Neutrino authors (see AUTHORS).
+// Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+// Time measurement using the posix monotonic clock.
+
+#define __USE_POSIX199309
+#include <time.h>
+
+uint64_t get_monotonic_time_usecs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((uint64_t) now.tv_sec) * 1000000 + ((uint64_t) now.tv_nsec) / 1000;
+}
@@ -9,6 +9,12 @@
 
 #include <stdarg.h>
 
+#ifdef IS_GCC
+#include "utils-posix-opt.c"
+#else
+#include "utils-fallback-opt.c"
+#endif
+
 
 void string_init(string_t *str, const char *chars) {
   str->chars = chars;
@@ -199,6 +205,38 @@ allocator_t *allocator_set_default(allocator_t *value) {
   return previous;
 }
 
+
+// --- S c r a t c h ---
+
+void reusable_scratch_memory_init(reusable_scratch_memory_t *memory) {
+  memory->memory = memory_block_empty();
+}
+
+void reusable_scratch_memory_dispose(reusable_scratch_memory_t *memory) {
+  allocator_default_free(memory->memory);
+  memory->memory = memory_block_empty();
+}
+
+void *reusable_scratch_memory_alloc(reusable_scratch_memory_t *memory,
+    size_t size) {
+  memory_block_t current = memory->memory;
+  if (current.size < size) {
+    // If the current memory block is too small to handle what we're asking
+    // for replace it with a new one with room enough.
+    allocator_default_free(current);
+    current = allocator_default_malloc(size * 2);
+    memory->memory = current;
+  }
+  return current.memory;
+}
+
+void reusable_scratch_memory_double_alloc(reusable_scratch_memory_t *memory,
+    size_t first_size, void **first, size_t second_size, void **second) {
+  void *block = reusable_scratch_memory_alloc(memory, first_size + second_size);
+  *first = block;
+  *second = ((byte_t*) block) + first_size;
+}
+
 void string_buffer_init(string_buffer_t *buf) {
   buf->length = 0;
   buf->memory = allocator_default_malloc(128);
@@ -19,6 +19,11 @@ static size_t align_size(uint32_t alignment, size_t size) {
   return (size + (alignment - 1)) & ~(alignment - 1);
 }
 
+// Returns the current time in microseconds from a clock that is unaffected by
+// changes to the system time, for measuring how long things take. What time
+// 0 corresponds to is unspecified.
+uint64_t get_monotonic_time_usecs();
+
 
 // --- S t r i n g ---
 
@@ -151,6 +156,39 @@ allocator_t *allocator_get_default();
 allocator_t *allocator_set_default(allocator_t *value);
 
 
+// --- S c r a t c h ---
+
+// A block of reusable scratch memory. It can be used to grab a block of memory
+// of a given size without worrying about releasing it. Just be sure not to
+// have two different users at the same time.
+typedef struct {
+  // The current memory block.
+  memory_block_t memory;
+} reusable_scratch_memory_t;
+
+// Initializes a reusable scratch memory block.
+void reusable_scratch_memory_init(reusable_scratch_memory_t *memory);
+
+// Disposes this scratch memory block, releasing any memory returned from this
+// block. Obviously this invalidates any memory blocks ever returned from this
+// block.
+void reusable_scratch_memory_dispose(reusable_scratch_memory_t *memory);
+
+// Returns a memory block of the given size backed by the given reusable memory
+// block. This invalidates any memory blocks previously returned, so only the
+// last block returned can be used. You don't have to explicitly release this
+// block, it will be disposed along with the reusable memory block whenever
+// it is disposed.
+void *reusable_scratch_memory_alloc(reusable_scratch_memory_t *memory,
+    size_t size);
+
+// Returns two blocks of memory from a reusable scratch memory block. All the
+// same rules apply as with reusable_scratch_malloc. Really this is just a
+// shorthand for allocating one block and splitting it in two.
+void reusable_scratch_memory_double_alloc(reusable_scratch_memory_t *memory,
+    size_t first_size, void **first, size_t second_size, void **second);
+
+
 // --- S t r i n g   b u f f e r ---
 
 // Buffer for building a string incrementally.
@@ -238,6 +238,7 @@ void set_##receiver##_##field(value_t self, value_t value) {                   \
   CHECK_FAMILY(of##Receiver, self);                                            \
   acValueCheck(VALUE_CHECK_ARG, value);                                        \
   *access_heap_object_field(self, k##Receiver##Field##Offset) = value;         \
+  record_heap_object_write(self, value);                                       \
 }                                                                              \
 GETTER_IMPL(Receiver, receiver, Field, field)
 
@@ -319,6 +320,7 @@ void set_##receiver_species##_species_##field(value_t self, value_t value) {   \
   CHECK_DIVISION(sd##ReceiverSpecies, self);                                   \
   acValueCheck(VALUE_CHECK_ARG, value);                                        \
   *access_heap_object_field(self, k##ReceiverSpecies##Species##Field##Offset) = value; \
+  record_heap_object_write(self, value);                                       \
 }                                                                              \
 SPECIES_GETTER_IMPL(Receiver, receiver, ReceiverSpecies, receiver_species,     \
     Field, field)
@@ -327,10 +329,18 @@ SPECIES_GETTER_IMPL(Receiver, receiver, ReceiverSpecies, receiver_species,     \
 // --- B u i l t i n s ---
 
 #define ADD_BUILTIN_IMPL(name, argc, impl)                                     \
-  TRY(add_builtin_method_impl(runtime, deref(s_map), name, argc, impl, -1))
+  TRY(add_builtin_method_impl(runtime, deref(s_map), name, argc, impl, -1,     \
+      NULL))
 
 #define ADD_BUILTIN_IMPL_MAY_ESCAPE(name, argc, leave_argc, impl)              \
-  TRY(add_builtin_method_impl(runtime, deref(s_map), name, argc, impl, leave_argc + 2))
+  TRY(add_builtin_method_impl(runtime, deref(s_map), name, argc, impl,         \
+      leave_argc + 2, NULL))
+
+// Adds a builtin that also has an inline implementation the interpreter can
+// execute directly at call sites.
+#define ADD_INLINE_BUILTIN_IMPL(name, argc, impl, inline_impl)                 \
+  TRY(add_builtin_method_impl(runtime, deref(s_map), name, argc, impl, -1,     \
+      inline_impl))
 
 
 // --- P l a n k t o n ---
@@ -123,6 +123,70 @@ static value_t integer_negate(builtin_arguments_t *args) {
   return decode_value(-self.encoded);
 }
 
+// The inline versions of the integer builtins. They only handle integers and
+// give up if the result doesn't fit, leaving that case to the builtin proper.
+
+// Integers whose absolute values are below this can be multiplied without
+// overflowing a tagged integer.
+static const int64_t kMaxInlineFactor = (1LL << 29);
+
+static value_t integer_plus_integer_inline(value_t self, value_t that) {
+  if (!in_domain(vdInteger, self) || !in_domain(vdInteger, that))
+    return nothing();
+  int64_t result = get_integer_value(self) + get_integer_value(that);
+  return fits_as_tagged_integer(result) ? new_integer(result) : nothing();
+}
+
+static value_t integer_minus_integer_inline(value_t self, value_t that) {
+  if (!in_domain(vdInteger, self) || !in_domain(vdInteger, that))
+    return nothing();
+  int64_t result = get_integer_value(self) - get_integer_value(that);
+  return fits_as_tagged_integer(result) ? new_integer(result) : nothing();
+}
+
+static value_t integer_times_integer_inline(value_t self, value_t that) {
+  if (!in_domain(vdInteger, self) || !in_domain(vdInteger, that))
+    return nothing();
+  int64_t a = get_integer_value(self);
+  int64_t b = get_integer_value(that);
+  if (a <= -kMaxInlineFactor || kMaxInlineFactor <= a
+      || b <= -kMaxInlineFactor || kMaxInlineFactor <= b)
+    return nothing();
+  return new_integer(a * b);
+}
+
+static value_t integer_divide_integer_inline(value_t self, value_t that) {
+  if (!in_domain(vdInteger, self) || !in_domain(vdInteger, that))
+    return nothing();
+  int64_t b = get_integer_value(that);
+  if (b == 0)
+    return nothing();
+  int64_t result = get_integer_value(self) / b;
+  return fits_as_tagged_integer(result) ? new_integer(result) : nothing();
+}
+
+static value_t integer_modulo_integer_inline(value_t self, value_t that) {
+  if (!in_domain(vdInteger, self) || !in_domain(vdInteger, that))
+    return nothing();
+  int64_t b = get_integer_value(that);
+  if (b == 0)
+    return nothing();
+  return new_integer(get_integer_value(self) % b);
+}
+
+static value_t integer_less_integer_inline(value_t self, value_t that) {
+  if (!in_domain(vdInteger, self) || !in_domain(vdInteger, that))
+    return nothing();
+  return new_boolean(get_integer_value(self) < get_integer_value(that));
+}
+
+static value_t integer_negate_inline(value_t self, value_t that) {
+  if (!in_domain(vdInteger, self))
+    return nothing();
+  int64_t result = -get_integer_value(self);
+  return fits_as_tagged_integer(result) ? new_integer(result) : nothing();
+}
+
 static value_t integer_print(builtin_arguments_t *args) {
   value_t self = get_builtin_subject(args);
   print_ln("%v", self);
@@ -130,13 +194,19 @@ static value_t integer_print(builtin_arguments_t *args) {
 }
 
 value_t add_integer_builtin_implementations(runtime_t *runtime, safe_value_t s_map) {
-  ADD_BUILTIN_IMPL("-int", 0, integer_negate);
-  ADD_BUILTIN_IMPL("int+int", 1, integer_plus_integer);
-  ADD_BUILTIN_IMPL("int-int", 1, integer_minus_integer);
-  ADD_BUILTIN_IMPL("int*int", 1, integer_times_integer);
-  ADD_BUILTIN_IMPL("int/int", 1, integer_divide_integer);
-  ADD_BUILTIN_IMPL("int%int", 1, integer_modulo_integer);
-  ADD_BUILTIN_IMPL("int<int", 1, integer_less_integer);
+  ADD_INLINE_BUILTIN_IMPL("-int", 0, integer_negate, integer_negate_inline);
+  ADD_INLINE_BUILTIN_IMPL("int+int", 1, integer_plus_integer,
+      integer_plus_integer_inline);
+  ADD_INLINE_BUILTIN_IMPL("int-int", 1, integer_minus_integer,
+      integer_minus_integer_inline);
+  ADD_INLINE_BUILTIN_IMPL("int*int", 1, integer_times_integer,
+      integer_times_integer_inline);
+  ADD_INLINE_BUILTIN_IMPL("int/int", 1, integer_divide_integer,
+      integer_divide_integer_inline);
+  ADD_INLINE_BUILTIN_IMPL("int%int", 1, integer_modulo_integer,
+      integer_modulo_integer_inline);
+  ADD_INLINE_BUILTIN_IMPL("int<int", 1, integer_less_integer,
+      integer_less_integer_inline);
   ADD_BUILTIN_IMPL("int.print()", 0, integer_print);
   return success();
 }
@@ -146,6 +216,7 @@ value_t add_integer_builtin_implementations(runtime_t *runtime, safe_value_t s_m
 
 void set_heap_object_header(value_t value, value_t species) {
   *access_heap_object_field(value, kHeapObjectHeaderOffset) = species;
+  record_heap_object_write(value, species);
 }
 
 value_t get_heap_object_header(value_t value) {
@@ -232,6 +303,15 @@ division_behavior_t *get_species_division_behavior(value_t value) {
   return (division_behavior_t*) ptr;
 }
 
+void set_species_heap(value_t value, heap_t *heap) {
+  *access_heap_object_field(value, kSpeciesHeapOffset) = pointer_to_value_bit_cast(heap);
+}
+
+heap_t *get_species_heap(value_t value) {
+  void *ptr = value_to_pointer_bit_cast(*access_heap_object_field(value, kSpeciesHeapOffset));
+  return (heap_t*) ptr;
+}
+
 species_division_t get_species_division(value_t value) {
   return get_species_division_behavior(value)->division;
 }
@@ -656,6 +736,7 @@ void set_array_at(value_t value, size_t index, value_t element) {
   CHECK_MUTABLE(value);
   CHECK_REL("array index out of bounds", index, <, get_array_length(value));
   get_array_elements(value)[index] = element;
+  record_heap_object_write(value, element);
 }
 
 value_t *get_array_elements(value_t value) {
@@ -1063,12 +1144,18 @@ static value_t get_id_hash_map_entry_value(value_t *entry) {
   return entry[kIdHashMapEntryValueOffset];
 }
 
-// Sets the full contents of a map entry.
-static void set_id_hash_map_entry(value_t *entry, value_t key, size_t hash,
-    value_t value) {
+// Sets the full contents of a map entry in the given map.
+static void set_id_hash_map_entry(value_t map, value_t *entry, value_t key,
+    size_t hash, value_t value) {
   entry[kIdHashMapEntryKeyOffset] = key;
   entry[kIdHashMapEntryHashOffset] = new_integer(hash);
   entry[kIdHashMapEntryValueOffset] = value;
+  // The entry array needs to be remembered for the pointers to be updated, and
+  // the map itself for it to be rehashed, if the key moves.
+  value_t entry_array = get_id_hash_map_entry_array(map);
+  record_heap_object_write(entry_array, key);
+  record_heap_object_write(entry_array, value);
+  record_heap_object_write(map, key);
 }
 
 // Sets the full contents of a map entry such that it can be recognized as
@@ -1173,7 +1260,7 @@ value_t try_set_id_hash_map_at(value_t map, value_t key, value_t value,
     // key couldn't be found. Report this.
     return new_condition(ccMapFull);
   }
-  set_id_hash_map_entry(entry, key, hash, value);
+  set_id_hash_map_entry(map, entry, key, hash, value);
   // Only increment the size if we created a new entry.
   if (create_mode != cmNotCreated) {
     // A new mapping was created.
@@ -1227,39 +1314,27 @@ value_t delete_id_hash_map_at(runtime_t *runtime, value_t map, value_t key) {
   }
 }
 
-void fixup_id_hash_map_post_migrate(runtime_t *runtime, value_t new_heap_object,
-    value_t old_object) {
-  // In this fixup we rehash the migrated hash map since the hash values are
-  // allowed to change during garbage collection. We do it by copying the
-  // entries currently stored in the object into space that's left over by the
-  // old one, clearing out the new entry array completely, and then re-adding
-  // the entries one by one, reading them from the scratch storage. Dumb but it
-  // works.
-
-  // Get the raw entry array from the new map.
-  value_t new_entry_array = get_id_hash_map_entry_array(new_heap_object);
-  size_t entry_array_length = get_array_length(new_entry_array);
-  value_t *new_entries = get_array_elements(new_entry_array);
-  // Get the raw entry array from the old map. This requires going directly
-  // through the object since the nice accessors do sanity checking and the
-  // state of the object at this point is, well, not sane.
-  value_t old_entry_array = *access_heap_object_field(old_object, kIdHashMapEntryArrayOffset);
-  CHECK_DOMAIN(vdMovedObject, get_heap_object_header(old_entry_array));
-  value_t *old_entries = get_array_elements_unchecked(old_entry_array);
-  // Copy the contents of the new entry array into the old one and clear it as
-  // we go so it's ready to have elements added back.
+// Rehashes the given map by copying its entries into the given scratch
+// storage, clearing out the entry array completely, and then re-adding the
+// entries one by one, reading them from the scratch storage. Dumb but it works.
+static void rehash_id_hash_map(value_t map, value_t *scratch) {
+  value_t entry_array = get_id_hash_map_entry_array(map);
+  size_t entry_array_length = get_array_length(entry_array);
+  value_t *entries = get_array_elements(entry_array);
+  // Copy the contents of the entry array into the scratch storage and clear it
+  // as we go so it's ready to have elements added back.
   for (size_t i = 0; i < entry_array_length; i++) {
-    old_entries[i] = new_entries[i];
-    new_entries[i] = null();
+    scratch[i] = entries[i];
+    entries[i] = null();
   }
   // Reset the map's fields. It is now empty.
-  set_id_hash_map_size(new_heap_object, 0);
-  set_id_hash_map_occupied_count(new_heap_object, 0);
-  // Fake an iterator that scans over the old array.
+  set_id_hash_map_size(map, 0);
+  set_id_hash_map_occupied_count(map, 0);
+  // Fake an iterator that scans over the scratch storage.
   id_hash_map_iter_t iter;
-  iter.entries = old_entries;
+  iter.entries = scratch;
   iter.cursor = 0;
-  iter.capacity = get_id_hash_map_capacity(new_heap_object);
+  iter.capacity = get_id_hash_map_capacity(map);
   iter.current = NULL;
   // Then simple scan over the entries and add them one at a time. Since they
   // come from the map originally adding them again must succeed.
@@ -1270,11 +1345,38 @@ void fixup_id_hash_map_post_migrate(runtime_t *runtime, value_t new_heap_object,
     // We need to be able to add elements even if the map is frozen and it's
     // okay because at the end it will be in the same state it was in before
     // so it's not really mutating it.
-    value_t added = try_set_id_hash_map_at(new_heap_object, key, value, true);
+    value_t added = try_set_id_hash_map_at(map, key, value, true);
     CHECK_FALSE("rehash failed to set", is_condition(added));
   }
 }
 
+void fixup_id_hash_map_post_migrate(runtime_t *runtime, value_t new_heap_object,
+    value_t old_object) {
+  // In this fixup we rehash the migrated hash map since the hash values are
+  // allowed to change during garbage collection. If the entry array was moved
+  // along with the map the old copy can be used as scratch storage.
+
+  // Get the raw entry array from the old map. This requires going directly
+  // through the object since the nice accessors do sanity checking and the
+  // state of the object at this point is, well, not sane.
+  value_t old_entry_array = *access_heap_object_field(old_object, kIdHashMapEntryArrayOffset);
+  if (in_domain(vdMovedObject, get_heap_object_header(old_entry_array))) {
+    rehash_id_hash_map(new_heap_object, get_array_elements_unchecked(old_entry_array));
+  } else {
+    // The entry array wasn't moved, which happens when it is in old space and
+    // only the nursery is being collected or when it is in the large object
+    // space, so there is no old copy to use.
+    // The same goes for a map that was itself not moved but may have had its
+    // keys moved, in which case the old and new object are the same.
+    value_t entry_array = get_id_hash_map_entry_array(new_heap_object);
+    size_t size = get_array_length(entry_array) * kValueSize;
+    memory_block_t scratch = allocator_default_malloc(size);
+    CHECK_FALSE("rehash scratch alloc failed", memory_block_is_empty(scratch));
+    rehash_id_hash_map(new_heap_object, (value_t*) scratch.memory);
+    allocator_default_free(scratch);
+  }
+}
+
 void id_hash_map_iter_init(id_hash_map_iter_t *iter, value_t map) {
   value_t entry_array = get_id_hash_map_entry_array(map);
   iter->entries = get_array_elements(entry_array);
@@ -1492,11 +1594,18 @@ void factory_print_on(value_t value, print_on_context_t *context) {
 ACCESSORS_IMPL(CodeBlock, code_block, acInFamily, ofBlob, Bytecode, bytecode);
 ACCESSORS_IMPL(CodeBlock, code_block, acInFamily, ofArray, ValuePool, value_pool);
 INTEGER_ACCESSORS_IMPL(CodeBlock, code_block, HighWaterMark, high_water_mark);
+ACCESSORS_IMPL(CodeBlock, code_block, acInFamilyOpt, ofArray, InlineCaches,
+    inline_caches);
+ACCESSORS_IMPL(CodeBlock, code_block, acInFamily, ofArray, DecodedBytecode,
+    decoded_bytecode);
+INTEGER_ACCESSORS_IMPL(CodeBlock, code_block, Serial, serial);
 
 value_t code_block_validate(value_t value) {
   VALIDATE_FAMILY(ofCodeBlock, value);
   VALIDATE_FAMILY(ofBlob, get_code_block_bytecode(value));
   VALIDATE_FAMILY(ofArray, get_code_block_value_pool(value));
+  VALIDATE_FAMILY_OPT(ofArray, get_code_block_inline_caches(value));
+  VALIDATE_FAMILY(ofArray, get_code_block_decoded_bytecode(value));
   return success();
 }
 
@@ -42,6 +42,7 @@
 FORWARD(blob_t);
 FORWARD(cycle_detector_t);
 FORWARD(hash_stream_t);
+FORWARD(heap_t);
 FORWARD(runtime_t);
 FORWARD(string_t);
 FORWARD(string_buffer_t);
@@ -474,9 +475,11 @@ static value_t new_moved_object(value_t target) {
   F(VoidP,                   void_p,                    _, _, _, _, X, _, _, _, _, 26)\
   F(WithEscapeAst,           with_escape_ast,           _, _, X, _, _, _, X, _, _, 23)
 
-// The next ordinal to use when adding a family. This isn't actually used in the
-// code it's just a reminder. Remember to update it when adding families.
-static const int kNextFamilyOrdinal = 76;
+// The next ordinal to use when adding a family. Tables indexed by family
+// ordinal are sized by this so remember to update it when adding families.
+enum {
+  kNextFamilyOrdinal = 76
+};
 
 // Enumerates all the object families.
 #define ENUM_HEAP_OBJECT_FAMILIES(F)                                           \
@@ -501,6 +504,12 @@ typedef enum {
 // Returns the string name of the given family.
 const char *get_heap_object_family_name(heap_object_family_t family);
 
+// Returns the ordinal of the given family, which is less than
+// kNextFamilyOrdinal.
+static size_t get_heap_object_family_ordinal(heap_object_family_t family) {
+  return ((size_t) family) >> kDomainTagSize;
+}
+
 // Number of bytes in an object header.
 #define kHeapObjectHeaderSize kValueSize
 
@@ -563,6 +572,20 @@ static address_t get_heap_object_address(value_t value) {
 #define access_heap_object_field(VALUE, INDEX)                                 \
   ((value_t*) (((address_t) get_heap_object_address(VALUE)) + ((size_t) (INDEX))))
 
+// The slow part of the write barrier, see record_heap_object_write.
+void record_heap_object_write_slow(value_t object, value_t value);
+
+// The write barrier. Must be called when the given value has been stored in a
+// field of the given object other than through the heap object setters, which
+// already call it. If the store created a pointer from old space into the
+// nursery this records the object such that the field gets updated when the
+// nursery is collected.
+static void record_heap_object_write(value_t object, value_t value) {
+  value_domain_t domain = get_value_domain(value);
+  if (domain == vdHeapObject || domain == vdDerivedObject)
+    record_heap_object_write_slow(object, value);
+}
+
 // Returns the object type of the object the given value points to. This is a
 // macro because it is a hot function.
 #define get_heap_object_family(VALUE) get_species_instance_family(get_heap_object_species(VALUE))
@@ -907,7 +930,7 @@ ENUM_SPECIES_DIVISIONS(DECLARE_SPECIES_DIVISION_ENUM)
 const char *get_species_division_name(species_division_t division);
 
 // The size of the species header, the part that's the same for all species.
-#define kSpeciesHeaderSize HEAP_OBJECT_SIZE(3)
+#define kSpeciesHeaderSize HEAP_OBJECT_SIZE(4)
 
 // The instance family could be stored within the family struct but we need it
 // so often that it's worth the extra space to have it as close at hand as
@@ -915,6 +938,9 @@ const char *get_species_division_name(species_division_t division);
 static const size_t kSpeciesInstanceFamilyOffset = HEAP_OBJECT_FIELD_OFFSET(0);
 static const size_t kSpeciesFamilyBehaviorOffset = HEAP_OBJECT_FIELD_OFFSET(1);
 static const size_t kSpeciesDivisionBehaviorOffset = HEAP_OBJECT_FIELD_OFFSET(2);
+// The heap the species was allocated in, which is the heap of all its
+// instances too. The write barrier uses it to get from an object to its heap.
+static const size_t kSpeciesHeapOffset = HEAP_OBJECT_FIELD_OFFSET(3);
 
 // Expands to the size of a species with N field in addition to the species
 // header.
@@ -945,6 +971,12 @@ division_behavior_t *get_species_division_behavior(value_t species);
 // Sets the species division behavior of this species.
 void set_species_division_behavior(value_t species, division_behavior_t *behavior);
 
+// Returns the heap this species and its instances live in.
+heap_t *get_species_heap(value_t species);
+
+// Sets the heap this species and its instances live in.
+void set_species_heap(value_t species, heap_t *heap);
+
 // Returns the division the given species belongs to.
 species_division_t get_species_division(value_t value);
 
@@ -1402,10 +1434,13 @@ ACCESSORS_DECL(factory, constructor);
 
 //  --- C o d e   b l o c k ---
 
-static const size_t kCodeBlockSize = HEAP_OBJECT_SIZE(3);
+static const size_t kCodeBlockSize = HEAP_OBJECT_SIZE(6);
 static const size_t kCodeBlockBytecodeOffset = HEAP_OBJECT_FIELD_OFFSET(0);
 static const size_t kCodeBlockValuePoolOffset = HEAP_OBJECT_FIELD_OFFSET(1);
 static const size_t kCodeBlockHighWaterMarkOffset = HEAP_OBJECT_FIELD_OFFSET(2);
+static const size_t kCodeBlockInlineCachesOffset = HEAP_OBJECT_FIELD_OFFSET(3);
+static const size_t kCodeBlockDecodedBytecodeOffset = HEAP_OBJECT_FIELD_OFFSET(4);
+static const size_t kCodeBlockSerialOffset = HEAP_OBJECT_FIELD_OFFSET(5);
 
 // The binary blob of bytecode for this code block.
 ACCESSORS_DECL(code_block, bytecode);
@@ -1416,6 +1451,21 @@ ACCESSORS_DECL(code_block, value_pool);
 // The highest stack height possible when executing this code.
 INTEGER_ACCESSORS_DECL(code_block, high_water_mark);
 
+// Mutable array with one slot for each call site in this code block that
+// caches lookup results, or nothing if there are no such sites. The array is
+// deliberately not frozen along with the rest of the code block.
+ACCESSORS_DECL(code_block, inline_caches);
+
+// The bytecode in the decoded form that is executed by the interpreter, with
+// value pool references resolved. See decode_bytecode. Like the inline caches
+// this is not frozen along with the code block if it contains instructions the
+// interpreter rewrites in place once it knows more about them.
+ACCESSORS_DECL(code_block, decoded_bytecode);
+
+// The index of this code block's entry in the runtime's code block table where
+// the data about it that lives outside the heap is kept.
+INTEGER_ACCESSORS_DECL(code_block, serial);
+
 
 // --- T y p e ---
 
@@ -0,0 +1,261 @@
+#!/usr/bin/python
+# Copyright 2014 the Neutrino authors (see AUTHORS).
+# Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+# Reads a heap dump written by ctrino and prints the objects and families that
+# retain the most memory. An object retains everything it dominates, that is,
+# everything that would become garbage if it did. See write_heap_dump_to_handle
+# in file.h for the format.
+
+import optparse
+
+# Record tags.
+FAMILY_TAG = ord('f')
+ROOT_TAG = ord('r')
+OBJECT_TAG = ord('o')
+END_TAG = ord('e')
+
+MAGIC = b'nheapdmp'
+VERSION = 1
+
+
+# Reads the records of a heap dump.
+class DumpReader(object):
+
+  def __init__(self, data):
+    self.data = bytearray(data)
+    self.cursor = 0
+
+  def read_byte(self):
+    result = self.data[self.cursor]
+    self.cursor += 1
+    return result
+
+  def read_uint(self):
+    result = 0
+    shift = 0
+    while True:
+      byte = self.read_byte()
+      result |= (byte & 0x7F) << shift
+      if byte < 0x80:
+        return result
+      shift += 7
+
+  def read_string(self):
+    length = self.read_uint()
+    start = self.cursor
+    self.cursor += length
+    return self.data[start:self.cursor].decode('utf-8')
+
+  def read(self, heap):
+    if bytes(self.data[0:len(MAGIC)]) != MAGIC:
+      raise Exception("Not a heap dump")
+    self.cursor = len(MAGIC)
+    version = self.read_uint()
+    if version != VERSION:
+      raise Exception("Unsupported heap dump version %i" % version)
+    while True:
+      tag = self.read_byte()
+      if tag == FAMILY_TAG:
+        ordinal = self.read_uint()
+        heap.family_names[ordinal] = self.read_string()
+      elif tag == ROOT_TAG:
+        heap.roots.append(self.read_uint())
+      elif tag == OBJECT_TAG:
+        address = self.read_uint()
+        family = self.read_uint()
+        size = self.read_uint()
+        ref_count = self.read_uint()
+        refs = [self.read_uint() for i in range(ref_count)]
+        heap.add_object(address, family, size, refs)
+      elif tag == END_TAG:
+        return
+      else:
+        raise Exception("Unexpected tag %i at %i" % (tag, self.cursor - 1))
+
+
+# The object graph read from a dump. Objects are numbered in the order they were
+# read and index 0 is a synthetic root that points to all the actual roots.
+class Heap(object):
+
+  def __init__(self):
+    self.family_names = {}
+    self.roots = []
+    self.index_by_address = {}
+    self.addresses = [None]
+    self.families = [None]
+    self.sizes = [0]
+    self.refs = [[]]
+
+  def add_object(self, address, family, size, refs):
+    self.index_by_address[address] = len(self.addresses)
+    self.addresses.append(address)
+    self.families.append(family)
+    self.sizes.append(size)
+    self.refs.append(refs)
+
+  def get_family_name(self, index):
+    family = self.families[index]
+    return self.family_names.get(family, "family %i" % family)
+
+  # Replaces the addresses in the reference lists with object indices, dropping
+  # any that don't refer to an object in the dump.
+  def resolve(self):
+    self.refs[0] = self.roots
+    for i in range(len(self.refs)):
+      resolved = []
+      for address in self.refs[i]:
+        index = self.index_by_address.get(address)
+        if index is not None:
+          resolved.append(index)
+      self.refs[i] = resolved
+
+  # Returns the objects reachable from the roots in reverse postorder.
+  def get_reverse_postorder(self):
+    order = []
+    visited = [False] * len(self.refs)
+    visited[0] = True
+    stack = [(0, 0)]
+    while stack:
+      (index, next_ref) = stack[-1]
+      refs = self.refs[index]
+      if next_ref < len(refs):
+        stack[-1] = (index, next_ref + 1)
+        target = refs[next_ref]
+        if not visited[target]:
+          visited[target] = True
+          stack.append((target, 0))
+      else:
+        stack.pop()
+        order.append(index)
+    order.reverse()
+    return order
+
+  # Computes the immediate dominator of every reachable object using the
+  # iterative algorithm by Cooper, Harvey and Kennedy. Unreachable objects get
+  # None.
+  def get_dominators(self):
+    order = self.get_reverse_postorder()
+    position = [None] * len(self.refs)
+    for (i, index) in enumerate(order):
+      position[index] = i
+    preds = [[] for i in range(len(self.refs))]
+    for index in order:
+      for target in self.refs[index]:
+        preds[target].append(index)
+    idom = [None] * len(self.refs)
+    idom[0] = 0
+    def intersect(a, b):
+      while a != b:
+        while position[a] > position[b]:
+          a = idom[a]
+        while position[b] > position[a]:
+          b = idom[b]
+      return a
+    changed = True
+    while changed:
+      changed = False
+      for index in order[1:]:
+        new_idom = None
+        for pred in preds[index]:
+          if idom[pred] is None:
+            continue
+          if new_idom is None:
+            new_idom = pred
+          else:
+            new_idom = intersect(pred, new_idom)
+        if idom[index] != new_idom:
+          idom[index] = new_idom
+          changed = True
+    return (order, idom)
+
+  # Returns the retained size of every object given the dominators.
+  def get_retained_sizes(self, order, idom):
+    retained = list(self.sizes)
+    # Children come after their dominators in reverse postorder so going
+    # backwards adds each object to its dominator after it's complete.
+    for index in reversed(order[1:]):
+      retained[idom[index]] += retained[index]
+    return retained
+
+
+def print_report(heap, top_count, tree_depth):
+  heap.resolve()
+  (order, idom) = heap.get_dominators()
+  retained = heap.get_retained_sizes(order, idom)
+  live = order[1:]
+  total = retained[0]
+  print("%i objects, %i live, %i bytes live" % (len(heap.sizes) - 1,
+      len(live), total))
+  # Families by the total size of their objects and by what they retain, that
+  # is, what's retained by objects of that family that aren't themselves
+  # retained by another object of the same family.
+  print("")
+  print("Families by size:")
+  children = [[] for i in range(len(heap.sizes))]
+  for index in live:
+    children[idom[index]].append(index)
+  by_family = {}
+  families_on_path = {}
+  stack = [(0, True)]
+  while stack:
+    (index, entering) = stack.pop()
+    family = heap.families[index]
+    if not entering:
+      families_on_path[family] -= 1
+      continue
+    if index > 0:
+      name = heap.get_family_name(index)
+      (count, size, kept) = by_family.get(name, (0, 0, 0))
+      if families_on_path.get(family, 0) == 0:
+        kept += retained[index]
+      by_family[name] = (count + 1, size + heap.sizes[index], kept)
+    families_on_path[family] = families_on_path.get(family, 0) + 1
+    stack.append((index, False))
+    for child in children[index]:
+      stack.append((child, True))
+  families = sorted(by_family.items(), key=lambda e: -e[1][2])
+  print("  %-28s %10s %12s %12s" % ("family", "count", "size", "retained"))
+  for (name, (count, size, kept)) in families[:top_count]:
+    print("  %-28s %10i %12i %12i" % (name, count, size, kept))
+  # The objects that retain the most.
+  print("")
+  print("Objects by retained size:")
+  objects = sorted(live, key=lambda i: -retained[i])
+  print("  %-18s %-28s %10s %12s" % ("address", "family", "size", "retained"))
+  for index in objects[:top_count]:
+    print("  %-18s %-28s %10i %12i" % (hex(heap.addresses[index]),
+        heap.get_family_name(index), heap.sizes[index], retained[index]))
+  if tree_depth > 0:
+    print("")
+    print("Dominator tree:")
+    stack = [(0, -1)]
+    while stack:
+      (index, depth) = stack.pop()
+      if depth >= 0:
+        print("  %s%s %s: %i" % ("  " * depth, heap.get_family_name(index),
+            hex(heap.addresses[index]), retained[index]))
+      if depth + 1 < tree_depth:
+        kids = sorted(children[index], key=lambda i: retained[i])
+        for kid in kids[-top_count:]:
+          stack.append((kid, depth + 1))
+
+
+def main():
+  parser = optparse.OptionParser(usage="%prog [options] <heap dump>")
+  parser.add_option("--top", type="int", default=20,
+      help="How many families and objects to list")
+  parser.add_option("--tree-depth", type="int", default=0,
+      help="How many levels of the dominator tree to print")
+  (options, args) = parser.parse_args()
+  if len(args) != 1:
+    parser.error("expected one heap dump")
+  with open(args[0], "rb") as file:
+    data = file.read()
+  heap = Heap()
+  DumpReader(data).read(heap)
+  print_report(heap, options.top, options.tree_depth)
+
+
+if __name__ == '__main__':
+  main()
@@ -7,6 +7,7 @@
 #include "crash.h"
 #include "log.h"
 #include "runtime.h"
+#include "syntax.h"
 #include "test.h"
 #include "utils.h"
 #include "tagged.h"
@@ -488,3 +489,38 @@ bool advance_lexical_permutation(int64_t *elms, size_t elmc) {
   }
   return true;
 }
+
+value_t new_infix_invocation(runtime_t *runtime, value_t code,
+    value_t self, value_t that) {
+  TRY_DEF(module, new_heap_empty_module(runtime, nothing()));
+  TRY_DEF(methodspace, new_heap_methodspace(runtime));
+  TRY_DEF(fragment, new_heap_module_fragment(runtime, module, present_stage(),
+      nothing(), methodspace, nothing()));
+  TRY(add_to_array_buffer(runtime, get_module_fragments(module), fragment));
+  TRY_DEF(op, new_heap_operation(runtime, afFreeze, otInfix, new_integer(0)));
+  TRY_DEF(op_guard, new_heap_guard(runtime, afFreeze, gtEq, op));
+  value_t tags[3] = {ROOT(runtime, subject_key), ROOT(runtime, selector_key),
+      new_integer(0)};
+  value_t guards[3] = {ROOT(runtime, any_guard), op_guard,
+      ROOT(runtime, any_guard)};
+  value_t values[3] = {self, op, that};
+  TRY_DEF(param_vector, new_heap_pair_array(runtime, 3));
+  TRY_DEF(args, new_heap_array(runtime, 3));
+  for (size_t i = 0; i < 3; i++) {
+    TRY_DEF(param, new_heap_parameter(runtime, afFreeze, guards[i],
+        ROOT(runtime, empty_array), false, i));
+    set_pair_array_first_at(param_vector, i, tags[i]);
+    set_pair_array_second_at(param_vector, i, param);
+    TRY_DEF(literal, new_heap_literal_ast(runtime, values[i]));
+    TRY_DEF(arg, new_heap_argument_ast(runtime, tags[i], literal));
+    set_array_at(args, i, arg);
+  }
+  co_sort_pair_array(param_vector);
+  TRY_DEF(signature, new_heap_signature(runtime, afFreeze, param_vector, 3, 3,
+      false));
+  TRY_DEF(method, new_heap_method(runtime, afFreeze, signature, nothing(),
+      code, nothing(), new_flag_set(kFlagSetAllOff)));
+  TRY(add_methodspace_method(runtime, methodspace, method));
+  TRY_DEF(ast, new_heap_invocation_ast(runtime, args));
+  return compile_expression(runtime, ast, fragment, scope_get_bottom());
+}
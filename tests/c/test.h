@@ -439,3 +439,9 @@ value_t variant_to_value(runtime_t *runtime, variant_t *variant);
 // times, starting from 0..N, generates all possible permutations. Returns false
 // iff the given array if in descending order, which is the end point.
 bool advance_lexical_permutation(int64_t *elms, size_t elmc);
+
+// Returns a code block that performs an infix invocation on the given values
+// in a fresh module whose only method, which accepts any subject and argument,
+// is the given code.
+value_t new_infix_invocation(runtime_t *runtime, value_t code, value_t self,
+    value_t that);
@@ -43,11 +43,8 @@ TEST(heap, align_address) {
 
 TEST(heap, space_alloc) {
   // Configure the space.
-  runtime_config_t config;
-  runtime_config_init_defaults(&config);
-  config.semispace_size_bytes = kKB;
   space_t space;
-  space_init(&space, &config);
+  space_init(&space, kKB);
 
   // Check that we can allocate all the memory but no more.
   address_t addr;
@@ -60,3 +57,21 @@ TEST(heap, space_alloc) {
   // Clean up.
   space_dispose(&space);
 }
+
+TEST(heap, remembered_set) {
+  remembered_set_t set;
+  remembered_set_init(&set);
+  // Add enough fake objects to make the set grow a few times.
+  value_t objects[200];
+  for (size_t i = 0; i < 200; i++) {
+    objects[i] = new_heap_object((address_t) (0x1000 + i * kValueSize));
+    ASSERT_TRUE(remembered_set_add(&set, objects[i]));
+    ASSERT_TRUE(remembered_set_add(&set, objects[i]));
+  }
+  ASSERT_EQ(200, set.size);
+  for (size_t i = 0; i < 200; i++)
+    ASSERT_TRUE(remembered_set_contains(&set, objects[i]));
+  ASSERT_FALSE(remembered_set_contains(&set,
+      new_heap_object((address_t) (0x1000 + 200 * kValueSize))));
+  remembered_set_dispose(&set);
+}
@@ -188,3 +188,429 @@ TEST(interp, lookup_error) {
   DISPOSE_TEST_ARENA();
   DISPOSE_RUNTIME();
 }
+
+// Returns the decoded bytecode of the given code block with any stack height
+// checks, which are only emitted with expensive checks enabled, removed.
+static value_t get_decoded_without_checks(runtime_t *runtime,
+    value_t code_block) {
+  static const size_t kSizes[] = {
+#define __EMIT_OPERATION_SIZE__(Name, ARGC, VALUES) ARGC,
+    ENUM_OPCODES(__EMIT_OPERATION_SIZE__)
+#undef __EMIT_OPERATION_SIZE__
+  };
+  value_t decoded = get_code_block_decoded_bytecode(code_block);
+  TRY_DEF(result, new_heap_array_buffer(runtime, get_array_length(decoded)));
+  // Step over whole instructions since an operand may happen to have the same
+  // value as the check opcode.
+  size_t pc = 0;
+  while (pc < get_array_length(decoded)) {
+    opcode_t opcode = (opcode_t) get_integer_value(get_array_at(decoded, pc));
+    size_t size = kSizes[opcode];
+    if (opcode != ocCheckStackHeight) {
+      for (size_t i = 0; i < size; i++)
+        TRY(add_to_array_buffer(runtime, result, get_array_at(decoded, pc + i)));
+    }
+    pc += size;
+  }
+  return result;
+}
+
+TEST(interp, decode_bytecode) {
+  CREATE_RUNTIME();
+  CREATE_TEST_ARENA();
+
+  assembler_t assm;
+  ASSERT_SUCCESS(assembler_init(&assm, runtime, nothing(), scope_get_bottom()));
+  value_t str = C(vStr("foo"));
+  ASSERT_SUCCESS(assembler_emit_push(&assm, str));
+  ASSERT_SUCCESS(assembler_emit_new_array(&assm, 1));
+  ASSERT_SUCCESS(assembler_emit_return(&assm));
+  value_t code_block = assembler_flush(&assm);
+  assembler_dispose(&assm);
+  ASSERT_SUCCESS(code_block);
+
+  // Value pool operands are replaced by the values themselves, everything else
+  // is kept as integers.
+  value_t decoded = get_code_block_decoded_bytecode(code_block);
+  ASSERT_EQ(get_blob_length(get_code_block_bytecode(code_block)) / sizeof(short_t),
+      get_array_length(decoded));
+  ASSERT_TRUE(is_frozen(decoded));
+  ASSERT_VALEQ(C(vArrayBuffer(vInt(ocPush), vValue(str), vInt(ocNewArray),
+      vInt(1), vInt(ocReturn))), get_decoded_without_checks(runtime, code_block));
+
+  DISPOSE_TEST_ARENA();
+  DISPOSE_RUNTIME();
+}
+
+TEST(interp, peephole) {
+  CREATE_RUNTIME();
+
+  assembler_t assm;
+  ASSERT_SUCCESS(assembler_init(&assm, runtime, nothing(), scope_get_bottom()));
+  ASSERT_SUCCESS(assembler_emit_push(&assm, new_integer(101)));
+  ASSERT_SUCCESS(assembler_emit_push(&assm, new_integer(102)));
+  // Reading the cursor keeps the instructions on each side apart.
+  assembler_get_code_cursor(&assm);
+  ASSERT_SUCCESS(assembler_emit_push(&assm, new_integer(103)));
+  ASSERT_SUCCESS(assembler_emit_load_argument(&assm, 2));
+  ASSERT_SUCCESS(assembler_emit_push(&assm, new_integer(104)));
+  ASSERT_SUCCESS(assembler_emit_slap(&assm, 3));
+  ASSERT_SUCCESS(assembler_emit_pop(&assm, 1));
+  ASSERT_SUCCESS(assembler_emit_load_argument(&assm, 0));
+  ASSERT_SUCCESS(assembler_emit_push(&assm, new_integer(105)));
+  ASSERT_SUCCESS(assembler_emit_slap(&assm, 2));
+  // Popping nothing keeps the slapped value so it isn't combined.
+  ASSERT_SUCCESS(assembler_emit_pop(&assm, 0));
+  ASSERT_SUCCESS(assembler_emit_return(&assm));
+  value_t code_block = assembler_flush(&assm);
+  assembler_dispose(&assm);
+  ASSERT_SUCCESS(code_block);
+
+#ifdef EXPENSIVE_CHECKS
+  // The stack height checks get between the instructions and stop them from
+  // being combined so they must come out exactly as they were emitted.
+  int64_t expected[] = {
+    ocPush, 101,
+    ocPush, 102,
+    ocPush, 103,
+    ocLoadArgument, 2,
+    ocPush, 104,
+    ocSlap, 3,
+    ocPop, 1,
+    ocLoadArgument, 0,
+    ocPush, 105,
+    ocSlap, 2,
+    ocPop, 0,
+    ocReturn
+  };
+#else
+  int64_t expected[] = {
+    ocPushPush, 101, 102,
+    ocPushLoadArgument, 103, 2,
+    ocPush, 104,
+    ocPop, 4,
+    ocLoadArgumentPush, 0, 105,
+    ocSlap, 2,
+    ocPop, 0,
+    ocReturn
+  };
+#endif
+  size_t expected_length = sizeof(expected) / sizeof(*expected);
+  value_t decoded = get_decoded_without_checks(runtime, code_block);
+  ASSERT_SUCCESS(decoded);
+  ASSERT_EQ(expected_length, get_array_buffer_length(decoded));
+  for (size_t i = 0; i < expected_length; i++)
+    ASSERT_VALEQ(new_integer(expected[i]), get_array_buffer_at(decoded, i));
+
+  DISPOSE_RUNTIME();
+}
+
+TEST(interp, load_cached_global) {
+  CREATE_RUNTIME();
+
+  // A module with a single fragment that binds x to an array.
+  value_t module = new_heap_empty_module(runtime, nothing());
+  value_t fragment = new_heap_module_fragment(runtime, module, present_stage(),
+      new_heap_namespace(runtime, nothing()), new_heap_methodspace(runtime),
+      new_heap_id_hash_map(runtime, 16));
+  ASSERT_SUCCESS(add_to_array_buffer(runtime, get_module_fragments(module),
+      fragment));
+  value_t names = new_heap_array(runtime, 1);
+  string_t x_str;
+  string_init(&x_str, "x");
+  set_array_at(names, 0, new_heap_string(runtime, &x_str));
+  value_t path = new_heap_path_with_names(runtime, names, 0);
+  value_t value = new_heap_array(runtime, 1);
+  set_array_at(value, 0, new_integer(42));
+  ASSERT_SUCCESS(set_namespace_binding_at(runtime,
+      get_module_fragment_namespace(fragment), path, value));
+  value_t ident = new_heap_identifier(runtime, present_stage(), path);
+
+  assembler_t assm;
+  ASSERT_SUCCESS(assembler_init(&assm, runtime, nothing(), scope_get_bottom()));
+  ASSERT_SUCCESS(assembler_emit_load_global(&assm, ident, fragment));
+  ASSERT_SUCCESS(assembler_emit_return(&assm));
+  value_t code_block = assembler_flush(&assm);
+  assembler_dispose(&assm);
+  ASSERT_SUCCESS(code_block);
+  value_t decoded = get_code_block_decoded_bytecode(code_block);
+  ASSERT_VALEQ(new_integer(ocLoadGlobal), get_array_at(decoded, 0));
+
+  // While the fragment is being bound its bindings may still change so the
+  // result isn't cached.
+  set_module_fragment_epoch(fragment, feBinding);
+  ASSERT_SAME(value, run_code_block_until_condition(ambience, code_block));
+  ASSERT_VALEQ(new_integer(ocLoadGlobal), get_array_at(decoded, 0));
+
+  // Once it's bound the first execution fills in the slot.
+  set_module_fragment_epoch(fragment, feComplete);
+  ASSERT_SAME(value, run_code_block_until_condition(ambience, code_block));
+  ASSERT_VALEQ(new_integer(ocLoadCachedGlobal), get_array_at(decoded, 0));
+  ASSERT_SAME(value, get_array_at(decoded, 1));
+
+  // Later executions read the slot rather than looking the name up again.
+  set_array_at(decoded, 1, new_integer(7));
+  ASSERT_VALEQ(new_integer(7), run_code_block_until_condition(ambience,
+      code_block));
+  set_array_at(decoded, 1, value);
+
+  // The collector moves the value and updates the slot.
+  safe_value_t s_ambience = runtime_protect_value(runtime, ambience);
+  safe_value_t s_code_block = runtime_protect_value(runtime, code_block);
+  safe_value_t s_value = runtime_protect_value(runtime, value);
+  ASSERT_SUCCESS(runtime_garbage_collect_nursery(runtime));
+  ASSERT_NSAME(value, deref(s_value));
+  decoded = get_code_block_decoded_bytecode(deref(s_code_block));
+  ASSERT_VALEQ(new_integer(ocLoadCachedGlobal), get_array_at(decoded, 0));
+  ASSERT_SAME(deref(s_value), get_array_at(decoded, 1));
+  value_t result = run_code_block_until_condition(deref(s_ambience),
+      deref(s_code_block));
+  ASSERT_SAME(deref(s_value), result);
+  ASSERT_VALEQ(new_integer(42), get_array_at(result, 0));
+  dispose_safe_value(runtime, s_ambience);
+  dispose_safe_value(runtime, s_code_block);
+  dispose_safe_value(runtime, s_value);
+
+  DISPOSE_RUNTIME();
+}
+
+// Returns the code of the builtin with the given name in the given map of
+// builtin implementations.
+static value_t get_builtin_code(runtime_t *runtime, value_t builtins,
+    const char *name) {
+  string_t name_str;
+  string_init(&name_str, name);
+  TRY_DEF(key, new_heap_string(runtime, &name_str));
+  TRY_DEF(impl, get_id_hash_map_at(builtins, key));
+  return get_builtin_implementation_code(impl);
+}
+
+// Evaluates an infix invocation on the given values in a fresh module whose
+// only method, which accepts any subject and argument, is the given code.
+static value_t run_infix_invocation(value_t ambience, value_t code,
+    value_t self, value_t that) {
+  runtime_t *runtime = get_ambience_runtime(ambience);
+  TRY_DEF(fragment, new_empty_module_fragment(runtime));
+  TRY_DEF(op, new_heap_operation(runtime, afFreeze, otInfix, new_integer(0)));
+  TRY_DEF(op_guard, new_heap_guard(runtime, afFreeze, gtEq, op));
+  value_t tags[3] = {ROOT(runtime, subject_key), ROOT(runtime, selector_key),
+      new_integer(0)};
+  value_t guards[3] = {ROOT(runtime, any_guard), op_guard,
+      ROOT(runtime, any_guard)};
+  value_t values[3] = {self, op, that};
+  TRY_DEF(param_vector, new_heap_pair_array(runtime, 3));
+  TRY_DEF(args, new_heap_array(runtime, 3));
+  for (size_t i = 0; i < 3; i++) {
+    TRY_DEF(param, new_heap_parameter(runtime, afFreeze, guards[i],
+        ROOT(runtime, empty_array), false, i));
+    set_pair_array_first_at(param_vector, i, tags[i]);
+    set_pair_array_second_at(param_vector, i, param);
+    TRY_DEF(literal, new_heap_literal_ast(runtime, values[i]));
+    TRY_DEF(arg, new_heap_argument_ast(runtime, tags[i], literal));
+    set_array_at(args, i, arg);
+  }
+  co_sort_pair_array(param_vector);
+  TRY_DEF(signature, new_heap_signature(runtime, afFreeze, param_vector, 3, 3,
+      false));
+  TRY_DEF(method, new_heap_method(runtime, afFreeze, signature, nothing(),
+      code, nothing(), new_flag_set(kFlagSetAllOff)));
+  TRY(add_methodspace_method(runtime, get_module_fragment_methodspace(fragment),
+      method));
+  TRY_DEF(ast, new_heap_invocation_ast(runtime, args));
+  TRY_DEF(code_block, compile_expression(runtime, ast, fragment,
+      scope_get_bottom()));
+  return run_code_block_until_condition(ambience, code_block);
+}
+
+// General implementation of the test builtin in inline_builtin_fallback. It
+// accepts anything and returns null so a null result means the inline version
+// didn't handle the call.
+static value_t general_builtin_marker(builtin_arguments_t *args) {
+  return null();
+}
+
+TEST(interp, inline_builtin_fallback) {
+  // The opcode profile shows whether a call executed the builtin instruction,
+  // that is, whether it took the general path.
+  runtime_config_t config;
+  runtime_config_init_defaults(&config);
+  config.profile_opcodes = true;
+  runtime_t *runtime = NULL;
+  ASSERT_SUCCESS(new_runtime(&config, &runtime));
+  value_t ambience = new_heap_ambience(runtime);
+  ASSERT_SUCCESS(ambience);
+  opcode_profile_t *profile = runtime->opcode_profile;
+  value_t builtins = ROOT(runtime, builtin_impls);
+  value_t plus = get_builtin_code(runtime, builtins, "int+int");
+  ASSERT_SUCCESS(plus);
+  value_t times = get_builtin_code(runtime, builtins, "int*int");
+  ASSERT_SUCCESS(times);
+
+  // Small integers are handled inline.
+  ASSERT_VALEQ(new_integer(7), run_infix_invocation(ambience, plus,
+      new_integer(3), new_integer(4)));
+  ASSERT_VALEQ(new_integer(12), run_infix_invocation(ambience, times,
+      new_integer(3), new_integer(4)));
+  ASSERT_EQ(0, profile->counts[ocBuiltin]);
+
+  // A factor this large might make the product overflow so the inline version
+  // gives up and the builtin proper computes it.
+  int64_t large = 1LL << 30;
+  ASSERT_VALEQ(new_integer(large * 4), run_infix_invocation(ambience, times,
+      new_integer(large), new_integer(4)));
+  ASSERT_EQ(1, profile->counts[ocBuiltin]);
+
+  // The largest tagged integer plus one overflows so that goes through the
+  // builtin too.
+  int64_t max = (1LL << 60) - 1;
+  ASSERT_SUCCESS(run_infix_invocation(ambience, plus, new_integer(max),
+      new_integer(1)));
+  ASSERT_EQ(2, profile->counts[ocBuiltin]);
+
+  // The integer builtins themselves only accept integers so to see what
+  // happens with anything else the inline integer addition is paired with a
+  // general implementation that accepts anything.
+  value_t wrapper = get_array_at(get_code_block_decoded_bytecode(plus), 2);
+  inline_builtin_method_t plus_inline =
+      (inline_builtin_method_t) get_void_p_value(wrapper);
+  safe_value_t s_map = runtime_protect_value(runtime,
+      new_heap_id_hash_map(runtime, 16));
+  ASSERT_SUCCESS(add_builtin_method_impl(runtime, deref(s_map), "test+", 1,
+      general_builtin_marker, -1, plus_inline));
+  value_t marker = get_builtin_code(runtime, deref(s_map), "test+");
+  ASSERT_SUCCESS(marker);
+  ASSERT_VALEQ(new_integer(7), run_infix_invocation(ambience, marker,
+      new_integer(3), new_integer(4)));
+  ASSERT_EQ(2, profile->counts[ocBuiltin]);
+  ASSERT_VALEQ(null(), run_infix_invocation(ambience, marker, new_integer(3),
+      new_float_32(4.0)));
+  ASSERT_EQ(3, profile->counts[ocBuiltin]);
+  ASSERT_VALEQ(null(), run_infix_invocation(ambience, marker, yes(),
+      new_integer(4)));
+  ASSERT_EQ(4, profile->counts[ocBuiltin]);
+  dispose_safe_value(runtime, s_map);
+
+  DISPOSE_RUNTIME();
+}
+
+TEST(interp, opcode_profile) {
+  runtime_config_t config;
+  runtime_config_init_defaults(&config);
+  config.profile_opcodes = true;
+  runtime_t *runtime = NULL;
+  ASSERT_SUCCESS(new_runtime(&config, &runtime));
+  value_t ambience = new_heap_ambience(runtime);
+  ASSERT_SUCCESS(ambience);
+
+  assembler_t assm;
+  ASSERT_SUCCESS(assembler_init(&assm, runtime, nothing(), scope_get_bottom()));
+  ASSERT_SUCCESS(assembler_emit_push(&assm, new_integer(7)));
+  ASSERT_SUCCESS(assembler_emit_new_array(&assm, 1));
+  ASSERT_SUCCESS(assembler_emit_return(&assm));
+  value_t code_block = assembler_flush(&assm);
+  assembler_dispose(&assm);
+  ASSERT_SUCCESS(code_block);
+  ASSERT_SUCCESS(run_code_block_until_condition(ambience, code_block));
+
+  opcode_profile_t *profile = runtime->opcode_profile;
+  ASSERT_EQ(1, profile->counts[ocPush]);
+  ASSERT_EQ(1, profile->counts[ocNewArray]);
+  ASSERT_EQ(1, profile->counts[ocReturn]);
+#ifndef EXPENSIVE_CHECKS
+  ASSERT_EQ(1, profile->pair_counts[ocPush][ocNewArray]);
+  ASSERT_EQ(1, profile->pair_counts[ocNewArray][ocReturn]);
+  code_block_data_t *data = code_block_table_get(runtime->code_block_table,
+      code_block);
+  ASSERT_EQ(3, data->opcode_count);
+#endif
+
+  DISPOSE_RUNTIME();
+}
+
+TEST(interp, alloc_profile) {
+  runtime_config_t config;
+  runtime_config_init_defaults(&config);
+  config.alloc_profile_interval = 1;
+  runtime_t *runtime = NULL;
+  ASSERT_SUCCESS(new_runtime(&config, &runtime));
+  value_t ambience = new_heap_ambience(runtime);
+  ASSERT_SUCCESS(ambience);
+
+  // With an interval of one byte every allocation is sampled.
+  alloc_profile_t *profile = runtime->alloc_profile;
+  uint64_t samples_before = profile->sample_count;
+  ASSERT_SUCCESS(new_heap_array(runtime, 3));
+  ASSERT_EQ(samples_before + 1, profile->sample_count);
+
+  // Arrays allocated by the interpreter are attributed to the array family.
+  assembler_t assm;
+  ASSERT_SUCCESS(assembler_init(&assm, runtime, nothing(), scope_get_bottom()));
+  ASSERT_SUCCESS(assembler_emit_push(&assm, new_integer(7)));
+  ASSERT_SUCCESS(assembler_emit_new_array(&assm, 1));
+  ASSERT_SUCCESS(assembler_emit_return(&assm));
+  value_t code_block = assembler_flush(&assm);
+  assembler_dispose(&assm);
+  ASSERT_SUCCESS(code_block);
+  ASSERT_SUCCESS(run_code_block_until_condition(ambience, code_block));
+  ASSERT_TRUE(profile->frame == NULL);
+  uint64_t array_samples = 0;
+  for (size_t i = 0; i < profile->capacity; i++) {
+    alloc_profile_entry_t *entry = &profile->entries[i];
+    if (entry->key != NULL && entry->family == ofArray)
+      array_samples += entry->samples;
+  }
+  ASSERT_TRUE(array_samples >= 2);
+
+  DISPOSE_RUNTIME();
+}
+
+// Returns the number of sites in the given profile where arrays were allocated.
+static size_t count_array_sites(alloc_profile_t *profile) {
+  size_t result = 0;
+  for (size_t i = 0; i < profile->capacity; i++) {
+    alloc_profile_entry_t *entry = &profile->entries[i];
+    if (entry->key != NULL && entry->family == ofArray)
+      result++;
+  }
+  return result;
+}
+
+TEST(interp, alloc_profile_sites) {
+  runtime_config_t config;
+  runtime_config_init_defaults(&config);
+  config.alloc_profile_interval = 1;
+  runtime_t *runtime = NULL;
+  ASSERT_SUCCESS(new_runtime(&config, &runtime));
+  value_t ambience = new_heap_ambience(runtime);
+  ASSERT_SUCCESS(ambience);
+
+  // A method that allocates an array.
+  assembler_t assm;
+  ASSERT_SUCCESS(assembler_init(&assm, runtime, nothing(), scope_get_bottom()));
+  ASSERT_SUCCESS(assembler_emit_push(&assm, new_integer(7)));
+  ASSERT_SUCCESS(assembler_emit_new_array(&assm, 1));
+  ASSERT_SUCCESS(assembler_emit_return(&assm));
+  value_t method_code = assembler_flush(&assm);
+  assembler_dispose(&assm);
+  ASSERT_SUCCESS(method_code);
+
+  // Two code blocks that make the exact same call at the same pc.
+  value_t first = new_infix_invocation(runtime, method_code, new_integer(3),
+      new_integer(4));
+  ASSERT_SUCCESS(first);
+  value_t second = new_infix_invocation(runtime, method_code, new_integer(3),
+      new_integer(4));
+  ASSERT_SUCCESS(second);
+  alloc_profile_t *profile = runtime->alloc_profile;
+
+  // Running the same code again doesn't make a new site...
+  ASSERT_SUCCESS(run_code_block_until_condition(ambience, first));
+  size_t sites = count_array_sites(profile);
+  ASSERT_SUCCESS(run_code_block_until_condition(ambience, first));
+  ASSERT_EQ(sites, count_array_sites(profile));
+  // ...but the same call from a different code block does.
+  ASSERT_SUCCESS(run_code_block_until_condition(ambience, second));
+  ASSERT_EQ(sites + 1, count_array_sites(profile));
+
+  DISPOSE_RUNTIME();
+}
@@ -0,0 +1,199 @@
+// Copyright 2014 the Neutrino authors (see AUTHORS).
+// Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include "alloc.h"
+#include "interp.h"
+#include "jit.h"
+#include "safe-inl.h"
+#include "syntax.h"
+#include "test.h"
+#include "try-inl.h"
+
+// Creates a runtime with the given config and an ambience for it.
+#define CREATE_RUNTIME_WITH_CONFIG(CONFIG)                                     \
+runtime_t *runtime = NULL;                                                     \
+value_t ambience = nothing();                                                  \
+ASSERT_SUCCESS(new_runtime((CONFIG), &runtime));                               \
+ASSERT_SUCCESS(ambience = new_heap_ambience(runtime));
+
+// Returns the native code the given code block has been compiled to, or NULL.
+static jit_code_t *get_native_code(runtime_t *runtime, value_t code_block) {
+  return code_block_table_get(runtime->code_block_table, code_block)->native_code;
+}
+
+// Returns a code block that exercises a mix of instructions that are and
+// aren't compiled, including a jump over some code.
+static value_t new_mixed_code_block(runtime_t *runtime, value_t str) {
+  assembler_t assm;
+  ASSERT_SUCCESS(assembler_init(&assm, runtime, nothing(), scope_get_bottom()));
+  ASSERT_SUCCESS(assembler_emit_push(&assm, str));
+  ASSERT_SUCCESS(assembler_emit_push(&assm, new_integer(102)));
+  short_buffer_cursor_t dest;
+  size_t goto_offset = assembler_get_code_cursor(&assm);
+  ASSERT_SUCCESS(assembler_emit_goto_forward(&assm, &dest));
+  ASSERT_SUCCESS(assembler_emit_push(&assm, new_integer(999)));
+  ASSERT_SUCCESS(assembler_emit_pop(&assm, 1));
+  short_buffer_cursor_set(&dest, assembler_get_code_cursor(&assm) - goto_offset);
+  ASSERT_SUCCESS(assembler_emit_new_reference(&assm));
+  ASSERT_SUCCESS(assembler_emit_get_reference(&assm));
+  ASSERT_SUCCESS(assembler_emit_push(&assm, new_integer(103)));
+  ASSERT_SUCCESS(assembler_emit_slap(&assm, 1));
+  ASSERT_SUCCESS(assembler_emit_new_array(&assm, 2));
+  ASSERT_SUCCESS(assembler_emit_return(&assm));
+  value_t code_block = assembler_flush(&assm);
+  assembler_dispose(&assm);
+  return code_block;
+}
+
+// Checks that the result of running the mixed code block is as expected.
+static void assert_mixed_result(value_t str, value_t result) {
+  ASSERT_FAMILY(ofArray, result);
+  ASSERT_EQ(2, get_array_length(result));
+  ASSERT_SAME(str, get_array_at(result, 0));
+  ASSERT_VALEQ(new_integer(103), get_array_at(result, 1));
+}
+
+TEST(jit, mixed) {
+  runtime_config_t config;
+  runtime_config_init_defaults(&config);
+  config.enable_jit = true;
+  config.jit_threshold = 0;
+  CREATE_RUNTIME_WITH_CONFIG(&config);
+
+  string_t chars;
+  string_init(&chars, "foo");
+  value_t str = new_heap_string(runtime, &chars);
+  value_t code_block = new_mixed_code_block(runtime, str);
+  ASSERT_SUCCESS(code_block);
+  ASSERT_TRUE(get_native_code(runtime, code_block) == NULL);
+  value_t result = run_code_block_until_condition(ambience, code_block);
+  assert_mixed_result(str, result);
+
+  jit_code_t *native = get_native_code(runtime, code_block);
+  if (!jit_is_supported()) {
+    ASSERT_TRUE(native == NULL);
+    DISPOSE_RUNTIME();
+    return;
+  }
+  ASSERT_TRUE(native != NULL);
+  // The simple instructions have native code, the rest is left to the
+  // interpreter.
+  value_t decoded = get_code_block_decoded_bytecode(code_block);
+  ASSERT_EQ(get_array_length(decoded), native->entry_count);
+  ASSERT_TRUE(jit_code_has_entry(native, 0));
+  for (size_t pc = 0; pc < native->entry_count; pc++) {
+    value_t elm = get_array_at(decoded, pc);
+    if (is_same_value(elm, new_integer(ocNewReference))
+        || is_same_value(elm, new_integer(ocNewArray))
+        || is_same_value(elm, new_integer(ocReturn)))
+      ASSERT_FALSE(jit_code_has_entry(native, pc));
+  }
+
+  // The native code reads the values from the decoded bytecode so it keeps
+  // working after the collector has moved them.
+  safe_value_t s_ambience = runtime_protect_value(runtime, ambience);
+  safe_value_t s_code_block = runtime_protect_value(runtime, code_block);
+  safe_value_t s_str = runtime_protect_value(runtime, str);
+  ASSERT_SUCCESS(runtime_garbage_collect_nursery(runtime));
+  ASSERT_NSAME(str, deref(s_str));
+  ASSERT_TRUE(native == get_native_code(runtime, deref(s_code_block)));
+  result = run_code_block_until_condition(deref(s_ambience),
+      deref(s_code_block));
+  assert_mixed_result(deref(s_str), result);
+  dispose_safe_value(runtime, s_ambience);
+  dispose_safe_value(runtime, s_code_block);
+  dispose_safe_value(runtime, s_str);
+
+  DISPOSE_RUNTIME();
+}
+
+TEST(jit, locals) {
+  runtime_config_t config;
+  runtime_config_init_defaults(&config);
+  config.enable_jit = true;
+  config.jit_threshold = 0;
+  CREATE_RUNTIME_WITH_CONFIG(&config);
+
+  // def x := 7; def y := 8; [y, x, y]
+  value_t x = new_heap_symbol_ast(runtime, null(), null());
+  value_t y = new_heap_symbol_ast(runtime, null(), null());
+  value_t elements = new_heap_array(runtime, 3);
+  set_array_at(elements, 0, new_heap_local_variable_ast(runtime, y));
+  set_array_at(elements, 1, new_heap_local_variable_ast(runtime, x));
+  set_array_at(elements, 2, new_heap_local_variable_ast(runtime, y));
+  value_t y_decl = new_heap_local_declaration_ast(runtime, y, no(),
+      new_heap_literal_ast(runtime, new_integer(8)),
+      new_heap_array_ast(runtime, elements));
+  set_symbol_ast_origin(y, y_decl);
+  value_t x_decl = new_heap_local_declaration_ast(runtime, x, no(),
+      new_heap_literal_ast(runtime, new_integer(7)), y_decl);
+  set_symbol_ast_origin(x, x_decl);
+  value_t code_block = compile_expression(runtime, x_decl, nothing(),
+      scope_get_bottom());
+  ASSERT_SUCCESS(code_block);
+  value_t result = run_code_block_until_condition(ambience, code_block);
+  ASSERT_FAMILY(ofArray, result);
+  ASSERT_EQ(3, get_array_length(result));
+  ASSERT_VALEQ(new_integer(8), get_array_at(result, 0));
+  ASSERT_VALEQ(new_integer(7), get_array_at(result, 1));
+  ASSERT_VALEQ(new_integer(8), get_array_at(result, 2));
+  ASSERT_EQ(jit_is_supported(), get_native_code(runtime, code_block) != NULL);
+
+  DISPOSE_RUNTIME();
+}
+
+TEST(jit, promotion) {
+  runtime_config_t config;
+  runtime_config_init_defaults(&config);
+  config.enable_jit = true;
+  config.jit_threshold = 3;
+  CREATE_RUNTIME_WITH_CONFIG(&config);
+
+  // A method that returns its argument.
+  assembler_t assm;
+  ASSERT_SUCCESS(assembler_init(&assm, runtime, nothing(), scope_get_bottom()));
+  ASSERT_SUCCESS(assembler_emit_push(&assm, new_integer(5)));
+  ASSERT_SUCCESS(assembler_emit_pop(&assm, 1));
+  ASSERT_SUCCESS(assembler_emit_load_argument(&assm, 2));
+  ASSERT_SUCCESS(assembler_emit_return(&assm));
+  value_t method_code = assembler_flush(&assm);
+  assembler_dispose(&assm);
+  ASSERT_SUCCESS(method_code);
+  value_t code_block = new_infix_invocation(runtime, method_code,
+      new_integer(3), new_integer(4));
+  ASSERT_SUCCESS(code_block);
+  code_block_table_t *table = runtime->code_block_table;
+
+  // The method is interpreted until it has been invoked often enough, then
+  // it's compiled.
+  for (size_t i = 1; i <= 4; i++) {
+    ASSERT_VALEQ(new_integer(4), run_code_block_until_condition(ambience,
+        code_block));
+    code_block_data_t *data = code_block_table_get(table, method_code);
+    ASSERT_EQ(i, data->invocation_count);
+    ASSERT_EQ(i >= 3 && jit_is_supported(), data->native_code != NULL);
+  }
+  // The top level is never invoked as a method so it stays interpreted.
+  ASSERT_TRUE(get_native_code(runtime, code_block) == NULL);
+
+  DISPOSE_RUNTIME();
+}
+
+TEST(jit, disabled) {
+  runtime_config_t config;
+  runtime_config_init_defaults(&config);
+  ASSERT_FALSE(config.enable_jit);
+  // Opcode profiling turns native code off since it isn't profiled.
+  config.enable_jit = true;
+  config.jit_threshold = 0;
+  config.profile_opcodes = true;
+  CREATE_RUNTIME_WITH_CONFIG(&config);
+
+  value_t code_block = new_mixed_code_block(runtime, new_integer(101));
+  ASSERT_SUCCESS(code_block);
+  value_t result = run_code_block_until_condition(ambience, code_block);
+  assert_mixed_result(new_integer(101), result);
+  ASSERT_TRUE(get_native_code(runtime, code_block) == NULL);
+
+  DISPOSE_RUNTIME();
+}
@@ -177,6 +177,42 @@ TEST(method, multi_score) {
   DISPOSE_RUNTIME();
 }
 
+TEST(method, type_match_cache) {
+  CREATE_RUNTIME();
+
+  // e <: d <: c <: b <: a
+  value_t types[5];
+  value_t space = new_heap_methodspace(runtime);
+  for (size_t i = 0; i < 5; i++) {
+    types[i] = new_heap_type(runtime, afFreeze, nothing(), null());
+    if (i > 0)
+      ASSERT_SUCCESS(add_methodspace_inheritance(runtime, space, types[i],
+          types[i - 1]));
+  }
+  value_t e = new_instance_of(runtime, types[4]);
+  value_t is_a = new_heap_guard(runtime, afFreeze, gtIs, types[0]);
+  value_t is_b = new_heap_guard(runtime, afFreeze, gtIs, types[1]);
+
+  // Matching again gives the same score, now from the cache.
+  lookup_cache_clear(runtime->lookup_cache);
+  ASSERT_COMPARE(is_a, e, ==, is_a, e);
+  ASSERT_COMPARE(is_b, e, >, is_a, e);
+  size_t cached = 0;
+  for (size_t i = 0; i < kTypeMatchCacheSize; i++) {
+    if (!is_nothing(runtime->lookup_cache->type_matches[i].space))
+      cached++;
+  }
+  // Usually two but the scores could have collided in the table.
+  ASSERT_TRUE(cached == 1 || cached == 2);
+
+  // Changing the hierarchy invalidates the cached scores.
+  ASSERT_SUCCESS(add_methodspace_inheritance(runtime, space, types[4],
+      types[0]));
+  ASSERT_COMPARE(is_a, e, >, is_b, e);
+
+  DISPOSE_RUNTIME();
+}
+
 #undef ASSERT_COMPARE
 
 TEST(method, signature) {
@@ -765,7 +801,7 @@ TEST(method, dense_perfect_lookup) {
   value_t dummy_code = new_heap_code_block(runtime,
       new_heap_blob(runtime, 0),
       ROOT(runtime, empty_array),
-      0);
+      0, 0);
   // Build a method for each combination of parameter types.
   value_t methods[4][4][4];
   for (size_t first = 0; first < 4; first++) {
@@ -798,6 +834,246 @@ TEST(method, dense_perfect_lookup) {
   DISPOSE_RUNTIME();
 }
 
+// Looks up a method for an invocation with three arguments tagged 0, 1, and 2
+// at the given stack offsets and returns the resulting argument map.
+static value_t lookup_argument_map(value_t ambience, value_t space,
+    int64_t *offsets) {
+  runtime_t *runtime = get_ambience_runtime(ambience);
+  value_t stack = new_heap_stack(runtime, 24);
+  value_t entries = new_heap_pair_array(runtime, 3);
+  frame_t frame = open_stack(stack);
+  push_stack_frame(runtime, stack, &frame, 3, null());
+  for (size_t i = 0; i < 3; i++) {
+    set_pair_array_first_at(entries, i, new_integer(i));
+    set_pair_array_second_at(entries, i, new_integer(offsets[i]));
+    frame_push_value(&frame, new_integer(i));
+  }
+  value_t tags = new_heap_call_tags(runtime, afFreeze, entries);
+  value_t arg_map = whatever();
+  ASSERT_SUCCESS(lookup_methodspace_method(ambience, space, tags, &frame,
+      &arg_map));
+  return arg_map;
+}
+
+TEST(method, in_order_argument_map) {
+  CREATE_RUNTIME();
+  CREATE_TEST_ARENA();
+
+  value_t space = new_heap_methodspace(runtime);
+  value_t any_guard = ROOT(runtime, any_guard);
+  value_t signature = make_signature(runtime, false, PARAMS(3,
+      PARAM(any_guard, false, vArray(vInt(0))),
+      PARAM(any_guard, false, vArray(vInt(1))),
+      PARAM(any_guard, false, vArray(vInt(2)))));
+  value_t dummy_code = new_heap_code_block(runtime,
+      new_heap_blob(runtime, 0),
+      ROOT(runtime, empty_array),
+      0, 0);
+  value_t method = new_heap_method(runtime, afFreeze, signature,
+      nothing(), dummy_code, nothing(), new_flag_set(kFlagSetAllOff));
+  ASSERT_SUCCESS(add_methodspace_method(runtime, space, method));
+
+  // Arguments evaluated in parameter order get the shared in-order map.
+  int64_t in_order[3] = {2, 1, 0};
+  value_t first = lookup_argument_map(ambience, space, in_order);
+  ASSERT_VAREQ(vArray(vInt(2), vInt(1), vInt(0)), first);
+  value_t in_order_maps = MROOT(runtime, in_order_argument_maps);
+  ASSERT_SAME(first, get_array_buffer_at(in_order_maps, 3));
+  ASSERT_SAME(first, lookup_argument_map(ambience, space, in_order));
+
+  // It's the same map the trie holds for those offsets.
+  value_t node = MROOT(runtime, argument_map_trie_root);
+  for (size_t i = 0; i < 3; i++)
+    node = get_argument_map_trie_child(runtime, node, new_integer(in_order[i]));
+  ASSERT_SAME(first, get_argument_map_trie_value(node));
+
+  // Other orders still go through the trie.
+  int64_t reversed[3] = {0, 1, 2};
+  value_t second = lookup_argument_map(ambience, space, reversed);
+  ASSERT_VAREQ(vArray(vInt(0), vInt(1), vInt(2)), second);
+  ASSERT_SAME(second, lookup_argument_map(ambience, space, reversed));
+  ASSERT_SAME(first, get_array_buffer_at(in_order_maps, 3));
+
+  DISPOSE_TEST_ARENA();
+  DISPOSE_RUNTIME();
+}
+
+// Looks up a method for an invocation with the given subject, selector, and
+// single positional argument. If the subject is nothing it is left out.
+static value_t lookup_invocation(value_t ambience, value_t space,
+    value_t subject, value_t selector, value_t arg) {
+  runtime_t *runtime = get_ambience_runtime(ambience);
+  size_t argc = is_nothing(subject) ? 2 : 3;
+  value_t stack = new_heap_stack(runtime, 16);
+  frame_t frame = open_stack(stack);
+  push_stack_frame(runtime, stack, &frame, argc, null());
+  value_t entries = new_heap_pair_array(runtime, argc);
+  size_t i = 0;
+  if (!is_nothing(subject)) {
+    frame_push_value(&frame, subject);
+    set_pair_array_first_at(entries, i, ROOT(runtime, subject_key));
+    set_pair_array_second_at(entries, i++, new_integer(2));
+  }
+  frame_push_value(&frame, selector);
+  set_pair_array_first_at(entries, i, ROOT(runtime, selector_key));
+  set_pair_array_second_at(entries, i++, new_integer(1));
+  frame_push_value(&frame, arg);
+  set_pair_array_first_at(entries, i, new_integer(0));
+  set_pair_array_second_at(entries, i, new_integer(0));
+  value_t tags = new_heap_call_tags(runtime, afFreeze, entries);
+  value_t arg_map;
+  return lookup_methodspace_method(ambience, space, tags, &frame, &arg_map);
+}
+
+// Shorthand for looking up an invocation without a subject.
+static value_t lookup_selector_and_argument(value_t ambience, value_t space,
+    value_t selector, value_t arg) {
+  return lookup_invocation(ambience, space, nothing(), selector, arg);
+}
+
+TEST(method, indexed_lookup) {
+  CREATE_RUNTIME();
+  CREATE_TEST_ARENA();
+
+  value_t dummy_code = new_heap_code_block(runtime, new_heap_blob(runtime, 0),
+      ROOT(runtime, empty_array), 0, 0);
+  value_t any_g = ROOT(runtime, any_guard);
+  value_t space = new_heap_methodspace(runtime);
+  // One method for each of a number of selectors.
+  value_t ops[kSignatureMapIndexMinSize + 1];
+  value_t methods[kSignatureMapIndexMinSize];
+  for (size_t i = 0; i <= kSignatureMapIndexMinSize; i++)
+    ops[i] = new_heap_operation(runtime, afFreeze, otInfix,
+        new_integer(i));
+  for (size_t i = 0; i < kSignatureMapIndexMinSize; i++) {
+    value_t signature = make_signature(runtime, false, PARAMS(2,
+        PARAM(new_heap_guard(runtime, afFreeze, gtEq, ops[i]), false,
+            vArray(vValue(ROOT(runtime, selector_key)))),
+        PARAM(any_g, false, vArray(vInt(0)))));
+    methods[i] = new_heap_method(runtime, afFreeze, signature, nothing(),
+        dummy_code, nothing(), new_flag_set(kFlagSetAllOff));
+    ASSERT_SUCCESS(add_methodspace_method(runtime, space, methods[i]));
+  }
+  // And one that applies to any selector.
+  value_t signature = make_signature(runtime, false, PARAMS(2,
+      PARAM(any_g, false, vArray(vValue(ROOT(runtime, selector_key)))),
+      PARAM(new_heap_guard(runtime, afFreeze, gtEq, new_integer(8)), false,
+          vArray(vInt(0)))));
+  value_t generic = new_heap_method(runtime, afFreeze, signature, nothing(),
+      dummy_code, nothing(), new_flag_set(kFlagSetAllOff));
+  ASSERT_SUCCESS(add_methodspace_method(runtime, space, generic));
+
+  value_t sigmap = get_methodspace_methods(space);
+  ASSERT_TRUE(is_nothing(get_signature_map_selector_index(sigmap)));
+  for (size_t i = 0; i < kSignatureMapIndexMinSize; i++)
+    ASSERT_SAME(methods[i], lookup_selector_and_argument(ambience, space,
+        ops[i], new_integer(4)));
+  // The index is built by the first lookup.
+  ASSERT_FALSE(is_nothing(get_signature_map_selector_index(sigmap)));
+  // A selector with no methods of its own only sees the generic one.
+  value_t unknown = ops[kSignatureMapIndexMinSize];
+  ASSERT_SAME(generic, lookup_selector_and_argument(ambience, space, unknown,
+      new_integer(8)));
+  ASSERT_CONDITION(ccLookupError, lookup_selector_and_argument(ambience, space,
+      unknown, new_integer(4)));
+  // The generic method is also considered for the indexed selectors.
+  ASSERT_CONDITION(ccLookupError, lookup_selector_and_argument(ambience, space,
+      ops[0], new_integer(8)));
+
+  // Adding a method drops the index.
+  ASSERT_SUCCESS(add_methodspace_method(runtime, space, generic));
+  ASSERT_TRUE(is_nothing(get_signature_map_selector_index(sigmap)));
+  // Freezing builds it again.
+  ASSERT_SUCCESS(ensure_frozen(runtime, sigmap));
+  ASSERT_FALSE(is_nothing(get_signature_map_selector_index(sigmap)));
+  ASSERT_SAME(methods[2], lookup_selector_and_argument(ambience, space,
+      ops[2], new_integer(4)));
+
+  DISPOSE_TEST_ARENA();
+  DISPOSE_RUNTIME();
+}
+
+TEST(method, subject_dispatch) {
+  CREATE_RUNTIME();
+  CREATE_TEST_ARENA();
+
+  value_t dummy_code = new_heap_code_block(runtime, new_heap_blob(runtime, 0),
+      ROOT(runtime, empty_array), 0, 0);
+  value_t any_g = ROOT(runtime, any_guard);
+  value_t a_p = new_heap_type(runtime, afFreeze, nothing(), C(vStr("A")));
+  value_t b_p = new_heap_type(runtime, afFreeze, nothing(), C(vStr("B")));
+  value_t c_p = new_heap_type(runtime, afFreeze, nothing(), C(vStr("C")));
+  value_t d_p = new_heap_type(runtime, afFreeze, nothing(), C(vStr("D")));
+  value_t space = new_heap_methodspace(runtime);
+  // D <: B <: A, D <: C
+  ASSERT_SUCCESS(add_methodspace_inheritance(runtime, space, b_p, a_p));
+  ASSERT_SUCCESS(add_methodspace_inheritance(runtime, space, d_p, b_p));
+  ASSERT_SUCCESS(add_methodspace_inheritance(runtime, space, d_p, c_p));
+  value_t op = new_heap_operation(runtime, afFreeze, otInfix, new_integer(0));
+  value_t op_g = new_heap_guard(runtime, afFreeze, gtEq, op);
+  // Methods on A, B, and C for the same operation and one for any subject.
+  value_t subject_gs[4] = {
+    new_heap_guard(runtime, afFreeze, gtIs, a_p),
+    new_heap_guard(runtime, afFreeze, gtIs, b_p),
+    new_heap_guard(runtime, afFreeze, gtIs, c_p),
+    any_g
+  };
+  value_t arg_gs[4] = {
+    any_g,
+    any_g,
+    any_g,
+    new_heap_guard(runtime, afFreeze, gtEq, new_integer(8))
+  };
+  value_t methods[4];
+  for (size_t i = 0; i < 4; i++) {
+    value_t signature = make_signature(runtime, false, PARAMS(3,
+        PARAM(subject_gs[i], false, vArray(vValue(ROOT(runtime, subject_key)))),
+        PARAM(op_g, false, vArray(vValue(ROOT(runtime, selector_key)))),
+        PARAM(arg_gs[i], false, vArray(vInt(0)))));
+    methods[i] = new_heap_method(runtime, afFreeze, signature, nothing(),
+        dummy_code, nothing(), new_flag_set(kFlagSetAllOff));
+    ASSERT_SUCCESS(add_methodspace_method(runtime, space, methods[i]));
+  }
+  // Fill up the map so it gets indexed.
+  for (size_t i = 1; i < kSignatureMapIndexMinSize; i++) {
+    value_t other = new_heap_operation(runtime, afFreeze, otInfix,
+        new_integer(i));
+    value_t signature = make_signature(runtime, false, PARAMS(3,
+        PARAM(subject_gs[0], false, vArray(vValue(ROOT(runtime, subject_key)))),
+        PARAM(new_heap_guard(runtime, afFreeze, gtEq, other), false,
+            vArray(vValue(ROOT(runtime, selector_key)))),
+        PARAM(any_g, false, vArray(vInt(0)))));
+    value_t method = new_heap_method(runtime, afFreeze, signature, nothing(),
+        dummy_code, nothing(), new_flag_set(kFlagSetAllOff));
+    ASSERT_SUCCESS(add_methodspace_method(runtime, space, method));
+  }
+  value_t sigmap = get_methodspace_methods(space);
+  ASSERT_SUCCESS(ensure_frozen(runtime, sigmap));
+  ASSERT_FALSE(is_nothing(get_signature_map_subject_index(sigmap)));
+
+  value_t a = new_instance_of(runtime, a_p);
+  value_t b = new_instance_of(runtime, b_p);
+  value_t c = new_instance_of(runtime, c_p);
+  value_t d = new_instance_of(runtime, d_p);
+  value_t four = new_integer(4);
+  ASSERT_SAME(methods[0], lookup_invocation(ambience, space, a, op, four));
+  ASSERT_SAME(methods[1], lookup_invocation(ambience, space, b, op, four));
+  ASSERT_SAME(methods[2], lookup_invocation(ambience, space, c, op, four));
+  // D is both a B and a C so the methods on those are ambiguous.
+  ASSERT_CONDITION(ccLookupError, lookup_invocation(ambience, space, d, op,
+      four));
+  // The method that accepts any subject is still found.
+  ASSERT_SAME(methods[3], lookup_invocation(ambience, space, new_integer(3), op,
+      new_integer(8)));
+  ASSERT_CONDITION(ccLookupError, lookup_invocation(ambience, space,
+      new_integer(3), op, four));
+  ASSERT_CONDITION(ccLookupError, lookup_selector_and_argument(ambience, space,
+      op, new_integer(8)));
+
+  DISPOSE_TEST_ARENA();
+  DISPOSE_RUNTIME();
+}
+
 // Shorthand for testing how an operation prints.
 #define CHECK_OP_PRINT(EXPECTED, OP) do {                                      \
   value_t op = (OP);                                                           \
@@ -810,6 +1086,207 @@ TEST(method, dense_perfect_lookup) {
 #define OP(otType, vValue)                                                     \
   new_heap_operation(runtime, afFreeze, otType, C(vValue))
 
+// Probes the inline cache in the given slot using the given two arguments,
+// returning the method found or a condition if there is none.
+static value_t probe_two_arguments(value_t ambience, value_t inline_caches,
+    value_t tags, value_t first, value_t second) {
+  runtime_t *runtime = get_ambience_runtime(ambience);
+  value_t stack = new_heap_stack(runtime, 16);
+  frame_t frame = open_stack(stack);
+  push_stack_frame(runtime, stack, &frame, 2, null());
+  frame_push_value(&frame, first);
+  frame_push_value(&frame, second);
+  value_t code_block = whatever();
+  value_t arg_map = whatever();
+  return probe_inline_cache(ambience, inline_caches, 0, tags, &frame,
+      &code_block, &arg_map);
+}
+
+// Records the given method in the inline cache in the given slot for the given
+// two arguments.
+static void update_two_arguments(value_t ambience, value_t inline_caches,
+    value_t tags, value_t first, value_t second, uint64_t identity_mask,
+    value_t method) {
+  runtime_t *runtime = get_ambience_runtime(ambience);
+  value_t stack = new_heap_stack(runtime, 16);
+  frame_t frame = open_stack(stack);
+  push_stack_frame(runtime, stack, &frame, 2, null());
+  frame_push_value(&frame, first);
+  frame_push_value(&frame, second);
+  lookup_footprint_t footprint;
+  footprint.identity_mask = identity_mask;
+  footprint.delegate_space = nothing();
+  ASSERT_SUCCESS(update_inline_cache(ambience, inline_caches, 0, tags, &frame,
+      &footprint, method, get_method_code(method), ROOT(runtime, array_of_zero)));
+}
+
+TEST(method, inline_cache) {
+  CREATE_RUNTIME();
+  CREATE_TEST_ARENA();
+
+  value_t a_p = new_heap_type(runtime, afFreeze, nothing(), C(vStr("A")));
+  value_t b_p = new_heap_type(runtime, afFreeze, nothing(), C(vStr("B")));
+  value_t a0 = new_instance_of(runtime, a_p);
+  value_t a1 = new_instance_of(runtime, a_p);
+  value_t b0 = new_instance_of(runtime, b_p);
+  value_t dummy_code = new_heap_code_block(runtime, new_heap_blob(runtime, 0),
+      ROOT(runtime, empty_array), 0, 0);
+  value_t signature = make_signature(runtime, false, PARAMS(1,
+      PARAM(ROOT(runtime, any_guard), false, vArray(vInt(0)))));
+  value_t methods[5];
+  for (size_t i = 0; i < 5; i++)
+    methods[i] = new_heap_method(runtime, afFreeze, signature, nothing(),
+        dummy_code, nothing(), new_flag_set(kFlagSetAllOff));
+  value_t entries = new_heap_pair_array(runtime, 2);
+  for (size_t i = 0; i < 2; i++) {
+    set_pair_array_first_at(entries, i, new_integer(i));
+    set_pair_array_second_at(entries, i, new_integer(1 - i));
+  }
+  value_t tags = new_heap_call_tags(runtime, afFreeze, entries);
+  value_t inline_caches = new_heap_array(runtime, 1);
+
+  // An empty cache never hits.
+  ASSERT_CONDITION(ccNotFound, probe_two_arguments(ambience, inline_caches,
+      tags, a0, b0));
+
+  // Entries keyed on types hit for any argument of the same type.
+  update_two_arguments(ambience, inline_caches, tags, a0, b0, 0, methods[0]);
+  ASSERT_SAME(methods[0], probe_two_arguments(ambience, inline_caches, tags,
+      a0, b0));
+  ASSERT_SAME(methods[0], probe_two_arguments(ambience, inline_caches, tags,
+      a1, b0));
+  ASSERT_CONDITION(ccNotFound, probe_two_arguments(ambience, inline_caches,
+      tags, b0, b0));
+
+  // Entries keyed on identity only hit for that exact argument.
+  update_two_arguments(ambience, inline_caches, tags, b0, a0, 0x1, methods[1]);
+  ASSERT_SAME(methods[1], probe_two_arguments(ambience, inline_caches, tags,
+      b0, a0));
+  ASSERT_SAME(methods[1], probe_two_arguments(ambience, inline_caches, tags,
+      b0, a1));
+  update_two_arguments(ambience, inline_caches, tags, a0, a0, 0x2, methods[2]);
+  ASSERT_SAME(methods[2], probe_two_arguments(ambience, inline_caches, tags,
+      a1, a0));
+  ASSERT_CONDITION(ccNotFound, probe_two_arguments(ambience, inline_caches,
+      tags, a0, a1));
+
+  // Once the cache is full no more entries are added.
+  update_two_arguments(ambience, inline_caches, tags, b0, b0, 0, methods[3]);
+  update_two_arguments(ambience, inline_caches, tags, a0, new_integer(8), 0,
+      methods[4]);
+  ASSERT_SAME(methods[3], probe_two_arguments(ambience, inline_caches, tags,
+      b0, b0));
+  ASSERT_CONDITION(ccNotFound, probe_two_arguments(ambience, inline_caches,
+      tags, a0, new_integer(8)));
+
+  // Changing any methodspace invalidates the cache.
+  value_t space = new_heap_methodspace(runtime);
+  ASSERT_SUCCESS(add_methodspace_inheritance(runtime, space, a_p, b_p));
+  ASSERT_CONDITION(ccNotFound, probe_two_arguments(ambience, inline_caches,
+      tags, a0, b0));
+  update_two_arguments(ambience, inline_caches, tags, a0, new_integer(8), 0,
+      methods[4]);
+  ASSERT_SAME(methods[4], probe_two_arguments(ambience, inline_caches, tags,
+      a1, new_integer(9)));
+
+  DISPOSE_TEST_ARENA();
+  DISPOSE_RUNTIME();
+}
+
+// Performs a full lookup of a call with the given single argument through the
+// given fragment.
+static value_t lookup_one_argument(value_t ambience, value_t fragment,
+    value_t tags, value_t arg) {
+  runtime_t *runtime = get_ambience_runtime(ambience);
+  value_t stack = new_heap_stack(runtime, 16);
+  frame_t frame = open_stack(stack);
+  push_stack_frame(runtime, stack, &frame, 1, null());
+  frame_push_value(&frame, arg);
+  value_t helper = get_methodspace_methods(
+      get_module_fragment_methodspace(fragment));
+  value_t arg_map = whatever();
+  return lookup_method_full(ambience, fragment, tags, &frame, helper, &arg_map,
+      NULL);
+}
+
+// Checks that the lookup cache has seen the given number of hits and misses
+// since the counters were last reset.
+#define ASSERT_LOOKUP_CACHE_STATS(HITS, MISSES) do {                           \
+  ASSERT_EQ(HITS, runtime->lookup_cache->hits);                                \
+  ASSERT_EQ(MISSES, runtime->lookup_cache->misses);                            \
+} while (false)
+
+TEST(method, lookup_cache) {
+  CREATE_RUNTIME();
+  CREATE_TEST_ARENA();
+
+  value_t a_p = new_heap_type(runtime, afFreeze, nothing(), C(vStr("A")));
+  value_t b_p = new_heap_type(runtime, afFreeze, nothing(), C(vStr("B")));
+  value_t a0 = new_instance_of(runtime, a_p);
+  value_t a1 = new_instance_of(runtime, a_p);
+  value_t b0 = new_instance_of(runtime, b_p);
+  value_t dummy_code = new_heap_code_block(runtime, new_heap_blob(runtime, 0),
+      ROOT(runtime, empty_array), 0, 0);
+  value_t guards[3] = {
+    new_heap_guard(runtime, afFreeze, gtIs, a_p),
+    new_heap_guard(runtime, afFreeze, gtIs, b_p),
+    new_heap_guard(runtime, afFreeze, gtEq, a0)
+  };
+  value_t methods[3];
+  for (size_t i = 0; i < 3; i++) {
+    value_t signature = make_signature(runtime, false, PARAMS(1,
+        PARAM(guards[i], false, vArray(vInt(0)))));
+    methods[i] = new_heap_method(runtime, afFreeze, signature, nothing(),
+        dummy_code, nothing(), new_flag_set(kFlagSetAllOff));
+  }
+  value_t space = new_heap_methodspace(runtime);
+  ASSERT_SUCCESS(add_methodspace_method(runtime, space, methods[0]));
+  ASSERT_SUCCESS(add_methodspace_method(runtime, space, methods[1]));
+  value_t fragment = new_heap_module_fragment(runtime, nothing(),
+      present_stage(), nothing(), space, nothing());
+  value_t entries = new_heap_pair_array(runtime, 1);
+  set_pair_array_first_at(entries, 0, new_integer(0));
+  set_pair_array_second_at(entries, 0, new_integer(0));
+  value_t tags = new_heap_call_tags(runtime, afFreeze, entries);
+  lookup_cache_init(runtime->lookup_cache);
+
+  // The first lookup for each type misses, the subsequent ones hit.
+  ASSERT_SAME(methods[0], lookup_one_argument(ambience, fragment, tags, a0));
+  ASSERT_LOOKUP_CACHE_STATS(0, 1);
+  ASSERT_SAME(methods[0], lookup_one_argument(ambience, fragment, tags, a1));
+  ASSERT_LOOKUP_CACHE_STATS(1, 1);
+  ASSERT_SAME(methods[1], lookup_one_argument(ambience, fragment, tags, b0));
+  ASSERT_LOOKUP_CACHE_STATS(1, 2);
+  ASSERT_SAME(methods[1], lookup_one_argument(ambience, fragment, tags, b0));
+  ASSERT_LOOKUP_CACHE_STATS(2, 2);
+
+  // Failed lookups aren't cached.
+  ASSERT_CONDITION(ccLookupError, lookup_one_argument(ambience, fragment, tags,
+      new_integer(8)));
+  ASSERT_CONDITION(ccLookupError, lookup_one_argument(ambience, fragment, tags,
+      new_integer(8)));
+  ASSERT_LOOKUP_CACHE_STATS(2, 4);
+
+  // Adding a method invalidates the cache. Once an argument's identity has
+  // been observed the cache keys on it rather than its type.
+  ASSERT_SUCCESS(add_methodspace_method(runtime, space, methods[2]));
+  ASSERT_SAME(methods[2], lookup_one_argument(ambience, fragment, tags, a0));
+  ASSERT_LOOKUP_CACHE_STATS(2, 5);
+  ASSERT_SAME(methods[0], lookup_one_argument(ambience, fragment, tags, a1));
+  ASSERT_LOOKUP_CACHE_STATS(2, 6);
+  ASSERT_SAME(methods[2], lookup_one_argument(ambience, fragment, tags, a0));
+  ASSERT_SAME(methods[0], lookup_one_argument(ambience, fragment, tags, a1));
+  ASSERT_LOOKUP_CACHE_STATS(4, 6);
+
+  // Clearing the cache, which happens on every gc, makes everything miss.
+  lookup_cache_clear(runtime->lookup_cache);
+  ASSERT_SAME(methods[2], lookup_one_argument(ambience, fragment, tags, a0));
+  ASSERT_LOOKUP_CACHE_STATS(4, 7);
+
+  DISPOSE_TEST_ARENA();
+  DISPOSE_RUNTIME();
+}
+
 TEST(method, operation_printing) {
   CREATE_RUNTIME();
   CREATE_TEST_ARENA();
@@ -2,6 +2,7 @@
 // Licensed under the Apache License, Version 2.0 (see LICENSE).
 
 #include "alloc.h"
+#include "file.h"
 #include "runtime.h"
 #include "safe-inl.h"
 #include "test.h"
@@ -61,6 +62,41 @@ TEST(runtime, runtime_validation) {
   DISPOSE_RUNTIME();
 }
 
+TEST(runtime, validation_levels) {
+  CREATE_RUNTIME();
+  ASSERT_SUCCESS(runtime_validate_at_level(runtime, gvExpensive, nothing()));
+
+  // A broken root is caught by anything but no validation.
+  value_t old_empty_array = ROOT(runtime, empty_array);
+  ROOT(runtime, empty_array) = new_integer(0);
+  ASSERT_SUCCESS(runtime_validate_at_level(runtime, gvNone, nothing()));
+  ASSERT_CHECK_FAILURE(ccValidationFailed,
+      runtime_validate_at_level(runtime, gvRoots, nothing()));
+  ROOT(runtime, empty_array) = old_empty_array;
+
+  // A broken non-root is only caught by full validation.
+  size_t capacity = 16;
+  value_t map = new_heap_id_hash_map(runtime, capacity);
+  set_id_hash_map_capacity(map, capacity + 1);
+  ASSERT_SUCCESS(runtime_validate_at_level(runtime, gvRoots, nothing()));
+  ASSERT_CHECK_FAILURE(ccValidationFailed,
+      runtime_validate_at_level(runtime, gvFull, nothing()));
+  set_id_hash_map_capacity(map, capacity);
+
+  // A reference to something outside the heap is only caught by expensive
+  // validation.
+  value_t array = new_heap_array(runtime, 1);
+  value_t outside = new_heap_object((address_t) &old_empty_array);
+  *access_heap_object_field(array, kArrayElementsOffset) = outside;
+  ASSERT_SUCCESS(runtime_validate_at_level(runtime, gvFull, nothing()));
+  ASSERT_CHECK_FAILURE(ccValidationFailed,
+      runtime_validate_at_level(runtime, gvExpensive, nothing()));
+  set_array_at(array, 0, null());
+  ASSERT_SUCCESS(runtime_validate_at_level(runtime, gvExpensive, nothing()));
+
+  DISPOSE_RUNTIME();
+}
+
 TEST(runtime, gc_move_null) {
   CREATE_RUNTIME();
 
@@ -80,6 +116,418 @@ TEST(runtime, gc_move_null) {
   DISPOSE_RUNTIME();
 }
 
+TEST(runtime, gc_nursery) {
+  CREATE_RUNTIME();
+
+  // Collecting the nursery promotes surviving objects to old space.
+  safe_value_t s_outer = runtime_protect_value(runtime, new_heap_array(runtime, 1));
+  ASSERT_TRUE(heap_in_nursery(&runtime->heap, deref(s_outer)));
+  ASSERT_SUCCESS(runtime_garbage_collect_nursery(runtime));
+  value_t outer = deref(s_outer);
+  ASSERT_FALSE(heap_in_nursery(&runtime->heap, outer));
+
+  // Storing a young object in the old one must keep it alive and update the
+  // field without moving the old object.
+  value_t inner_before = new_heap_array(runtime, 1);
+  set_array_at(inner_before, 0, new_integer(8));
+  set_array_at(outer, 0, inner_before);
+  ASSERT_SUCCESS(runtime_garbage_collect_nursery(runtime));
+  ASSERT_SAME(outer, deref(s_outer));
+  value_t inner_after = get_array_at(outer, 0);
+  ASSERT_NSAME(inner_before, inner_after);
+  ASSERT_FALSE(heap_in_nursery(&runtime->heap, inner_after));
+  ASSERT_VALEQ(new_integer(8), get_array_at(inner_after, 0));
+
+  // A full collection moves old objects too.
+  ASSERT_SUCCESS(runtime_garbage_collect(runtime));
+  ASSERT_NSAME(outer, deref(s_outer));
+  ASSERT_VALEQ(new_integer(8), get_array_at(get_array_at(deref(s_outer), 0), 0));
+
+  dispose_safe_value(runtime, s_outer);
+  DISPOSE_RUNTIME();
+}
+
+TEST(runtime, gc_barrier_runtimes) {
+  CREATE_RUNTIME();
+  runtime_t *other = NULL;
+  ASSERT_SUCCESS(new_runtime(NULL, &other));
+
+  // The write barrier finds the heap through the object's species so the
+  // object is recorded in the heap of the runtime that allocated it, not the
+  // other one.
+  safe_value_t s_outer = runtime_protect_value(runtime, new_heap_array(runtime, 1));
+  ASSERT_SUCCESS(runtime_garbage_collect_nursery(runtime));
+  value_t outer = deref(s_outer);
+  set_array_at(outer, 0, new_heap_array(runtime, 1));
+  ASSERT_TRUE(remembered_set_contains(&runtime->heap.remembered_set, outer));
+  ASSERT_FALSE(remembered_set_contains(&other->heap.remembered_set, outer));
+  ASSERT_SUCCESS(runtime_garbage_collect_nursery(runtime));
+  ASSERT_FALSE(heap_in_nursery(&runtime->heap, get_array_at(deref(s_outer), 0)));
+
+  dispose_safe_value(runtime, s_outer);
+  ASSERT_SUCCESS(delete_runtime(other));
+  DISPOSE_RUNTIME();
+}
+
+TEST(runtime, gc_nursery_id_hash_map) {
+  CREATE_RUNTIME();
+
+  // Promote a map to old space and then add young keys to it.
+  safe_value_t s_map = runtime_protect_value(runtime, new_heap_id_hash_map(runtime, 16));
+  ASSERT_SUCCESS(runtime_garbage_collect_nursery(runtime));
+  value_t map = deref(s_map);
+  ASSERT_FALSE(heap_in_nursery(&runtime->heap, map));
+  safe_value_t s_keys[4];
+  for (size_t i = 0; i < 4; i++) {
+    value_t key = new_heap_instance(runtime, ROOT(runtime, empty_instance_species));
+    s_keys[i] = runtime_protect_value(runtime, key);
+    ASSERT_SUCCESS(set_id_hash_map_at(runtime, map, key, new_integer(i)));
+  }
+  // Promoting the keys changes their identity hashes so the map must have
+  // been rehashed for them to be found.
+  ASSERT_SUCCESS(runtime_garbage_collect_nursery(runtime));
+  ASSERT_SAME(map, deref(s_map));
+  for (size_t i = 0; i < 4; i++) {
+    value_t key = deref(s_keys[i]);
+    ASSERT_FALSE(heap_in_nursery(&runtime->heap, key));
+    ASSERT_VALEQ(new_integer(i), get_id_hash_map_at(map, key));
+    dispose_safe_value(runtime, s_keys[i]);
+  }
+
+  dispose_safe_value(runtime, s_map);
+  DISPOSE_RUNTIME();
+}
+
+TEST(runtime, gc_heap_growth) {
+  runtime_config_t config;
+  runtime_config_init_defaults(&config);
+  config.semispace_size_bytes = 256 * kKB;
+  config.nursery_size_bytes = 256 * kKB;
+  runtime_t *runtime = NULL;
+  ASSERT_SUCCESS(new_runtime(&config, &runtime));
+
+  // Build up more live data than fits in the initial old space, using arrays
+  // that are small enough to not go in the large object space.
+  size_t count = 128;
+  safe_value_t s_outer = runtime_protect_value(runtime,
+      new_heap_array(runtime, count));
+  for (size_t i = 0; i < count; i++) {
+    value_t inner = new_heap_array(runtime, 512);
+    if (in_condition_cause(ccHeapExhausted, inner)) {
+      ASSERT_SUCCESS(runtime_garbage_collect_nursery(runtime));
+      inner = new_heap_array(runtime, 512);
+    }
+    ASSERT_SUCCESS(inner);
+    set_array_at(deref(s_outer), i, inner);
+  }
+  ASSERT_SUCCESS(runtime_garbage_collect(runtime));
+  size_t grown = space_get_capacity_bytes(&runtime->heap.old_space);
+  ASSERT_TRUE(grown > 2 * config.semispace_size_bytes);
+
+  // Once the data is dead old space shrinks back down.
+  for (size_t i = 0; i < count; i++)
+    set_array_at(deref(s_outer), i, null());
+  ASSERT_SUCCESS(runtime_garbage_collect(runtime));
+  size_t shrunk = space_get_capacity_bytes(&runtime->heap.old_space);
+  ASSERT_TRUE(shrunk < grown / 2);
+  ASSERT_TRUE(shrunk >= config.semispace_size_bytes);
+
+  dispose_safe_value(runtime, s_outer);
+  DISPOSE_RUNTIME();
+}
+
+TEST(runtime, gc_large_object) {
+  CREATE_RUNTIME();
+
+  heap_t *heap = &runtime->heap;
+  size_t used_before = heap->large_object_space.used_bytes;
+  safe_value_t s_large = runtime_protect_value(runtime,
+      new_heap_array(runtime, 4096));
+  value_t large = deref(s_large);
+  ASSERT_FALSE(heap_in_nursery(heap, large));
+  ASSERT_TRUE(heap_in_large_object_space(heap, large));
+  value_t inner = new_heap_array(runtime, 2);
+  ASSERT_TRUE(heap_in_nursery(heap, inner));
+  set_array_at(large, 0, inner);
+
+  // Large objects stay where they are but their fields are updated.
+  ASSERT_SUCCESS(runtime_garbage_collect_nursery(runtime));
+  ASSERT_SAME(large, deref(s_large));
+  inner = get_array_at(large, 0);
+  ASSERT_FALSE(heap_in_nursery(heap, inner));
+  ASSERT_EQ(2, get_array_length(inner));
+  ASSERT_SUCCESS(runtime_garbage_collect(runtime));
+  ASSERT_SAME(large, deref(s_large));
+  ASSERT_EQ(2, get_array_length(get_array_at(large, 0)));
+
+  // Once it's dead it gets freed.
+  dispose_safe_value(runtime, s_large);
+  ASSERT_SUCCESS(runtime_garbage_collect(runtime));
+  ASSERT_EQ(used_before, heap->large_object_space.used_bytes);
+
+  DISPOSE_RUNTIME();
+}
+
+TEST(runtime, gc_immortal) {
+  CREATE_RUNTIME();
+
+  // The roots are deep frozen so promoting makes them stay put.
+  heap_t *heap = &runtime->heap;
+  ASSERT_FALSE(heap_in_immortal_space(heap, ROOT(runtime, empty_array)));
+  ASSERT_SUCCESS(runtime_promote_deep_frozen(runtime));
+  value_t empty_array = ROOT(runtime, empty_array);
+  ASSERT_TRUE(heap_in_immortal_space(heap, empty_array));
+  ASSERT_TRUE(heap->immortal_space_is_closed);
+  ASSERT_SUCCESS(runtime_garbage_collect(runtime));
+  ASSERT_SAME(empty_array, ROOT(runtime, empty_array));
+
+  // Deep frozen objects get promoted, others don't.
+  safe_value_t s_frozen = runtime_protect_value(runtime,
+      new_heap_array(runtime, 1));
+  safe_value_t s_mutable = runtime_protect_value(runtime,
+      new_heap_array(runtime, 1));
+  ASSERT_SUCCESS(ensure_frozen(runtime, deref(s_frozen)));
+  ASSERT_SUCCESS(validate_deep_frozen(runtime, deref(s_frozen), NULL));
+  ASSERT_SUCCESS(runtime_promote_deep_frozen(runtime));
+  ASSERT_TRUE(heap_in_immortal_space(heap, deref(s_frozen)));
+  ASSERT_FALSE(heap_in_immortal_space(heap, deref(s_mutable)));
+  ASSERT_TRUE(heap_in_immortal_space(heap, ROOT(runtime, empty_array)));
+  ASSERT_TRUE(heap->immortal_space_is_closed);
+
+  dispose_safe_value(runtime, s_frozen);
+  dispose_safe_value(runtime, s_mutable);
+  DISPOSE_RUNTIME();
+}
+
+TEST(runtime, gc_reuse_old_space) {
+  CREATE_RUNTIME();
+
+  // Full collections with little live data alternate between the same two
+  // blocks of memory rather than allocating a new one each time.
+  ASSERT_SUCCESS(runtime_garbage_collect(runtime));
+  address_t first = runtime->heap.old_space.start;
+  ASSERT_SUCCESS(runtime_garbage_collect(runtime));
+  address_t second = runtime->heap.old_space.start;
+  ASSERT_TRUE(first != second);
+  ASSERT_SUCCESS(runtime_garbage_collect(runtime));
+  ASSERT_TRUE(first == runtime->heap.old_space.start);
+  ASSERT_SUCCESS(runtime_garbage_collect(runtime));
+  ASSERT_TRUE(second == runtime->heap.old_space.start);
+
+  DISPOSE_RUNTIME();
+}
+
+TEST(runtime, gc_stats) {
+  CREATE_RUNTIME();
+
+  gc_stats_t *stats = &runtime->gc_stats;
+  size_t nursery_before = stats->nursery_collections;
+  size_t full_before = stats->full_collections;
+  size_t allocated_before = stats->bytes_allocated;
+  size_t array_ordinal = get_heap_object_family_ordinal(ofArray);
+  size_t arrays_before = stats->survivor_counts[array_ordinal];
+
+  // Allocating is counted and a surviving array is counted by both kinds of
+  // collection.
+  safe_value_t s_array = runtime_protect_value(runtime, new_heap_array(runtime, 4));
+  ASSERT_TRUE(stats->bytes_allocated > allocated_before);
+  size_t copied_before = stats->bytes_copied;
+  ASSERT_SUCCESS(runtime_garbage_collect_nursery(runtime));
+  ASSERT_EQ(nursery_before + 1, stats->nursery_collections);
+  ASSERT_TRUE(stats->bytes_copied > copied_before);
+  ASSERT_TRUE(stats->survivor_counts[array_ordinal] > arrays_before);
+  ASSERT_SUCCESS(runtime_garbage_collect(runtime));
+  ASSERT_EQ(full_before + 1, stats->full_collections);
+  ASSERT_TRUE(stats->max_pause_usecs <= stats->nursery_pause_usecs
+      + stats->full_pause_usecs);
+
+  dispose_safe_value(runtime, s_array);
+  DISPOSE_RUNTIME();
+}
+
+// The number of small arrays in the graph used to test parallel collection.
+static const size_t kGcGraphSize = 2048;
+
+// Builds a graph of arrays whose shape is given by the seed and returns an
+// array that holds on to it. Element 0 of each small array is its index and the
+// rest point to other small arrays, so there are shared references and cycles.
+// The last two elements of the result are an id hash map from instances to
+// every third small array and a large object that holds the keys and values.
+static value_t new_gc_graph(runtime_t *runtime, uint32_t seed) {
+  pseudo_random_t random;
+  pseudo_random_init(&random, seed);
+  TRY_DEF(result, new_heap_array(runtime, kGcGraphSize + 2));
+  for (size_t i = 0; i < kGcGraphSize; i++) {
+    TRY_DEF(node, new_heap_array(runtime, pseudo_random_next(&random, 8) + 1));
+    set_array_at(node, 0, new_integer(i));
+    set_array_at(result, i, node);
+  }
+  for (size_t i = 0; i < kGcGraphSize; i++) {
+    value_t node = get_array_at(result, i);
+    for (size_t j = 1; j < get_array_length(node); j++)
+      set_array_at(node, j, get_array_at(result,
+          pseudo_random_next(&random, kGcGraphSize)));
+  }
+  TRY_DEF(map, new_heap_id_hash_map(runtime, 16));
+  TRY_DEF(large, new_heap_array(runtime, 4096));
+  for (size_t i = 0; i < kGcGraphSize; i += 3) {
+    value_t node = get_array_at(result, i);
+    TRY_DEF(key, new_heap_instance(runtime, ROOT(runtime, empty_instance_species)));
+    TRY(set_id_hash_map_at(runtime, map, key, node));
+    set_array_at(large, 2 * (i / 3), key);
+    set_array_at(large, 2 * (i / 3) + 1, node);
+  }
+  set_array_at(result, kGcGraphSize, map);
+  set_array_at(result, kGcGraphSize + 1, large);
+  return result;
+}
+
+// Checks that the given graph still has the shape given by the seed.
+static void check_gc_graph(runtime_t *runtime, value_t graph, uint32_t seed) {
+  pseudo_random_t random;
+  pseudo_random_init(&random, seed);
+  for (size_t i = 0; i < kGcGraphSize; i++) {
+    value_t node = get_array_at(graph, i);
+    ASSERT_EQ(pseudo_random_next(&random, 8) + 1, get_array_length(node));
+    ASSERT_VALEQ(new_integer(i), get_array_at(node, 0));
+  }
+  for (size_t i = 0; i < kGcGraphSize; i++) {
+    value_t node = get_array_at(graph, i);
+    for (size_t j = 1; j < get_array_length(node); j++)
+      ASSERT_SAME(get_array_at(graph, pseudo_random_next(&random, kGcGraphSize)),
+          get_array_at(node, j));
+  }
+  value_t map = get_array_at(graph, kGcGraphSize);
+  value_t large = get_array_at(graph, kGcGraphSize + 1);
+  ASSERT_TRUE(heap_in_large_object_space(&runtime->heap, large));
+  for (size_t i = 0; i < kGcGraphSize; i += 3) {
+    value_t key = get_array_at(large, 2 * (i / 3));
+    value_t node = get_array_at(graph, i);
+    ASSERT_SAME(node, get_array_at(large, 2 * (i / 3) + 1));
+    ASSERT_SAME(node, get_id_hash_map_at(map, key));
+  }
+}
+
+TEST(runtime, gc_parallel) {
+  // Collect the same graph once serially and once using several threads.
+  gc_stats_t deltas[2];
+  for (size_t run = 0; run < 2; run++) {
+    runtime_config_t config;
+    runtime_config_init_defaults(&config);
+    config.gc_thread_count = (run == 0) ? 1 : 4;
+    config.gc_validation_level = gvExpensive;
+    runtime_t *runtime = NULL;
+    ASSERT_SUCCESS(new_runtime(&config, &runtime));
+
+    // Do it a few times so objects get copied from old space as well as from
+    // the nursery.
+    uint32_t seed = 42;
+    value_t graph = new_gc_graph(runtime, seed);
+    ASSERT_SUCCESS(graph);
+    safe_value_t s_graph = runtime_protect_value(runtime, graph);
+    gc_stats_t before = runtime->gc_stats;
+    for (size_t i = 0; i < 3; i++) {
+      ASSERT_SUCCESS(runtime_garbage_collect(runtime));
+      check_gc_graph(runtime, deref(s_graph), seed);
+      ASSERT_SUCCESS(runtime_validate_at_level(runtime, gvExpensive, nothing()));
+    }
+    gc_stats_t *after = &runtime->gc_stats;
+    deltas[run].bytes_copied = after->bytes_copied - before.bytes_copied;
+    for (size_t i = 0; i < kNextFamilyOrdinal; i++)
+      deltas[run].survivor_counts[i] = after->survivor_counts[i]
+          - before.survivor_counts[i];
+
+    dispose_safe_value(runtime, s_graph);
+    DISPOSE_RUNTIME();
+  }
+
+  // Threads or not, the same objects were copied.
+  ASSERT_EQ(deltas[0].bytes_copied, deltas[1].bytes_copied);
+  for (size_t i = 0; i < kNextFamilyOrdinal; i++)
+    ASSERT_EQ(deltas[0].survivor_counts[i], deltas[1].survivor_counts[i]);
+}
+
+// Reads an unsigned LEB128 varint from a heap dump.
+static uint64_t read_heap_dump_uint(FILE *handle) {
+  uint64_t result = 0;
+  size_t shift = 0;
+  while (true) {
+    int byte = fgetc(handle);
+    result |= ((uint64_t) (byte & 0x7F)) << shift;
+    if (byte < 0x80)
+      return result;
+    shift += 7;
+  }
+}
+
+TEST(runtime, heap_dump) {
+  CREATE_RUNTIME();
+
+  safe_value_t s_array = runtime_protect_value(runtime, new_heap_array(runtime, 2));
+  value_t array = deref(s_array);
+  set_array_at(array, 0, new_heap_array(runtime, 0));
+  FILE *handle = tmpfile();
+  ASSERT_TRUE(handle != NULL);
+  ASSERT_SUCCESS(write_heap_dump_to_handle(runtime, handle));
+  rewind(handle);
+
+  // Read the dump back, checking that the protected array is a root and that
+  // its record references its species and the inner array.
+  char magic[8];
+  ASSERT_EQ(8, fread(magic, 1, 8, handle));
+  ASSERT_EQ(0, memcmp(magic, "nheapdmp", 8));
+  ASSERT_EQ(1, read_heap_dump_uint(handle));
+  uint64_t array_address = (address_arith_t) get_heap_object_address(array);
+  bool found_root = false;
+  bool found_object = false;
+  size_t family_count = 0;
+  size_t object_count = 0;
+  while (true) {
+    int tag = fgetc(handle);
+    if (tag == 'e') {
+      break;
+    } else if (tag == 'f') {
+      read_heap_dump_uint(handle);
+      fseek(handle, read_heap_dump_uint(handle), SEEK_CUR);
+      family_count++;
+    } else if (tag == 'r') {
+      if (read_heap_dump_uint(handle) == array_address)
+        found_root = true;
+    } else {
+      ASSERT_EQ('o', tag);
+      uint64_t address = read_heap_dump_uint(handle);
+      uint64_t family = read_heap_dump_uint(handle);
+      uint64_t size = read_heap_dump_uint(handle);
+      uint64_t ref_count = read_heap_dump_uint(handle);
+      uint64_t refs[3];
+      for (size_t i = 0; i < ref_count; i++) {
+        uint64_t ref = read_heap_dump_uint(handle);
+        if (i < 3)
+          refs[i] = ref;
+      }
+      if (address == array_address) {
+        ASSERT_EQ(get_heap_object_family_ordinal(ofArray), family);
+        ASSERT_EQ(calc_array_size(2), size);
+        ASSERT_EQ(2, ref_count);
+        ASSERT_EQ((address_arith_t) get_heap_object_address(
+            get_heap_object_species(array)), refs[0]);
+        ASSERT_EQ((address_arith_t) get_heap_object_address(
+            get_array_at(array, 0)), refs[1]);
+        found_object = true;
+      }
+      object_count++;
+    }
+  }
+  fclose(handle);
+  ASSERT_TRUE(found_root);
+  ASSERT_TRUE(found_object);
+  ASSERT_TRUE(family_count > 0);
+  ASSERT_TRUE(object_count > 0);
+
+  dispose_safe_value(runtime, s_array);
+  DISPOSE_RUNTIME();
+}
+
 TEST(runtime, safe_value_loop) {
   CREATE_RUNTIME();
 
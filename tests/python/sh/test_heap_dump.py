@@ -0,0 +1,213 @@
+#!/usr/bin/python
+# Copyright 2014 the Neutrino authors (see AUTHORS).
+# Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+
+import imp
+import os.path
+import sys
+import unittest
+
+
+# The script's name isn't a valid module name so it has to be loaded by hand
+# from wherever it is on the python path.
+def load_heap_dump():
+  for dir in sys.path:
+    path = os.path.join(dir, "heap-dump.py")
+    if os.path.exists(path):
+      return imp.load_source("heap_dump", path)
+  raise Exception("Couldn't find heap-dump.py")
+
+
+heap_dump = load_heap_dump()
+
+
+# Builds a heap dump in the format written by ctrino.
+class DumpWriter(object):
+
+  def __init__(self):
+    self.data = bytearray(heap_dump.MAGIC)
+    self.write_uint(heap_dump.VERSION)
+
+  def write_uint(self, value):
+    while value >= 0x80:
+      self.data.append((value & 0x7F) | 0x80)
+      value >>= 7
+    self.data.append(value)
+
+  def write_family(self, ordinal, name):
+    self.data.append(heap_dump.FAMILY_TAG)
+    self.write_uint(ordinal)
+    encoded = name.encode('utf-8')
+    self.write_uint(len(encoded))
+    self.data.extend(encoded)
+
+  def write_root(self, address):
+    self.data.append(heap_dump.ROOT_TAG)
+    self.write_uint(address)
+
+  def write_object(self, address, family, size, refs):
+    self.data.append(heap_dump.OBJECT_TAG)
+    for value in [address, family, size, len(refs)] + refs:
+      self.write_uint(value)
+
+  def flush(self):
+    self.data.append(heap_dump.END_TAG)
+    return bytes(self.data)
+
+
+# Collects what's printed.
+class Output(object):
+
+  def __init__(self):
+    self.parts = []
+
+  def write(self, str):
+    self.parts.append(str)
+
+  def get_lines(self):
+    return "".join(self.parts).split("\n")
+
+
+ARRAY = 1
+STRING = 2
+MAP = 3
+
+# Addresses of the objects in the fixture. They're large enough that they take
+# more than one byte to encode.
+A = 0x1000
+B = 0x1010
+C = 0x1020
+D = 0x1030
+E = 0x1040
+F = 0x1050
+G = 0x1060
+H = 0x1070
+# An address that doesn't refer to an object in the dump.
+X = 0x2000
+
+
+# Returns a small dump with the following graph where A and B are the roots and
+# G is garbage.
+#
+#     A   B
+#    / \ /
+#   C   D   G
+#   |\  |   |
+#   H  \|   |
+#       E <-+
+#       |
+#       F
+#
+# The dominator tree is root -> {A -> C -> H, B, D, E -> F}.
+def new_fixture_dump():
+  writer = DumpWriter()
+  writer.write_family(ARRAY, "Array")
+  writer.write_family(STRING, "String")
+  writer.write_root(A)
+  writer.write_root(B)
+  writer.write_object(A, ARRAY, 10, [C, D])
+  writer.write_object(B, MAP, 20, [D, X])
+  writer.write_object(C, ARRAY, 30, [H, E])
+  writer.write_object(D, ARRAY, 40, [E])
+  writer.write_object(E, STRING, 50, [F])
+  writer.write_object(F, STRING, 60, [])
+  writer.write_object(G, STRING, 70, [E])
+  writer.write_object(H, STRING, 80, [])
+  return writer.flush()
+
+
+def read_fixture_heap():
+  heap = heap_dump.Heap()
+  heap_dump.DumpReader(new_fixture_dump()).read(heap)
+  return heap
+
+
+class HeapDumpTest(unittest.TestCase):
+
+  def test_read(self):
+    heap = read_fixture_heap()
+    self.assertEqual({ARRAY: "Array", STRING: "String"}, heap.family_names)
+    self.assertEqual([A, B], heap.roots)
+    self.assertEqual([None, A, B, C, D, E, F, G, H], heap.addresses)
+    self.assertEqual([0, 10, 20, 30, 40, 50, 60, 70, 80], heap.sizes)
+    self.assertEqual([D, X], heap.refs[2])
+    self.assertEqual("family 3", heap.get_family_name(2))
+
+  def test_bad_dump(self):
+    heap = heap_dump.Heap()
+    reader = heap_dump.DumpReader(b"nheapdmq\x01e")
+    self.assertRaises(Exception, lambda: reader.read(heap))
+
+  def test_dominators(self):
+    heap = read_fixture_heap()
+    heap.resolve()
+    # The reference to the address that isn't in the dump has been dropped.
+    self.assertEqual([4], heap.refs[2])
+    (order, idom) = heap.get_dominators()
+    index = heap.index_by_address
+    self.assertEqual(0, order[0])
+    self.assertFalse(index[G] in order)
+    dominators = {}
+    for (address, i) in index.items():
+      dom = idom[i]
+      dominators[address] = None if dom is None else heap.addresses[dom]
+    self.assertEqual({
+      A: None,
+      B: None,
+      C: A,
+      D: None,
+      E: None,
+      F: E,
+      G: None,
+      H: C,
+    }, dominators)
+    self.assertEqual(0, idom[index[A]])
+    self.assertEqual(None, idom[index[G]])
+    retained = heap.get_retained_sizes(order, idom)
+    self.assertEqual(290, retained[0])
+    self.assertEqual(120, retained[index[A]])
+    self.assertEqual(20, retained[index[B]])
+    self.assertEqual(110, retained[index[C]])
+    self.assertEqual(40, retained[index[D]])
+    self.assertEqual(110, retained[index[E]])
+    self.assertEqual(60, retained[index[F]])
+    self.assertEqual(80, retained[index[H]])
+
+  def test_report(self):
+    heap = read_fixture_heap()
+    output = Output()
+    stdout = sys.stdout
+    sys.stdout = output
+    try:
+      heap_dump.print_report(heap, 3, 2)
+    finally:
+      sys.stdout = stdout
+    self.assertEqual([
+      "8 objects, 7 live, 290 bytes live",
+      "",
+      "Families by size:",
+      "  family                            count         size     retained",
+      "  String                                3          190          190",
+      "  Array                                 3           80          160",
+      "  family 3                              1           20           20",
+      "",
+      "Objects by retained size:",
+      "  address            family                             size     retained",
+      "  0x1000             Array                                10          120",
+      "  0x1020             Array                                30          110",
+      "  0x1040             String                               50          110",
+      "",
+      "Dominator tree:",
+      "  Array 0x1000: 120",
+      "    Array 0x1020: 110",
+      "  String 0x1040: 110",
+      "    String 0x1050: 60",
+      "  Array 0x1030: 40",
+      "",
+    ], output.get_lines())
+
+
+if __name__ == '__main__':
+  runner = unittest.TextTestRunner(verbosity=0)
+  unittest.main(testRunner=runner)